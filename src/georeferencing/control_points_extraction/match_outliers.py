@@ -1,7 +1,8 @@
 import json
+import os
 from shapely.geometry import Polygon
 from find_polygon_centroid import calculate_polygon_centroid
-from polygons_comparation import topological_similarity
+from polygons_comparation import topological_similarity, segmenter_native
 
 def load_json(path):
     with open(path, 'r') as f:
@@ -11,10 +12,58 @@ def save_json(data, path):
     with open(path, 'w') as f:
         json.dump(data, f, indent=4)
 
+def load_footprint_index(polygons_path):
+    # Índice binario (.p2pf) de los polígonos de polygons_path, junto al JSON. Solo se lee el
+    # JSON cuando el índice no existe o es más antiguo que él.
+    index_path = os.path.splitext(polygons_path)[0] + ".p2pf"
+    if os.path.exists(index_path) and os.path.getmtime(index_path) >= os.path.getmtime(polygons_path):
+        return segmenter_native.FootprintIndex.load(index_path)
+    polygons = load_json(polygons_path)
+    names = list(polygons.keys())
+    index = segmenter_native.FootprintIndex.build(names, [polygons[name][0]['coordinates'] for name in names])
+    index.save(index_path)
+    return index
+
+def match_outliers_native(old_outliers, new_outliers, old_polygons, new_polygons_path):
+    # El doble bucle de match_outliers en código nativo. Compara cada outlier antiguo con
+    # todos los nuevos y calcula cada alineación exactamente (descriptor_tolerance=0,
+    # raster_size=0): la poda por descriptores y la rejilla pueden descartar parejas con IoU
+    # sobre el umbral y su recall aún no se ha medido.
+    index = load_footprint_index(new_polygons_path)
+    positions = {name: i for i, name in enumerate(index.names())}
+    order = {positions[new_id]: k for k, new_id in enumerate(new_outliers)}
+    if not order:
+        return []
+    matches = index.match([old_polygons[old_id][0]['coordinates'] for old_id in old_outliers],
+                          descriptor_tolerance=0, raster_size=0, allowed=list(order.keys()))
+
+    found = {}
+    for query, footprint in zip(matches["query"], matches["footprint"]):
+        found.setdefault(int(query), []).append(int(footprint))
+
+    control_points = []
+    for query, old_id in enumerate(old_outliers):
+        old_coords = old_polygons[old_id][0]['coordinates']
+        top_left_corner = old_polygons[old_id][0]["top_left_corner"]
+        # Mismo orden que new_outliers
+        for footprint in sorted(found.get(query, []), key=order.get):
+            centroid_x, centroid_y = calculate_polygon_centroid(old_coords)
+            pixel_x = top_left_corner[0] + centroid_x
+            pixel_y = top_left_corner[1] + centroid_y
+            latitude, longitude = index.centroid(footprint)
+            control_points.append([pixel_x, pixel_y, latitude, longitude])
+    return control_points
+
 def match_outliers(old_outliers_path, new_outliers_path, old_polygons_path, new_polygons_path, output_path):
     old_outliers = load_json(old_outliers_path)
     new_outliers = load_json(new_outliers_path)
     old_polygons = load_json(old_polygons_path)
+
+    if segmenter_native is not None:
+        save_json(match_outliers_native(old_outliers, new_outliers, old_polygons, new_polygons_path), output_path)
+        print(f"Matched outliers saved to {output_path}")
+        return
+
     new_polygons = load_json(new_polygons_path)
     
     control_points = []
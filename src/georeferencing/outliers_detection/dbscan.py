@@ -1,6 +1,5 @@
 import os
 import json
-import csv
 import numpy as np
 import pandas as pd
 import matplotlib.pyplot as plt
@@ -12,14 +11,24 @@ from georeferencing.outliers_detection.metrics import calculate_area, calculate_
 from skopt import gp_minimize
 from skopt.space import Real, Integer
 
-def process_shapes(json_data, output_csv):
+# Módulo nativo (segmentation/segmenter_module.cpp); si no está compilado se usan metrics.py y sklearn.
+try:
+    from segmentation import segmenter_native
+except ImportError:
+    segmenter_native = None
+
+FEATURE_COLUMNS = ['Num_Sides', 'Area', 'Perimeter', 'Circularity', 'Compactness', 'Convexity', 'CV']
+
+def process_shapes(json_data, output_csv=None):
     """
-    Procesa los datos de polígonos contenidos en un archivo JSON, calculando diversas propiedades geométricas
-    y guardándolas en un archivo CSV.
+    Procesa los datos de polígonos contenidos en un archivo JSON, calculando diversas propiedades geométricas.
 
     Parámetros:
         json_data (dict): Datos de los polígonos en formato JSON.
-        output_csv (str): Ruta del archivo CSV donde se guardarán los resultados.
+        output_csv (str): Ruta opcional de un archivo CSV donde guardar también los resultados.
+
+    Retorna:
+        pd.DataFrame: Una fila por polígono con la columna 'Name' y las propiedades.
 
     Este método calcula las siguientes propiedades geométricas para cada polígono:
         - Número de lados ('Num_Sides')
@@ -30,65 +39,72 @@ def process_shapes(json_data, output_csv):
         - Convexidad ('Convexity')
         - Coeficiente de variación de los lados ('CV')
     """
-    with open(output_csv, mode='w', newline='') as csv_file:
-        writer = csv.writer(csv_file)
-        writer.writerow(['Name', 'Num_Sides', 'Area', 'Perimeter', 'Circularity', 'Compactness', 'Convexity', 'CV'])
-
-        for shape_name, shape_data in json_data.items():
-            for shape in shape_data:
-                coordinates = shape['coordinates']
-                num_sides = len(coordinates)
-                area = calculate_area(coordinates)
-                perimeter = calculate_perimeter(coordinates)
-                compactness = calculate_compactness(area, perimeter)
-                circularity = calculate_circularity(area, perimeter)
-                convexity = convexity_measure(coordinates)
-                cv = side_length_variation(coordinates)
-
-                writer.writerow([shape_name, num_sides, area, perimeter, circularity, compactness, convexity, cv])
-
-def verifying_normal_distribution(csv_path):
+    names = []
+    polygons = []
+    for shape_name, shape_data in json_data.items():
+        for shape in shape_data:
+            names.append(shape_name)
+            polygons.append(shape['coordinates'])
+
+    if segmenter_native is not None:
+        # Todos los polígonos de una vez en C++, con los mismos valores que metrics.py.
+        rows = segmenter_native.polygon_features([np.asarray(coordinates, dtype=np.int32) for coordinates in polygons],
+                                                 threads=0)
+    else:
+        rows = []
+        for coordinates in polygons:
+            num_sides = len(coordinates)
+            area = calculate_area(coordinates)
+            perimeter = calculate_perimeter(coordinates)
+            compactness = calculate_compactness(area, perimeter)
+            circularity = calculate_circularity(area, perimeter)
+            convexity = convexity_measure(coordinates)
+            cv = side_length_variation(coordinates)
+            rows.append([num_sides, area, perimeter, circularity, compactness, convexity, cv])
+
+    df = pd.DataFrame(np.asarray(rows, dtype=np.float64).reshape(-1, len(FEATURE_COLUMNS)), columns=FEATURE_COLUMNS)
+    df['Num_Sides'] = df['Num_Sides'].astype(int)
+    df.insert(0, 'Name', names)
+    if output_csv is not None:
+        df.to_csv(output_csv, index=False)
+    return df
+
+def verifying_normal_distribution(df):
     """
-    Verifica si los datos en un archivo CSV siguen una distribución normal utilizando la prueba de Shapiro-Wilk.
+    Verifica si los datos siguen una distribución normal utilizando la prueba de Shapiro-Wilk.
 
     Parámetros:
-        csv_path (str): Ruta del archivo CSV con los datos.
+        df (pd.DataFrame): Features de los polígonos, como los devuelve process_shapes.
 
     Retorna:
         bool: True si los datos siguen una distribución normal (p-value > 0.05), False en caso contrario.
     """
-    # Cargar el archivo CSV
-    df = pd.read_csv(csv_path)
-    df = df.drop(columns=['Name']).values
-
     # Prueba de Shapiro-Wilk
-    stat, p = shapiro(df)
+    stat, p = shapiro(df.drop(columns=['Name']).values)
     if p > 0.05:
         return True
     else:
         return False
 
-def load_and_preprocess_data(csv_path):
+def load_and_preprocess_data(shapes):
     """
-    Carga los datos desde un CSV, separa los nombres de los polígonos y extrae los features.
+    Separa los nombres de los polígonos y extrae los features.
     Aplica estandarización si los datos son normales, de lo contrario, aplica normalización.
 
     Parámetros:
-        csv_path: str - Ruta del archivo CSV con los features.
+        shapes: pd.DataFrame - Features de los polígonos, como los devuelve process_shapes.
 
     Retorna:
         features: np.array - Datos preprocesados.
         polygon_names: pd.Series - Nombres de los polígonos.
     """
-    # Cargar el archivo CSV
-    df = pd.read_csv(csv_path)
-    df = df[df['Num_Sides'] >= 12]
+    df = shapes[shapes['Num_Sides'] >= 12]
 
     # Separar los nombres de los polígonos y los features
     polygon_names = df['Name']
     features = df.drop(columns=['Name', 'Area', 'Perimeter']).values
 
-    if verifying_normal_distribution(csv_path):
+    if verifying_normal_distribution(shapes):
         # Estandarización de los datos
         scaler = StandardScaler()
     else:
@@ -99,7 +115,7 @@ def load_and_preprocess_data(csv_path):
     
     return features, polygon_names
 
-def detect_outliers_with_dbscan(features, polygon_names, eps=0.5, min_samples=5):
+def detect_outliers_with_dbscan(features, polygon_names, eps=0.5, min_samples=5, neighbor_index=None):
     """
     Aplica DBSCAN para detectar outliers en los polígonos.
 
@@ -108,14 +124,19 @@ def detect_outliers_with_dbscan(features, polygon_names, eps=0.5, min_samples=5)
         polygon_names: pd.Series - Nombres de los polígonos.
         eps: float - Máxima distancia entre dos muestras para formar un cluster.
         min_samples: int - Número mínimo de muestras para que un punto no sea outlier.
+        neighbor_index: segmenter_native.NeighborIndex - Vecindarios de features ya calculados
+            (opcional), para no repetir la búsqueda en cada llamada.
 
     Retorna:
         int - Número de outliers detectados.
         list - Lista de nombres de polígonos detectados como outliers.
     """
     # Aplicar DBSCAN
-    dbscan = DBSCAN(eps=eps, min_samples=min_samples)
-    labels = dbscan.fit_predict(features)  
+    if neighbor_index is not None:
+        labels = neighbor_index.cluster(eps, min_samples)
+    else:
+        dbscan = DBSCAN(eps=eps, min_samples=min_samples)
+        labels = dbscan.fit_predict(features)
 
     # Identificar outliers (label == -1)
     outlier_indices = np.where(labels == -1)[0]
@@ -137,9 +158,16 @@ def bayesian_optimization(features, polygon_names):
     """
     space = [Real(0.1, 1.0, name='eps'), Integer(2, 20, name='min_samples')]
 
+    # Los vecindarios hasta el eps máximo del espacio se buscan una sola vez (KD-tree en C++);
+    # cada llamada solo recorre los que caen dentro de su eps.
+    neighbor_index = None
+    if segmenter_native is not None:
+        neighbor_index = segmenter_native.NeighborIndex(features, max_eps=space[0].high, threads=0)
+
     def objective_function(params):
         eps, min_samples = params
-        num_outliers, _ = detect_outliers_with_dbscan(features, polygon_names, eps=eps, min_samples=min_samples)
+        num_outliers, _ = detect_outliers_with_dbscan(features, polygon_names, eps=eps, min_samples=min_samples,
+                                                      neighbor_index=neighbor_index)
         return -num_outliers  # Maximizar outliers
 
     res = gp_minimize(objective_function, space, n_calls=15, random_state=42)
@@ -167,7 +195,7 @@ def clustering_polygons(json_path, output_path):
     """
     Realiza el proceso completo de detección de outliers en polígonos mediante DBSCAN:
     - Carga los datos desde un archivo JSON.
-    - Extrae y guarda las características de los polígonos en un archivo CSV.
+    - Extrae las características de los polígonos.
     - Ejecuta la optimización bayesiana para encontrar los mejores hiperparámetros para DBSCAN.
     - Detecta los outliers utilizando DBSCAN.
     - Guarda los nombres de los polígonos outliers en un archivo JSON.
@@ -176,16 +204,14 @@ def clustering_polygons(json_path, output_path):
         json_path (str): Ruta del archivo JSON con los datos de los polígonos.
         output_path (str): Ruta donde se guardará el archivo con los nombres de los polígonos outliers.
     """
-    # Ruta para guardar los features de los polígonos en CSV
-    features_csv = "features.csv"
     # Cargar los datos del JSON
     with open(json_path, 'r') as file:
         json_data = json.load(file)
 
-    # Extraer features y guardar en CSV
-    process_shapes(json_data, features_csv)
+    # Extraer features
+    shapes = process_shapes(json_data)
     # Preprocesar datos
-    features, polygon_names = load_and_preprocess_data(features_csv)
+    features, polygon_names = load_and_preprocess_data(shapes)
     # Ejecutar optimización bayesiana para hallar los mejores hiperparámetros para DBSCAN
     eps, min_samples = bayesian_optimization(features, polygon_names)
     # Aplicar DBSCAN
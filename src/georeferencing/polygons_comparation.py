@@ -2,6 +2,12 @@ import math
 from shapely.geometry import Polygon, Point
 from shapely.affinity import scale, rotate, translate
 
+# Módulo nativo (segmentation/segmenter_module.cpp); si no está compilado se usa Shapely.
+try:
+    from segmentation import segmenter_native
+except ImportError:
+    segmenter_native = None
+
 def scale_polygon_to_area_one(poly: Polygon) -> Polygon:
     """
     Escala un polígono (Shapely) para que su área sea 1.
@@ -73,6 +79,12 @@ def topological_similarity(coordsA, coordsB, threshold=0.9) -> bool:
     - coordsA, coordsB: listas de tuplas (x, y) en sentido horario (clockwise).
     - threshold: umbral del IoU para decidir si son similares.
     """
+    if segmenter_native is not None:
+        # El mismo IoU máximo en C++, con la intersección exacta de cada par de alineaciones.
+        max_iou = segmenter_native.aligned_iou(coordsA, coordsB)
+        print(f"Máximo IoU calculado: {max_iou:.8f}")
+        return max_iou >= threshold
+
     # 1. Convertir a polígonos Shapely y escalar a área 1
     polyA = scale_polygon_to_area_one(Polygon(coordsA))
     polyB = scale_polygon_to_area_one(Polygon(coordsB))
@@ -1,8 +1,7 @@
 import os
 from termcolor import colored as col
 import multiprocessing
-from segmentation.segmentator import segmentate_image
-from vectorization.vectorize import vectorization_pipeline
+from segmentation.segmentator import segmentate_image, SegmentationService
 from georeferencing.outliers_detection.dbscan import clustering_polygons
 from termcolor import colored as col
 import multiprocessing
@@ -22,7 +21,18 @@ def heatmap_generation(image_name):
                       './segmentation/heatmaps',
                       'segmentation/model.pth')
     
-def process_image(image_name):
+# Parámetros del segmentador, los mismos para segmentate_image y para SegmentationService
+SEGMENTATION_CONFIG = dict(k=25,
+                           use8Way=1,
+                           euclidif=1,
+                           adj=1,
+                           minComponentSize=400,
+                           buildingBlockTreshold=0.000009,
+                           writeMasks=False,
+                           simplifyTolerance=2,
+                           metrics="json")
+
+def process_image(image_name, service=None):
     p1 = multiprocessing.Process(target=text_elimination,args=[image_name])
     p1.start()
     p1.join() 
@@ -32,35 +42,31 @@ def process_image(image_name):
     p2.join() 
 
     print(col('SEGMENTATING','blue'))
-    segmentate_image(f'./label_extraction/labelless_data/{image_name}.png',
-                      f'./segmentation/heatmaps/{image_name}.hmp',
-                      f'segmentation/processed_data/{image_name}/',
-                      k=25,
-                      use8Way=1,
-                      euclidif=1,
-                      adj=1,
-                      minComponentSize=400,
-                      buildingBlockTreshold=0.000009
-                      )
-    print(col('VECTORIZING','blue'))
-    vectorization_pipeline( input_dir=f'segmentation/processed_data/building_blocks/',
-                             vectorize_dir=f'vectorization/vectorized_temp/',
-                             components_info_path=f'segmentation/processed_data/components_info.json',
-                             simplify_method="shapely",
-                             simplify_tolerance=2,
-                             output_directory=f'vectorization/vectorized_data/',
-                             output_file_name=f'{image_name}_polygons',
-                             verbose=True
-                            )
-    
-    
-    
-    clustering_polygons(json_path=f'vectorization/vectorized_data/{image_name}_polygons.json',
+    # Con un servicio abierto (SegmentationService) la hoja va al segmentador ya cargado
+    if service is not None:
+        metrics = service.segment(f'./label_extraction/labelless_data/{image_name}.png',
+                                  f'segmentation/processed_data/{image_name}/',
+                                  heatmap_path=f'./segmentation/heatmaps/{image_name}.hmp')["metrics"]
+    else:
+        metrics = segmentate_image(f'./label_extraction/labelless_data/{image_name}.png',
+                                   f'./segmentation/heatmaps/{image_name}.hmp',
+                                   f'segmentation/processed_data/{image_name}/',
+                                   **SEGMENTATION_CONFIG)
+    if metrics is not None:
+        components = metrics["components"]
+        print(col(f"Segmented in {metrics['seconds']:.2f}s, peak RSS {metrics['peak_rss_kb'] // 1024} MiB: "
+                  f"{components['building_blocks']} building blocks of {components['accepted']} components", 'blue'))
+    # The segmenter writes the building block outlines itself, so the mask vectorization
+    # step (vectorization.vectorize.vectorization_pipeline) is no longer needed here
+    clustering_polygons(json_path=f'segmentation/processed_data/{image_name}/polygons.json',
                          output_path=f"georeferencing/outliers_detection/detected_outliers/{image_name}_outliers.json")
     
     # extract_control_points(outliers_path, control_points_path)
     
     # geodigitalize_map(vectorized_path, control_points_path, labels_path, digitalized_path)
 
+    return metrics
+
 if __name__ == '__main__':
-    process_image("ohcah_cpcu_000013433")
\ No newline at end of file
+    with SegmentationService(**SEGMENTATION_CONFIG) as service:
+        process_image("ohcah_cpcu_000013433", service)
\ No newline at end of file
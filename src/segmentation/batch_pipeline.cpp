@@ -0,0 +1,190 @@
+#include "batch_pipeline.h"
+#include "segmentation_io.h"
+#include "task_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Function to check for an extension stb_image decodes
+bool isImageFile(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && slash > dot)) {
+        return false;
+    }
+    std::string extension = path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension == "jpg" || extension == "jpeg" || extension == "png" || extension == "bmp" ||
+           extension == "tga" || extension == "ppm";
+}
+
+// Function to get the file name of a path without its extension
+std::string stemOf(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    return name.substr(0, name.find_last_of('.'));
+}
+
+std::string markerPath(const std::string& outputFolder) {
+    return outputFolder + "/" + batchCompleteMarker;
+}
+
+bool isComplete(const std::string& outputFolder) {
+    return static_cast<bool>(std::ifstream(markerPath(outputFolder)));
+}
+
+// Function to mark an output folder complete, naming the image it came from
+bool markComplete(const Sheet& sheet) {
+    std::ofstream marker(markerPath(sheet.outputFolder));
+    marker << sheet.imagePath << "\n";
+    return static_cast<bool>(marker);
+}
+
+} // namespace
+
+int processBatch(const std::string& imageDir, const std::string& heatmapDir, const std::string& outputDir,
+                 const Config& config, const BatchOptions& options) {
+    std::vector<std::string> files = getFiles(imageDir);
+    std::sort(files.begin(), files.end());
+
+    // One sheet per image of the directory, leaving out the ones already written
+    std::vector<std::unique_ptr<Sheet>> sheets;
+    size_t skipped = 0;
+    for (const std::string& file : files) {
+        if (!isImageFile(file)) {
+            continue;
+        }
+        auto sheet = std::make_unique<Sheet>();
+        sheet->imagePath = file;
+        sheet->heatmapPath = heatmapDir + "/" + stemOf(file) + ".hmp";
+        sheet->outputFolder = outputDir + "/" + stemOf(file);
+        if (options.resume && isComplete(sheet->outputFolder)) {
+            skipped++;
+            continue;
+        }
+        sheets.push_back(std::move(sheet));
+    }
+    std::cout << "Batch of " << sheets.size() + skipped << " images, " << skipped
+              << " already complete\n";
+    if (!createDirectory(outputDir)) {
+        throw std::runtime_error("Failed to create directory: " + outputDir);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::atomic<size_t> nextSheet{0};
+    std::atomic<int> failed{0};
+    std::atomic<size_t> finished{0};
+    TaskQueue<std::unique_ptr<Sheet>> decoded(options.queueDepth);
+    TaskQueue<std::unique_ptr<Sheet>> segmented(options.queueDepth);
+    // Buffers of the written sheets, enough for one per writer and the one being segmented
+    SheetArena arena(static_cast<size_t>(std::max(options.writeThreads, 1)) + 1);
+
+    auto reportFinished = [&](const Sheet& sheet) {
+        std::ostringstream message;
+        message << "Finished " << ++finished << "/" << sheets.size() << ": " << sheet.imagePath;
+        if (config.bandHeight <= 0) {
+            message << " (Components: " << sheet.result.components.size() << ")";
+        }
+        message << "\n";
+        std::cout << message.str();
+    };
+
+    // Decode stage. A stale marker goes first, so a sheet interrupted from here on is redone.
+    auto decode = [&]() {
+        for (size_t i = nextSheet++; i < sheets.size(); i = nextSheet++) {
+            std::unique_ptr<Sheet> sheet = std::move(sheets[i]);
+            std::remove(markerPath(sheet->outputFolder).c_str());
+            try {
+                if (config.bandHeight <= 0) {
+                    loadSheet(*sheet);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+                failed++;
+                continue;
+            }
+            decoded.push(std::move(sheet));
+        }
+    };
+
+    // Segmentation stage, one sheet at a time. Streamed sheets are written here as well.
+    auto segment = [&]() {
+        Segmenter segmenter;
+        std::unique_ptr<Sheet> sheet;
+        while (decoded.pop(sheet)) {
+            try {
+                if (config.bandHeight > 0) {
+                    if (processImage(sheet->imagePath, sheet->heatmapPath, sheet->outputFolder, config) &&
+                        markComplete(*sheet)) {
+                        reportFinished(*sheet);
+                    } else {
+                        failed++;
+                    }
+                    continue;
+                }
+                sheet->arena = &arena;
+                segmentSheet(segmenter, *sheet, config);
+            } catch (const std::exception& e) {
+                std::cerr << sheet->imagePath << ": " << e.what() << "\n";
+                failed++;
+                continue;
+            }
+            segmented.push(std::move(sheet));
+        }
+    };
+
+    // Write stage
+    auto write = [&]() {
+        std::unique_ptr<Sheet> sheet;
+        while (segmented.pop(sheet)) {
+            if (writeSheet(*sheet, config) && markComplete(*sheet)) {
+                reportFinished(*sheet);
+            } else {
+                std::cerr << "Failed to write the outputs of: " << sheet->imagePath << "\n";
+                failed++;
+            }
+            arena.giveBack(std::move(sheet->result));
+            sheet.reset();
+        }
+    };
+
+    std::vector<std::thread> decoders;
+    for (int i = 0; i < std::max(options.decodeThreads, 1); ++i) {
+        decoders.emplace_back(decode);
+    }
+    std::thread segmentation(segment);
+    std::vector<std::thread> writers;
+    for (int i = 0; i < std::max(options.writeThreads, 1); ++i) {
+        writers.emplace_back(write);
+    }
+
+    // Each queue closes once every producer feeding it is done
+    for (std::thread& decoder : decoders) {
+        decoder.join();
+    }
+    decoded.close();
+    segmentation.join();
+    segmented.close();
+    for (std::thread& writer : writers) {
+        writer.join();
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Batch finished: " << finished << " written, " << failed << " failed, " << skipped
+              << " skipped (Time: " << elapsed.count() << "s)\n";
+    return failed;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include "segmenter.h"
+
+// Stage sizes of processBatch
+struct BatchOptions {
+    int decodeThreads = 2; // Sheets decoded at the same time
+    int writeThreads = 2;  // Sheets whose outputs are written at the same time
+    int queueDepth = 2;    // Sheets waiting between two stages
+    bool resume = true;    // Skip sheets whose output folder is marked complete
+};
+
+// File written into an output folder after every output of its sheet, checked on resume
+const char* const batchCompleteMarker = ".complete";
+
+// Segment every image of imageDir with its heatmap heatmapDir/<name>.hmp into
+// outputDir/<name>/, with the outputs of processImage. Sheets go through three stages
+// joined by bounded queues: decodeThreads decode images and map heatmaps, one segmenter
+// (itself using Config::threads with the unionfind engine) labels them and writeThreads
+// write masks, tables, rasters and previews, so at most about
+// decodeThreads + 2 * queueDepth + writeThreads + 1 sheets are in memory. With a
+// bandHeight the sheets are streamed by the segmentation stage instead. Returns the
+// number of sheets that failed.
+int processBatch(const std::string& imageDir, const std::string& heatmapDir, const std::string& outputDir,
+                 const Config& config, const BatchOptions& options);
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Word-packed bit vector with bulk clear, range set and popcount, used for the per-pixel
+// visited flags and masks of the segmenter
+class Bitset {
+public:
+    // Resize to size bits, all clear
+    void assign(size_t size) {
+        size_ = size;
+        words_.assign((size + 63) / 64, 0);
+    }
+
+    size_t size() const { return size_; }
+
+    bool test(size_t i) const { return (words_[i >> 6] >> (i & 63)) & 1; }
+
+    void set(size_t i) { words_[i >> 6] |= std::uint64_t(1) << (i & 63); }
+
+    // Set bits [begin, end)
+    void setRange(size_t begin, size_t end) {
+        if (begin >= end) {
+            return;
+        }
+        size_t first = begin >> 6;
+        size_t last = (end - 1) >> 6;
+        std::uint64_t firstMask = ~std::uint64_t(0) << (begin & 63);
+        std::uint64_t lastMask = ~std::uint64_t(0) >> (63 - ((end - 1) & 63));
+        if (first == last) {
+            words_[first] |= firstMask & lastMask;
+            return;
+        }
+        words_[first] |= firstMask;
+        for (size_t w = first + 1; w < last; ++w) {
+            words_[w] = ~std::uint64_t(0);
+        }
+        words_[last] |= lastMask;
+    }
+
+    // Number of set bits
+    size_t count() const {
+        size_t total = 0;
+        for (std::uint64_t word : words_) {
+            total += popcount(word);
+        }
+        return total;
+    }
+
+    // First clear bit at or after i, or size() when there is none
+    size_t findClear(size_t i) const {
+        if (i >= size_) {
+            return size_;
+        }
+        size_t w = i >> 6;
+        std::uint64_t free = ~words_[w] & (~std::uint64_t(0) << (i & 63));
+        while (free == 0) {
+            if (++w == words_.size()) {
+                return size_;
+            }
+            free = ~words_[w];
+        }
+        size_t found = (w << 6) + lowestBit(free);
+        return found < size_ ? found : size_;
+    }
+
+private:
+    static int popcount(std::uint64_t word) {
+#if defined(__GNUC__)
+        return __builtin_popcountll(word);
+#else
+        int bits = 0;
+        for (; word; word &= word - 1) {
+            ++bits;
+        }
+        return bits;
+#endif
+    }
+
+    static int lowestBit(std::uint64_t word) {
+#if defined(__GNUC__)
+        return __builtin_ctzll(word);
+#else
+        int bit = 0;
+        while (!(word & 1)) {
+            word >>= 1;
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    std::vector<std::uint64_t> words_;
+    size_t size_ = 0;
+};
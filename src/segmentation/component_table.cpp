@@ -0,0 +1,217 @@
+#include "component_table.h"
+#include "json_writer.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const char tableMagic[4] = {'P', '2', 'P', 'C'};
+const std::uint16_t tableVersion = 1;
+const std::uint16_t tableColumns = 8;
+const std::uint16_t tableColumnsWithStats = 12;
+const std::uint8_t use8WayFlag = 1;
+const std::uint8_t euclidifFlag = 2;
+
+template <typename T>
+void writeColumn(std::ofstream& file, const std::vector<T>& column) {
+    file.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+}
+
+template <typename T>
+void readColumn(std::ifstream& file, std::vector<T>& column, size_t count) {
+    column.resize(count);
+    file.read(reinterpret_cast<char*>(column.data()), count * sizeof(T));
+}
+
+} // namespace
+
+TableLabeling tableLabeling(const Config& config, bool streamed) {
+    TableLabeling labeling;
+    if (streamed) {
+        labeling.labeler = TableLabeler::Streaming;
+    } else if (config.fillEngine == FillEngine::Stack) {
+        labeling.labeler = TableLabeler::Stack;
+    } else if (config.fillEngine == FillEngine::Scanline) {
+        labeling.labeler = TableLabeler::Scanline;
+    } else {
+        labeling.labeler = TableLabeler::UnionFind;
+    }
+    labeling.k = config.k;
+    labeling.use8Way = config.use8Way;
+    labeling.euclidif = config.euclidif;
+    return labeling;
+}
+
+std::string tableLabelerName(TableLabeler labeler) {
+    switch (labeler) {
+    case TableLabeler::Unknown: return "unknown";
+    case TableLabeler::Stack: return "stack";
+    case TableLabeler::Scanline: return "scanline";
+    case TableLabeler::UnionFind: return "unionfind";
+    case TableLabeler::Streaming: return "streaming";
+    }
+    return "unknown";
+}
+
+void writeComponentsInfo(const ComponentSet& components, const std::string& path, bool compact) {
+    JsonWriter json(path, compact);
+    json.raw('[');
+    for (size_t i = 0; i < components.components.size(); ++i) {
+        const Component& comp = components.components[i];
+        if (i > 0) {
+            json.raw(',');
+        }
+        json.newline(2).raw('{');
+        json.newline(4).key("component").value(comp.id).raw(',');
+        json.newline(4).key("topLeftCorner").raw('{').space();
+        json.key("x").value(comp.xMin).raw(',').space();
+        json.key("y").value(comp.yMin).space().raw("},");
+        json.newline(4).key("width").value(comp.width()).raw(',');
+        json.newline(4).key("height").value(comp.height()).raw(',');
+        json.newline(4).key("buildingBlockProbability").value(static_cast<double>(comp.avgProbability));
+        if (!components.heatmapStats.empty()) {
+            const ComponentHeatmapStats& stats = components.heatmapStats[i];
+            json.raw(',').newline(4).key("probabilityMin").value(static_cast<double>(stats.minProbability));
+            json.raw(',').newline(4).key("probabilityMax").value(static_cast<double>(stats.maxProbability));
+            json.raw(',').newline(4).key("probabilityStdDev").value(static_cast<double>(stats.stdDevProbability));
+            json.raw(',').newline(4).key("aboveThresholdShare").value(static_cast<double>(stats.aboveThreshold));
+        }
+        json.newline(2).raw('}');
+    }
+    json.newline().raw(']');
+    json.close();
+}
+
+void writeComponentTable(const ComponentSet& components, const std::string& path, const TableLabeling& labeling) {
+    const size_t count = components.components.size();
+    std::vector<std::int32_t> ids, xs, ys, widths, heights, sizes;
+    std::vector<float> probabilities;
+    std::vector<std::uint8_t> buildingBlocks;
+    for (auto* column : {&ids, &xs, &ys, &widths, &heights, &sizes}) {
+        column->reserve(count);
+    }
+    probabilities.reserve(count);
+    buildingBlocks.reserve(count);
+    const bool withStats = !components.heatmapStats.empty();
+    for (const Component& comp : components.components) {
+        ids.push_back(comp.id);
+        xs.push_back(comp.xMin);
+        ys.push_back(comp.yMin);
+        widths.push_back(comp.width());
+        heights.push_back(comp.height());
+        sizes.push_back(comp.size);
+        probabilities.push_back(comp.avgProbability);
+        buildingBlocks.push_back(comp.isBuildingBlock ? 1 : 0);
+    }
+
+    ComponentTableHeader header;
+    std::memcpy(header.magic, tableMagic, sizeof(tableMagic));
+    header.version = tableVersion;
+    header.columnCount = withStats ? tableColumnsWithStats : tableColumns;
+    header.count = static_cast<std::uint32_t>(count);
+    header.payloadOffset = sizeof(header);
+    header.labeler = static_cast<std::uint8_t>(labeling.labeler);
+    header.labelingFlags = static_cast<std::uint8_t>((labeling.use8Way ? use8WayFlag : 0) |
+                                                     (labeling.euclidif ? euclidifFlag : 0));
+    header.reserved = 0;
+    header.k = labeling.k;
+    header.probabilityPercentile = components.probabilityPercentile;
+    header.probabilityThreshold = components.probabilityThreshold;
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create component table: " + path);
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (auto* column : {&ids, &xs, &ys, &widths, &heights, &sizes}) {
+        writeColumn(file, *column);
+    }
+    writeColumn(file, probabilities);
+    writeColumn(file, buildingBlocks);
+    if (withStats) {
+        std::vector<float> column(count);
+        for (float ComponentHeatmapStats::*field :
+             {&ComponentHeatmapStats::minProbability, &ComponentHeatmapStats::maxProbability,
+              &ComponentHeatmapStats::stdDevProbability, &ComponentHeatmapStats::aboveThreshold}) {
+            for (size_t i = 0; i < count; ++i) {
+                column[i] = components.heatmapStats[i].*field;
+            }
+            writeColumn(file, column);
+        }
+    }
+    if (!file) {
+        throw std::runtime_error("Error writing component table: " + path);
+    }
+}
+
+ComponentSet readComponentTable(const std::string& path, TableLabeling* labeling) {
+    std::ifstream file(path, std::ios::binary);
+    ComponentTableHeader header;
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, tableMagic, sizeof(tableMagic)) != 0) {
+        throw std::runtime_error("Not a component table file: " + path);
+    }
+    if (header.version != tableVersion ||
+        (header.columnCount != tableColumns && header.columnCount != tableColumnsWithStats)) {
+        throw std::runtime_error("Unsupported component table version " + std::to_string(header.version) +
+                                 " in: " + path);
+    }
+
+    if (labeling) {
+        labeling->labeler = header.labeler <= static_cast<std::uint8_t>(TableLabeler::Streaming)
+                                ? static_cast<TableLabeler>(header.labeler)
+                                : TableLabeler::Unknown;
+        labeling->k = header.k;
+        labeling->use8Way = (header.labelingFlags & use8WayFlag) != 0;
+        labeling->euclidif = (header.labelingFlags & euclidifFlag) != 0;
+    }
+
+    const size_t count = header.count;
+    std::vector<std::int32_t> ids, xs, ys, widths, heights, sizes;
+    std::vector<float> probabilities;
+    std::vector<std::uint8_t> buildingBlocks;
+    file.seekg(header.payloadOffset);
+    for (auto* column : {&ids, &xs, &ys, &widths, &heights, &sizes}) {
+        readColumn(file, *column, count);
+    }
+    readColumn(file, probabilities, count);
+    readColumn(file, buildingBlocks, count);
+    ComponentSet result;
+    if (header.columnCount == tableColumnsWithStats) {
+        result.heatmapStats.resize(count);
+        std::vector<float> column;
+        for (float ComponentHeatmapStats::*field :
+             {&ComponentHeatmapStats::minProbability, &ComponentHeatmapStats::maxProbability,
+              &ComponentHeatmapStats::stdDevProbability, &ComponentHeatmapStats::aboveThreshold}) {
+            readColumn(file, column, count);
+            for (size_t i = 0; i < count; ++i) {
+                result.heatmapStats[i].*field = column[i];
+            }
+        }
+    }
+    if (!file) {
+        throw std::runtime_error("Error reading component table: " + path);
+    }
+
+    result.probabilityPercentile = header.probabilityPercentile;
+    result.probabilityThreshold = header.probabilityThreshold;
+    result.components.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        Component comp;
+        comp.id = ids[i];
+        comp.xMin = xs[i];
+        comp.xMax = xs[i] + widths[i] - 1;
+        comp.yMin = ys[i];
+        comp.yMax = ys[i] + heights[i] - 1;
+        comp.size = sizes[i];
+        comp.avgProbability = probabilities[i];
+        comp.isBuildingBlock = buildingBlocks[i] != 0;
+        comp.runBegin = 0;
+        comp.runEnd = 0;
+        result.components.push_back(comp);
+    }
+    return result;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "segmenter.h"
+
+// Binary component table (.p2pc), a little-endian flat columnar sidecar of
+// components_info.json written next to it and read by component_table.py:
+//   header   ComponentTableHeader, 32 bytes
+//   payload  at payloadOffset, one column after the other, count values each, in the order
+//            id, x, y, width, height, size (int32), avgProbability (float32) and
+//            isBuildingBlock (uint8), then with the heatmap statistics of the components
+//            (columnCount 12) probabilityMin, probabilityMax, probabilityStdDev and
+//            aboveThresholdShare (float32)
+//   The header also records how the components were labeled, see TableLabeling, and the
+//   probability threshold of their classification. Tables written before they were recorded
+//   hold zeros there and read as TableLabeler::Unknown.
+struct ComponentTableHeader {
+    char magic[4];               // "P2PC"
+    std::uint16_t version;       // 1
+    std::uint16_t columnCount;   // 8, or 12 with the heatmap statistics
+    std::uint32_t count;         // Number of components
+    std::uint32_t payloadOffset; // 32 for version 1
+    std::uint8_t labeler;        // TableLabeler
+    std::uint8_t labelingFlags;  // Bit 0 use8Way, bit 1 euclidif
+    std::uint16_t reserved;
+    float k;                     // Color threshold of the labeling
+    float probabilityPercentile; // ComponentSet::probabilityPercentile
+    float probabilityThreshold;  // ComponentSet::probabilityThreshold
+};
+static_assert(sizeof(ComponentTableHeader) == 32, "ComponentTableHeader must match the on-disk layout");
+
+// Labeling that wrote a component table
+enum class TableLabeler : std::uint8_t {
+    Unknown = 0, // A table written before the labeling was recorded
+    Stack = 1,
+    Scanline = 2,
+    UnionFind = 3,
+    Streaming = 4 // StreamingSegmenter, the neighbor criterion of the unionfind engine in bands
+};
+
+// How the components of a table were labeled, so a cache is only patched with the criterion
+// that wrote it
+struct TableLabeling {
+    TableLabeler labeler = TableLabeler::Unknown;
+    float k = 0.0f;
+    bool use8Way = false;
+    bool euclidif = false;
+};
+
+// Function to get the labeling of a run with config, streamed by a StreamingSegmenter or not
+TableLabeling tableLabeling(const Config& config, bool streamed);
+
+// Function to get the name of a table labeler ("unknown", "stack", "scanline", "unionfind" or
+// "streaming")
+std::string tableLabelerName(TableLabeler labeler);
+
+// Function to write components_info.json, pretty-printed or without any whitespace
+void writeComponentsInfo(const ComponentSet& components, const std::string& path, bool compact);
+
+// Function to write the binary component table of components labeled as labeling says, with
+// their heatmap statistics when they have them
+void writeComponentTable(const ComponentSet& components, const std::string& path, const TableLabeling& labeling);
+
+// Function to read a binary component table back into components without runs, with its
+// probability threshold and heatmap statistics, for reclassifyImage and resegmentImage, and
+// its labeling into labeling when given. Throws
+// std::runtime_error on failure.
+ComponentSet readComponentTable(const std::string& path, TableLabeling* labeling = nullptr);
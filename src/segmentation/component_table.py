@@ -0,0 +1,60 @@
+"""
+Binary component table (.p2pc) written by the C++ segmenter next to components_info.json,
+see component_table.h.
+
+Layout, little-endian: a 32-byte header (magic "P2PC", uint16 version, uint16 column count,
+uint32 component count, uint32 payload offset, 16 bytes recording the labeling engine, the
+use8Way and euclidif flags, k and the probability percentile and threshold of the
+classification, see ComponentTableHeader) followed by the columns id, x, y, width, height,
+size (int32), avg_probability (float32) and is_building_block (uint8), then with the heatmap
+statistics probability_min, probability_max, probability_std_dev and above_threshold_share
+(float32), count values each.
+"""
+
+import struct
+
+import numpy as np
+
+MAGIC = b"P2PC"
+VERSION = 1
+HEADER = struct.Struct("<4sHHII16x")
+
+COLUMNS = [
+    ("id", np.dtype("<i4")),
+    ("x", np.dtype("<i4")),
+    ("y", np.dtype("<i4")),
+    ("width", np.dtype("<i4")),
+    ("height", np.dtype("<i4")),
+    ("size", np.dtype("<i4")),
+    ("avg_probability", np.dtype("<f4")),
+    ("is_building_block", np.dtype("u1")),
+]
+
+STATS_COLUMNS = [
+    ("probability_min", np.dtype("<f4")),
+    ("probability_max", np.dtype("<f4")),
+    ("probability_std_dev", np.dtype("<f4")),
+    ("above_threshold_share", np.dtype("<f4")),
+]
+
+
+def read_component_table(path: str) -> dict:
+    """
+    Reads a .p2pc file as a dict of column name to a read-only memory-mapped array.
+    """
+    with open(path, "rb") as f:
+        header = f.read(HEADER.size)
+    if len(header) < HEADER.size or header[:4] != MAGIC:
+        raise ValueError(f"Not a component table file: {path}")
+    _, version, column_count, count, offset = HEADER.unpack(header)
+    if version != VERSION or column_count not in (len(COLUMNS), len(COLUMNS) + len(STATS_COLUMNS)):
+        raise ValueError(f"Unsupported component table version {version} in: {path}")
+
+    columns = {}
+    for name, dtype in (COLUMNS + STATS_COLUMNS)[:column_count]:
+        if count:
+            columns[name] = np.memmap(path, dtype=dtype, mode="r", offset=offset, shape=(count,))
+        else:
+            columns[name] = np.empty(0, dtype=dtype)
+        offset += count * dtype.itemsize
+    return columns
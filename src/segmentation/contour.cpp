@@ -0,0 +1,150 @@
+#include "contour.h"
+
+#include <cmath>
+#include <utility>
+
+namespace {
+
+// Perpendicular distance from point to the line through start and end, or to start when
+// both ends coincide, like rdp.pldist
+double lineDistance(const RingPoint& point, const RingPoint& start, const RingPoint& end) {
+    double dx = end.x - start.x;
+    double dy = end.y - start.y;
+    double px = point.x - start.x;
+    double py = point.y - start.y;
+    if (dx == 0.0 && dy == 0.0) {
+        return std::sqrt(px * px + py * py);
+    }
+    return std::abs(dx * py - dy * px) / std::sqrt(dx * dx + dy * dy);
+}
+
+} // namespace
+
+std::vector<RingPoint> traceOutline(const ComponentSet& components, const Component& comp) {
+    // Crop of the component with a one pixel background border
+    const int maskWidth = comp.width() + 2;
+    const int maskHeight = comp.height() + 2;
+    std::vector<int> piece(static_cast<size_t>(maskWidth) * maskHeight, 0);
+    for (const PixelRun& run : components.runsOf(comp)) {
+        int* row = piece.data() + static_cast<size_t>(run.y - comp.yMin + 1) * maskWidth - comp.xMin + 1;
+        for (int x = run.xBegin; x <= run.xEnd; ++x) {
+            row[x] = -1;
+        }
+    }
+
+    // Number the 4-connected pieces and find the largest, the first one on ties
+    int pieceCount = 0;
+    int bestPiece = 0;
+    int bestSize = 0;
+    int bestStart = 0;
+    std::vector<int> stack;
+    for (int start = 0; start < static_cast<int>(piece.size()); ++start) {
+        if (piece[start] != -1) {
+            continue;
+        }
+        int id = ++pieceCount;
+        int size = 0;
+        piece[start] = id;
+        stack.push_back(start);
+        while (!stack.empty()) {
+            int cell = stack.back();
+            stack.pop_back();
+            ++size;
+            for (int neighbor : {cell - 1, cell + 1, cell - maskWidth, cell + maskWidth}) {
+                if (piece[neighbor] == -1) {
+                    piece[neighbor] = id;
+                    stack.push_back(neighbor);
+                }
+            }
+        }
+        if (size > bestSize) {
+            bestPiece = id;
+            bestSize = size;
+            bestStart = start;
+        }
+    }
+    std::vector<RingPoint> ring;
+    if (bestSize == 0) {
+        return ring;
+    }
+
+    // Follow the pixel edges with the piece on the right, starting east along the top edge
+    // of its first pixel in raster order, whose left and upper neighbors are background.
+    // Vertex (x, y) is the top-left corner of mask cell (x, y).
+    auto inside = [&](int x, int y) { return piece[static_cast<size_t>(y) * maskWidth + x] == bestPiece; };
+    const int stepX[4] = {1, 0, -1, 0}; // East, south, west, north
+    const int stepY[4] = {0, 1, 0, -1};
+    const int startX = bestStart % maskWidth;
+    const int startY = bestStart / maskWidth;
+    auto emit = [&](int x, int y) { ring.push_back({x - 1 + comp.xMin, y - 1 + comp.yMin}); };
+
+    int x = startX;
+    int y = startY;
+    int direction = 0;
+    emit(x, y);
+    do {
+        x += stepX[direction];
+        y += stepY[direction];
+        // Cells ahead of the vertex, on the left and on the right of the current direction
+        int left = (direction + 3) % 4;
+        int right = (direction + 1) % 4;
+        bool aheadLeft, aheadRight;
+        switch (direction) {
+        case 0: aheadLeft = inside(x, y - 1); aheadRight = inside(x, y); break;
+        case 1: aheadLeft = inside(x, y); aheadRight = inside(x - 1, y); break;
+        case 2: aheadLeft = inside(x - 1, y); aheadRight = inside(x - 1, y - 1); break;
+        default: aheadLeft = inside(x - 1, y - 1); aheadRight = inside(x, y - 1); break;
+        }
+        // A diagonal neighbor alone does not connect in 4-connectivity, so turn right then
+        int next = !aheadRight ? right : (aheadLeft ? left : direction);
+        if (next != direction) {
+            direction = next;
+            if (x != startX || y != startY) {
+                emit(x, y);
+            }
+        }
+    } while (x != startX || y != startY || direction != 0);
+    emit(startX, startY);
+    return ring;
+}
+
+std::vector<RingPoint> simplifyRdp(const std::vector<RingPoint>& points, double epsilon) {
+    if (points.size() < 3) {
+        return points;
+    }
+    // Iterative form of rdp.rdp_rec, it keeps the same points
+    std::vector<bool> keep(points.size(), true);
+    std::vector<std::pair<size_t, size_t>> stack = {{0, points.size() - 1}};
+    while (!stack.empty()) {
+        size_t first = stack.back().first;
+        size_t last = stack.back().second;
+        stack.pop_back();
+        double maxDistance = 0.0;
+        size_t farthest = first;
+        for (size_t i = first + 1; i < last; ++i) {
+            if (!keep[i]) {
+                continue;
+            }
+            double distance = lineDistance(points[i], points[first], points[last]);
+            if (distance > maxDistance) {
+                farthest = i;
+                maxDistance = distance;
+            }
+        }
+        if (maxDistance > epsilon) {
+            stack.push_back({first, farthest});
+            stack.push_back({farthest, last});
+        } else {
+            for (size_t i = first + 1; i < last; ++i) {
+                keep[i] = false;
+            }
+        }
+    }
+    std::vector<RingPoint> simplified;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (keep[i]) {
+            simplified.push_back(points[i]);
+        }
+    }
+    return simplified;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <vector>
+#include "segmenter.h"
+
+// Polygon vertex, in pixel corner coordinates: pixel (x, y) spans [x, x + 1] x [y, y + 1]
+struct RingPoint {
+    int x, y;
+};
+
+// Exterior ring of a component, traced along pixel edges by crack following, in image
+// coordinates. Only the largest 4-connected piece is traced, like the main polygon that
+// gdal_polygonize and vectorize.filter_polygons kept, and holes are ignored. The ring runs
+// clockwise on screen (y down), is closed by repeating its first vertex and only has a
+// vertex where the outline turns.
+std::vector<RingPoint> traceOutline(const ComponentSet& components, const Component& comp);
+
+// Ramer-Douglas-Peucker simplification of a polyline, same result as rdp.rdp(points, epsilon)
+// from the rdp package used by vectorize.simplify_shapefile_with_rdp
+std::vector<RingPoint> simplifyRdp(const std::vector<RingPoint>& points, double epsilon);
@@ -0,0 +1,211 @@
+#include "dbscan.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace {
+
+constexpr int leafSize = 16;
+
+// Static KD-tree over the point indices, split at the median of the widest axis
+class KdTree {
+public:
+    KdTree(const double* points, size_t count, int dims) : points_(points), dims_(dims), order_(count) {
+        std::iota(order_.begin(), order_.end(), 0u);
+        if (count > 0) {
+            nodes_.reserve(2 * count / leafSize + 2);
+            build(0, count);
+        }
+    }
+
+    // Append (squared distance, index) of every point within radius of query
+    void radius(const double* query, double radius, std::vector<std::pair<double, std::uint32_t>>& out) const {
+        if (!nodes_.empty()) {
+            search(0, query, radius * radius, out);
+        }
+    }
+
+private:
+    struct Node {
+        size_t begin, end; // Range of order_
+        int axis;          // -1 for leaves
+        double split;
+        int left, right;
+    };
+
+    int build(size_t begin, size_t end) {
+        const int index = static_cast<int>(nodes_.size());
+        nodes_.push_back({begin, end, -1, 0.0, -1, -1});
+        if (end - begin <= static_cast<size_t>(leafSize)) {
+            return index;
+        }
+        int axis = 0;
+        double widest = -1.0;
+        for (int d = 0; d < dims_; ++d) {
+            double low = coordinate(order_[begin], d), high = low;
+            for (size_t i = begin + 1; i < end; ++i) {
+                low = std::min(low, coordinate(order_[i], d));
+                high = std::max(high, coordinate(order_[i], d));
+            }
+            if (high - low > widest) {
+                widest = high - low;
+                axis = d;
+            }
+        }
+        const size_t middle = begin + (end - begin) / 2;
+        std::nth_element(order_.begin() + begin, order_.begin() + middle, order_.begin() + end,
+                         [&](std::uint32_t a, std::uint32_t b) { return coordinate(a, axis) < coordinate(b, axis); });
+        const double split = coordinate(order_[middle], axis);
+        const int left = build(begin, middle);
+        const int right = build(middle, end);
+        nodes_[index].axis = axis;
+        nodes_[index].split = split;
+        nodes_[index].left = left;
+        nodes_[index].right = right;
+        return index;
+    }
+
+    void search(int index, const double* query, double squaredRadius,
+                std::vector<std::pair<double, std::uint32_t>>& out) const {
+        const Node& node = nodes_[index];
+        if (node.axis < 0) {
+            for (size_t i = node.begin; i < node.end; ++i) {
+                const double distance = squaredDistance(query, order_[i]);
+                if (distance <= squaredRadius) {
+                    out.emplace_back(distance, order_[i]);
+                }
+            }
+            return;
+        }
+        // Points left of the split are <= split and points right of it >= split
+        const double offset = query[node.axis] - node.split;
+        const int nearSide = offset < 0.0 ? node.left : node.right;
+        const int farSide = offset < 0.0 ? node.right : node.left;
+        search(nearSide, query, squaredRadius, out);
+        if (offset * offset <= squaredRadius) {
+            search(farSide, query, squaredRadius, out);
+        }
+    }
+
+    double coordinate(std::uint32_t point, int axis) const { return points_[static_cast<size_t>(point) * dims_ + axis]; }
+
+    double squaredDistance(const double* query, std::uint32_t point) const {
+        const double* other = points_ + static_cast<size_t>(point) * dims_;
+        double sum = 0.0;
+        for (int d = 0; d < dims_; ++d) {
+            const double delta = query[d] - other[d];
+            sum += delta * delta;
+        }
+        return sum;
+    }
+
+    const double* points_;
+    int dims_;
+    std::vector<std::uint32_t> order_;
+    std::vector<Node> nodes_;
+};
+
+} // namespace
+
+NeighborIndex::NeighborIndex(const double* points, size_t count, int dims, double maxEps, int threads)
+    : maxEps_(maxEps), offsets_(count + 1, 0) {
+    if (maxEps < 0.0) {
+        throw std::invalid_argument("maxEps must not be negative");
+    }
+    const KdTree tree(points, count, dims);
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const size_t parts = std::max<size_t>(1, std::min(static_cast<size_t>(threads), count));
+
+    // Each worker gathers the neighborhoods of a slice of the points, then they are
+    // concatenated in point order
+    std::vector<std::vector<std::pair<double, std::uint32_t>>> found(parts);
+    auto query = [&](size_t part) {
+        const size_t begin = count * part / parts, end = count * (part + 1) / parts;
+        std::vector<std::pair<double, std::uint32_t>>& out = found[part];
+        for (size_t i = begin; i < end; ++i) {
+            const size_t first = out.size();
+            tree.radius(points + i * dims, maxEps, out);
+            std::sort(out.begin() + first, out.end());
+            offsets_[i + 1] = out.size() - first;
+        }
+    };
+    if (parts == 1) {
+        query(0);
+    } else {
+        std::vector<std::thread> workers;
+        for (size_t part = 0; part < parts; ++part) {
+            workers.emplace_back(query, part);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        offsets_[i + 1] += offsets_[i];
+    }
+    neighbors_.reserve(offsets_[count]);
+    distances_.reserve(offsets_[count]);
+    for (auto& part : found) {
+        for (const auto& neighbor : part) {
+            distances_.push_back(neighbor.first);
+            neighbors_.push_back(neighbor.second);
+        }
+        part = {};
+    }
+}
+
+std::vector<int> NeighborIndex::cluster(double eps, int minSamples) const {
+    if (eps > maxEps_) {
+        throw std::invalid_argument("eps is above the maxEps of the neighbor index");
+    }
+    const size_t count = size();
+    const double squaredEps = eps * eps;
+
+    // End of the eps neighborhood of every point, a prefix of the stored one
+    std::vector<std::uint64_t> ends(count);
+    std::vector<char> core(count);
+    for (size_t i = 0; i < count; ++i) {
+        ends[i] = std::upper_bound(distances_.begin() + offsets_[i], distances_.begin() + offsets_[i + 1], squaredEps) -
+                  distances_.begin();
+        core[i] = ends[i] - offsets_[i] >= static_cast<std::uint64_t>(std::max(minSamples, 0));
+    }
+
+    // Depth-first expansion from every unlabeled core point, as sklearn's dbscan_inner
+    std::vector<int> labels(count, -1);
+    std::vector<std::uint32_t> stack;
+    int label = 0;
+    for (size_t start = 0; start < count; ++start) {
+        if (labels[start] != -1 || !core[start]) {
+            continue;
+        }
+        stack.push_back(static_cast<std::uint32_t>(start));
+        while (!stack.empty()) {
+            const std::uint32_t point = stack.back();
+            stack.pop_back();
+            if (labels[point] != -1) {
+                continue;
+            }
+            labels[point] = label;
+            if (!core[point]) {
+                continue;
+            }
+            for (std::uint64_t j = offsets_[point]; j < ends[point]; ++j) {
+                if (labels[neighbors_[j]] == -1) {
+                    stack.push_back(neighbors_[j]);
+                }
+            }
+        }
+        label++;
+    }
+    return labels;
+}
+
+size_t countNoise(const std::vector<int>& labels) {
+    return static_cast<size_t>(std::count(labels.begin(), labels.end(), -1));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Neighborhoods of a point set within maxEps, found once through a KD-tree and kept sorted
+// by distance, so DBSCAN can be rerun for any eps <= maxEps without another radius search:
+// the neighborhood for eps is a prefix of the stored one. Meant for the eps search of
+// bayesian_optimization in georeferencing/outliers_detection/dbscan.py, which clusters the
+// same scaled polygon features many times.
+class NeighborIndex {
+public:
+    // count points of dims coordinates each, row-major. Points are queried across threads,
+    // 0 uses every core. Throws std::invalid_argument when maxEps is negative.
+    NeighborIndex(const double* points, size_t count, int dims, double maxEps, int threads);
+
+    size_t size() const { return offsets_.size() - 1; }
+    double maxEps() const { return maxEps_; }
+
+    // Labels of DBSCAN(eps, minSamples) with the Euclidean metric, as sklearn.cluster.DBSCAN
+    // assigns them: the neighborhood of a point includes itself and every point at distance
+    // <= eps, points with at least minSamples neighbors are core points, clusters are numbered
+    // from 0 in the order of their first core point and noise is -1. Throws
+    // std::invalid_argument when eps is above maxEps.
+    std::vector<int> cluster(double eps, int minSamples) const;
+
+private:
+    double maxEps_;
+    std::vector<std::uint64_t> offsets_;  // size() + 1 offsets into neighbors_ and distances_
+    std::vector<std::uint32_t> neighbors_; // Per point, nearest first, the point itself included
+    std::vector<double> distances_;        // Squared distances of neighbors_
+};
+
+// Function to count the noise points of labels
+size_t countNoise(const std::vector<int>& labels);
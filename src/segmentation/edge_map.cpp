@@ -0,0 +1,272 @@
+#include "edge_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EDGE_MAP_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define EDGE_MAP_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+const int maxSquaredDistance = 3 * 255 * 255;
+const int maxManhattanDistance = 3 * 255;
+
+// One image row split into its red, green and blue planes
+struct PlanarRow {
+    const std::uint8_t* channel[3];
+
+    PlanarRow shifted(int offset) const {
+        return {{channel[0] + offset, channel[1] + offset, channel[2] + offset}};
+    }
+};
+
+// Set bit in out[i] for every i below count where a[i] and b[i] are within threshold
+using MarkKernel = void (*)(const PlanarRow& a, const PlanarRow& b, int count, bool euclidif, int threshold,
+                            std::uint8_t bit, std::uint8_t* out);
+
+void markPassableScalar(const PlanarRow& a, const PlanarRow& b, int count, bool euclidif, int threshold,
+                        std::uint8_t bit, std::uint8_t* out) {
+    for (int i = 0; i < count; ++i) {
+        Color ca{a.channel[0][i], a.channel[1][i], a.channel[2][i]};
+        Color cb{b.channel[0][i], b.channel[1][i], b.channel[2][i]};
+        if (colorDistance(ca, cb, euclidif) <= threshold) {
+            out[i] |= bit;
+        }
+    }
+}
+
+#ifdef EDGE_MAP_X86
+
+// Byte i of masks[m] is 1 when bit i of m is set
+struct SpreadTable {
+    std::uint64_t masks[256];
+
+    SpreadTable() {
+        for (int m = 0; m < 256; ++m) {
+            masks[m] = 0;
+            for (int i = 0; i < 8; ++i) {
+                if (m & (1 << i)) {
+                    masks[m] |= std::uint64_t(1) << (i * 8);
+                }
+            }
+        }
+    }
+};
+const SpreadTable spreadTable;
+
+// OR bit into the bytes of out selected by the low lanes bits of mask
+inline void orMask(std::uint8_t* out, int mask, int lanes, std::uint8_t bit) {
+    std::uint64_t spread = spreadTable.masks[mask] * bit;
+    std::uint64_t current = 0;
+    std::memcpy(&current, out, lanes);
+    current |= spread;
+    std::memcpy(out, &current, lanes);
+}
+
+__attribute__((target("avx2")))
+void markPassableAvx2(const PlanarRow& a, const PlanarRow& b, int count, bool euclidif, int threshold,
+                      std::uint8_t bit, std::uint8_t* out) {
+    const __m256i limit = _mm256_set1_epi32(threshold + 1);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i sum = _mm256_setzero_si256();
+        for (int c = 0; c < 3; ++c) {
+            __m256i va = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a.channel[c] + i)));
+            __m256i vb = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b.channel[c] + i)));
+            __m256i d = _mm256_sub_epi32(va, vb);
+            sum = _mm256_add_epi32(sum, euclidif ? _mm256_mullo_epi32(d, d) : _mm256_abs_epi32(d));
+        }
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(limit, sum)));
+        if (mask) {
+            orMask(out + i, mask, 8, bit);
+        }
+    }
+    markPassableScalar(a.shifted(i), b.shifted(i), count - i, euclidif, threshold, bit, out + i);
+}
+
+// Widen four bytes to 32-bit lanes
+__attribute__((target("sse4.1")))
+inline __m128i load4(const std::uint8_t* p) {
+    std::int32_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(word));
+}
+
+__attribute__((target("sse4.1")))
+void markPassableSse41(const PlanarRow& a, const PlanarRow& b, int count, bool euclidif, int threshold,
+                       std::uint8_t bit, std::uint8_t* out) {
+    const __m128i limit = _mm_set1_epi32(threshold + 1);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i sum = _mm_setzero_si128();
+        for (int c = 0; c < 3; ++c) {
+            __m128i d = _mm_sub_epi32(load4(a.channel[c] + i), load4(b.channel[c] + i));
+            sum = _mm_add_epi32(sum, euclidif ? _mm_mullo_epi32(d, d) : _mm_abs_epi32(d));
+        }
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(limit, sum)));
+        if (mask) {
+            orMask(out + i, mask, 4, bit);
+        }
+    }
+    markPassableScalar(a.shifted(i), b.shifted(i), count - i, euclidif, threshold, bit, out + i);
+}
+
+#endif
+
+#ifdef EDGE_MAP_NEON
+
+void markPassableNeon(const PlanarRow& a, const PlanarRow& b, int count, bool euclidif, int threshold,
+                      std::uint8_t bit, std::uint8_t* out) {
+    const uint32x4_t limit = vdupq_n_u32(static_cast<std::uint32_t>(threshold));
+    const uint8x8_t bits = vdup_n_u8(bit);
+    int i = 0;
+    if (threshold >= 0) {
+        for (; i + 8 <= count; i += 8) {
+            uint32x4_t low = vdupq_n_u32(0);
+            uint32x4_t high = vdupq_n_u32(0);
+            for (int c = 0; c < 3; ++c) {
+                uint8x8_t d = vabd_u8(vld1_u8(a.channel[c] + i), vld1_u8(b.channel[c] + i));
+                uint16x8_t term = euclidif ? vmull_u8(d, d) : vmovl_u8(d);
+                low = vaddw_u16(low, vget_low_u16(term));
+                high = vaddw_u16(high, vget_high_u16(term));
+            }
+            uint16x8_t pass = vcombine_u16(vmovn_u32(vcleq_u32(low, limit)), vmovn_u32(vcleq_u32(high, limit)));
+            uint8x8_t marked = vand_u8(vmovn_u16(pass), bits);
+            vst1_u8(out + i, vorr_u8(vld1_u8(out + i), marked));
+        }
+    }
+    markPassableScalar(a.shifted(i), b.shifted(i), count - i, euclidif, threshold, bit, out + i);
+}
+
+#endif
+
+struct KernelChoice {
+    MarkKernel kernel;
+    const char* name;
+};
+
+KernelChoice selectKernel() {
+#ifdef EDGE_MAP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {markPassableAvx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return {markPassableSse41, "sse4.1"};
+    }
+#endif
+#ifdef EDGE_MAP_NEON
+    return {markPassableNeon, "neon"};
+#endif
+    return {markPassableScalar, "scalar"};
+}
+
+const KernelChoice& kernelChoice() {
+    static const KernelChoice choice = selectKernel();
+    return choice;
+}
+
+// Edge bytes of rows [yBegin, yEnd). Reads the row below yEnd too, but only writes the band.
+void buildEdgeRows(const ImageView& image, int yBegin, int yEnd, bool use8Way, bool euclidif, int threshold,
+                   std::uint8_t* edges) {
+    const int width = image.width;
+    const int height = image.height;
+    MarkKernel mark = kernelChoice().kernel;
+
+    // Planar copies of the current row and the one below it
+    std::vector<std::uint8_t> planes(static_cast<size_t>(width) * 6);
+    auto planarRow = [&](int slot) {
+        const std::uint8_t* base = planes.data() + static_cast<size_t>(slot) * width * 3;
+        return PlanarRow{{base, base + width, base + 2 * width}};
+    };
+    auto loadRow = [&](int y, int slot) {
+        std::uint8_t* base = planes.data() + static_cast<size_t>(slot) * width * 3;
+        const Color* row = image.pixels + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; ++x) {
+            base[x] = row[x].r;
+            base[width + x] = row[x].g;
+            base[2 * width + x] = row[x].b;
+        }
+    };
+
+    int current = 0;
+    loadRow(yBegin, current);
+    for (int y = yBegin; y < yEnd; ++y) {
+        std::uint8_t* out = edges + static_cast<size_t>(y) * width;
+        std::fill(out, out + width, 0);
+        PlanarRow row = planarRow(current);
+        mark(row, row.shifted(1), width - 1, euclidif, threshold, EdgeEast, out);
+        if (y + 1 < height) {
+            loadRow(y + 1, 1 - current);
+            PlanarRow below = planarRow(1 - current);
+            mark(row, below, width, euclidif, threshold, EdgeSouth, out);
+            if (use8Way) {
+                mark(row, below.shifted(1), width - 1, euclidif, threshold, EdgeSouthEast, out);
+                mark(row.shifted(1), below, width - 1, euclidif, threshold, EdgeSouthWest, out + 1);
+            }
+            current = 1 - current;
+        }
+    }
+}
+
+} // namespace
+
+int colorDistanceThreshold(double k, bool euclidif) {
+    if (!(k >= 0.0)) {
+        return -1;
+    }
+    if (!euclidif) {
+        return k >= maxManhattanDistance ? maxManhattanDistance : static_cast<int>(std::floor(k));
+    }
+    if (k >= std::sqrt(static_cast<double>(maxSquaredDistance))) {
+        return maxSquaredDistance;
+    }
+    // Start from k * k and settle on the exact boundary of the original sqrt test
+    int threshold = static_cast<int>(k * k);
+    while (threshold < maxSquaredDistance && std::sqrt(static_cast<double>(threshold + 1)) <= k) {
+        ++threshold;
+    }
+    while (threshold >= 0 && std::sqrt(static_cast<double>(threshold)) > k) {
+        --threshold;
+    }
+    return threshold;
+}
+
+void buildEdgeMap(const ImageView& image, bool use8Way, bool euclidif, int threshold, int threads,
+                  std::vector<std::uint8_t>& edges) {
+    const int height = image.height;
+    edges.resize(static_cast<size_t>(image.width) * height);
+    if (image.width == 0 || height == 0) {
+        return;
+    }
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int bandCount = std::max(1, std::min(threads, height));
+    if (bandCount == 1) {
+        buildEdgeRows(image, 0, height, use8Way, euclidif, threshold, edges.data());
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < bandCount; ++t) {
+        int yBegin = static_cast<int>(static_cast<long long>(height) * t / bandCount);
+        int yEnd = static_cast<int>(static_cast<long long>(height) * (t + 1) / bandCount);
+        workers.emplace_back(buildEdgeRows, std::cref(image), yBegin, yEnd, use8Way, euclidif, threshold,
+                             edges.data());
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+const char* edgeKernelName() {
+    return kernelChoice().name;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include "segmenter.h"
+
+// Bits of an edge map byte. Each pixel stores whether it passes the color test with the
+// neighbors after it in raster order; the other four directions are read from the
+// neighbor's byte, see edgePasses.
+enum EdgeBit : std::uint8_t {
+    EdgeEast = 1,      // (x + 1, y)
+    EdgeSouth = 2,     // (x, y + 1)
+    EdgeSouthEast = 4, // (x + 1, y + 1), only with use8Way
+    EdgeSouthWest = 8  // (x - 1, y + 1), only with use8Way
+};
+
+// Integer color distance, squared when euclidif so no square root is needed
+inline int colorDistance(const Color& c1, const Color& c2, bool euclidif) {
+    int dr = c1.r - c2.r;
+    int dg = c1.g - c2.g;
+    int db = c1.b - c2.b;
+    if (euclidif) {
+        return dr * dr + dg * dg + db * db;
+    }
+    return std::abs(dr) + std::abs(dg) + std::abs(db);
+}
+
+// Largest colorDistance that passes the k threshold, -1 when none does. Comparing the
+// integer distance against it gives exactly the answer of the original floating point
+// test colorDifference(c1, c2) <= k.
+int colorDistanceThreshold(double k, bool euclidif);
+
+// Whether the pixel at index passes the color test with its neighbor at (dx, dy)
+inline bool edgePasses(const std::uint8_t* edges, int width, int index, int dx, int dy) {
+    if (dy < 0 || (dy == 0 && dx < 0)) {
+        index += dy * width + dx;
+        dx = -dx;
+        dy = -dy;
+    }
+    std::uint8_t bit = dy == 0 ? EdgeEast : (dx == 0 ? EdgeSouth : (dx > 0 ? EdgeSouthEast : EdgeSouthWest));
+    return (edges[index] & bit) != 0;
+}
+
+// Fill edges with one byte per pixel of EdgeBit flags for the pixels within threshold of
+// their neighbors. Rows are split across threads, 0 uses every core. The distances are
+// computed by an AVX2, SSE4.1 or NEON kernel picked for the running CPU.
+void buildEdgeMap(const ImageView& image, bool use8Way, bool euclidif, int threshold, int threads,
+                  std::vector<std::uint8_t>& edges);
+
+// Name of the edge map kernel used on this CPU
+const char* edgeKernelName();
@@ -0,0 +1,348 @@
+#include "footprint_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+const char indexMagic[4] = {'P', '2', 'P', 'F'};
+const std::uint16_t indexVersion = 1;
+
+template <typename T>
+void writeColumn(std::ofstream& file, const std::vector<T>& column) {
+    file.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+}
+
+template <typename T>
+void readColumn(std::ifstream& file, std::vector<T>& column, size_t count) {
+    column.resize(count);
+    file.read(reinterpret_cast<char*>(column.data()), count * sizeof(T));
+}
+
+double cross(const FootprintPoint& o, const FootprintPoint& a, const FootprintPoint& b) {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Convex hull of points by Andrew's monotone chain, counterclockwise without repeating the first vertex
+std::vector<FootprintPoint> convexHull(std::vector<FootprintPoint> points) {
+    std::sort(points.begin(), points.end(),
+              [](const FootprintPoint& a, const FootprintPoint& b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+    points.erase(std::unique(points.begin(), points.end(),
+                             [](const FootprintPoint& a, const FootprintPoint& b) { return a.x == b.x && a.y == b.y; }),
+                 points.end());
+    if (points.size() < 3) {
+        return points;
+    }
+    std::vector<FootprintPoint> hull(2 * points.size());
+    size_t k = 0;
+    for (size_t i = 0; i < points.size(); ++i) {
+        while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0) {
+            k--;
+        }
+        hull[k++] = points[i];
+    }
+    for (size_t i = points.size() - 1, lower = k + 1; i-- > 0;) {
+        while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0) {
+            k--;
+        }
+        hull[k++] = points[i];
+    }
+    hull.resize(k - 1);
+    return hull;
+}
+
+// Sort-Tile-Recursive order of items [begin, end) by center(item, axis): slices along each
+// axis in turn, so that consecutive runs of nodeCapacity items are compact boxes
+template <typename Center>
+void strOrder(std::uint32_t* begin, std::uint32_t* end, int axis, Center center) {
+    auto byAxis = [&](std::uint32_t a, std::uint32_t b) { return center(a, axis) < center(b, axis); };
+    std::sort(begin, end, byAxis);
+    if (axis + 1 == descriptorCount) {
+        return;
+    }
+    const size_t count = end - begin;
+    const double pages = std::ceil(static_cast<double>(count) / FootprintIndex::nodeCapacity);
+    const size_t slices = static_cast<size_t>(std::ceil(std::pow(pages, 1.0 / (descriptorCount - axis))));
+    const size_t sliceSize = slices > 0 ? ((count + slices - 1) / slices + FootprintIndex::nodeCapacity - 1) /
+                                              FootprintIndex::nodeCapacity * FootprintIndex::nodeCapacity
+                                        : count;
+    for (std::uint32_t* slice = begin; slice < end; slice += std::min<size_t>(sliceSize, end - slice)) {
+        strOrder(slice, slice + std::min<size_t>(sliceSize, end - slice), axis + 1, center);
+    }
+}
+
+} // namespace
+
+NormalizedShape normalizeShape(const FootprintPoint* points, size_t count) {
+    NormalizedShape shape;
+    if (count == 0) {
+        return shape;
+    }
+    std::vector<FootprintPoint> ring(points, points + count);
+    if (ring.front().x != ring.back().x || ring.front().y != ring.back().y) {
+        ring.push_back(ring.front());
+    }
+    double area = 0.0, cx = 0.0, cy = 0.0;
+    for (size_t i = 0; i + 1 < ring.size(); ++i) {
+        const double c = ring[i].x * ring[i + 1].y - ring[i + 1].x * ring[i].y;
+        area += c;
+        cx += (ring[i].x + ring[i + 1].x) * c;
+        cy += (ring[i].y + ring[i + 1].y) * c;
+    }
+    area *= 0.5;
+    if (area == 0.0) {
+        return shape;
+    }
+    cx /= 6.0 * area;
+    cy /= 6.0 * area;
+
+    // Scaled around the centroid and moved onto the origin; the alignment translates it anyway
+    const double scale = 1.0 / std::sqrt(std::fabs(area));
+    for (FootprintPoint& point : ring) {
+        point = {(point.x - cx) * scale, (point.y - cy) * scale};
+    }
+
+    // Second moments of the unit area shape about its centroid, with the sign of the ring
+    // orientation divided out
+    double xx = 0.0, yy = 0.0, xy = 0.0;
+    for (size_t i = 0; i + 1 < ring.size(); ++i) {
+        const FootprintPoint& a = ring[i];
+        const FootprintPoint& b = ring[i + 1];
+        const double c = a.x * b.y - b.x * a.y;
+        xx += c * (a.x * a.x + a.x * b.x + b.x * b.x);
+        yy += c * (a.y * a.y + a.y * b.y + b.y * b.y);
+        xy += c * (a.x * b.y + 2.0 * a.x * a.y + 2.0 * b.x * b.y + b.x * a.y);
+    }
+    const double sign = area > 0.0 ? 1.0 : -1.0;
+    xx *= sign / 12.0;
+    yy *= sign / 12.0;
+    xy *= sign / 24.0;
+    const double mean = 0.5 * (xx + yy);
+    const double spread = std::sqrt(0.25 * (xx - yy) * (xx - yy) + xy * xy);
+
+    const std::vector<FootprintPoint> hull = convexHull(ring);
+    double hullArea = 0.0;
+    for (size_t i = 0; i < hull.size(); ++i) {
+        const FootprintPoint& a = hull[i];
+        const FootprintPoint& b = hull[(i + 1) % hull.size()];
+        hullArea += a.x * b.y - b.x * a.y;
+    }
+    hullArea *= 0.5;
+    double diameter = 0.0;
+    for (size_t i = 0; i < hull.size(); ++i) {
+        for (size_t j = i + 1; j < hull.size(); ++j) {
+            diameter = std::max(diameter, std::hypot(hull[i].x - hull[j].x, hull[i].y - hull[j].y));
+        }
+    }
+
+    shape.ring = std::move(ring);
+    shape.diameter = diameter;
+    shape.descriptor.values[0] = static_cast<float>(xx + yy);
+    shape.descriptor.values[1] = static_cast<float>(mean + spread > 0.0 ? (mean - spread) / (mean + spread) : 0.0);
+    shape.descriptor.values[2] = static_cast<float>(hullArea > 0.0 ? 1.0 / hullArea : 0.0);
+    shape.valid = true;
+    return shape;
+}
+
+FootprintPoint ringCentroid(const FootprintPoint* points, size_t count) {
+    double area = 0.0, cx = 0.0, cy = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        const FootprintPoint& a = points[i];
+        const FootprintPoint& b = points[(i + 1) % count];
+        const double c = a.x * b.y - b.x * a.y;
+        area += c;
+        cx += (a.x + b.x) * c;
+        cy += (a.y + b.y) * c;
+    }
+    area /= 2.0;
+    if (area == 0.0) {
+        return {0.0, 0.0};
+    }
+    return {cx / (6.0 * area), cy / (6.0 * area)};
+}
+
+FootprintIndex::FootprintIndex(const std::vector<std::vector<FootprintPoint>>& rings, std::vector<std::string> names) {
+    if (names.size() != rings.size()) {
+        throw std::invalid_argument("FootprintIndex needs one name per ring");
+    }
+    pointOffsets_.assign(1, 0);
+    nameOffsets_.assign(1, 0);
+    for (size_t i = 0; i < rings.size(); ++i) {
+        const NormalizedShape shape = normalizeShape(rings[i].data(), rings[i].size());
+        points_.insert(points_.end(), shape.ring.begin(), shape.ring.end());
+        pointOffsets_.push_back(points_.size());
+        diameters_.push_back(shape.diameter);
+        centroids_.push_back(ringCentroid(rings[i].data(), rings[i].size()));
+        descriptors_.push_back(shape.descriptor);
+        names_ += names[i];
+        nameOffsets_.push_back(names_.size());
+    }
+    buildTree();
+}
+
+void FootprintIndex::buildTree() {
+    // Footprints that cannot be normalized are left out of the tree
+    for (std::uint32_t i = 0; i < size(); ++i) {
+        if (pointCount(i) > 0) {
+            entries_.push_back(i);
+        }
+    }
+    strOrder(entries_.data(), entries_.data() + entries_.size(), 0,
+             [&](std::uint32_t i, int axis) { return descriptors_[i].values[axis]; });
+    auto merge = [](FootprintIndexNode& node, const float* lower, const float* upper) {
+        for (int d = 0; d < descriptorCount; ++d) {
+            node.lower[d] = std::min(node.lower[d], lower[d]);
+            node.upper[d] = std::max(node.upper[d], upper[d]);
+        }
+    };
+    auto emptyNode = [](std::uint32_t first, std::uint32_t count) {
+        FootprintIndexNode node;
+        std::fill(node.lower, node.lower + descriptorCount, INFINITY);
+        std::fill(node.upper, node.upper + descriptorCount, -INFINITY);
+        node.first = first;
+        node.count = count;
+        return node;
+    };
+    for (size_t first = 0; first < entries_.size(); first += nodeCapacity) {
+        const size_t count = std::min<size_t>(nodeCapacity, entries_.size() - first);
+        FootprintIndexNode node = emptyNode(static_cast<std::uint32_t>(first), static_cast<std::uint32_t>(count));
+        for (size_t i = first; i < first + count; ++i) {
+            const float* values = descriptors_[entries_[i]].values;
+            merge(node, values, values);
+        }
+        nodes_.push_back(node);
+    }
+    leafCount_ = static_cast<std::uint32_t>(nodes_.size());
+
+    // Each level above is the STR packing of the centers of the one below
+    size_t levelBegin = 0;
+    while (nodes_.size() - levelBegin > 1) {
+        const size_t levelEnd = nodes_.size();
+        std::vector<std::uint32_t> order(levelEnd - levelBegin);
+        std::iota(order.begin(), order.end(), 0u);
+        strOrder(order.data(), order.data() + order.size(), 0, [&](std::uint32_t i, int axis) {
+            const FootprintIndexNode& node = nodes_[levelBegin + i];
+            return 0.5f * (node.lower[axis] + node.upper[axis]);
+        });
+        std::vector<FootprintIndexNode> level(order.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            level[i] = nodes_[levelBegin + order[i]];
+        }
+        std::copy(level.begin(), level.end(), nodes_.begin() + levelBegin);
+        for (size_t first = 0; first < level.size(); first += nodeCapacity) {
+            const size_t count = std::min<size_t>(nodeCapacity, level.size() - first);
+            FootprintIndexNode node =
+                emptyNode(static_cast<std::uint32_t>(levelBegin + first), static_cast<std::uint32_t>(count));
+            for (size_t i = first; i < first + count; ++i) {
+                merge(node, level[i].lower, level[i].upper);
+            }
+            nodes_.push_back(node);
+        }
+        levelBegin = levelEnd;
+    }
+}
+
+void FootprintIndex::candidates(const ShapeDescriptor& descriptor, float tolerance,
+                                std::vector<std::uint32_t>& out) const {
+    if (nodes_.empty()) {
+        return;
+    }
+    float lower[descriptorCount], upper[descriptorCount];
+    for (int d = 0; d < descriptorCount; ++d) {
+        lower[d] = descriptor.values[d] - tolerance;
+        upper[d] = descriptor.values[d] + tolerance;
+    }
+    auto overlaps = [&](const float* low, const float* high) {
+        for (int d = 0; d < descriptorCount; ++d) {
+            if (high[d] < lower[d] || low[d] > upper[d]) {
+                return false;
+            }
+        }
+        return true;
+    };
+    const size_t first = out.size();
+    std::vector<std::uint32_t> stack{static_cast<std::uint32_t>(nodes_.size() - 1)};
+    while (!stack.empty()) {
+        const FootprintIndexNode& node = nodes_[stack.back()];
+        const bool leaf = stack.back() < leafCount_;
+        stack.pop_back();
+        if (!overlaps(node.lower, node.upper)) {
+            continue;
+        }
+        for (std::uint32_t i = node.first; i < node.first + node.count; ++i) {
+            if (!leaf) {
+                stack.push_back(i);
+            } else if (overlaps(descriptors_[entries_[i]].values, descriptors_[entries_[i]].values)) {
+                out.push_back(entries_[i]);
+            }
+        }
+    }
+    std::sort(out.begin() + first, out.end());
+}
+
+void FootprintIndex::save(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open footprint index for writing: " + path);
+    }
+    FootprintIndexHeader header{};
+    std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+    header.version = indexVersion;
+    header.descriptorCount = descriptorCount;
+    header.count = static_cast<std::uint32_t>(size());
+    header.nodeCount = static_cast<std::uint32_t>(nodes_.size());
+    header.pointCount = points_.size();
+    header.nameBytes = names_.size();
+    header.leafCount = leafCount_;
+    header.payloadOffset = sizeof(FootprintIndexHeader);
+    header.entryCount = static_cast<std::uint32_t>(entries_.size());
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeColumn(file, pointOffsets_);
+    writeColumn(file, points_);
+    writeColumn(file, diameters_);
+    writeColumn(file, centroids_);
+    writeColumn(file, descriptors_);
+    writeColumn(file, entries_);
+    writeColumn(file, nodes_);
+    writeColumn(file, nameOffsets_);
+    file.write(names_.data(), names_.size());
+    if (!file.flush()) {
+        throw std::runtime_error("Error writing footprint index: " + path);
+    }
+}
+
+FootprintIndex FootprintIndex::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    FootprintIndexHeader header;
+    if (!file || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, indexMagic, sizeof(indexMagic)) != 0) {
+        throw std::runtime_error("Not a footprint index file: " + path);
+    }
+    if (header.version != indexVersion || header.descriptorCount != descriptorCount) {
+        throw std::runtime_error("Unsupported footprint index version " + std::to_string(header.version) +
+                                 " in: " + path);
+    }
+
+    FootprintIndex index;
+    const size_t count = header.count;
+    file.seekg(header.payloadOffset);
+    readColumn(file, index.pointOffsets_, count + 1);
+    readColumn(file, index.points_, header.pointCount);
+    readColumn(file, index.diameters_, count);
+    readColumn(file, index.centroids_, count);
+    readColumn(file, index.descriptors_, count);
+    index.leafCount_ = header.leafCount;
+    readColumn(file, index.entries_, header.entryCount);
+    readColumn(file, index.nodes_, header.nodeCount);
+    readColumn(file, index.nameOffsets_, count + 1);
+    index.names_.resize(header.nameBytes);
+    file.read(&index.names_[0], header.nameBytes);
+    if (!file || index.pointOffsets_.back() != header.pointCount || index.nameOffsets_.back() != header.nameBytes) {
+        throw std::runtime_error("Error reading footprint index: " + path);
+    }
+    return index;
+}
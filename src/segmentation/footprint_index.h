@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Footprint vertex, in the units of its source (pixels or degrees)
+struct FootprintPoint {
+    double x, y;
+};
+
+// Descriptors of a shape that do not change with its position, scale or rotation, the key
+// of the footprint index: polar second moment of area over area^2, ratio of the smaller to
+// the larger principal second moment, and area over convex hull area
+constexpr int descriptorCount = 3;
+struct ShapeDescriptor {
+    float values[descriptorCount];
+};
+
+// A ring scaled to area 1 around its centroid, as scale_polygon_to_area_one in
+// georeferencing/polygons_comparation.py leaves it before aligning the sides
+struct NormalizedShape {
+    std::vector<FootprintPoint> ring; // Closed, the first vertex repeated at the end
+    double diameter = 0.0;            // Largest distance between two vertices
+    ShapeDescriptor descriptor{};
+    bool valid = false;               // False for rings of zero area, which cannot be scaled
+};
+
+// Function to normalize a ring of count vertices, closed or not
+NormalizedShape normalizeShape(const FootprintPoint* points, size_t count);
+
+// Function to get the centroid of a ring like calculate_polygon_centroid in
+// georeferencing/find_polygon_centroid.py, (0, 0) for rings of zero area
+FootprintPoint ringCentroid(const FootprintPoint* points, size_t count);
+
+// Binary footprint index (.p2pf), written once from a polygons JSON such as
+// georeferencing/modern_data/modern_data.json so later runs do not parse it again:
+//   header   FootprintIndexHeader, 64 bytes
+//   payload  at payloadOffset, one column after the other: the normalized rings (pointOffsets
+//            as count + 1 uint64, points as x, y float64 pairs), diameters (float64),
+//            centroids of the source rings (x, y float64), descriptors (descriptorCount
+//            float32 each), the STR packed R-tree (entries as entryCount uint32, nodes as
+//            FootprintIndexNode) and the names (nameOffsets as count + 1 uint64, then the
+//            bytes)
+struct FootprintIndexHeader {
+    char magic[4];                 // "P2PF"
+    std::uint16_t version;         // 1
+    std::uint16_t descriptorCount; // 3 for version 1
+    std::uint32_t count;           // Number of footprints
+    std::uint32_t nodeCount;
+    std::uint64_t pointCount;
+    std::uint64_t nameBytes;
+    std::uint32_t leafCount;       // Nodes [0, leafCount) are leaves, the root is the last one
+    std::uint32_t payloadOffset;   // 64 for version 1
+    std::uint32_t entryCount;      // Footprints in the tree, those with a ring
+    std::uint32_t reserved[5];
+};
+static_assert(sizeof(FootprintIndexHeader) == 64, "FootprintIndexHeader must match the on-disk layout");
+
+// R-tree node: the bounds of its descriptors and a range of entries for leaves, of nodes
+// of the level below otherwise
+struct FootprintIndexNode {
+    float lower[descriptorCount];
+    float upper[descriptorCount];
+    std::uint32_t first;
+    std::uint32_t count;
+};
+static_assert(sizeof(FootprintIndexNode) == 32, "FootprintIndexNode must match the on-disk layout");
+
+// Footprints keyed by their shape descriptors in a Sort-Tile-Recursive packed R-tree, so the
+// candidates of a match come from a box query instead of a scan
+class FootprintIndex {
+public:
+    static constexpr int nodeCapacity = 16;
+
+    // Footprint i is rings[i] named names[i]
+    FootprintIndex(const std::vector<std::vector<FootprintPoint>>& rings, std::vector<std::string> names);
+
+    // Function to read an index written by save. Throws std::runtime_error on failure.
+    static FootprintIndex load(const std::string& path);
+    // Throws std::runtime_error when the file cannot be written
+    void save(const std::string& path) const;
+
+    size_t size() const { return diameters_.size(); }
+    std::string name(size_t i) const {
+        return names_.substr(nameOffsets_[i], nameOffsets_[i + 1] - nameOffsets_[i]);
+    }
+    FootprintPoint centroid(size_t i) const { return centroids_[i]; }
+    const ShapeDescriptor& descriptor(size_t i) const { return descriptors_[i]; }
+    double diameter(size_t i) const { return diameters_[i]; }
+    // Normalized ring of footprint i, closed, pointCount(i) vertices; empty for rings of zero area
+    const FootprintPoint* ring(size_t i) const { return points_.data() + pointOffsets_[i]; }
+    size_t pointCount(size_t i) const { return pointOffsets_[i + 1] - pointOffsets_[i]; }
+
+    // Append the footprints whose descriptors are within tolerance of descriptor on every
+    // axis to out, in increasing order
+    void candidates(const ShapeDescriptor& descriptor, float tolerance, std::vector<std::uint32_t>& out) const;
+
+private:
+    FootprintIndex() = default;
+    void buildTree();
+
+    std::vector<std::uint64_t> pointOffsets_;
+    std::vector<FootprintPoint> points_;
+    std::vector<double> diameters_;
+    std::vector<FootprintPoint> centroids_;
+    std::vector<ShapeDescriptor> descriptors_;
+    std::uint32_t leafCount_ = 0;
+    std::vector<std::uint32_t> entries_;
+    std::vector<FootprintIndexNode> nodes_;
+    std::vector<std::uint64_t> nameOffsets_;
+    std::string names_;
+};
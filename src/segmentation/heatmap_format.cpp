@@ -0,0 +1,352 @@
+#include "heatmap_format.h"
+
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char heatmapMagic[4] = {'P', '2', 'P', 'H'};
+const std::uint16_t heatmapVersion = 1;
+
+size_t dtypeSize(HeatmapDType dtype) {
+    switch (dtype) {
+    case HeatmapDType::Float32: return 4;
+    case HeatmapDType::Float16: return 2;
+    case HeatmapDType::UInt8: return 1;
+    }
+    throw std::runtime_error("Unknown heatmap dtype.");
+}
+
+// IEEE 754 half to single precision, including subnormals, infinities and NaN
+float halfToFloat(std::uint16_t half) {
+    std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000) << 16;
+    std::uint32_t exponent = (half >> 10) & 0x1f;
+    std::uint32_t mantissa = half & 0x3ff;
+    std::uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Subnormal half, normalize it
+        exponent = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Single to half precision, rounding to nearest even
+std::uint16_t floatToHalf(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    std::uint16_t sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000);
+    std::uint32_t exponent = (bits >> 23) & 0xff;
+    std::uint32_t mantissa = bits & 0x7fffff;
+    if (exponent == 0xff) {
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    int halfExponent = static_cast<int>(exponent) - 112;
+    if (halfExponent >= 0x1f) {
+        return sign | 0x7c00;
+    }
+    if (halfExponent <= 0) {
+        if (halfExponent < -10) {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        int shift = 14 - halfExponent;
+        std::uint32_t half = mantissa >> shift;
+        std::uint32_t rest = mantissa & ((1u << shift) - 1);
+        std::uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            ++half;
+        }
+        return sign | static_cast<std::uint16_t>(half);
+    }
+    std::uint32_t half = (static_cast<std::uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    std::uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        ++half; // May carry into the exponent, which is still the right rounding
+    }
+    return sign | static_cast<std::uint16_t>(half);
+}
+
+// Decode one payload value at element index
+float decodeValue(const unsigned char* payload, HeatmapDType dtype, size_t index, float scale, float bias) {
+    switch (dtype) {
+    case HeatmapDType::Float32: {
+        float value;
+        std::memcpy(&value, payload + index * 4, sizeof(value));
+        return value;
+    }
+    case HeatmapDType::Float16: {
+        std::uint16_t half;
+        std::memcpy(&half, payload + index * 2, sizeof(half));
+        return halfToFloat(half);
+    }
+    case HeatmapDType::UInt8:
+        return payload[index] * scale + bias;
+    }
+    return 0.0f;
+}
+
+// Parse the legacy text heatmap, one value per pixel separated by whitespace
+void parseTextHeatmap(const char* begin, const char* end, std::vector<float>& values) {
+    size_t count = values.size();
+    size_t i = 0;
+    const char* cursor = begin;
+    while (i < count) {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t')) {
+            ++cursor;
+        }
+        if (cursor == end) {
+            break;
+        }
+        auto parsed = std::from_chars(cursor, end, values[i]);
+        if (parsed.ec != std::errc()) {
+            throw std::runtime_error("Malformed text heatmap value.");
+        }
+        cursor = parsed.ptr;
+        ++i;
+    }
+    if (i != count) {
+        throw std::runtime_error("Text heatmap has fewer values than image pixels.");
+    }
+}
+
+} // namespace
+
+HeatmapFile::HeatmapFile(const std::string& path, int width, int height)
+    : width_(width), height_(height) {
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+
+    const unsigned char* bytes = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    // No mapping here, read the file into a staging buffer instead
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Failed to open heatmap file: " + path);
+    }
+    std::vector<unsigned char> staging(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(staging.data()), staging.size());
+    if (!file) {
+        throw std::runtime_error("Error reading heatmap data from file: " + path);
+    }
+    bytes = staging.data();
+    size = staging.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open heatmap file: " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat heatmap file: " + path);
+    }
+    size = static_cast<size_t>(info.st_size);
+    if (size > 0) {
+        mapping_ = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (size == 0 || mapping_ == MAP_FAILED) {
+        mapping_ = nullptr;
+        throw std::runtime_error("Failed to map heatmap file: " + path);
+    }
+    mappingSize_ = size;
+    bytes = static_cast<const unsigned char*>(mapping_);
+#endif
+
+    try {
+        HeatmapHeader header;
+        if (size >= sizeof(header) && std::memcmp(bytes, heatmapMagic, sizeof(heatmapMagic)) == 0) {
+            std::memcpy(&header, bytes, sizeof(header));
+            if (header.version != heatmapVersion) {
+                throw std::runtime_error("Unsupported heatmap version " + std::to_string(header.version) +
+                                         " in: " + path);
+            }
+            if (header.width != static_cast<std::uint32_t>(width) ||
+                header.height != static_cast<std::uint32_t>(height)) {
+                throw std::runtime_error("Heatmap size " + std::to_string(header.width) + "x" +
+                                         std::to_string(header.height) + " does not match the image in: " + path);
+            }
+            HeatmapDType dtype = static_cast<HeatmapDType>(header.dtype);
+            const size_t elementSize = dtypeSize(dtype);
+            const size_t tile = header.tileSize;
+            const size_t tilesX = tile ? (width + tile - 1) / tile : 0;
+            const size_t tilesY = tile ? (height + tile - 1) / tile : 0;
+            const size_t elementCount = tile ? tilesX * tilesY * tile * tile : pixelCount;
+            if (header.payloadOffset < sizeof(header) || size < header.payloadOffset ||
+                (size - header.payloadOffset) / elementSize < elementCount) {
+                throw std::runtime_error("Truncated heatmap file: " + path);
+            }
+            payload_ = bytes + header.payloadOffset;
+            dtype_ = dtype;
+            tileSize_ = tile;
+            scale_ = header.scale;
+            bias_ = header.bias;
+            if (dtype == HeatmapDType::Float32 && tile == 0 && header.payloadOffset % alignof(float) == 0) {
+                values_ = reinterpret_cast<const float*>(payload_);
+            }
+        } else if (size == pixelCount * sizeof(float)) {
+            // Legacy headerless raw float32
+            values_ = reinterpret_cast<const float*>(bytes);
+        } else {
+            // Legacy text written by older heatmap_generator.py versions
+            decoded_.resize(pixelCount);
+            parseTextHeatmap(reinterpret_cast<const char*>(bytes), reinterpret_cast<const char*>(bytes) + size,
+                             decoded_);
+        }
+    } catch (...) {
+#ifndef _WIN32
+        munmap(mapping_, mappingSize_);
+#endif
+        throw;
+    }
+
+    if (!decoded_.empty()) {
+        values_ = decoded_.data();
+    }
+#ifdef _WIN32
+    // The staging buffer goes away with the constructor
+    if (values_ == nullptr) {
+        decoded_.resize(pixelCount);
+        decodeRows(0, height, decoded_.data());
+    } else if (values_ != decoded_.data()) {
+        decoded_.assign(values_, values_ + pixelCount);
+    }
+    values_ = decoded_.data();
+    payload_ = nullptr;
+#else
+    if (!decoded_.empty()) {
+        // Everything was parsed, the mapping is no longer needed
+        munmap(mapping_, mappingSize_);
+        mapping_ = nullptr;
+        mappingSize_ = 0;
+    }
+#endif
+}
+
+HeatmapFile::~HeatmapFile() {
+#ifndef _WIN32
+    if (mapping_) {
+        munmap(mapping_, mappingSize_);
+    }
+#endif
+}
+
+HeatmapView HeatmapFile::view() {
+    if (values_ == nullptr) {
+        decoded_.resize(static_cast<size_t>(width_) * height_);
+        decodeRows(0, height_, decoded_.data());
+        values_ = decoded_.data();
+        band_ = std::vector<float>();
+    }
+    return {values_, width_, height_};
+}
+
+const float* HeatmapFile::rows(int rowBegin, int rowEnd) {
+    if (values_ != nullptr) {
+        return values_ + static_cast<size_t>(rowBegin) * width_;
+    }
+    band_.resize(static_cast<size_t>(rowEnd - rowBegin) * width_);
+    decodeRows(rowBegin, rowEnd, band_.data());
+    return band_.data();
+}
+
+void HeatmapFile::decodeRows(int rowBegin, int rowEnd, float* out) const {
+    const size_t width = width_;
+    const size_t tile = tileSize_;
+    const size_t tilesX = tile ? (width + tile - 1) / tile : 0;
+    for (size_t y = rowBegin; y < static_cast<size_t>(rowEnd); ++y) {
+        float* row = out + (y - rowBegin) * width;
+        for (size_t x = 0; x < width; ++x) {
+            size_t index = y * width + x;
+            if (tile) {
+                size_t tileIndex = (y / tile) * tilesX + x / tile;
+                index = tileIndex * tile * tile + (y % tile) * tile + x % tile;
+            }
+            row[x] = decodeValue(payload_, dtype_, index, scale_, bias_);
+        }
+    }
+}
+
+void writeHeatmap(const std::string& path, const HeatmapView& heatmap, HeatmapDType dtype, int tileSize) {
+    if (tileSize < 0) {
+        throw std::invalid_argument("Heatmap tile size must be non-negative.");
+    }
+    const size_t width = heatmap.width;
+    const size_t height = heatmap.height;
+    const size_t elementSize = dtypeSize(dtype);
+
+    HeatmapHeader header;
+    std::memcpy(header.magic, heatmapMagic, sizeof(heatmapMagic));
+    header.version = heatmapVersion;
+    header.dtype = static_cast<std::uint16_t>(dtype);
+    header.width = static_cast<std::uint32_t>(width);
+    header.height = static_cast<std::uint32_t>(height);
+    header.tileSize = static_cast<std::uint32_t>(tileSize);
+    header.payloadOffset = sizeof(header);
+    // Heatmaps are probabilities, quantize [0, 1] to the full byte range
+    header.scale = dtype == HeatmapDType::UInt8 ? 1.0f / 255.0f : 1.0f;
+    header.bias = 0.0f;
+
+    auto encode = [&](float value, unsigned char* out) {
+        if (dtype == HeatmapDType::Float32) {
+            std::memcpy(out, &value, sizeof(value));
+        } else if (dtype == HeatmapDType::Float16) {
+            std::uint16_t half = floatToHalf(value);
+            std::memcpy(out, &half, sizeof(half));
+        } else {
+            float q = (value - header.bias) / header.scale + 0.5f;
+            *out = static_cast<unsigned char>(q < 0.0f ? 0.0f : (q > 255.0f ? 255.0f : q));
+        }
+    };
+
+    std::vector<unsigned char> payload;
+    if (tileSize == 0) {
+        payload.resize(width * height * elementSize);
+        for (size_t i = 0; i < width * height; ++i) {
+            encode(heatmap.values[i], payload.data() + i * elementSize);
+        }
+    } else {
+        const size_t tile = tileSize;
+        const size_t tilesX = (width + tile - 1) / tile;
+        const size_t tilesY = (height + tile - 1) / tile;
+        payload.assign(tilesX * tilesY * tile * tile * elementSize, 0);
+        for (size_t y = 0; y < height; ++y) {
+            for (size_t x = 0; x < width; ++x) {
+                size_t index = ((y / tile) * tilesX + x / tile) * tile * tile + (y % tile) * tile + x % tile;
+                encode(heatmap.values[y * width + x], payload.data() + index * elementSize);
+            }
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create heatmap file: " + path);
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+    if (!file) {
+        throw std::runtime_error("Error writing heatmap file: " + path);
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "segmenter.h"
+
+// Binary heatmap file (.hmp), little-endian, written by heatmap_format.py as well:
+//   header   HeatmapHeader, 32 bytes
+//   payload  at payloadOffset, width * height values of dtype. Row-major when tileSize is 0,
+//            otherwise tileSize x tileSize tiles in row-major tile order with edge tiles
+//            padded to the full tile size.
+// UInt8 values decode to value * scale + bias; float payloads ignore scale and bias.
+enum class HeatmapDType : std::uint16_t {
+    Float32 = 0,
+    Float16 = 1,
+    UInt8 = 2
+};
+
+struct HeatmapHeader {
+    char magic[4];               // "P2PH"
+    std::uint16_t version;       // 1
+    std::uint16_t dtype;         // HeatmapDType
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t tileSize;      // 0 for row-major
+    std::uint32_t payloadOffset; // 32 for version 1
+    float scale;
+    float bias;
+};
+static_assert(sizeof(HeatmapHeader) == 32, "HeatmapHeader must match the on-disk layout");
+
+// Heatmap read from a .hmp file. A row-major float32 payload is used in place through a
+// read-only memory map; other dtypes and tiled payloads are decoded from the map as they
+// are asked for, a band of rows at a time through rows(), and only decoded whole once
+// view() asks for the whole heatmap. Headerless legacy files are accepted too: raw float32
+// values, used in place, or the space separated text that heatmap_generator.py used to
+// write, parsed whole. Where no mapping is available everything is decoded once. Throws
+// std::runtime_error on failure.
+class HeatmapFile {
+public:
+    HeatmapFile(const std::string& path, int width, int height);
+    ~HeatmapFile();
+    HeatmapFile(const HeatmapFile&) = delete;
+    HeatmapFile& operator=(const HeatmapFile&) = delete;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // The whole heatmap, decoding it on the first call when it is not used in place
+    HeatmapView view();
+
+    // Row-major values of rows [rowBegin, rowEnd), valid until the next call of rows or view
+    const float* rows(int rowBegin, int rowEnd);
+
+private:
+    void decodeRows(int rowBegin, int rowEnd, float* out) const;
+
+    int width_;
+    int height_;
+    void* mapping_ = nullptr;
+    std::size_t mappingSize_ = 0;
+    const float* values_ = nullptr;    // The whole heatmap, once it is at hand
+    std::vector<float> decoded_;
+    std::vector<float> band_;          // Rows decoded by rows()
+    const unsigned char* payload_ = nullptr;
+    HeatmapDType dtype_ = HeatmapDType::Float32;
+    std::size_t tileSize_ = 0;
+    float scale_ = 1.0f;
+    float bias_ = 0.0f;
+};
+
+// Function to write a heatmap in the binary format
+void writeHeatmap(const std::string& path, const HeatmapView& heatmap,
+                  HeatmapDType dtype = HeatmapDType::Float32, int tileSize = 0);
@@ -0,0 +1,83 @@
+"""
+Binary heatmap (.hmp) files shared with the C++ segmenter, see heatmap_format.h.
+
+Layout, little-endian: a 32-byte header (magic "P2PH", uint16 version, uint16 dtype,
+uint32 width, uint32 height, uint32 tile size, uint32 payload offset, float32 scale,
+float32 bias) followed by the values. Tile size 0 stores the values row-major, otherwise
+they are stored as tile_size x tile_size tiles in row-major tile order, edge tiles padded.
+"""
+
+import struct
+
+import numpy as np
+
+MAGIC = b"P2PH"
+VERSION = 1
+HEADER = struct.Struct("<4sHHIIIIff")
+
+DTYPES = {"float32": 0, "float16": 1, "uint8": 2}
+NUMPY_DTYPES = {0: np.dtype("<f4"), 1: np.dtype("<f2"), 2: np.dtype("u1")}
+
+
+def write_heatmap(path: str, heatmap: np.ndarray, dtype: str = "float32", tile_size: int = 0) -> None:
+    """
+    Writes an (height, width) heatmap of [0,1] probabilities.
+
+    Parameters:
+    -----------
+    - path: Output .hmp path.
+    - heatmap: 2D array of probabilities.
+    - dtype: "float32", "float16" or "uint8" (quantized to 1/255 steps).
+    - tile_size: 0 for row-major, otherwise the side of the square tiles.
+    """
+    heatmap = np.asarray(heatmap, dtype=np.float32)
+    height, width = heatmap.shape
+    code = DTYPES[dtype]
+    scale, bias = (1.0 / 255.0, 0.0) if dtype == "uint8" else (1.0, 0.0)
+
+    if dtype == "uint8":
+        values = np.clip(np.rint((heatmap - bias) / scale), 0, 255).astype(np.uint8)
+    else:
+        values = heatmap.astype(NUMPY_DTYPES[code])
+
+    if tile_size:
+        tiles_y = -(-height // tile_size)
+        tiles_x = -(-width // tile_size)
+        padded = np.zeros((tiles_y * tile_size, tiles_x * tile_size), dtype=values.dtype)
+        padded[:height, :width] = values
+        values = padded.reshape(tiles_y, tile_size, tiles_x, tile_size).swapaxes(1, 2)
+
+    with open(path, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, code, width, height, tile_size, HEADER.size, scale, bias))
+        f.write(np.ascontiguousarray(values).tobytes())
+
+
+def read_heatmap(path: str) -> np.ndarray:
+    """
+    Reads a .hmp file as an (height, width) float32 array. Row-major float32 files come back
+    as a read-only memory map; other dtypes and tiled files are decoded into memory.
+    """
+    with open(path, "rb") as f:
+        header = f.read(HEADER.size)
+    if len(header) < HEADER.size or header[:4] != MAGIC:
+        raise ValueError(f"Not a binary heatmap file: {path}")
+    _, version, code, width, height, tile_size, offset, scale, bias = HEADER.unpack(header)
+    if version != VERSION:
+        raise ValueError(f"Unsupported heatmap version {version} in: {path}")
+
+    dtype = NUMPY_DTYPES[code]
+    if tile_size:
+        tiles_y = -(-height // tile_size)
+        tiles_x = -(-width // tile_size)
+        shape = (tiles_y, tiles_x, tile_size, tile_size)
+    else:
+        shape = (height, width)
+    values = np.memmap(path, dtype=dtype, mode="r", offset=offset, shape=shape)
+
+    if tile_size:
+        values = values.swapaxes(1, 2).reshape(tiles_y * tile_size, tiles_x * tile_size)[:height, :width]
+    if code == DTYPES["uint8"]:
+        return values.astype(np.float32) * np.float32(scale) + np.float32(bias)
+    if code != DTYPES["float32"] or tile_size:
+        return np.ascontiguousarray(values, dtype=np.float32)
+    return values
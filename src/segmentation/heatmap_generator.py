@@ -11,6 +11,11 @@ import matplotlib.cm as cm
 
 import matplotlib.pyplot as plt
 
+try:
+    from segmentation.heatmap_format import write_heatmap
+except ImportError:
+    from heatmap_format import write_heatmap
+
 class BorderDetectionCNN(nn.Module):
     def __init__(self, num_classes=2):
         super(BorderDetectionCNN, self).__init__()
@@ -70,6 +75,49 @@ class BorderDetectionCNN(nn.Module):
         return x
 
 
+class BorderProbability(nn.Module):
+    """BorderDetectionCNN followed by the softmax: one border probability per patch"""
+    def __init__(self, model):
+        super(BorderProbability, self).__init__()
+        self.model = model
+
+    def forward(self, x):
+        return F.softmax(self.model(x), dim=1)[:, 1]
+
+
+def export_model(model_path: str = "model.pth", output_path: str = "model.onnx") -> str:
+    """
+    Exports the trained model for the native heatmap inference of the segmenter
+    (main.exe config --infer model image outputFolder, see heatmap_inference.h).
+
+    Parameters:
+    -----------
+    - model_path: Path to the trained model checkpoint.
+    - output_path: ".onnx" for ONNX Runtime, ".pt" for a TorchScript module run by LibTorch.
+      Both take (N, 3, 224, 224) normalized patches with a free batch size N and return
+      the N border probabilities.
+
+    Returns:
+    --------
+    - output_path
+    """
+    model = BorderDetectionCNN(num_classes=2)
+    model.load_state_dict(torch.load(model_path, map_location="cpu"))
+    wrapped = BorderProbability(model).eval()
+    example = torch.zeros(1, 3, 224, 224)
+
+    with torch.no_grad():
+        if output_path.lower().endswith(".onnx"):
+            torch.onnx.export(wrapped, example, output_path,
+                              input_names=["patches"], output_names=["border_probability"],
+                              dynamic_axes={"patches": {0: "batch"}, "border_probability": {0: "batch"}},
+                              opset_version=17)
+        else:
+            torch.jit.trace(wrapped, example).save(output_path)
+    print(f"Model exported to: {output_path}")
+    return output_path
+
+
 def generate_heatmap(
     image_path: str,
     output_path="heatmaps",
@@ -165,12 +213,10 @@ def generate_heatmap(
     cv2.imwrite(output_filename, overlay)
     print(f"Heatmap image saved to: {output_filename}")
 
-    # Save heatmap as .hmp text file
+    # Save heatmap as binary .hmp file, memory-mapped by the segmenter
     os.makedirs(hmp_output_dir, exist_ok=True)
     hmp_output_path = os.path.join(hmp_output_dir, f"{base_name}.hmp")
-    with open(hmp_output_path, 'w') as f:
-        for row in heatmap_normalized.flatten():
-            f.write(f"{row:.3f} ")
+    write_heatmap(hmp_output_path, heatmap_normalized)
     print(f"Heatmap .hmp file saved to: {hmp_output_path}")
 
     return heatmap_normalized
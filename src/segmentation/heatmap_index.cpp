@@ -0,0 +1,64 @@
+#include "heatmap_index.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+ComponentHeatmapStats HeatmapStatsSums::stats() const {
+    ComponentHeatmapStats stats;
+    if (count == 0.0) {
+        return stats;
+    }
+    const double mean = sum / count;
+    stats.minProbability = low;
+    stats.maxProbability = high;
+    stats.stdDevProbability = static_cast<float>(std::sqrt(std::max(0.0, squares / count - mean * mean)));
+    stats.aboveThreshold = static_cast<float>(above / count);
+    return stats;
+}
+
+ComponentHeatmapStats heatmapStatsOf(const HeatmapView& heatmap, float threshold, RunRange runs) {
+    HeatmapStatsSums sums;
+    for (const PixelRun& run : runs) {
+        const float* values = heatmap.values + static_cast<size_t>(run.y) * heatmap.width;
+        for (int x = run.xBegin; x <= run.xEnd; ++x) {
+            sums.add(values[x], threshold);
+        }
+    }
+    return sums.stats();
+}
+
+void computeHeatmapStats(ComponentSet& result, const HeatmapView& heatmap, int threads) {
+    const size_t count = result.components.size();
+    result.heatmapStats.resize(count);
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Components differ widely in size, so workers take them in small chunks
+    const size_t chunk = 64;
+    std::atomic<size_t> next{0};
+    auto work = [&]() {
+        for (size_t begin = next.fetch_add(chunk); begin < count; begin = next.fetch_add(chunk)) {
+            for (size_t i = begin; i < std::min(begin + chunk, count); ++i) {
+                result.heatmapStats[i] =
+                    heatmapStatsOf(heatmap, result.probabilityThreshold, result.runsOf(result.components[i]));
+            }
+        }
+    };
+    const int workerCount = static_cast<int>(std::min<size_t>(threads, (count + chunk - 1) / chunk));
+    if (workerCount <= 1) {
+        work();
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < workerCount; ++t) {
+        workers.emplace_back(work);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include "segmenter.h"
+
+// Running sums of the heatmap statistics of one component, fed its values in raster order
+struct HeatmapStatsSums {
+    double count = 0.0;
+    double sum = 0.0;
+    double squares = 0.0;
+    std::uint64_t above = 0;
+    float low = std::numeric_limits<float>::infinity();
+    float high = -std::numeric_limits<float>::infinity();
+
+    void add(float value, float threshold) {
+        count += 1.0;
+        sum += value;
+        squares += static_cast<double>(value) * value;
+        above += value >= threshold ? 1 : 0;
+        low = value < low ? value : low;
+        high = value > high ? value : high;
+    }
+
+    ComponentHeatmapStats stats() const;
+};
+
+// Heatmap statistics of the pixels of runs, in one pass over their values with double
+// accumulators: minimum, maximum, standard deviation and share at or above threshold
+ComponentHeatmapStats heatmapStatsOf(const HeatmapView& heatmap, float threshold, RunRange runs);
+
+// Function to fill result.heatmapStats from result.runs, against the probability threshold
+// of the classification. Components are split across threads, 0 uses every core. Every
+// component is visited once, so only the pixels of the components are read and nothing
+// is allocated beyond the statistics.
+void computeHeatmapStats(ComponentSet& result, const HeatmapView& heatmap, int threads);
@@ -0,0 +1,483 @@
+#include "heatmap_inference.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+#ifdef P2P_HAVE_ONNXRUNTIME
+#include <array>
+#include <onnxruntime_cxx_api.h>
+#endif
+#ifdef P2P_HAVE_TORCH
+#include <torch/cuda.h>
+#include <torch/script.h>
+#endif
+
+namespace {
+
+// Fixed point of PIL's 8-bit resampling
+const int precisionBits = 32 - 8 - 2;
+
+bool hasSuffix(const std::string& text, const std::string& suffix) {
+    if (text.size() < suffix.size()) {
+        return false;
+    }
+    std::string tail = text.substr(text.size() - suffix.size());
+    std::transform(tail.begin(), tail.end(), tail.begin(), [](unsigned char c) { return std::tolower(c); });
+    return tail == suffix;
+}
+
+#if defined(P2P_HAVE_ONNXRUNTIME) || defined(P2P_HAVE_TORCH)
+// Copy the border probabilities of a model output: one value per patch as export_model
+// writes them, or the two logits of BorderDetectionCNN, softmaxed
+void copyProbabilities(const float* values, std::size_t valueCount, int count, float* probabilities) {
+    if (valueCount == static_cast<std::size_t>(count)) {
+        std::copy(values, values + count, probabilities);
+    } else if (valueCount == 2 * static_cast<std::size_t>(count)) {
+        for (int i = 0; i < count; ++i) {
+            probabilities[i] = 1.0f / (1.0f + std::exp(values[2 * i] - values[2 * i + 1]));
+        }
+    } else {
+        throw std::runtime_error("Unexpected model output: " + std::to_string(valueCount) + " values for " +
+                                 std::to_string(count) + " patches");
+    }
+}
+#endif
+
+#ifdef P2P_HAVE_ONNXRUNTIME
+class OnnxPatchClassifier : public PatchClassifier {
+public:
+    OnnxPatchClassifier(const std::string& modelPath, int threads)
+        : env_(ORT_LOGGING_LEVEL_WARNING, "past2polygon"), session_(nullptr) {
+        Ort::SessionOptions options;
+        if (threads > 0) {
+            options.SetIntraOpNumThreads(threads);
+        }
+        options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+#ifdef _WIN32
+        std::wstring widePath(modelPath.begin(), modelPath.end());
+        session_ = Ort::Session(env_, widePath.c_str(), options);
+#else
+        session_ = Ort::Session(env_, modelPath.c_str(), options);
+#endif
+        Ort::AllocatorWithDefaultOptions allocator;
+        inputName_ = session_.GetInputNameAllocated(0, allocator).get();
+        outputName_ = session_.GetOutputNameAllocated(0, allocator).get();
+    }
+
+    void classify(const float* patches, int count, float* probabilities) override {
+        std::array<std::int64_t, 4> shape{count, 3, patchSize, patchSize};
+        Ort::MemoryInfo memory = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+        Ort::Value input = Ort::Value::CreateTensor<float>(
+            memory, const_cast<float*>(patches), static_cast<std::size_t>(count) * 3 * patchSize * patchSize,
+            shape.data(), shape.size());
+        const char* inputNames[] = {inputName_.c_str()};
+        const char* outputNames[] = {outputName_.c_str()};
+        std::vector<Ort::Value> outputs = session_.Run(Ort::RunOptions{nullptr}, inputNames, &input, 1,
+                                                       outputNames, 1);
+        copyProbabilities(outputs[0].GetTensorData<float>(),
+                          outputs[0].GetTensorTypeAndShapeInfo().GetElementCount(), count, probabilities);
+    }
+
+private:
+    Ort::Env env_;
+    Ort::Session session_;
+    std::string inputName_;
+    std::string outputName_;
+};
+#endif
+
+#ifdef P2P_HAVE_TORCH
+class TorchScriptPatchClassifier : public PatchClassifier {
+public:
+    TorchScriptPatchClassifier(const std::string& modelPath, int threads)
+        : device_(torch::cuda::is_available() ? torch::kCUDA : torch::kCPU) {
+        if (threads > 0) {
+            torch::set_num_threads(threads);
+        }
+        module_ = torch::jit::load(modelPath, device_);
+        module_.eval();
+    }
+
+    void classify(const float* patches, int count, float* probabilities) override {
+        torch::NoGradGuard noGrad;
+        torch::Tensor input = torch::from_blob(const_cast<float*>(patches), {count, 3, patchSize, patchSize},
+                                               torch::kFloat32).to(device_);
+        torch::Tensor output = module_.forward({input}).toTensor().to(torch::kCPU, torch::kFloat32).contiguous();
+        copyProbabilities(output.data_ptr<float>(), static_cast<std::size_t>(output.numel()), count, probabilities);
+    }
+
+private:
+    torch::Device device_;
+    torch::jit::script::Module module_;
+};
+#endif
+
+// Run work(worker, begin, end) over [0, count) split across threads
+template <typename Work>
+void runSplit(int count, int threads, Work work) {
+    int workerCount = std::max(1, std::min(threads, count));
+    if (workerCount == 1) {
+        work(0, 0, count);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < workerCount; ++t) {
+        int begin = static_cast<int>(static_cast<long long>(count) * t / workerCount);
+        int end = static_cast<int>(static_cast<long long>(count) * (t + 1) / workerCount);
+        workers.emplace_back(work, t, begin, end);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+} // namespace
+
+std::unique_ptr<PatchClassifier> loadPatchClassifier(const std::string& modelPath, int threads) {
+    if (hasSuffix(modelPath, ".onnx")) {
+#ifdef P2P_HAVE_ONNXRUNTIME
+        try {
+            return std::make_unique<OnnxPatchClassifier>(modelPath, threads);
+        } catch (const Ort::Exception& e) {
+            throw std::runtime_error("Failed to load model " + modelPath + ": " + e.what());
+        }
+#else
+        throw std::runtime_error("Built without ONNX Runtime, can not load " + modelPath);
+#endif
+    }
+    if (hasSuffix(modelPath, ".pt") || hasSuffix(modelPath, ".ts")) {
+#ifdef P2P_HAVE_TORCH
+        try {
+            return std::make_unique<TorchScriptPatchClassifier>(modelPath, threads);
+        } catch (const c10::Error& e) {
+            throw std::runtime_error("Failed to load model " + modelPath + ": " + e.what_without_backtrace());
+        }
+#else
+        throw std::runtime_error("Built without LibTorch, can not load " + modelPath);
+#endif
+    }
+    (void)threads;
+    throw std::runtime_error("Unknown model format, export it with export_model to .onnx or .pt: " + modelPath);
+}
+
+const char* inferenceRuntimeName() {
+#if defined(P2P_HAVE_ONNXRUNTIME) && defined(P2P_HAVE_TORCH)
+    return "onnxruntime,libtorch";
+#elif defined(P2P_HAVE_ONNXRUNTIME)
+    return "onnxruntime";
+#elif defined(P2P_HAVE_TORCH)
+    return "libtorch";
+#else
+    return "none";
+#endif
+}
+
+PatchGrid makePatchGrid(int width, int height, const HeatmapOptions& options) {
+    PatchGrid grid;
+    grid.windowSize = options.windowSize > 0 ? options.windowSize : std::max(2, height / 150);
+    grid.stepSize = options.stepSize > 0 ? options.stepSize : std::max(1, grid.windowSize / 2);
+    auto starts = [&](int side) {
+        return side > grid.windowSize ? (side - grid.windowSize + grid.stepSize - 1) / grid.stepSize : 0;
+    };
+    grid.columns = starts(width);
+    grid.rows = starts(height);
+    return grid;
+}
+
+PatchResampler::PatchResampler(int windowSize) : windowSize_(windowSize) {
+    // precompute_coeffs of PIL's Resample.c for the bilinear filter
+    const double scale = static_cast<double>(windowSize) / patchSize;
+    const double filterScale = std::max(scale, 1.0);
+    const double support = filterScale;
+    taps_ = static_cast<int>(std::ceil(support)) * 2 + 1;
+    bounds_.resize(2 * patchSize);
+    weights_.assign(static_cast<std::size_t>(taps_) * patchSize, 0);
+    std::vector<double> kernel(taps_);
+    for (int o = 0; o < patchSize; ++o) {
+        const double center = (o + 0.5) * scale;
+        int first = std::max(0, static_cast<int>(center - support + 0.5));
+        int last = std::min(windowSize, static_cast<int>(center + support + 0.5));
+        int count = last - first;
+        double total = 0.0;
+        for (int i = 0; i < count; ++i) {
+            double distance = std::abs((i + first - center + 0.5) / filterScale);
+            kernel[i] = distance < 1.0 ? 1.0 - distance : 0.0;
+            total += kernel[i];
+        }
+        for (int i = 0; i < count; ++i) {
+            double weight = total != 0.0 ? kernel[i] / total : kernel[i];
+            weights_[static_cast<std::size_t>(o) * taps_ + i] =
+                static_cast<std::int32_t>(0.5 + weight * (1 << precisionBits));
+        }
+        bounds_[2 * o] = first;
+        bounds_[2 * o + 1] = count;
+    }
+    // ToTensor and Normalize, in float like torchvision
+    for (int c = 0; c < 3; ++c) {
+        for (int v = 0; v < 256; ++v) {
+            normalized_[c][v] = (static_cast<float>(v) / 255.0f - patchMean[c]) / patchStd[c];
+        }
+    }
+}
+
+void PatchResampler::prepare(const ImageView& image, int x, int y, float* out) const {
+    // Horizontal pass over the window rows the vertical pass reads, 8-bit like PIL, into
+    // one plane per channel so the vertical pass runs along contiguous samples
+    const int rowFirst = bounds_[0];
+    const int rowLast = bounds_[2 * (patchSize - 1)] + bounds_[2 * (patchSize - 1) + 1];
+    thread_local std::vector<unsigned char> rows;
+    rows.resize(static_cast<std::size_t>(rowLast - rowFirst) * 3 * patchSize);
+    auto clip8 = [](std::int32_t sum) {
+        return static_cast<unsigned char>(std::min(255, std::max(0, sum >> precisionBits)));
+    };
+    for (int r = rowFirst; r < rowLast; ++r) {
+        const Color* source = image.pixels + static_cast<std::size_t>(y + r) * image.width + x;
+        unsigned char* target = rows.data() + static_cast<std::size_t>(r - rowFirst) * 3 * patchSize;
+        for (int o = 0; o < patchSize; ++o) {
+            const Color* in = source + bounds_[2 * o];
+            const std::int32_t* k = weights_.data() + static_cast<std::size_t>(o) * taps_;
+            std::int32_t sr = 1 << (precisionBits - 1), sg = sr, sb = sr;
+            for (int i = 0; i < bounds_[2 * o + 1]; ++i) {
+                sr += in[i].r * k[i];
+                sg += in[i].g * k[i];
+                sb += in[i].b * k[i];
+            }
+            target[o] = clip8(sr);
+            target[patchSize + o] = clip8(sg);
+            target[2 * patchSize + o] = clip8(sb);
+        }
+    }
+
+    // Vertical pass straight into the normalized planes, one output row of all three
+    // channels at a time
+    const std::size_t plane = static_cast<std::size_t>(patchSize) * patchSize;
+    std::int32_t sums[3 * patchSize];
+    for (int o = 0; o < patchSize; ++o) {
+        const unsigned char* in = rows.data() + static_cast<std::size_t>(bounds_[2 * o] - rowFirst) * 3 * patchSize;
+        const std::int32_t* k = weights_.data() + static_cast<std::size_t>(o) * taps_;
+        const int count = bounds_[2 * o + 1];
+        std::fill(sums, sums + 3 * patchSize, 1 << (precisionBits - 1));
+        for (int i = 0; i < count; ++i) {
+            const unsigned char* row = in + static_cast<std::size_t>(i) * 3 * patchSize;
+            const std::int32_t weight = k[i];
+            for (int p = 0; p < 3 * patchSize; ++p) {
+                sums[p] += row[p] * weight;
+            }
+        }
+        for (int c = 0; c < 3; ++c) {
+            float* target = out + c * plane + static_cast<std::size_t>(o) * patchSize;
+            const float* normalized = normalized_[c];
+            const std::int32_t* channel = sums + c * patchSize;
+            for (int p = 0; p < patchSize; ++p) {
+                target[p] = normalized[clip8(channel[p])];
+            }
+        }
+    }
+}
+
+StreamingHeatmapInference::StreamingHeatmapInference(const ImageView& image, PatchClassifier& classifier,
+                                                     const HeatmapOptions& options)
+    : image_(image), classifier_(classifier), options_(options),
+      grid_(makePatchGrid(image.width, image.height, options)) {
+    width_ = image.width;
+    height_ = image.height;
+    threads_ = options.threads > 0 ? options.threads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    heatmap_.assign(static_cast<std::size_t>(width_) * height_, 0.0f);
+    probabilities_.resize(grid_.size());
+    sums_.assign((static_cast<std::size_t>(grid_.columns) + 1) * (grid_.rows + 1), 0.0);
+    auto coverage = [&](int side, int starts) {
+        std::vector<Coverage> axis(side);
+        for (int p = 0; p < side; ++p) {
+            int reach = p - grid_.windowSize + 1;
+            axis[p].first = reach <= 0 ? 0 : (reach + grid_.stepSize - 1) / grid_.stepSize;
+            axis[p].last = std::min(starts - 1, p / grid_.stepSize);
+        }
+        return axis;
+    };
+    columnCoverage_ = coverage(width_, grid_.columns);
+    rowCoverage_ = coverage(height_, grid_.rows);
+    worker_ = std::thread(&StreamingHeatmapInference::run, this);
+}
+
+StreamingHeatmapInference::~StreamingHeatmapInference() {
+    cancelled_ = true;
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void StreamingHeatmapInference::run() {
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        // Border probability of every window, batchSize windows per forward pass. The next
+        // batch is prepared while the classifier runs on the current one.
+        const int patchCount = static_cast<int>(grid_.size());
+        const int batchSize = std::max(1, std::min(options_.batchSize, std::max(patchCount, 1)));
+        const std::size_t patchFloats = static_cast<std::size_t>(3) * patchSize * patchSize;
+        const PatchResampler resampler(grid_.windowSize);
+        std::vector<float> batches[2];
+        if (patchCount > 0) {
+            batches[0].resize(batchSize * patchFloats);
+        }
+        if (patchCount > batchSize) {
+            batches[1].resize(batchSize * patchFloats);
+        }
+        auto prepareBatch = [&](int first, std::vector<float>& batch) {
+            int count = std::min(batchSize, patchCount - first);
+            runSplit(count, threads_, [&](int, int begin, int end) {
+                for (int i = begin; i < end; ++i) {
+                    int patch = first + i;
+                    resampler.prepare(image_, (patch % grid_.columns) * grid_.stepSize,
+                                      (patch / grid_.columns) * grid_.stepSize, batch.data() + i * patchFloats);
+                }
+            });
+        };
+        if (patchCount > 0) {
+            prepareBatch(0, batches[0]);
+        }
+        const std::size_t stride = static_cast<std::size_t>(grid_.columns) + 1;
+        int windowRowsDone = 0;
+        int rowsDone = 0;
+        for (int first = 0, b = 0; first < patchCount && !cancelled_; first += batchSize, b ^= 1) {
+            std::thread next;
+            if (first + batchSize < patchCount) {
+                next = std::thread(prepareBatch, first + batchSize, std::ref(batches[b ^ 1]));
+            }
+            try {
+                classifier_.classify(batches[b].data(), std::min(batchSize, patchCount - first),
+                                     probabilities_.data() + first);
+            } catch (...) {
+                if (next.joinable()) {
+                    next.join();
+                }
+                throw;
+            }
+            if (next.joinable()) {
+                next.join();
+            }
+
+            // Extend the summed-area table over the window rows completed by this batch,
+            // then hand out the heatmap rows no later window covers
+            const int windowRows = std::min(first + batchSize, patchCount) / grid_.columns;
+            for (; windowRowsDone < windowRows; ++windowRowsDone) {
+                const int r = windowRowsDone;
+                double rowSum = 0.0;
+                for (int c = 0; c < grid_.columns; ++c) {
+                    rowSum += probabilities_[static_cast<std::size_t>(r) * grid_.columns + c];
+                    sums_[(r + 1) * stride + c + 1] = sums_[r * stride + c + 1] + rowSum;
+                }
+            }
+            int rowEnd = rowsDone;
+            while (rowEnd < height_ && rowCoverage_[rowEnd].first <= rowCoverage_[rowEnd].last &&
+                   rowCoverage_[rowEnd].last < windowRowsDone) {
+                ++rowEnd;
+            }
+            if (windowRowsDone == grid_.rows) {
+                rowEnd = height_;
+            }
+            if (rowEnd > rowsDone) {
+                averageRows(rowsDone, rowEnd);
+                rowsDone = rowEnd;
+                std::lock_guard<std::mutex> lock(mutex_);
+                rowsReady_ = rowsDone;
+                ready_.notify_all();
+            }
+        }
+        if (patchCount == 0) {
+            // No window fits, the heatmap stays zero
+            std::lock_guard<std::mutex> lock(mutex_);
+            rowsReady_ = height_;
+        }
+        if (cancelled_ && rowsDone < height_) {
+            throw std::runtime_error("Heatmap inference cancelled");
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        error_ = std::current_exception();
+    }
+    seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(mutex_);
+    ready_.notify_all();
+}
+
+void StreamingHeatmapInference::averageRows(int rowBegin, int rowEnd) {
+    const std::size_t stride = static_cast<std::size_t>(grid_.columns) + 1;
+    const int workerCount = std::max(1, std::min(threads_, rowEnd - rowBegin));
+    std::vector<float> rangeMin(workerCount), rangeMax(workerCount);
+    runSplit(rowEnd - rowBegin, workerCount, [&](int worker, int begin, int end) {
+        float low = 0.0f, high = 0.0f;
+        bool any = false;
+        for (int y = rowBegin + begin; y < rowBegin + end; ++y) {
+            const Coverage& rowRange = rowCoverage_[y];
+            float* out = heatmap_.data() + static_cast<std::size_t>(y) * width_;
+            for (int x = 0; x < width_; ++x) {
+                const Coverage& columnRange = columnCoverage_[x];
+                float value = 0.0f;
+                if (rowRange.first <= rowRange.last && columnRange.first <= columnRange.last) {
+                    std::size_t top = rowRange.first * stride, bottom = (rowRange.last + 1) * stride;
+                    std::size_t left = columnRange.first, right = columnRange.last + 1;
+                    double sum = sums_[bottom + right] - sums_[top + right] - sums_[bottom + left] + sums_[top + left];
+                    int count = (rowRange.last - rowRange.first + 1) * (columnRange.last - columnRange.first + 1);
+                    value = static_cast<float>(sum / count);
+                }
+                out[x] = value;
+                low = any ? std::min(low, value) : value;
+                high = any ? std::max(high, value) : value;
+                any = true;
+            }
+        }
+        rangeMin[worker] = low;
+        rangeMax[worker] = high;
+    });
+    const float low = *std::min_element(rangeMin.begin(), rangeMin.end());
+    const float high = *std::max_element(rangeMax.begin(), rangeMax.end());
+    low_ = rowBegin == 0 ? low : std::min(low_, low);
+    high_ = rowBegin == 0 ? high : std::max(high_, high);
+}
+
+const float* StreamingHeatmapInference::waitRows(int rowBegin, int rowEnd) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_.wait(lock, [&]() { return rowsReady_ >= std::min(rowEnd, height_) || error_; });
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+    return heatmap_.data() + static_cast<std::size_t>(rowBegin) * width_;
+}
+
+void StreamingHeatmapInference::finish(float& low, float& range) {
+    if (!finished_) {
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        // Min-max normalization of generate_heatmap
+        range_ = (high_ - low_) + 1e-8f;
+        runSplit(height_, std::min(threads_, std::max(height_, 1)), [&](int, int begin, int end) {
+            for (std::size_t i = static_cast<std::size_t>(begin) * width_; i < static_cast<std::size_t>(end) * width_;
+                 ++i) {
+                heatmap_[i] = (heatmap_[i] - low_) / range_;
+            }
+        });
+        finished_ = true;
+    }
+    low = low_;
+    range = range_;
+}
+
+const float* StreamingHeatmapInference::finishedRows(int rowBegin, int) {
+    return heatmap_.data() + static_cast<std::size_t>(rowBegin) * width_;
+}
+
+std::vector<float> inferHeatmap(const ImageView& image, PatchClassifier& classifier, const HeatmapOptions& options) {
+    StreamingHeatmapInference inference(image, classifier, options);
+    float low, range;
+    inference.finish(low, range);
+    return std::move(inference.values());
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "segmenter.h"
+#include "stream_segmenter.h"
+
+// Native version of generate_heatmap in heatmap_generator.py: the sheet is cut into square
+// windows, every window is resized to patchSize x patchSize and normalized like the training
+// transform, batches of windows go through the border classifier, and each pixel gets the
+// mean border probability of the windows covering it, min-max normalized to [0, 1].
+
+// Side of the square model input and the ImageNet statistics of the training transform
+constexpr int patchSize = 224;
+constexpr float patchMean[3] = {0.485f, 0.456f, 0.406f};
+constexpr float patchStd[3] = {0.229f, 0.224f, 0.225f};
+
+// Border classifier behind the heatmap. Implementations wrap an inference runtime.
+class PatchClassifier {
+public:
+    virtual ~PatchClassifier() = default;
+
+    // Border probability of count patches of 3 x patchSize x patchSize normalized floats,
+    // row-major NCHW, into probabilities[0, count)
+    virtual void classify(const float* patches, int count, float* probabilities) = 0;
+};
+
+// Function to load a model exported by export_model in heatmap_generator.py: ".onnx" files
+// through ONNX Runtime, ".pt" and ".ts" TorchScript files through LibTorch. Each runtime is
+// only available when the build found it (P2P_HAVE_ONNXRUNTIME, P2P_HAVE_TORCH); threads is
+// the intra-op thread count, 0 leaves it to the runtime. Throws std::runtime_error on failure.
+std::unique_ptr<PatchClassifier> loadPatchClassifier(const std::string& modelPath, int threads);
+
+// Function to get the names of the runtimes in this build, e.g. "onnxruntime" or "none"
+const char* inferenceRuntimeName();
+
+// Sliding window settings, the defaults are those of generate_heatmap
+struct HeatmapOptions {
+    int windowSize = 0; // Window side in pixels, 0 uses max(2, height / 150)
+    int stepSize = 0;   // Window stride, 0 uses max(1, windowSize / 2)
+    int batchSize = 128; // Windows per forward pass; two batches of 588 KiB per window are held
+    int threads = 1;     // Workers preparing the patches and averaging, 0 uses every core
+};
+
+// Windows of a sheet: starts 0, stepSize, ... before side - windowSize on both axes, in
+// raster order, as generate_heatmap visits them
+struct PatchGrid {
+    int windowSize = 0;
+    int stepSize = 0;
+    int columns = 0;
+    int rows = 0;
+
+    std::size_t size() const { return static_cast<std::size_t>(columns) * rows; }
+};
+
+// Function to lay out the windows of a width x height sheet
+PatchGrid makePatchGrid(int width, int height, const HeatmapOptions& options);
+
+// Bilinear resize of a windowSize square to patchSize with the filter support, rounding and
+// 8-bit intermediate of PIL's Image.resize, so the model sees the patches it was trained on
+class PatchResampler {
+public:
+    explicit PatchResampler(int windowSize);
+
+    // Resize the window at (x, y) of image and write it normalized into out, 3 planes of
+    // patchSize x patchSize floats. The resize and the normalization run as one pass.
+    void prepare(const ImageView& image, int x, int y, float* out) const;
+
+private:
+    int windowSize_;
+    int taps_;                           // Coefficients per output sample
+    std::vector<int> bounds_;            // First input sample and count per output sample
+    std::vector<std::int32_t> weights_;  // taps_ fixed point coefficients per output sample
+    float normalized_[3][256];           // (value / 255 - mean) / std per channel
+};
+
+// inferHeatmap on a worker thread that hands the rows out top to bottom: a row is final
+// once every window covering it has been classified, so StreamingSegmenter can label the
+// top of the sheet while the model works on the bottom. The rows are handed out before the
+// min-max normalization, which finish applies once the whole sheet is known. image must
+// outlive the inference.
+class StreamingHeatmapInference : public HeatmapRowSource {
+public:
+    StreamingHeatmapInference(const ImageView& image, PatchClassifier& classifier, const HeatmapOptions& options);
+    ~StreamingHeatmapInference() override;
+    StreamingHeatmapInference(const StreamingHeatmapInference&) = delete;
+    StreamingHeatmapInference& operator=(const StreamingHeatmapInference&) = delete;
+
+    // Rethrow the error of the worker thread, if it failed
+    const float* waitRows(int rowBegin, int rowEnd) override;
+    void finish(float& low, float& range) override;
+    const float* finishedRows(int rowBegin, int rowEnd) override;
+
+    const PatchGrid& grid() const { return grid_; }
+    // The heatmap, normalized once finish has returned
+    std::vector<float>& values() { return heatmap_; }
+    // Wall time of the worker thread, known once finish has returned
+    double seconds() const { return seconds_; }
+
+private:
+    // Windows of the grid covering a position of one axis, [first, last], empty when
+    // first > last
+    struct Coverage {
+        int first;
+        int last;
+    };
+
+    void run();
+    // Average rows [rowBegin, rowEnd) from the summed-area table of the classified windows
+    void averageRows(int rowBegin, int rowEnd);
+
+    ImageView image_;
+    PatchClassifier& classifier_;
+    HeatmapOptions options_;
+    PatchGrid grid_;
+    int threads_;
+    std::vector<float> heatmap_;
+    std::vector<float> probabilities_; // Per window, in raster order
+    std::vector<double> sums_;         // Summed-area table of probabilities_, one row more and column more
+    std::vector<Coverage> columnCoverage_;
+    std::vector<Coverage> rowCoverage_;
+    float low_ = 0.0f;
+    float high_ = 0.0f;
+    float range_ = 1.0f;
+    double seconds_ = 0.0;
+
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    int rowsReady_ = 0;
+    std::exception_ptr error_;
+    std::atomic<bool> cancelled_{false};
+    bool finished_ = false;
+    std::thread worker_;
+};
+
+// Function to compute the heatmap of a sheet, width * height row-major values in [0, 1].
+// Border probabilities are averaged through a summed-area table of the window grid, so a
+// pixel costs four lookups however many windows overlap it. Throws std::runtime_error when
+// the classifier fails.
+std::vector<float> inferHeatmap(const ImageView& image, PatchClassifier& classifier, const HeatmapOptions& options);
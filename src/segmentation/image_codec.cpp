@@ -0,0 +1,405 @@
+#include "image_codec.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "stb_image.h"
+#include "stb_image_write.h"
+#ifdef P2P_HAVE_LIBJPEG
+#include <jpeglib.h>
+#endif
+#ifdef P2P_HAVE_LIBPNG
+#include <png.h>
+#endif
+
+namespace {
+
+const size_t messageLength = 200;
+
+#if !defined(P2P_HAVE_LIBJPEG) || !defined(P2P_HAVE_LIBPNG)
+// stb_image_write callback appending to a std::vector<unsigned char>
+void appendBytes(void* context, void* data, int size) {
+    auto* bytes = static_cast<std::vector<unsigned char>*>(context);
+    const auto* begin = static_cast<const unsigned char*>(data);
+    bytes->insert(bytes->end(), begin, begin + size);
+}
+#endif
+
+#ifdef P2P_HAVE_LIBJPEG
+
+// libjpeg reports errors through error_exit, which must not return; it jumps back to the
+// setjmp of the call in progress with the message. Nothing between the setjmp and the
+// libjpeg calls may have a destructor.
+struct JpegErrorManager {
+    jpeg_error_mgr base;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+void jpegErrorExit(j_common_ptr info) {
+    auto* error = reinterpret_cast<JpegErrorManager*>(info->err);
+    (*info->err->format_message)(info, error->message);
+    std::longjmp(error->jump, 1);
+}
+
+#ifdef P2P_HAVE_LIBJPEG_DECODE
+
+bool isJpeg(const unsigned char* data, size_t size) {
+    return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+// Decode from file when it is not null, from data otherwise. Returns malloc'ed RGB pixels,
+// nullptr with the error in message on failure.
+unsigned char* decodeJpeg(std::FILE* file, const unsigned char* data, size_t size, int& width, int& height,
+                          int& channels, char* message) {
+    jpeg_decompress_struct info;
+    JpegErrorManager error;
+    unsigned char* volatile pixels = nullptr;
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = jpegErrorExit;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&info);
+        std::free(pixels);
+        std::snprintf(message, messageLength, "%s", error.message);
+        return nullptr;
+    }
+    jpeg_create_decompress(&info);
+    if (file) {
+        jpeg_stdio_src(&info, file);
+    } else {
+        jpeg_mem_src(&info, const_cast<unsigned char*>(data), static_cast<unsigned long>(size));
+    }
+    jpeg_read_header(&info, TRUE);
+    channels = info.num_components;
+    info.out_color_space = JCS_RGB;
+    info.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&info);
+    width = static_cast<int>(info.output_width);
+    height = static_cast<int>(info.output_height);
+    const size_t stride = static_cast<size_t>(width) * 3;
+    pixels = static_cast<unsigned char*>(std::malloc(stride * height));
+    if (!pixels) {
+        jpeg_destroy_decompress(&info);
+        std::snprintf(message, messageLength, "Out of memory");
+        return nullptr;
+    }
+    while (info.output_scanline < info.output_height) {
+        JSAMPROW rows[16];
+        const int count = std::min<int>(16, static_cast<int>(info.output_height - info.output_scanline));
+        for (int i = 0; i < count; ++i) {
+            rows[i] = pixels + (info.output_scanline + i) * stride;
+        }
+        jpeg_read_scanlines(&info, rows, count);
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return pixels;
+}
+
+#endif // P2P_HAVE_LIBJPEG_DECODE
+
+// Encode at quality 100 without chroma subsampling, like stb_image_write at that quality.
+// Returns the malloc'ed stream in out, false with the error in message on failure.
+bool encodeJpeg(const unsigned char* pixels, int width, int height, int channels, unsigned char** out,
+                unsigned long* outSize, char* message) {
+    jpeg_compress_struct info;
+    JpegErrorManager error;
+    *out = nullptr;
+    *outSize = 0;
+    info.err = jpeg_std_error(&error.base);
+    error.base.error_exit = jpegErrorExit;
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&info);
+        std::free(*out);
+        *out = nullptr;
+        std::snprintf(message, messageLength, "%s", error.message);
+        return false;
+    }
+    jpeg_create_compress(&info);
+    jpeg_mem_dest(&info, out, outSize);
+    info.image_width = static_cast<JDIMENSION>(width);
+    info.image_height = static_cast<JDIMENSION>(height);
+    info.input_components = channels;
+    info.in_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&info);
+    jpeg_set_quality(&info, 100, TRUE);
+    for (int i = 0; i < info.num_components; ++i) {
+        info.comp_info[i].h_samp_factor = 1;
+        info.comp_info[i].v_samp_factor = 1;
+    }
+    info.dct_method = JDCT_ISLOW;
+    jpeg_start_compress(&info, TRUE);
+    const size_t stride = static_cast<size_t>(width) * channels;
+    while (info.next_scanline < info.image_height) {
+        JSAMPROW rows[16];
+        const int count = std::min<int>(16, static_cast<int>(info.image_height - info.next_scanline));
+        for (int i = 0; i < count; ++i) {
+            rows[i] = const_cast<unsigned char*>(pixels) + (info.next_scanline + i) * stride;
+        }
+        jpeg_write_scanlines(&info, rows, count);
+    }
+    jpeg_finish_compress(&info);
+    jpeg_destroy_compress(&info);
+    return true;
+}
+
+#ifdef P2P_HAVE_LIBJPEG_DECODE
+
+// JPEG decoded a few rows at a time, so the streaming mode never holds the whole sheet
+class JpegRowSource : public RowSource {
+public:
+    JpegRowSource(std::FILE* file, const std::string& path) : file_(file) {
+        info_.err = jpeg_std_error(&error_.base);
+        error_.base.error_exit = jpegErrorExit;
+        if (setjmp(error_.jump)) {
+            jpeg_destroy_decompress(&info_);
+            std::fclose(file_);
+            throw std::runtime_error("Failed to load image: " + path + ": " + error_.message);
+        }
+        jpeg_create_decompress(&info_);
+        jpeg_stdio_src(&info_, file_);
+        jpeg_read_header(&info_, TRUE);
+        info_.out_color_space = JCS_RGB;
+        info_.dct_method = JDCT_ISLOW;
+        jpeg_start_decompress(&info_);
+        width_ = static_cast<int>(info_.output_width);
+        height_ = static_cast<int>(info_.output_height);
+    }
+    ~JpegRowSource() override {
+        jpeg_destroy_decompress(&info_);
+        std::fclose(file_);
+    }
+
+    void readRows(int count, Color* rows) override {
+        if (setjmp(error_.jump)) {
+            throw std::runtime_error(std::string("Failed to decode JPEG rows: ") + error_.message);
+        }
+        unsigned char* first = reinterpret_cast<unsigned char*>(rows);
+        const size_t stride = static_cast<size_t>(width_) * 3;
+        for (int done = 0; done < count;) {
+            JSAMPROW pointers[16];
+            const int batch = std::min(16, count - done);
+            for (int i = 0; i < batch; ++i) {
+                pointers[i] = first + static_cast<size_t>(done + i) * stride;
+            }
+            done += static_cast<int>(jpeg_read_scanlines(&info_, pointers, batch));
+        }
+    }
+
+private:
+    std::FILE* file_;
+    jpeg_decompress_struct info_;
+    JpegErrorManager error_;
+};
+
+#endif // P2P_HAVE_LIBJPEG_DECODE
+
+#endif // P2P_HAVE_LIBJPEG
+
+#ifdef P2P_HAVE_LIBPNG
+
+void pngError(png_structp png, png_const_charp text) {
+    std::snprintf(static_cast<char*>(png_get_error_ptr(png)), messageLength, "%s", text);
+    png_longjmp(png, 1);
+}
+
+void pngWarning(png_structp, png_const_charp) {}
+
+void pngWrite(png_structp png, png_bytep data, png_size_t size) {
+    auto* bytes = static_cast<std::vector<unsigned char>*>(png_get_io_ptr(png));
+    bytes->insert(bytes->end(), data, data + size);
+}
+
+void pngFlush(png_structp) {}
+
+// Encode into out, false with the error in message on failure
+bool encodePng(const unsigned char* pixels, int width, int height, int channels, std::vector<unsigned char>* out,
+               char* message) {
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, message, pngError, pngWarning);
+    if (!png) {
+        std::snprintf(message, messageLength, "Could not create the PNG encoder");
+        return false;
+    }
+    png_infop info = png_create_info_struct(png);
+    if (!info || setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        return false;
+    }
+    png_set_write_fn(png, out, pngWrite, pngFlush);
+    png_set_IHDR(png, info, static_cast<png_uint_32>(width), static_cast<png_uint_32>(height), 8,
+                 channels == 1 ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    // Masks and previews are mostly flat areas, which the SUB filter at the fastest zlib level
+    // already compresses well
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, PNG_FILTER_SUB);
+    png_set_compression_level(png, 1);
+    png_write_info(png, info);
+    const size_t stride = static_cast<size_t>(width) * channels;
+    for (int y = 0; y < height; ++y) {
+        png_write_row(png, const_cast<png_bytep>(pixels + y * stride));
+    }
+    png_write_end(png, nullptr);
+    png_destroy_write_struct(&png, &info);
+    return true;
+}
+
+#endif // P2P_HAVE_LIBPNG
+
+} // namespace
+
+// Function to parse an image format name
+ImageFormat parseImageFormat(const std::string& name) {
+    if (name == "jpg" || name == "jpeg") return ImageFormat::Jpeg;
+    if (name == "png") return ImageFormat::Png;
+    throw std::runtime_error("Unknown image format: " + name);
+}
+
+// Function to get the name of an image format
+std::string imageFormatName(ImageFormat format) {
+    switch (format) {
+    case ImageFormat::Jpeg: return "jpg";
+    case ImageFormat::Png: return "png";
+    }
+    return "unknown";
+}
+
+ImageBuffer decodeImage(const std::string& path, int& width, int& height, int& channels) {
+#ifdef P2P_HAVE_LIBJPEG_DECODE
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error("Failed to load image: " + path);
+    }
+    unsigned char magic[3] = {};
+    const size_t read = std::fread(magic, 1, sizeof(magic), file);
+    std::rewind(file);
+    if (isJpeg(magic, read)) {
+        char message[messageLength];
+        unsigned char* pixels = decodeJpeg(file, nullptr, 0, width, height, channels, message);
+        std::fclose(file);
+        if (pixels) {
+            return {pixels, std::free};
+        }
+        // stb_image reads some files libjpeg does not convert to RGB, such as CMYK scans
+        unsigned char* fallback = stbi_load(path.c_str(), &width, &height, &channels, 3);
+        if (!fallback) {
+            throw std::runtime_error("Failed to load image: " + path + ": " + message);
+        }
+        return {fallback, stbi_image_free};
+    }
+    std::fclose(file);
+#endif
+    unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 3);
+    if (!pixels) {
+        throw std::runtime_error("Failed to load image: " + path);
+    }
+    return {pixels, stbi_image_free};
+}
+
+ImageBuffer decodeImage(const unsigned char* data, size_t size, int& width, int& height, int& channels) {
+#ifdef P2P_HAVE_LIBJPEG_DECODE
+    if (isJpeg(data, size)) {
+        char message[messageLength];
+        unsigned char* pixels = decodeJpeg(nullptr, data, size, width, height, channels, message);
+        if (pixels) {
+            return {pixels, std::free};
+        }
+    }
+#endif
+    unsigned char* pixels = stbi_load_from_memory(data, static_cast<int>(size), &width, &height, &channels, 3);
+    if (!pixels) {
+        throw std::runtime_error("Failed to decode image");
+    }
+    return {pixels, stbi_image_free};
+}
+
+// Function to read the size of an image from its header
+bool readImageSize(const std::string& path, int& width, int& height) {
+    int channels;
+    return stbi_info(path.c_str(), &width, &height, &channels) != 0;
+}
+
+std::vector<unsigned char> encodeImage(const unsigned char* pixels, int width, int height, int channels,
+                                       ImageFormat format) {
+    std::vector<unsigned char> bytes;
+    bool encoded = false;
+    char message[messageLength] = "stb_image_write failed";
+    if (format == ImageFormat::Jpeg) {
+#ifdef P2P_HAVE_LIBJPEG
+        unsigned char* stream = nullptr;
+        unsigned long size = 0;
+        encoded = encodeJpeg(pixels, width, height, channels, &stream, &size, message);
+        if (encoded) {
+            bytes.assign(stream, stream + size);
+        }
+        std::free(stream);
+#else
+        encoded = stbi_write_jpg_to_func(appendBytes, &bytes, width, height, channels, pixels, 100) != 0;
+#endif
+    } else {
+#ifdef P2P_HAVE_LIBPNG
+        encoded = encodePng(pixels, width, height, channels, &bytes, message);
+#else
+        encoded = stbi_write_png_to_func(appendBytes, &bytes, width, height, channels, pixels,
+                                         width * channels) != 0;
+#endif
+    }
+    if (!encoded) {
+        throw std::runtime_error("Failed to encode " + imageFormatName(format) + " image: " + message);
+    }
+    return bytes;
+}
+
+void writeImage(const std::string& path, const unsigned char* pixels, int width, int height, int channels,
+                ImageFormat format) {
+    writeFileBytes(path, encodeImage(pixels, width, height, channels, format));
+}
+
+// Function to write encoded bytes to a file
+void writeFileBytes(const std::string& path, const std::vector<unsigned char>& bytes) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!file) {
+        throw std::runtime_error("Could not write file: " + path);
+    }
+}
+
+std::unique_ptr<RowSource> openJpegRowSource(const std::string& path) {
+#ifdef P2P_HAVE_LIBJPEG_DECODE
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return nullptr;
+    }
+    unsigned char magic[3] = {};
+    const size_t read = std::fread(magic, 1, sizeof(magic), file);
+    std::rewind(file);
+    if (!isJpeg(magic, read)) {
+        std::fclose(file);
+        return nullptr;
+    }
+    return std::make_unique<JpegRowSource>(file, path);
+#else
+    (void)path;
+    return nullptr;
+#endif
+}
+
+// Function to get the names of the codecs in use
+const char* imageCodecName() {
+#if defined(P2P_HAVE_LIBJPEG_DECODE) && defined(P2P_HAVE_LIBPNG)
+    return "jpeg=libjpeg-turbo png=libpng";
+#elif defined(P2P_HAVE_LIBJPEG_DECODE)
+    return "jpeg=libjpeg-turbo png=stb";
+#elif defined(P2P_HAVE_LIBJPEG) && defined(P2P_HAVE_LIBPNG)
+    return "jpeg=stb+libjpeg-turbo png=libpng";
+#elif defined(P2P_HAVE_LIBJPEG)
+    return "jpeg=stb+libjpeg-turbo png=stb";
+#elif defined(P2P_HAVE_LIBPNG)
+    return "jpeg=stb png=libpng";
+#else
+    return "jpeg=stb png=stb";
+#endif
+}
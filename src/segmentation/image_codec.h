@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include "segmenter.h"
+#include "stream_segmenter.h"
+
+// Image decoding and encoding behind one interface. JPEG is encoded by libjpeg-turbo and PNG
+// by libpng when the build found them (P2P_HAVE_LIBJPEG, P2P_HAVE_LIBPNG), by stb_image_write
+// otherwise. Every image is decoded by stb_image, so the pixels and with them the
+// segmentation do not depend on the build. libjpeg-turbo also decodes JPEG, and streams it
+// row by row for the band mode, only in builds with P2P_HAVE_LIBJPEG_DECODE: the two
+// decoders round differently and a sheet segments slightly differently between them.
+
+// Decoded pixels and the function that frees them
+using ImageBuffer = std::unique_ptr<unsigned char, void (*)(void*)>;
+
+// Function to parse an image format name ("jpg" or "png")
+ImageFormat parseImageFormat(const std::string& name);
+
+// Function to get the name of an image format, also its file extension without the dot
+std::string imageFormatName(ImageFormat format);
+
+// Decode an image file to packed RGB. channels is the channel count of the file. Throws
+// std::runtime_error on failure.
+ImageBuffer decodeImage(const std::string& path, int& width, int& height, int& channels);
+
+// decodeImage of an encoded image in memory
+ImageBuffer decodeImage(const unsigned char* data, size_t size, int& width, int& height, int& channels);
+
+// Function to read the size of an image from its header, false when it can not be read
+bool readImageSize(const std::string& path, int& width, int& height);
+
+// Encode packed 8-bit pixels with 1 (gray) or 3 (RGB) channels. Throws std::runtime_error
+// on failure.
+std::vector<unsigned char> encodeImage(const unsigned char* pixels, int width, int height, int channels,
+                                       ImageFormat format);
+
+// Encode an image into a file. Throws std::runtime_error on failure.
+void writeImage(const std::string& path, const unsigned char* pixels, int width, int height, int channels,
+                ImageFormat format);
+
+// Function to write encoded bytes to a file. Throws std::runtime_error on failure.
+void writeFileBytes(const std::string& path, const std::vector<unsigned char>& bytes);
+
+// JPEG file decoded a few rows at a time by libjpeg-turbo, nullptr when the build does not
+// decode with libjpeg (P2P_HAVE_LIBJPEG_DECODE) or the file is not a JPEG. Throws std::runtime_error when the header is invalid.
+std::unique_ptr<RowSource> openJpegRowSource(const std::string& path);
+
+// Function to get the names of the codecs in use, e.g. "jpeg=stb+libjpeg-turbo png=stb" for
+// JPEG decoded by stb_image and encoded by libjpeg-turbo
+const char* imageCodecName();
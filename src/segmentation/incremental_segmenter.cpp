@@ -0,0 +1,283 @@
+#include "incremental_segmenter.h"
+#include "edge_map.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Neighbor offsets, the four before a pixel in raster order first
+const int neighborDx[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+const int neighborDy[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+const bool neighborIsDiagonal[8] = {false, true, false, true, false, true, false, true};
+
+// Region pixels carry their index in the region in the raster while they are labeled
+const std::uint32_t regionTag = 0x80000000u;
+
+int findRoot(std::vector<int>& parent, int node) {
+    int root = node;
+    while (parent[root] != root) {
+        root = parent[root];
+    }
+    while (parent[node] != root) {
+        int next = parent[node];
+        parent[node] = root;
+        node = next;
+    }
+    return root;
+}
+
+void uniteRoots(std::vector<int>& parent, int a, int b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    } else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+// Bounds, size and heatmap sum of a relabeled component
+struct RegionComponent {
+    int xMin, xMax, yMin, yMax, size;
+    double heatmapSum;
+};
+
+} // namespace
+
+ResegmentPatch IncrementalSegmenter::resegment(const ImageView& rows, int rowBegin, const HeatmapView& heatmap,
+                                               const Config& config, const PixelRect& dirty, std::uint32_t* labels,
+                                               ComponentSet& result) {
+    const int width = result.width;
+    const int height = result.height;
+    if (heatmap.width != width || heatmap.height != height || rows.width != width || rowBegin < 0 ||
+        rows.height < 0 || rowBegin + rows.height > height) {
+        throw std::invalid_argument("Image, heatmap and label raster sizes do not match");
+    }
+    const int rowEnd = rowBegin + rows.height;
+    const size_t rowOffset = static_cast<size_t>(rowBegin) * width;
+    const int xBegin = std::max(dirty.x, 0);
+    const int yBegin = std::max(dirty.y, 0);
+    const int xEnd = std::min(dirty.x + dirty.width, width);
+    const int yEnd = std::min(dirty.y + dirty.height, height);
+    if (xBegin >= xEnd || yBegin >= yEnd) {
+        throw std::invalid_argument("The dirty rectangle does not overlap the image");
+    }
+
+    int maxId = 0;
+    for (const Component& comp : result.components) {
+        maxId = std::max(maxId, comp.id);
+    }
+    componentIndex_.assign(maxId + 1, -1);
+    for (size_t i = 0; i < result.components.size(); ++i) {
+        componentIndex_[result.components[i].id] = static_cast<int>(i);
+    }
+    invalidated_.assign(maxId + 1, false);
+    region_.assign(static_cast<size_t>(rows.height) * width);
+    regionPixels_.clear();
+
+    // Region pixels whose color tests need rows that were not given are only counted into
+    // the rows reached, the growth stops before it would test them
+    ResegmentPatch patch;
+    patch.rowBegin = height;
+    patch.rowEnd = 0;
+    const bool euclidif = config.euclidif;
+    const int threshold = colorDistanceThreshold(config.k, euclidif);
+    auto passes = [&](size_t a, size_t b) {
+        return colorDistance(rows.pixels[a - rowOffset], rows.pixels[b - rowOffset], euclidif) <= threshold;
+    };
+    auto addPixel = [&](size_t index) {
+        const int y = static_cast<int>(index / width);
+        patch.rowBegin = std::min(patch.rowBegin, y);
+        patch.rowEnd = std::max(patch.rowEnd, y + 1);
+        if (std::max(y - 1, 0) < rowBegin || std::min(y + 2, height) > rowEnd) {
+            patch.complete = false;
+        } else if (!region_.test(index - rowOffset)) {
+            region_.set(index - rowOffset);
+            regionPixels_.push_back(index);
+        }
+    };
+    auto invalidate = [&](std::uint32_t id) {
+        if (id > static_cast<std::uint32_t>(maxId) || componentIndex_[id] < 0) {
+            throw std::runtime_error("The label raster holds id " + std::to_string(id) +
+                                     " which is not in the component table");
+        }
+        if (invalidated_[id]) {
+            return;
+        }
+        invalidated_[id] = true;
+        const Component& comp = result.components[componentIndex_[id]];
+        for (int y = comp.yMin; y <= comp.yMax; ++y) {
+            const size_t row = static_cast<size_t>(y) * width;
+            for (int x = comp.xMin; x <= comp.xMax; ++x) {
+                if (labels[row + x] == id) {
+                    addPixel(row + x);
+                }
+            }
+        }
+    };
+
+    // Seed with the dirty rectangle grown by one pixel and the components inside it
+    for (int y = std::max(yBegin - 1, 0); y < std::min(yEnd + 1, height); ++y) {
+        for (int x = std::max(xBegin - 1, 0); x < std::min(xEnd + 1, width); ++x) {
+            const size_t index = static_cast<size_t>(y) * width + x;
+            addPixel(index);
+            if (labels[index] != 0) {
+                invalidate(labels[index]);
+            }
+        }
+    }
+
+    // Grow through the passing color tests across the region border
+    for (size_t i = 0; i < regionPixels_.size() && patch.complete; ++i) {
+        const size_t index = regionPixels_[i];
+        const int x = static_cast<int>(index % width);
+        const int y = static_cast<int>(index / width);
+        for (int d = 0; d < 8; ++d) {
+            if (neighborIsDiagonal[d] && !config.use8Way) {
+                continue;
+            }
+            const int nx = x + neighborDx[d];
+            const int ny = y + neighborDy[d];
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height) {
+                continue;
+            }
+            const size_t neighbor = static_cast<size_t>(ny) * width + nx;
+            if (region_.test(neighbor - rowOffset) || !passes(index, neighbor)) {
+                continue;
+            }
+            if (labels[neighbor] == 0) {
+                addPixel(neighbor);
+            } else {
+                invalidate(labels[neighbor]);
+            }
+        }
+    }
+
+    if (!patch.complete) {
+        return patch;
+    }
+
+    // Label the region in raster order like labelRowsUnionFind, joining each pixel to the
+    // region neighbors before it
+    std::sort(regionPixels_.begin(), regionPixels_.end());
+    const int regionCount = static_cast<int>(regionPixels_.size());
+    parent_.resize(regionCount);
+    for (int i = 0; i < regionCount; ++i) {
+        const size_t index = regionPixels_[i];
+        const int x = static_cast<int>(index % width);
+        const int y = static_cast<int>(index / width);
+        parent_[i] = i;
+        int root = -1;
+        for (int d = 0; d < 4; ++d) {
+            if (neighborIsDiagonal[d] && !config.use8Way) {
+                continue;
+            }
+            const int nx = x + neighborDx[d];
+            const int ny = y + neighborDy[d];
+            if (nx < 0 || nx >= width || ny < 0) {
+                continue;
+            }
+            const size_t neighbor = static_cast<size_t>(ny) * width + nx;
+            if (!region_.test(neighbor - rowOffset) || !passes(index, neighbor)) {
+                continue;
+            }
+            const int node = static_cast<int>(labels[neighbor] & ~regionTag);
+            if (root < 0) {
+                root = findRoot(parent_, node);
+                parent_[i] = root;
+            } else {
+                uniteRoots(parent_, root, node);
+                root = findRoot(parent_, root);
+            }
+        }
+        labels[index] = regionTag | static_cast<std::uint32_t>(i);
+    }
+
+    // Flatten the forest into consecutive labels; parents always precede their children
+    int labelCount = 0;
+    for (int i = 0; i < regionCount; ++i) {
+        parent_[i] = parent_[i] == i ? labelCount++ : parent_[parent_[i]];
+    }
+    std::vector<RegionComponent> components(labelCount, {width, 0, height, 0, 0, 0.0});
+    for (int i = 0; i < regionCount; ++i) {
+        const size_t index = regionPixels_[i];
+        const int x = static_cast<int>(index % width);
+        const int y = static_cast<int>(index / width);
+        RegionComponent& comp = components[parent_[i]];
+        comp.xMin = std::min(comp.xMin, x);
+        comp.xMax = std::max(comp.xMax, x);
+        comp.yMin = std::min(comp.yMin, y);
+        comp.yMax = std::max(comp.yMax, y);
+        ++comp.size;
+        comp.heatmapSum += heatmap.values[index];
+    }
+
+    // Drop the invalidated components and give the kept region components their ids
+    patch.regionPixels = regionPixels_.size();
+    for (int id = 1; id <= maxId; ++id) {
+        if (invalidated_[id]) {
+            patch.removedIds.push_back(id);
+        }
+    }
+    result.components.erase(std::remove_if(result.components.begin(), result.components.end(),
+                                           [&](const Component& comp) { return invalidated_[comp.id]; }),
+                            result.components.end());
+    std::vector<int> ids(labelCount, 0);
+    size_t reused = 0;
+    int nextId = maxId + 1;
+    for (int label = 0; label < labelCount; ++label) {
+        const RegionComponent& comp = components[label];
+        if (!passesComponentFilter(config, comp.size, comp.xMax - comp.xMin + 1, comp.yMax - comp.yMin + 1)) {
+            countRejectedComponent(result.stats, config, comp.size);
+            continue;
+        }
+        ids[label] = reused < patch.removedIds.size() ? patch.removedIds[reused++] : nextId++;
+        patch.addedIds.push_back(ids[label]);
+    }
+    std::sort(patch.addedIds.begin(), patch.addedIds.end());
+
+    // Write the ids back into the raster and collect the runs of the kept components, which
+    // are in raster order within each component
+    std::vector<std::vector<PixelRun>> runs(labelCount);
+    for (int i = 0; i < regionCount; ++i) {
+        const size_t index = regionPixels_[i];
+        const int label = parent_[i];
+        labels[index] = static_cast<std::uint32_t>(ids[label]);
+        if (ids[label] == 0) {
+            continue;
+        }
+        const int x = static_cast<int>(index % width);
+        const int y = static_cast<int>(index / width);
+        std::vector<PixelRun>& componentRuns = runs[label];
+        if (!componentRuns.empty() && componentRuns.back().y == y && componentRuns.back().xEnd == x - 1) {
+            componentRuns.back().xEnd = x;
+        } else {
+            componentRuns.push_back({y, x, x});
+        }
+    }
+    for (int label = 0; label < labelCount; ++label) {
+        if (ids[label] == 0) {
+            continue;
+        }
+        const RegionComponent& comp = components[label];
+        Component kept;
+        kept.id = ids[label];
+        kept.xMin = comp.xMin;
+        kept.xMax = comp.xMax;
+        kept.yMin = comp.yMin;
+        kept.yMax = comp.yMax;
+        kept.size = comp.size;
+        kept.avgProbability = static_cast<float>(comp.heatmapSum / comp.size);
+        kept.isBuildingBlock = false;
+        kept.runBegin = result.runs.size();
+        result.runs.insert(result.runs.end(), runs[label].begin(), runs[label].end());
+        kept.runEnd = result.runs.size();
+        result.components.push_back(kept);
+    }
+    std::sort(result.components.begin(), result.components.end(),
+              [](const Component& a, const Component& b) { return a.id < b.id; });
+    result.heatmapStats.clear();
+    return patch;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "bitset.h"
+#include "segmenter.h"
+
+// Rectangle of pixels, for the edited region of a sheet
+struct PixelRect {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// What IncrementalSegmenter::resegment changed, ids in ascending order
+struct ResegmentPatch {
+    std::vector<int> removedIds;  // Components invalidated by the edit, no longer in the set
+    std::vector<int> addedIds;    // Components labeled again, reusing removed ids first
+    size_t regionPixels = 0;      // Pixels relabeled
+    int rowBegin = 0;             // Rows of the relabeled pixels, the ones to write back
+    int rowEnd = 0;
+    bool complete = true;         // False when the region reached rows it was not given
+};
+
+// Relabels the part of a segmented sheet an edit can reach, with the neighbor criterion of
+// the unionfind engine, and leaves every other component and its id untouched.
+//
+// The region starts as the dirty rectangle grown by one pixel, since an edited pixel changes
+// its color test with its neighbors. Every component with a pixel in it is invalidated and
+// all its pixels join the region. The region then grows through the passing color tests
+// across its border: a pixel of no component joins alone, a pixel of a component brings the
+// whole component. Pixels outside the region keep their labels and, once the growth stops,
+// no outside pixel passes the color test with a region pixel, so relabeling the region on
+// its own gives the components a full unionfind run over the edited image would give. The
+// work is proportional to the region, not to the sheet, and only the rows of the image
+// around the region are read.
+//
+// The region is labeled in raster order and filtered with passesComponentFilter. The kept
+// components take the removed ids in ascending order, then ids after the largest one, so the
+// ids no longer follow the raster order of the sheet but no surviving component changes id.
+//
+// The labels must come from the same criterion: the unionfind engine or a StreamingSegmenter
+// with the k, use8Way and euclidif of the config. The growth only stops at passing color
+// tests of that criterion, so labels of a fill engine or of other values are patched into
+// a mix of two segmentations without any error.
+class IncrementalSegmenter {
+public:
+    // Patch labels, the result.width * result.height raster of the component ids of result,
+    // and result itself for an edit inside dirty. rows holds the rows [rowBegin, rowBegin +
+    // rows.height) of the edited image. result.components must hold every id of the raster,
+    // their runs are not needed. The new components have their runs in result.runs and are
+    // not classified; result.heatmapStats is cleared.
+    //
+    // When the region, or a row next to it, reaches past the rows given, nothing is changed
+    // and the patch comes back incomplete with the rows reached so far in rowBegin and rowEnd;
+    // call again with at least one more row on either side of them. Without any rows that
+    // only costs the seeding, which needs no colors. Throws std::invalid_argument when the
+    // sizes do not match or dirty lies outside the image, std::runtime_error when the raster
+    // holds an id the components do not.
+    ResegmentPatch resegment(const ImageView& rows, int rowBegin, const HeatmapView& heatmap, const Config& config,
+                             const PixelRect& dirty, std::uint32_t* labels, ComponentSet& result);
+
+private:
+    Bitset region_;                       // Pixels being relabeled, over the rows given
+    std::vector<size_t> regionPixels_;    // The same pixels as indices, in raster order once grown
+    std::vector<int> componentIndex_;     // Index in result.components of every id, -1 for none
+    std::vector<bool> invalidated_;       // Per id
+    std::vector<int> parent_;             // Union-find over the region pixels
+};
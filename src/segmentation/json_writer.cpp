@@ -0,0 +1,124 @@
+#include "json_writer.h"
+
+#include <stdexcept>
+
+namespace {
+
+// Buffered bytes before a write to the file
+const size_t flushSize = size_t(1) << 20;
+
+} // namespace
+
+JsonWriter::JsonWriter(const std::string& path, bool compact) : path_(path), compact_(compact) {
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) {
+        throw std::runtime_error("Failed to create " + path);
+    }
+    buffer_.reserve(flushSize + 256);
+}
+
+JsonWriter::~JsonWriter() {
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+JsonWriter& JsonWriter::raw(const char* text) {
+    buffer_ += text;
+    flushIfFull();
+    return *this;
+}
+
+JsonWriter& JsonWriter::raw(char c) {
+    buffer_ += c;
+    flushIfFull();
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(int number) {
+    return value(static_cast<long long>(number));
+}
+
+JsonWriter& JsonWriter::value(long long number) {
+    char digits[24];
+    int length = std::snprintf(digits, sizeof(digits), "%lld", number);
+    buffer_.append(digits, length);
+    flushIfFull();
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(double number) {
+    char digits[32];
+    int length = std::snprintf(digits, sizeof(digits), "%g", number);
+    buffer_.append(digits, length);
+    flushIfFull();
+    return *this;
+}
+
+JsonWriter& JsonWriter::value(const std::string& text) {
+    buffer_ += '"';
+    for (char c : text) {
+        switch (c) {
+        case '\\': buffer_ += "\\\\"; break;
+        case '"': buffer_ += "\\\""; break;
+        case '\b': buffer_ += "\\b"; break;
+        case '\f': buffer_ += "\\f"; break;
+        case '\n': buffer_ += "\\n"; break;
+        case '\r': buffer_ += "\\r"; break;
+        case '\t': buffer_ += "\\t"; break;
+        default: buffer_ += c; break;
+        }
+    }
+    buffer_ += '"';
+    flushIfFull();
+    return *this;
+}
+
+JsonWriter& JsonWriter::key(const char* name) {
+    buffer_ += '"';
+    buffer_ += name;
+    buffer_ += compact_ ? "\":" : "\": ";
+    flushIfFull();
+    return *this;
+}
+
+JsonWriter& JsonWriter::newline(int indent) {
+    if (!compact_) {
+        buffer_ += '\n';
+        buffer_.append(indent, ' ');
+        flushIfFull();
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::space() {
+    if (!compact_) {
+        buffer_ += ' ';
+    }
+    return *this;
+}
+
+void JsonWriter::close() {
+    if (!file_) {
+        return;
+    }
+    bool written = flush();
+    written = std::fclose(file_) == 0 && written;
+    file_ = nullptr;
+    if (!written) {
+        throw std::runtime_error("Failed to write " + path_);
+    }
+}
+
+void JsonWriter::flushIfFull() {
+    if (buffer_.size() >= flushSize && !flush()) {
+        throw std::runtime_error("Failed to write " + path_);
+    }
+}
+
+bool JsonWriter::flush() {
+    bool written = buffer_.empty() || std::fwrite(buffer_.data(), 1, buffer_.size(), file_) == buffer_.size();
+    buffer_.clear();
+    return written;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+
+// Buffered JSON text output. Values are formatted into a large in-memory buffer that goes
+// to the file in a few big writes. The caller lays out the document; newline() and space()
+// emit the pretty-printing whitespace and nothing in compact mode. Throws
+// std::runtime_error when the file cannot be created or written.
+class JsonWriter {
+public:
+    JsonWriter(const std::string& path, bool compact);
+    ~JsonWriter();
+    JsonWriter(const JsonWriter&) = delete;
+    JsonWriter& operator=(const JsonWriter&) = delete;
+
+    // Structural characters and other text written as is
+    JsonWriter& raw(const char* text);
+    JsonWriter& raw(char c);
+
+    JsonWriter& value(int number);
+    JsonWriter& value(long long number);
+    // Same digits as std::ostream's default formatting, %g with 6 significant digits
+    JsonWriter& value(double number);
+    JsonWriter& value(const std::string& text);
+
+    // "name": followed by a space in pretty mode
+    JsonWriter& key(const char* name);
+
+    // Line break and indent spaces, pretty mode only
+    JsonWriter& newline(int indent = 0);
+    // Single space, pretty mode only
+    JsonWriter& space();
+
+    // Flush and close the file; also done by the destructor, which swallows errors
+    void close();
+
+private:
+    void flushIfFull();
+    bool flush();
+
+    std::FILE* file_ = nullptr;
+    std::string path_;
+    std::string buffer_;
+    bool compact_;
+};
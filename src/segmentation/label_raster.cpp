@@ -0,0 +1,387 @@
+#include "label_raster.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <zlib.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char rasterMagic[4] = {'P', '2', 'P', 'L'};
+const std::uint16_t rasterVersion = 1;
+
+// TIFF field types
+const std::uint16_t tiffShort = 3;
+const std::uint16_t tiffLong = 4;
+
+struct TiffEntry {
+    std::uint16_t tag;
+    std::uint16_t type;
+    std::uint32_t count;
+    std::uint32_t value; // The value itself when it fits in four bytes, otherwise its file offset
+};
+static_assert(sizeof(TiffEntry) == 12, "TiffEntry must match the on-disk layout");
+
+template <typename T>
+void writeValue(std::ofstream& file, T value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void writeRaw(const std::string& path, const std::vector<std::uint32_t>& labels, int width, int height) {
+    LabelRasterHeader header = makeLabelRasterHeader(width, height);
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create label raster: " + path);
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(labels.data()), labels.size() * sizeof(std::uint32_t));
+    if (!file) {
+        throw std::runtime_error("Error writing label raster: " + path);
+    }
+}
+
+// Append the runs of comp.id in row y, given the ids of its bounding box span of the row
+void appendRowRuns(const std::uint32_t* row, const Component& comp, int y, std::vector<PixelRun>& runs) {
+    const int boxWidth = comp.width();
+    const std::uint32_t id = static_cast<std::uint32_t>(comp.id);
+    for (int x = 0; x < boxWidth; ++x) {
+        if (row[x] != id) {
+            continue;
+        }
+        int xEnd = x;
+        while (xEnd + 1 < boxWidth && row[xEnd + 1] == id) {
+            ++xEnd;
+        }
+        runs.push_back({y, comp.xMin + x, comp.xMin + xEnd});
+        x = xEnd;
+    }
+}
+
+// Rows [yBegin, yEnd) of the raster into out, width ids per row
+using RowReader = std::function<void(int yBegin, int yEnd, std::uint32_t* out)>;
+
+void writeTiff(const std::string& path, const RowReader& readRows, int width, int height) {
+    const size_t tile = labelTileSize;
+    const size_t tilesX = (static_cast<size_t>(width) + tile - 1) / tile;
+    const size_t tilesY = (static_cast<size_t>(height) + tile - 1) / tile;
+    const size_t tileCount = tilesX * tilesY;
+    if (tileCount == 0) {
+        throw std::invalid_argument("Cannot write an empty label raster as TIFF: " + path);
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to create label raster: " + path);
+    }
+    // Header, the first IFD offset is patched in once the tiles are written
+    file.write("II", 2);
+    writeValue<std::uint16_t>(file, 42);
+    writeValue<std::uint32_t>(file, 0);
+
+    std::vector<std::uint32_t> tileOffsets(tileCount);
+    std::vector<std::uint32_t> tileSizes(tileCount);
+    std::vector<std::uint32_t> strip(tile * width);
+    std::vector<std::uint32_t> samples(tile * tile);
+    std::vector<Bytef> compressed(compressBound(static_cast<uLong>(samples.size() * sizeof(std::uint32_t))));
+    unsigned long long offset = 8;
+    for (size_t ty = 0; ty < tilesY; ++ty) {
+        size_t y0 = ty * tile;
+        size_t rows = std::min(tile, static_cast<size_t>(height) - y0);
+        readRows(static_cast<int>(y0), static_cast<int>(y0 + rows), strip.data());
+        for (size_t tx = 0; tx < tilesX; ++tx) {
+            // Edge tiles are padded with background up to the full tile size
+            std::fill(samples.begin(), samples.end(), 0);
+            size_t x0 = tx * tile;
+            size_t columns = std::min(tile, static_cast<size_t>(width) - x0);
+            for (size_t y = 0; y < rows; ++y) {
+                const std::uint32_t* source = strip.data() + y * width + x0;
+                std::copy(source, source + columns, samples.begin() + y * tile);
+            }
+            // Horizontal differencing, TIFF predictor 2: runs of one id become zeros
+            for (size_t y = 0; y < tile; ++y) {
+                std::uint32_t* row = samples.data() + y * tile;
+                for (size_t x = tile - 1; x > 0; --x) {
+                    row[x] -= row[x - 1];
+                }
+            }
+
+            uLongf compressedSize = static_cast<uLongf>(compressed.size());
+            if (compress2(compressed.data(), &compressedSize, reinterpret_cast<const Bytef*>(samples.data()),
+                          static_cast<uLong>(samples.size() * sizeof(std::uint32_t)), Z_DEFAULT_COMPRESSION) != Z_OK) {
+                throw std::runtime_error("Failed to compress label raster tile: " + path);
+            }
+            file.write(reinterpret_cast<const char*>(compressed.data()), compressedSize);
+            tileOffsets[ty * tilesX + tx] = static_cast<std::uint32_t>(offset);
+            tileSizes[ty * tilesX + tx] = static_cast<std::uint32_t>(compressedSize);
+            offset += compressedSize;
+            if (offset > 0xFFFFFFF0ull) {
+                throw std::runtime_error("Label raster exceeds the 4 GiB classic TIFF limit: " + path);
+            }
+        }
+    }
+
+    // Tile offset and size arrays, then the IFD on a word boundary
+    if (offset % 2) {
+        file.put(0);
+        ++offset;
+    }
+    std::uint32_t offsetsAt = static_cast<std::uint32_t>(offset);
+    std::uint32_t sizesAt = static_cast<std::uint32_t>(offset + tileCount * sizeof(std::uint32_t));
+    if (tileCount > 1) {
+        file.write(reinterpret_cast<const char*>(tileOffsets.data()), tileCount * sizeof(std::uint32_t));
+        file.write(reinterpret_cast<const char*>(tileSizes.data()), tileCount * sizeof(std::uint32_t));
+        offset += 2 * tileCount * sizeof(std::uint32_t);
+    } else {
+        offsetsAt = tileOffsets[0];
+        sizesAt = tileSizes[0];
+    }
+    const std::uint32_t count = static_cast<std::uint32_t>(tileCount);
+    const TiffEntry entries[] = {
+        {256, tiffLong, 1, static_cast<std::uint32_t>(width)},  // ImageWidth
+        {257, tiffLong, 1, static_cast<std::uint32_t>(height)}, // ImageLength
+        {258, tiffShort, 1, 32},                                // BitsPerSample
+        {259, tiffShort, 1, 8},                                 // Compression, Deflate
+        {262, tiffShort, 1, 1},                                 // PhotometricInterpretation, BlackIsZero
+        {277, tiffShort, 1, 1},                                 // SamplesPerPixel
+        {284, tiffShort, 1, 1},                                 // PlanarConfiguration, contiguous
+        {317, tiffShort, 1, 2},                                 // Predictor, horizontal differencing
+        {322, tiffLong, 1, static_cast<std::uint32_t>(tile)},   // TileWidth
+        {323, tiffLong, 1, static_cast<std::uint32_t>(tile)},   // TileLength
+        {324, tiffLong, count, offsetsAt},                      // TileOffsets
+        {325, tiffLong, count, sizesAt},                        // TileByteCounts
+        {339, tiffShort, 1, 1},                                 // SampleFormat, unsigned integer
+    };
+    const std::uint32_t ifdAt = static_cast<std::uint32_t>(offset);
+    writeValue<std::uint16_t>(file, sizeof(entries) / sizeof(entries[0]));
+    file.write(reinterpret_cast<const char*>(entries), sizeof(entries));
+    writeValue<std::uint32_t>(file, 0); // No further IFD
+    file.seekp(4);
+    writeValue(file, ifdAt);
+    if (!file) {
+        throw std::runtime_error("Error writing label raster: " + path);
+    }
+}
+
+} // namespace
+
+LabelRasterHeader makeLabelRasterHeader(int width, int height) {
+    LabelRasterHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, rasterMagic, sizeof(rasterMagic));
+    header.version = rasterVersion;
+    header.width = static_cast<std::uint32_t>(width);
+    header.height = static_cast<std::uint32_t>(height);
+    header.payloadOffset = sizeof(header);
+    return header;
+}
+
+// Function to parse a label raster format name
+LabelRasterFormat parseLabelRasterFormat(const std::string& name) {
+    if (name == "none") return LabelRasterFormat::None;
+    if (name == "raw") return LabelRasterFormat::Raw;
+    if (name == "tiff") return LabelRasterFormat::Tiff;
+    throw std::runtime_error("Unknown label raster format: " + name);
+}
+
+// Function to get the name of a label raster format
+std::string labelRasterFormatName(LabelRasterFormat format) {
+    switch (format) {
+    case LabelRasterFormat::None: return "none";
+    case LabelRasterFormat::Raw: return "raw";
+    case LabelRasterFormat::Tiff: return "tiff";
+    }
+    return "unknown";
+}
+
+std::string labelRasterFileName(LabelRasterFormat format) {
+    return format == LabelRasterFormat::Tiff ? "labels.tif" : "labels.p2pl";
+}
+
+std::vector<std::uint32_t> rasterizeLabels(const ComponentSet& components) {
+    std::vector<std::uint32_t> labels(static_cast<size_t>(components.width) * components.height, 0);
+    for (const Component& comp : components.components) {
+        for (const PixelRun& run : components.runsOf(comp)) {
+            std::uint32_t* row = labels.data() + static_cast<size_t>(run.y) * components.width;
+            std::fill(row + run.xBegin, row + run.xEnd + 1, static_cast<std::uint32_t>(comp.id));
+        }
+    }
+    return labels;
+}
+
+void writeLabelRaster(const std::string& path, const std::vector<std::uint32_t>& labels, int width, int height,
+                      LabelRasterFormat format) {
+    if (labels.size() != static_cast<size_t>(width) * height) {
+        throw std::invalid_argument("Label raster size does not match its dimensions");
+    }
+    switch (format) {
+    case LabelRasterFormat::None: return;
+    case LabelRasterFormat::Raw: writeRaw(path, labels, width, height); return;
+    case LabelRasterFormat::Tiff: {
+        auto readRows = [&](int yBegin, int yEnd, std::uint32_t* out) {
+            std::copy(labels.begin() + static_cast<size_t>(yBegin) * width,
+                      labels.begin() + static_cast<size_t>(yEnd) * width, out);
+        };
+        writeTiff(path, readRows, width, height);
+        return;
+    }
+    }
+}
+
+std::vector<PixelRun> labelRuns(const std::uint32_t* labels, int width, const Component& comp) {
+    std::vector<PixelRun> runs;
+    for (int y = comp.yMin; y <= comp.yMax; ++y) {
+        appendRowRuns(labels + static_cast<size_t>(y) * width + comp.xMin, comp, y, runs);
+    }
+    return runs;
+}
+
+void convertLabelRasterToTiff(const std::string& rawPath, const std::string& tiffPath) {
+    LabelRasterReader raster(rawPath);
+    auto readRows = [&](int yBegin, int yEnd, std::uint32_t* out) { raster.readRows(yBegin, yEnd, out); };
+    writeTiff(tiffPath, readRows, raster.width(), raster.height());
+}
+
+LabelRasterReader::LabelRasterReader(const std::string& path) : file_(path, std::ios::binary), path_(path) {
+    LabelRasterHeader header;
+    if (!file_ || !file_.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, rasterMagic, sizeof(rasterMagic)) != 0) {
+        throw std::runtime_error("Not a label raster file: " + path);
+    }
+    if (header.version != rasterVersion) {
+        throw std::runtime_error("Unsupported label raster version " + std::to_string(header.version) + " in: " + path);
+    }
+    width_ = static_cast<int>(header.width);
+    height_ = static_cast<int>(header.height);
+    payloadOffset_ = header.payloadOffset;
+}
+
+void LabelRasterReader::readRows(int yBegin, int yEnd, std::uint32_t* out) {
+    file_.seekg(payloadOffset_ + static_cast<std::streamoff>(yBegin) * width_ * sizeof(std::uint32_t));
+    file_.read(reinterpret_cast<char*>(out), static_cast<std::streamsize>(yEnd - yBegin) * width_ * sizeof(std::uint32_t));
+    if (!file_) {
+        throw std::runtime_error("Error reading label raster: " + path_);
+    }
+}
+
+std::vector<PixelRun> LabelRasterReader::readRuns(const Component& comp) {
+    const int boxWidth = comp.width();
+    std::vector<std::uint32_t> row(boxWidth);
+    std::vector<PixelRun> runs;
+    for (int y = comp.yMin; y <= comp.yMax; ++y) {
+        file_.seekg(payloadOffset_ + (static_cast<std::streamoff>(y) * width_ + comp.xMin) * sizeof(std::uint32_t));
+        file_.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(boxWidth) * sizeof(std::uint32_t));
+        if (!file_) {
+            throw std::runtime_error("Error reading label raster: " + path_);
+        }
+        appendRowRuns(row.data(), comp, y, runs);
+    }
+    return runs;
+}
+
+LabelRasterFile::LabelRasterFile(const std::string& path) : path_(path) {
+    const unsigned char* bytes = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    // No mapping here, the payload is read into buffer_ once the header is checked
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Failed to open label raster: " + path);
+    }
+    size = static_cast<size_t>(file.tellg());
+    LabelRasterHeader staging;
+    file.seekg(0);
+    if (size >= sizeof(staging)) {
+        file.read(reinterpret_cast<char*>(&staging), sizeof(staging));
+    }
+    bytes = reinterpret_cast<const unsigned char*>(&staging);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Failed to open label raster: " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to stat label raster: " + path);
+    }
+    size = static_cast<size_t>(info.st_size);
+    if (size > 0) {
+        mapping_ = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (size == 0 || mapping_ == MAP_FAILED) {
+        mapping_ = nullptr;
+        throw std::runtime_error("Failed to map label raster: " + path);
+    }
+    mappingSize_ = size;
+    bytes = static_cast<const unsigned char*>(mapping_);
+#endif
+
+    try {
+        LabelRasterHeader header;
+        if (size < sizeof(header) || std::memcmp(bytes, rasterMagic, sizeof(rasterMagic)) != 0) {
+            throw std::runtime_error("Not a label raster file: " + path);
+        }
+        std::memcpy(&header, bytes, sizeof(header));
+        if (header.version != rasterVersion) {
+            throw std::runtime_error("Unsupported label raster version " + std::to_string(header.version) +
+                                     " in: " + path);
+        }
+        width_ = static_cast<int>(header.width);
+        height_ = static_cast<int>(header.height);
+        payloadOffset_ = header.payloadOffset;
+        const size_t pixelCount = static_cast<size_t>(width_) * height_;
+        if (payloadOffset_ < sizeof(header) || payloadOffset_ % alignof(std::uint32_t) != 0 || size < payloadOffset_ ||
+            (size - payloadOffset_) / sizeof(std::uint32_t) < pixelCount) {
+            throw std::runtime_error("Truncated label raster: " + path);
+        }
+#ifdef _WIN32
+        buffer_.resize(pixelCount);
+        file.seekg(payloadOffset_);
+        file.read(reinterpret_cast<char*>(buffer_.data()), pixelCount * sizeof(std::uint32_t));
+        if (!file) {
+            throw std::runtime_error("Error reading label raster: " + path);
+        }
+        labels_ = buffer_.data();
+#else
+        labels_ = reinterpret_cast<std::uint32_t*>(static_cast<unsigned char*>(mapping_) + payloadOffset_);
+#endif
+    } catch (...) {
+#ifndef _WIN32
+        munmap(mapping_, mappingSize_);
+#endif
+        throw;
+    }
+}
+
+LabelRasterFile::~LabelRasterFile() {
+#ifndef _WIN32
+    if (mapping_) {
+        munmap(mapping_, mappingSize_);
+    }
+#endif
+}
+
+void LabelRasterFile::flush(int rowBegin, int rowEnd) {
+    rowBegin = std::max(rowBegin, 0);
+    rowEnd = std::min(rowEnd, height_);
+    if (rowBegin >= rowEnd) {
+        return;
+    }
+    const size_t first = static_cast<size_t>(rowBegin) * width_;
+    const size_t count = static_cast<size_t>(rowEnd - rowBegin) * width_;
+    std::fstream file(path_, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(payloadOffset_ + first * sizeof(std::uint32_t));
+    file.write(reinterpret_cast<const char*>(labels_ + first), count * sizeof(std::uint32_t));
+    file.flush();
+    if (!file) {
+        throw std::runtime_error("Error writing label raster: " + path_);
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "segmenter.h"
+
+// Label raster: the 1-based component id of every pixel, 0 where no kept component is,
+// written next to the component table so any component can be cropped by id from its
+// bounding box. Two little-endian layouts, both read by label_raster.py:
+//
+// Raw (.p2pl)
+//   header   LabelRasterHeader, 32 bytes
+//   payload  at payloadOffset, width * height uint32 ids, row-major
+//
+// TIFF (.tif)
+//   Classic baseline TIFF, one uint32 sample per pixel (BitsPerSample 32, SampleFormat 1),
+//   labelTileSize tiles, Deflate compression with the horizontal differencing predictor.
+//   Readable by GDAL, libtiff and tifffile.
+struct LabelRasterHeader {
+    char magic[4];               // "P2PL"
+    std::uint16_t version;       // 1
+    std::uint16_t reserved0;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t payloadOffset; // 32 for version 1
+    std::uint32_t reserved[3];
+};
+static_assert(sizeof(LabelRasterHeader) == 32, "LabelRasterHeader must match the on-disk layout");
+
+// Header of a raw label raster of the given size
+LabelRasterHeader makeLabelRasterHeader(int width, int height);
+
+// Side of the square TIFF tiles, a multiple of 16 as the TIFF specification requires
+const int labelTileSize = 256;
+
+// Function to parse a label raster format name ("none", "raw" or "tiff")
+LabelRasterFormat parseLabelRasterFormat(const std::string& name);
+
+// Function to get the name of a label raster format
+std::string labelRasterFormatName(LabelRasterFormat format);
+
+// File name of the label raster in the output folder, labels.p2pl or labels.tif
+std::string labelRasterFileName(LabelRasterFormat format);
+
+// Function to paint the component ids into a width * height raster
+std::vector<std::uint32_t> rasterizeLabels(const ComponentSet& components);
+
+// Function to write a label raster. Throws std::runtime_error on failure.
+void writeLabelRaster(const std::string& path, const std::vector<std::uint32_t>& labels, int width, int height,
+                      LabelRasterFormat format);
+
+// Runs of the pixels labeled comp.id inside its bounding box of a width ids wide raster,
+// in raster order
+std::vector<PixelRun> labelRuns(const std::uint32_t* labels, int width, const Component& comp);
+
+// Function to convert a raw label raster to TIFF, reading one strip of tiles at a time
+void convertLabelRasterToTiff(const std::string& rawPath, const std::string& tiffPath);
+
+// Raw label raster read back row by row, so a component can be cropped without loading the
+// whole raster. Throws std::runtime_error on failure.
+class LabelRasterReader {
+public:
+    explicit LabelRasterReader(const std::string& path);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Rows [yBegin, yEnd) into out, width ids per row
+    void readRows(int yBegin, int yEnd, std::uint32_t* out);
+
+    // Runs of the pixels labeled comp.id inside its bounding box, in raster order
+    std::vector<PixelRun> readRuns(const Component& comp);
+
+private:
+    std::ifstream file_;
+    std::string path_;
+    int width_ = 0;
+    int height_ = 0;
+    std::uint32_t payloadOffset_ = 0;
+};
+
+// Raw label raster mapped copy-on-write, so the ids of an edited region can be patched in
+// memory and only the rows holding them written back to the file, without reading or
+// rewriting the whole file. Nothing reaches the file before flush, so the caller can commit
+// the outputs that describe the new ids first. Where no mapping is available the payload is
+// read whole. Throws std::runtime_error on failure.
+class LabelRasterFile {
+public:
+    explicit LabelRasterFile(const std::string& path);
+    ~LabelRasterFile();
+    LabelRasterFile(const LabelRasterFile&) = delete;
+    LabelRasterFile& operator=(const LabelRasterFile&) = delete;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // width * height ids, row-major
+    std::uint32_t* labels() { return labels_; }
+    const std::uint32_t* labels() const { return labels_; }
+
+    // Write the rows [rowBegin, rowEnd) of the ids back into the file
+    void flush(int rowBegin, int rowEnd);
+
+private:
+    std::string path_;
+    int width_ = 0;
+    int height_ = 0;
+    std::uint32_t payloadOffset_ = 0;
+    void* mapping_ = nullptr;
+    std::size_t mappingSize_ = 0;
+    std::uint32_t* labels_ = nullptr;
+    std::vector<std::uint32_t> buffer_;
+};
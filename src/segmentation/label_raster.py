@@ -0,0 +1,44 @@
+"""
+Label rasters written by the C++ segmenter next to components_info.json, see label_raster.h.
+
+Every pixel holds the 1-based id of its component, 0 where no kept component is. The raw
+.p2pl layout is little-endian: a 32-byte header (magic "P2PL", uint16 version, 2 reserved
+bytes, uint32 width, uint32 height, uint32 payload offset, 12 reserved bytes) followed by the
+row-major uint32 ids. The .tif layout is a Deflate compressed, tiled uint32 TIFF.
+"""
+
+import struct
+
+import numpy as np
+
+MAGIC = b"P2PL"
+VERSION = 1
+HEADER = struct.Struct("<4sH2xIII12x")
+
+
+def read_label_raster(path: str) -> np.ndarray:
+    """
+    Reads a label raster as an (height, width) uint32 array. A .p2pl file comes back as a
+    read-only memory map; a .tif file is decoded with tifffile.
+    """
+    if path.endswith((".tif", ".tiff")):
+        import tifffile
+
+        return tifffile.imread(path)
+
+    with open(path, "rb") as f:
+        header = f.read(HEADER.size)
+    if len(header) < HEADER.size or header[:4] != MAGIC:
+        raise ValueError(f"Not a label raster file: {path}")
+    _, version, width, height, offset = HEADER.unpack(header)
+    if version != VERSION:
+        raise ValueError(f"Unsupported label raster version {version} in: {path}")
+    return np.memmap(path, dtype=np.dtype("<u4"), mode="r", offset=offset, shape=(height, width))
+
+
+def crop_component(labels: np.ndarray, x: int, y: int, width: int, height: int, component_id: int) -> np.ndarray:
+    """
+    Boolean mask of one component over its bounding box, as listed in components_info.json
+    or in the component table. Only the bounding box is read from a memory-mapped raster.
+    """
+    return labels[y : y + height, x : x + width] == component_id
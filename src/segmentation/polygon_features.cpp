@@ -0,0 +1,142 @@
+#include "polygon_features.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+constexpr double pi = 3.14159265358979323846;
+
+std::int64_t cross(const RingPoint& o, const RingPoint& a, const RingPoint& b) {
+    return static_cast<std::int64_t>(a.x - o.x) * (b.y - o.y) - static_cast<std::int64_t>(a.y - o.y) * (b.x - o.x);
+}
+
+// Twice the area of the convex hull of points, by Andrew's monotone chain
+std::int64_t doubledHullArea(const RingPoint* points, size_t count) {
+    std::vector<RingPoint> sorted(points, points + count);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const RingPoint& a, const RingPoint& b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+    sorted.erase(std::unique(sorted.begin(), sorted.end(),
+                             [](const RingPoint& a, const RingPoint& b) { return a.x == b.x && a.y == b.y; }),
+                 sorted.end());
+    if (sorted.size() < 3) {
+        return 0;
+    }
+    std::vector<RingPoint> hull(2 * sorted.size());
+    size_t k = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        while (k >= 2 && cross(hull[k - 2], hull[k - 1], sorted[i]) <= 0) {
+            k--;
+        }
+        hull[k++] = sorted[i];
+    }
+    for (size_t i = sorted.size() - 1, lower = k + 1; i-- > 0;) {
+        while (k >= lower && cross(hull[k - 2], hull[k - 1], sorted[i]) <= 0) {
+            k--;
+        }
+        hull[k++] = sorted[i];
+    }
+    std::int64_t area = 0;
+    for (size_t i = 0; i + 1 < k; ++i) {
+        area += static_cast<std::int64_t>(hull[i].x) * hull[i + 1].y - static_cast<std::int64_t>(hull[i + 1].x) * hull[i].y;
+    }
+    return area;
+}
+
+// Run work(begin, end) over [0, count) split across threads
+template <typename Work>
+void splitRange(size_t count, int threads, Work work) {
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    const size_t parts = std::max<size_t>(1, std::min(static_cast<size_t>(threads), count));
+    if (parts == 1) {
+        work(0, count);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < parts; ++t) {
+        workers.emplace_back(work, count * t / parts, count * (t + 1) / parts);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+} // namespace
+
+PolygonFeatures computePolygonFeatures(const RingPoint* points, size_t count) {
+    PolygonFeatures features;
+    features.sides = static_cast<int>(count);
+    if (count == 0) {
+        return features;
+    }
+    // The closing side is included, as in metrics.py
+    std::int64_t doubledArea = 0;
+    auto sideLength = [&](size_t i) {
+        const RingPoint& a = points[i];
+        const RingPoint& b = points[(i + 1) % count];
+        const double dx = b.x - a.x, dy = b.y - a.y;
+        return std::sqrt(dx * dx + dy * dy);
+    };
+    double lengthSum = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        const RingPoint& a = points[i];
+        const RingPoint& b = points[(i + 1) % count];
+        doubledArea += static_cast<std::int64_t>(a.x) * b.y - static_cast<std::int64_t>(b.x) * a.y;
+        lengthSum += sideLength(i);
+    }
+    features.area = 0.5 * static_cast<double>(std::llabs(doubledArea));
+    features.perimeter = lengthSum;
+    if (lengthSum > 0.0) {
+        const double squared = lengthSum * lengthSum;
+        features.compactness = features.area / squared;
+        features.circularity = 4.0 * pi * features.area / squared;
+        // Deviations from the mean in a second pass, like side_length_variation
+        const double mean = lengthSum / count;
+        double deviations = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            const double deviation = sideLength(i) - mean;
+            deviations += deviation * deviation;
+        }
+        features.sideCv = std::sqrt(deviations / count) / mean;
+    }
+    const std::int64_t hullArea = doubledHullArea(points, count);
+    if (hullArea != 0) {
+        features.convexity = static_cast<double>(std::llabs(doubledArea)) / static_cast<double>(hullArea);
+    }
+    return features;
+}
+
+std::vector<PolygonFeatures> computePolygonFeatures(const std::vector<std::vector<RingPoint>>& rings, int threads) {
+    std::vector<PolygonFeatures> features(rings.size());
+    splitRange(rings.size(), threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            features[i] = computePolygonFeatures(rings[i].data(), rings[i].size());
+        }
+    });
+    return features;
+}
+
+std::vector<PolygonFeatures> computeOutlineFeatures(const ComponentSet& result, double tolerance, int threads) {
+    std::vector<const Component*> blocks;
+    for (const Component& comp : result.components) {
+        if (comp.isBuildingBlock) {
+            blocks.push_back(&comp);
+        }
+    }
+    std::vector<PolygonFeatures> features(blocks.size());
+    splitRange(blocks.size(), threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            std::vector<RingPoint> ring = traceOutline(result, *blocks[i]);
+            if (tolerance > 0.0) {
+                ring = simplifyRdp(ring, tolerance);
+            }
+            features[i] = computePolygonFeatures(ring.data(), ring.size());
+        }
+    });
+    return features;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "contour.h"
+#include "segmenter.h"
+
+// Shape features of a polygon, the columns process_shapes in
+// georeferencing/outliers_detection/dbscan.py writes, computed as metrics.py does
+struct PolygonFeatures {
+    int sides = 0;           // Vertices of the ring, the repeated closing one included
+    double area = 0.0;       // Shoelace area
+    double perimeter = 0.0;
+    double circularity = 0.0; // 4 pi area / perimeter^2
+    double compactness = 0.0; // area / perimeter^2
+    double convexity = 0.0;   // area / convex hull area
+    double sideCv = 0.0;      // Coefficient of variation of the side lengths
+};
+
+// Function to compute the features of a ring of count vertices, closed or not
+PolygonFeatures computePolygonFeatures(const RingPoint* points, size_t count);
+
+// Function to compute the features of every ring, split across threads (0 uses every core)
+std::vector<PolygonFeatures> computePolygonFeatures(const std::vector<std::vector<RingPoint>>& rings, int threads);
+
+// Function to compute the features of the building block outlines savePolygons writes to
+// polygons.json, traced and simplified with tolerance, in the same order
+std::vector<PolygonFeatures> computeOutlineFeatures(const ComponentSet& result, double tolerance, int threads);
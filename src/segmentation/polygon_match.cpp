@@ -0,0 +1,339 @@
+#include "polygon_match.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <thread>
+
+namespace {
+
+// Ring translated so the midpoint of side lies on the origin and rotated so the side runs
+// along the positive x axis, as align_polygon_on_side does
+std::vector<FootprintPoint> alignOnSide(const ShapeView& shape, size_t side) {
+    const FootprintPoint& a = shape.ring[side];
+    const FootprintPoint& b = shape.ring[side + 1];
+    const double mx = 0.5 * (a.x + b.x), my = 0.5 * (a.y + b.y);
+    const double angle = std::atan2(b.y - a.y, b.x - a.x);
+    const double c = std::cos(angle), s = std::sin(angle);
+    std::vector<FootprintPoint> aligned(shape.count);
+    for (size_t i = 0; i < shape.count; ++i) {
+        const double x = shape.ring[i].x - mx, y = shape.ring[i].y - my;
+        aligned[i] = {x * c + y * s, -x * s + y * c};
+    }
+    return aligned;
+}
+
+double signedArea(const std::vector<FootprintPoint>& ring) {
+    double area = 0.0;
+    for (size_t i = 0; i + 1 < ring.size(); ++i) {
+        area += ring[i].x * ring[i + 1].y - ring[i + 1].x * ring[i].y;
+    }
+    return 0.5 * area;
+}
+
+// Triangle (origin, a, b) counterclockwise, with the sign of the ring edge it came from
+struct FanTriangle {
+    FootprintPoint p[3];
+    double sign;
+    double xMin, xMax, yMin, yMax;
+};
+
+// A ring is the signed sum of the triangles from the origin to each edge: their signs add up
+// to the winding number, 1 or -1 inside and 0 outside
+std::vector<FanTriangle> fanOf(const std::vector<FootprintPoint>& ring) {
+    std::vector<FanTriangle> fan;
+    fan.reserve(ring.size());
+    for (size_t i = 0; i + 1 < ring.size(); ++i) {
+        const FootprintPoint& a = ring[i];
+        const FootprintPoint& b = ring[i + 1];
+        const double cross = a.x * b.y - b.x * a.y;
+        if (cross == 0.0) {
+            continue;
+        }
+        FanTriangle t;
+        t.p[0] = {0.0, 0.0};
+        t.p[1] = cross > 0.0 ? a : b;
+        t.p[2] = cross > 0.0 ? b : a;
+        t.sign = cross > 0.0 ? 1.0 : -1.0;
+        t.xMin = std::min({0.0, a.x, b.x});
+        t.xMax = std::max({0.0, a.x, b.x});
+        t.yMin = std::min({0.0, a.y, b.y});
+        t.yMax = std::max({0.0, a.y, b.y});
+        fan.push_back(t);
+    }
+    return fan;
+}
+
+// Area of the intersection of two counterclockwise triangles, by clipping one against the
+// edges of the other
+double triangleOverlap(const FanTriangle& subject, const FanTriangle& clip) {
+    FootprintPoint buffers[2][9];
+    FootprintPoint* polygon = buffers[0];
+    FootprintPoint* next = buffers[1];
+    int count = 3;
+    std::copy(subject.p, subject.p + 3, polygon);
+    for (int e = 0; e < 3 && count > 0; ++e) {
+        const FootprintPoint& a = clip.p[e];
+        const FootprintPoint& b = clip.p[(e + 1) % 3];
+        auto side = [&](const FootprintPoint& p) { return (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x); };
+        int nextCount = 0;
+        for (int i = 0; i < count; ++i) {
+            const FootprintPoint& p = polygon[i];
+            const FootprintPoint& q = polygon[(i + 1) % count];
+            const double sp = side(p), sq = side(q);
+            if (sp >= 0.0) {
+                next[nextCount++] = p;
+            }
+            if ((sp >= 0.0) != (sq >= 0.0)) {
+                const double t = sp / (sp - sq);
+                next[nextCount++] = {p.x + t * (q.x - p.x), p.y + t * (q.y - p.y)};
+            }
+        }
+        std::swap(polygon, next);
+        count = nextCount;
+    }
+    double area = 0.0;
+    for (int i = 0; i < count; ++i) {
+        const FootprintPoint& p = polygon[i];
+        const FootprintPoint& q = polygon[(i + 1) % count];
+        area += p.x * q.y - q.x * p.y;
+    }
+    return 0.5 * area;
+}
+
+double exactIoU(const std::vector<FootprintPoint>& a, const std::vector<FootprintPoint>& b) {
+    const double areaA = signedArea(a), areaB = signedArea(b);
+    if (areaA == 0.0 || areaB == 0.0) {
+        return 0.0;
+    }
+    const std::vector<FanTriangle> fanA = fanOf(a), fanB = fanOf(b);
+    double intersection = 0.0;
+    for (const FanTriangle& s : fanA) {
+        for (const FanTriangle& t : fanB) {
+            if (s.xMax <= t.xMin || t.xMax <= s.xMin || s.yMax <= t.yMin || t.yMax <= s.yMin) {
+                continue;
+            }
+            intersection += s.sign * t.sign * triangleOverlap(s, t);
+        }
+    }
+    intersection *= (areaA > 0.0 ? 1.0 : -1.0) * (areaB > 0.0 ? 1.0 : -1.0);
+    const double united = std::fabs(areaA) + std::fabs(areaB) - intersection;
+    return united > 0.0 ? intersection / united : 0.0;
+}
+
+// Alignment of a ring rasterized on a size x size grid over [-frame, frame]^2, one bit per
+// cell center inside the ring (nonzero winding), rows padded to whole words
+struct AlignmentMask {
+    std::vector<std::uint64_t> words;
+    size_t cells = 0;
+};
+
+AlignmentMask rasterize(const std::vector<FootprintPoint>& ring, double frame, int size) {
+    const size_t stride = (static_cast<size_t>(size) + 63) / 64;
+    AlignmentMask mask;
+    mask.words.assign(stride * size, 0);
+    const double cell = 2.0 * frame / size;
+    std::vector<std::pair<double, int>> crossings;
+    for (int row = 0; row < size; ++row) {
+        const double y = -frame + (row + 0.5) * cell;
+        crossings.clear();
+        for (size_t i = 0; i + 1 < ring.size(); ++i) {
+            const FootprintPoint& a = ring[i];
+            const FootprintPoint& b = ring[i + 1];
+            if ((a.y <= y) != (b.y <= y)) {
+                crossings.emplace_back(a.x + (y - a.y) / (b.y - a.y) * (b.x - a.x), a.y <= y ? 1 : -1);
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        std::uint64_t* words = mask.words.data() + row * stride;
+        int winding = 0;
+        for (size_t i = 0; i + 1 < crossings.size(); ++i) {
+            winding += crossings[i].second;
+            if (winding == 0) {
+                continue;
+            }
+            // Cells whose centers lie in [x0, x1)
+            const double begin = std::ceil((crossings[i].first + frame) / cell - 0.5);
+            const double end = std::ceil((crossings[i + 1].first + frame) / cell - 0.5);
+            const int first = static_cast<int>(std::max(0.0, begin));
+            const int last = static_cast<int>(std::min(static_cast<double>(size), end));
+            for (int x = first; x < last; ++x) {
+                words[x >> 6] |= std::uint64_t(1) << (x & 63);
+            }
+            mask.cells += std::max(0, last - first);
+        }
+    }
+    return mask;
+}
+
+int popcount(std::uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    int bits = 0;
+    for (; word; word &= word - 1) {
+        ++bits;
+    }
+    return bits;
+#endif
+}
+
+size_t overlapCells(const AlignmentMask& a, const AlignmentMask& b) {
+    size_t cells = 0;
+    for (size_t i = 0; i < a.words.size(); ++i) {
+        cells += popcount(a.words[i] & b.words[i]);
+    }
+    return cells;
+}
+
+// Every alignment of a ring, rasterized over one frame
+std::vector<AlignmentMask> rasterizeAlignments(const ShapeView& shape, double frame, int size) {
+    std::vector<AlignmentMask> masks;
+    masks.reserve(shape.count - 1);
+    for (size_t side = 0; side + 1 < shape.count; ++side) {
+        masks.push_back(rasterize(alignOnSide(shape, side), frame, size));
+    }
+    return masks;
+}
+
+// Frame of a pair by the larger of the diameters, rounded up to a power of 2^(1/4) so the
+// alignments of a query are shared by the candidates of similar size. Every vertex of an
+// alignment lies within a diameter of the origin, which is on the ring.
+int frameBucket(double diameter) {
+    return static_cast<int>(std::ceil(4.0 * std::log2(std::max(diameter, 1e-6))));
+}
+
+double bucketFrame(int bucket) {
+    return std::exp2(bucket / 4.0);
+}
+
+struct AlignmentScore {
+    double iou;
+    size_t sideA, sideB;
+};
+
+double searchAlignments(const ShapeView& a, const std::vector<AlignmentMask>& masksA, const ShapeView& b,
+                        const std::vector<AlignmentMask>& masksB, int refineCount) {
+    std::vector<AlignmentScore> best;
+    for (size_t i = 0; i < masksA.size(); ++i) {
+        for (size_t j = 0; j < masksB.size(); ++j) {
+            const size_t overlap = overlapCells(masksA[i], masksB[j]);
+            const size_t united = masksA[i].cells + masksB[j].cells - overlap;
+            const double iou = united > 0 ? static_cast<double>(overlap) / united : 0.0;
+            if (static_cast<int>(best.size()) < std::max(refineCount, 1)) {
+                best.push_back({iou, i, j});
+            } else if (iou > best.back().iou) {
+                best.back() = {iou, i, j};
+            } else {
+                continue;
+            }
+            std::sort(best.begin(), best.end(),
+                      [](const AlignmentScore& x, const AlignmentScore& y) { return x.iou > y.iou; });
+        }
+    }
+    if (refineCount <= 0) {
+        return best.empty() ? 0.0 : best.front().iou;
+    }
+    double result = 0.0;
+    for (const AlignmentScore& score : best) {
+        result = std::max(result, alignedIoU(a, score.sideA, b, score.sideB));
+    }
+    return result;
+}
+
+} // namespace
+
+double alignedIoU(const ShapeView& a, size_t sideA, const ShapeView& b, size_t sideB) {
+    return exactIoU(alignOnSide(a, sideA), alignOnSide(b, sideB));
+}
+
+double maxAlignedIoU(const ShapeView& a, const ShapeView& b, const MatchOptions& options) {
+    if (a.count < 2 || b.count < 2) {
+        return 0.0;
+    }
+    if (options.rasterSize <= 0) {
+        double result = 0.0;
+        for (size_t i = 0; i + 1 < a.count; ++i) {
+            const std::vector<FootprintPoint> alignedA = alignOnSide(a, i);
+            for (size_t j = 0; j + 1 < b.count; ++j) {
+                result = std::max(result, exactIoU(alignedA, alignOnSide(b, j)));
+            }
+        }
+        return result;
+    }
+    const double frame = bucketFrame(frameBucket(std::max(a.diameter, b.diameter)));
+    return searchAlignments(a, rasterizeAlignments(a, frame, options.rasterSize), b,
+                            rasterizeAlignments(b, frame, options.rasterSize), options.refineCount);
+}
+
+std::vector<FootprintMatch> matchFootprints(const std::vector<NormalizedShape>& queries, const FootprintIndex& index,
+                                            const MatchOptions& options, const std::vector<std::uint8_t>& allowed) {
+    std::vector<std::vector<FootprintMatch>> found(queries.size());
+    std::atomic<size_t> nextQuery{0};
+    auto work = [&]() {
+        std::vector<std::uint32_t> candidates;
+        for (size_t q = nextQuery++; q < queries.size(); q = nextQuery++) {
+            const NormalizedShape& query = queries[q];
+            if (!query.valid) {
+                continue;
+            }
+            candidates.clear();
+            if (options.descriptorTolerance > 0.0f) {
+                index.candidates(query.descriptor, options.descriptorTolerance, candidates);
+            } else {
+                for (std::uint32_t i = 0; i < index.size(); ++i) {
+                    candidates.push_back(i);
+                }
+            }
+            const ShapeView a = viewOf(query);
+            std::map<int, std::vector<AlignmentMask>> masksA; // Per frame bucket
+            for (std::uint32_t footprint : candidates) {
+                if ((!allowed.empty() && !allowed[footprint]) || index.pointCount(footprint) < 2) {
+                    continue;
+                }
+                const ShapeView b = viewOf(index, footprint);
+                double iou;
+                if (options.rasterSize > 0) {
+                    const int bucket = frameBucket(std::max(a.diameter, b.diameter));
+                    auto masks = masksA.find(bucket);
+                    if (masks == masksA.end()) {
+                        masks = masksA.emplace(bucket, rasterizeAlignments(a, bucketFrame(bucket), options.rasterSize))
+                                    .first;
+                    }
+                    iou = searchAlignments(a, masks->second, b,
+                                           rasterizeAlignments(b, bucketFrame(bucket), options.rasterSize),
+                                           options.refineCount);
+                } else {
+                    iou = maxAlignedIoU(a, b, options);
+                }
+                if (iou >= options.threshold) {
+                    found[q].push_back({static_cast<std::uint32_t>(q), footprint, iou});
+                }
+            }
+        }
+    };
+
+    int threads = options.threads;
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<int>(std::max<size_t>(1, std::min(static_cast<size_t>(threads), queries.size())));
+    if (threads == 1) {
+        work();
+    } else {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back(work);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    std::vector<FootprintMatch> matches;
+    for (const auto& query : found) {
+        matches.insert(matches.end(), query.begin(), query.end());
+    }
+    return matches;
+}
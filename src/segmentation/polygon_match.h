@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "footprint_index.h"
+
+// Native version of topological_similarity in georeferencing/polygons_comparation.py: two
+// rings scaled to area 1 are aligned on every pair of sides (the side midpoint on the origin,
+// the side along the x axis) and compared by their intersection over union; the score of
+// the pair is the largest IoU over all the alignments.
+
+// Closed ring of unit area and its diameter, from a NormalizedShape or a FootprintIndex
+struct ShapeView {
+    const FootprintPoint* ring = nullptr;
+    size_t count = 0;
+    double diameter = 0.0;
+};
+
+inline ShapeView viewOf(const NormalizedShape& shape) {
+    return {shape.ring.data(), shape.ring.size(), shape.diameter};
+}
+
+inline ShapeView viewOf(const FootprintIndex& index, size_t i) {
+    return {index.ring(i), index.pointCount(i), index.diameter(i)};
+}
+
+// The defaults compare every footprint and compute every alignment exactly. The descriptor
+// box and the raster are heuristics: neither bound is proven to keep every pair at or above
+// the threshold (a square and a 105 x 95.2 rectangle reach an IoU of 0.909 with principal
+// moment ratios 1.000 and 0.822), so they are opt-in until their recall has been measured.
+struct MatchOptions {
+    double threshold = 0.9;          // Pairs at or above this IoU are matches
+    float descriptorTolerance = 0.0f; // Half width of the descriptor box of the candidates, 0 compares every footprint
+    int rasterSize = 0;              // Raster cells per side for the alignment search, 0 computes every alignment exactly
+    int refineCount = 3;             // Best raster alignments whose IoU is then computed exactly
+    int threads = 1;                  // Queries matched in parallel, 0 uses every core
+};
+
+// Function to compute the exact IoU of a aligned on side sideA and b aligned on side sideB
+double alignedIoU(const ShapeView& a, size_t sideA, const ShapeView& b, size_t sideB);
+
+// Function to compute the largest IoU over the side alignments of a and b. With a raster,
+// every alignment pair is first scored on a rasterSize x rasterSize bit grid, rasterizing
+// each alignment of a ring once, and only the refineCount best are computed exactly.
+double maxAlignedIoU(const ShapeView& a, const ShapeView& b, const MatchOptions& options);
+
+struct FootprintMatch {
+    std::uint32_t query;
+    std::uint32_t footprint;
+    double iou;
+};
+
+// Function to match every query against the footprints of index whose descriptors are near
+// its own, skipping footprints with allowed[i] == 0 when allowed is not empty. Returns the
+// pairs at or above options.threshold ordered by query, then footprint.
+std::vector<FootprintMatch> matchFootprints(const std::vector<NormalizedShape>& queries, const FootprintIndex& index,
+                                            const MatchOptions& options,
+                                            const std::vector<std::uint8_t>& allowed = {});
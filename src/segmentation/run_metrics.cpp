@@ -0,0 +1,218 @@
+#include "run_metrics.h"
+#include "json_writer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+RunMetrics::RunMetrics() : origin_(std::chrono::steady_clock::now()) {}
+
+double RunMetrics::now() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin_).count();
+}
+
+void RunMetrics::beginStage(const std::string& name, std::uint64_t pixels) {
+    if (running_ >= 0) {
+        endStage();
+    }
+    Stage stage;
+    stage.name = name;
+    stage.start = now();
+    stage.pixels = pixels;
+    stages_.push_back(stage);
+    running_ = static_cast<int>(stages_.size()) - 1;
+}
+
+void RunMetrics::endStage(std::uint64_t bytesWritten) {
+    if (running_ < 0) {
+        return;
+    }
+    Stage& stage = stages_[running_];
+    stage.seconds = now() - stage.start;
+    stage.peakRssKb = peakRssKilobytes();
+    stage.bytesWritten = bytesWritten;
+    running_ = -1;
+}
+
+void RunMetrics::addSegmenterStages(const ComponentSet& result, std::uint64_t pixels) {
+    const Stage* parent = running_ >= 0 ? &stages_[running_] : nullptr;
+    const std::string parentName = parent ? parent->name : "";
+    double start = parent ? parent->start : now();
+    const std::pair<const char*, double> nested[] = {{"edge_map", result.stats.edgeMapSeconds},
+                                                     {"label", result.stats.labelSeconds},
+                                                     {"heatmap_wait", result.stats.heatmapWaitSeconds},
+                                                     {"classify", result.stats.classifySeconds}};
+    std::vector<Stage> added;
+    for (const auto& entry : nested) {
+        // Only streamed heatmaps are waited for
+        if (entry.second == 0.0 && std::string(entry.first) == "heatmap_wait") {
+            continue;
+        }
+        Stage stage;
+        stage.name = entry.first;
+        stage.parent = parentName;
+        stage.start = start;
+        stage.seconds = entry.second;
+        stage.pixels = pixels;
+        added.push_back(stage);
+        start += entry.second;
+    }
+    // Appended after the parent so its index stays valid
+    stages_.insert(stages_.end(), added.begin(), added.end());
+}
+
+void RunMetrics::setComponents(const ComponentSet& result) {
+    stats_ = result.stats;
+    accepted_ = static_cast<int>(result.components.size());
+    buildingBlocks_ = 0;
+    for (const Component& comp : result.components) {
+        buildingBlocks_ += comp.isBuildingBlock ? 1 : 0;
+    }
+}
+
+void RunMetrics::setRun(const std::string& imagePath, int width, int height, const Config& config) {
+    imagePath_ = imagePath;
+    width_ = width;
+    height_ = height;
+    engine_ = config.bandHeight > 0 ? "streaming" : fillEngineName(config.fillEngine);
+    threads_ = config.threads;
+}
+
+void RunMetrics::writeJson(const std::string& path, bool compact) const {
+    double seconds = 0.0;
+    long peakRssKb = 0;
+    std::uint64_t bytesWritten = 0;
+    for (const Stage& stage : stages_) {
+        if (stage.parent.empty()) {
+            seconds = std::max(seconds, stage.start + stage.seconds);
+            bytesWritten += stage.bytesWritten;
+        }
+        peakRssKb = std::max(peakRssKb, stage.peakRssKb);
+    }
+
+    JsonWriter json(path, compact);
+    json.raw('{');
+    json.newline(4).key("image").value(imagePath_).raw(',');
+    json.newline(4).key("width").value(width_).raw(',');
+    json.newline(4).key("height").value(height_).raw(',');
+    json.newline(4).key("engine").value(engine_).raw(',');
+    json.newline(4).key("threads").value(threads_).raw(',');
+    json.newline(4).key("seconds").value(seconds).raw(',');
+    json.newline(4).key("peak_rss_kb").value(static_cast<long long>(peakRssKb)).raw(',');
+    json.newline(4).key("bytes_written").value(static_cast<long long>(bytesWritten)).raw(',');
+    json.newline(4).key("components").raw('{');
+    json.newline(8).key("accepted").value(accepted_).raw(',');
+    json.newline(8).key("rejected_too_small").value(stats_.rejectedTooSmall).raw(',');
+    json.newline(8).key("rejected_low_density").value(stats_.rejectedLowDensity).raw(',');
+    json.newline(8).key("building_blocks").value(buildingBlocks_).raw(',');
+    json.newline(8).key("non_building_blocks").value(accepted_ - buildingBlocks_);
+    json.newline(4).raw("},");
+    json.newline(4).key("max_fill_depth").value(static_cast<long long>(stats_.maxFillDepth)).raw(',');
+    json.newline(4).key("stages").raw('[');
+    for (size_t i = 0; i < stages_.size(); ++i) {
+        const Stage& stage = stages_[i];
+        json.raw(i == 0 ? "" : ",").newline(8).raw('{');
+        json.newline(12).key("name").value(stage.name).raw(',');
+        if (!stage.parent.empty()) {
+            json.newline(12).key("parent").value(stage.parent).raw(',');
+        }
+        json.newline(12).key("start").value(stage.start).raw(',');
+        json.newline(12).key("seconds").value(stage.seconds).raw(',');
+        json.newline(12).key("pixels_per_second")
+            .value(stage.pixels > 0 && stage.seconds > 0.0 ? stage.pixels / stage.seconds : 0.0)
+            .raw(',');
+        if (stage.parent.empty()) {
+            json.newline(12).key("peak_rss_kb").value(static_cast<long long>(stage.peakRssKb)).raw(',');
+        }
+        json.newline(12).key("bytes_written").value(static_cast<long long>(stage.bytesWritten));
+        json.newline(8).raw('}');
+    }
+    json.newline(4).raw(']');
+    json.newline().raw('}');
+    json.close();
+}
+
+void RunMetrics::writeTrace(const std::string& path) const {
+    auto micros = [](double seconds) { return static_cast<long long>(seconds * 1e6); };
+    JsonWriter json(path, true);
+    json.raw("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    json.raw("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":").value(imagePath_).raw("}}");
+    for (const Stage& stage : stages_) {
+        json.raw(",\n{\"name\":").value(stage.name).raw(",\"cat\":\"segmentation\",\"ph\":\"X\",\"pid\":1,\"tid\":1");
+        json.raw(",\"ts\":").value(micros(stage.start)).raw(",\"dur\":").value(micros(stage.seconds));
+        json.raw(",\"args\":{\"pixels\":").value(static_cast<long long>(stage.pixels));
+        json.raw(",\"bytes_written\":").value(static_cast<long long>(stage.bytesWritten)).raw("}}");
+        if (stage.parent.empty()) {
+            json.raw(",\n{\"name\":\"peak_rss_kb\",\"ph\":\"C\",\"pid\":1,\"ts\":")
+                .value(micros(stage.start + stage.seconds));
+            json.raw(",\"args\":{\"peak_rss_kb\":").value(static_cast<long long>(stage.peakRssKb)).raw("}}");
+        }
+    }
+    json.raw("]}\n");
+    json.close();
+}
+
+// Function to parse a metrics format name
+MetricsFormat parseMetricsFormat(const std::string& name) {
+    if (name == "none") return MetricsFormat::None;
+    if (name == "json") return MetricsFormat::Json;
+    if (name == "trace") return MetricsFormat::Trace;
+    throw std::runtime_error("Unknown metrics format: " + name);
+}
+
+// Function to get the name of a metrics format
+std::string metricsFormatName(MetricsFormat format) {
+    switch (format) {
+    case MetricsFormat::None: return "none";
+    case MetricsFormat::Json: return "json";
+    case MetricsFormat::Trace: return "trace";
+    }
+    return "unknown";
+}
+
+void writeRunMetrics(const RunMetrics& metrics, const std::string& outputFolder, const Config& config) {
+    if (config.metrics == MetricsFormat::None) {
+        return;
+    }
+    try {
+        metrics.writeJson(outputFolder + "/metrics.json", config.compactJson);
+        if (config.metrics == MetricsFormat::Trace) {
+            metrics.writeTrace(outputFolder + "/metrics_trace.json");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+    }
+}
+
+long peakRssKilobytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<long>(usage.ru_maxrss / 1024); // Bytes on macOS
+#else
+    return static_cast<long>(usage.ru_maxrss);
+#endif
+#endif
+}
+
+std::uint64_t fileSize(const std::string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? static_cast<std::uint64_t>(info.st_size) : 0;
+}
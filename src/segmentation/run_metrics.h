@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "segmenter.h"
+
+// Per-stage measurements of one processImage run, written next to the other outputs so
+// pipeline.py can collect them without parsing stdout. metrics.json holds:
+//   image, width, height, engine, threads     the run
+//   seconds, peak_rss_kb, bytes_written        totals
+//   components   accepted, rejected_too_small, rejected_low_density, building_blocks,
+//                non_building_blocks
+//   max_fill_depth                             deepest fill stack, 0 for unionfind
+//   stages       name, start, seconds, pixels_per_second, peak_rss_kb, bytes_written; the
+//                segmenter stages nested in "segment" have a parent instead of peak_rss_kb
+// Peak RSS is the peak of the whole process up to the end of the stage, so in batch mode it
+// covers the other sheets in flight too. The Chrome trace (chrome://tracing, Perfetto) has
+// one complete event per stage and a counter track of the peak RSS.
+class RunMetrics {
+public:
+    RunMetrics();
+
+    // Start a stage over pixels pixels; stages do not overlap except for nested ones
+    void beginStage(const std::string& name, std::uint64_t pixels = 0);
+    // End the running stage, which wrote bytesWritten bytes
+    void endStage(std::uint64_t bytesWritten = 0);
+    // Stages timed inside Segmenter::segment, nested in the running stage back to back
+    void addSegmenterStages(const ComponentSet& result, std::uint64_t pixels);
+
+    // Component counts and fill depth of a segmented sheet
+    void setComponents(const ComponentSet& result);
+    void setRun(const std::string& imagePath, int width, int height, const Config& config);
+
+    // Throws std::runtime_error on failure
+    void writeJson(const std::string& path, bool compact) const;
+    void writeTrace(const std::string& path) const;
+
+private:
+    struct Stage {
+        std::string name;
+        std::string parent;
+        double start = 0.0; // Seconds since the metrics were created
+        double seconds = 0.0;
+        std::uint64_t pixels = 0;
+        long peakRssKb = 0;
+        std::uint64_t bytesWritten = 0;
+    };
+
+    double now() const;
+
+    std::chrono::steady_clock::time_point origin_;
+    std::vector<Stage> stages_;
+    int running_ = -1;
+    std::string imagePath_;
+    int width_ = 0;
+    int height_ = 0;
+    std::string engine_;
+    int threads_ = 0;
+    SegmentationStats stats_;
+    int accepted_ = 0;
+    int buildingBlocks_ = 0;
+};
+
+// Function to parse a metrics format name ("none", "json" or "trace")
+MetricsFormat parseMetricsFormat(const std::string& name);
+
+// Function to get the name of a metrics format
+std::string metricsFormatName(MetricsFormat format);
+
+// Write metrics.json, and metrics_trace.json for the trace format, into outputFolder.
+// Errors are reported on stderr, since metrics never fail a run.
+void writeRunMetrics(const RunMetrics& metrics, const std::string& outputFolder, const Config& config);
+
+// Peak resident set size of the process so far in KiB, 0 where it is not available
+long peakRssKilobytes();
+
+// Size of a file in bytes, 0 when it does not exist
+std::uint64_t fileSize(const std::string& path);
@@ -0,0 +1,497 @@
+// Benchmarks of the segmentation stages, one group per input sheet: the checked-in
+// tiny_map sample and synthetic street grids of the requested sizes.
+//
+// Built by the segmentation_bench CMake target when Google Benchmark is found, and run as
+// the training corpus of the PGO presets (see CMakeLists.txt).
+//
+// Run from src/ like main.exe, so the tiny_map sample is found:
+//   segmentation/build/release/segmentation_bench [--sizes=1,16,200] [--tiny_image=path] [--tiny_heatmap=path]
+//                                   [--output=dir] [--benchmark_filter=Label/...]
+// --sizes lists the synthetic sheets in megapixels (default 1,16), --output is where the
+// encoding stages write (default p2p_bench in the temp directory). Stages:
+//   Decode       decodeImage of the JPEG sheet, quality 95 for the synthetic ones
+//   HeatmapLoad  mapping a row-major float32 .hmp and reading every value
+//   PreparePatches  resizing and normalizing the first 1024 windows of inferHeatmap into
+//                model input; the model itself is not part of the harness
+//   EdgeMap      the neighbor color tests, see buildEdgeMap
+//   Label/...    Segmenter::segment with each engine, including the component bounds, sizes
+//                and heatmap sums, which every engine accumulates during labeling
+//   Classify     the heatmap and size percentiles and the building block test
+//   HeatmapStats the heatmap statistics of every component, straight from its runs
+//   Outlines     traceOutline and simplifyRdp of every building block
+//   OutlineFeatures  the outlier detection shape features of every building block outline
+//   Dbscan       the NeighborIndex of the min-max scaled features and DBSCAN at the 15 eps
+//                values of a bayesian_optimization run
+//   FootprintMatch/...  the FootprintIndex of the building block outlines and matchFootprints of
+//                the first 16 of them against it, as match_outliers does with modern_data.json,
+//                exactly and with the descriptor box and raster heuristics
+//   Encode/...   components_info.json, the .p2pc table, the label rasters, rendering the
+//                preview, the preview as JPEG and PNG, and every processImage output
+//                including masks and previews
+// The sheet is built once per group, so only one sheet is held in memory at a time.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "component_table.h"
+#include "contour.h"
+#include "dbscan.h"
+#include "edge_map.h"
+#include "footprint_index.h"
+#include "heatmap_format.h"
+#include "heatmap_index.h"
+#include "heatmap_inference.h"
+#include "image_codec.h"
+#include "label_raster.h"
+#include "polygon_features.h"
+#include "polygon_match.h"
+#include "segmentation_io.h"
+#include "segmentation_preview.h"
+#include "segmenter.h"
+#include "stb_image_write.h"
+#include "synthetic_map.h"
+
+namespace {
+
+// Settings of the pipeline.py call
+Config benchConfig() {
+    Config config;
+    config.k = 25;
+    config.use8Way = true;
+    config.euclidif = true;
+    config.adj = true;
+    config.minComponentSize = 400;
+    config.buildingBlockTreshold = 0.000009;
+    config.writeMasks = true;
+    config.simplifyTolerance = 2;
+    return config;
+}
+
+// Sheet of one benchmark group
+struct BenchInput {
+    std::string name;
+    std::vector<unsigned char> jpeg; // Encoded sheet, the input of Decode
+    int width = 0;
+    int height = 0;
+    std::vector<Color> pixels;       // Decoded from jpeg
+    std::vector<float> heatmap;
+    std::string heatmapPath;         // heatmap as a row-major float32 .hmp
+    Sheet sheet;                     // Segmented with benchConfig, the input of the later stages
+};
+
+struct InputSpec {
+    std::string name;
+    int megapixels = 0; // 0 for the tiny_map sample
+};
+
+std::string tinyImagePath = "label_extraction/labelless_data/tiny_map_labelless.jpg";
+std::string tinyHeatmapPath = "segmentation/heatmaps/tiny_map_labelless.hmp";
+std::string outputDir;
+
+std::vector<unsigned char> readFile(const std::string& path) {
+    std::unique_ptr<FILE, int (*)(FILE*)> file(std::fopen(path.c_str(), "rb"), std::fclose);
+    if (!file) {
+        throw std::runtime_error("Could not open: " + path);
+    }
+    std::vector<unsigned char> bytes;
+    unsigned char chunk[1 << 16];
+    size_t read;
+    while ((read = std::fread(chunk, 1, sizeof(chunk), file.get())) > 0) {
+        bytes.insert(bytes.end(), chunk, chunk + read);
+    }
+    return bytes;
+}
+
+std::unique_ptr<BenchInput> buildInput(const InputSpec& spec) {
+    auto input = std::make_unique<BenchInput>();
+    input->name = spec.name;
+    if (spec.megapixels == 0) {
+        input->jpeg = readFile(tinyImagePath);
+    } else {
+        // Sheets of about 3:2 like the scanned ones
+        int width = static_cast<int>(std::lround(std::sqrt(spec.megapixels * 1e6 * 1.5)));
+        int height = static_cast<int>(std::lround(spec.megapixels * 1e6 / width));
+        SyntheticMap map = generateStreetGrid(width, height);
+        stbi_write_jpg_to_func(
+            [](void* context, void* data, int size) {
+                auto* bytes = static_cast<std::vector<unsigned char>*>(context);
+                bytes->insert(bytes->end(), static_cast<unsigned char*>(data), static_cast<unsigned char*>(data) + size);
+            },
+            &input->jpeg, width, height, 3, map.pixels.data(), 95);
+        input->heatmap = std::move(map.heatmap);
+    }
+
+    int channels;
+    ImageBuffer decoded = decodeImage(input->jpeg.data(), input->jpeg.size(), input->width, input->height, channels);
+    const Color* pixels = reinterpret_cast<const Color*>(decoded.get());
+    input->pixels.assign(pixels, pixels + static_cast<size_t>(input->width) * input->height);
+
+    if (spec.megapixels == 0) {
+        HeatmapFile heatmap(tinyHeatmapPath, input->width, input->height);
+        const HeatmapView view = heatmap.view();
+        input->heatmap.assign(view.values, view.values + static_cast<size_t>(view.width) * view.height);
+    }
+    input->heatmapPath = outputDir + "/" + spec.name + ".hmp";
+    writeHeatmap(input->heatmapPath, {input->heatmap.data(), input->width, input->height});
+
+    Segmenter segmenter;
+    input->sheet.outputFolder = outputDir + "/" + spec.name;
+    input->sheet.width = input->width;
+    input->sheet.height = input->height;
+    input->sheet.result = segmenter.segment({input->pixels.data(), input->width, input->height},
+                                            {input->heatmap.data(), input->width, input->height}, benchConfig());
+    // writeSheet renders the segmentation preview from the image, which input owns
+    input->sheet.pixels = ImageBuffer(reinterpret_cast<unsigned char*>(input->pixels.data()), [](void*) {});
+    return input;
+}
+
+// The sheet of the running group; the previous one is released first
+BenchInput& inputFor(const InputSpec& spec) {
+    static std::unique_ptr<BenchInput> current;
+    if (!current || current->name != spec.name) {
+        current.reset();
+        current = buildInput(spec);
+    }
+    return *current;
+}
+
+void setPixelsProcessed(benchmark::State& state, const BenchInput& input) {
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * input.width * input.height);
+    state.counters["MP"] = input.width * static_cast<double>(input.height) / 1e6;
+}
+
+void benchDecode(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    for (auto _ : state) {
+        int width, height, channels;
+        ImageBuffer decoded = decodeImage(input.jpeg.data(), input.jpeg.size(), width, height, channels);
+        benchmark::DoNotOptimize(decoded.get());
+    }
+    setPixelsProcessed(state, input);
+}
+
+void benchHeatmapLoad(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    for (auto _ : state) {
+        HeatmapFile heatmap(input.heatmapPath, input.width, input.height);
+        const HeatmapView view = heatmap.view();
+        float sum = 0.0f;
+        for (size_t i = 0; i < static_cast<size_t>(view.width) * view.height; ++i) {
+            sum += view.values[i];
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    setPixelsProcessed(state, input);
+}
+
+void benchPreparePatches(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    const ImageView image{input.pixels.data(), input.width, input.height};
+    const PatchGrid grid = makePatchGrid(input.width, input.height, HeatmapOptions());
+    const int count = static_cast<int>(std::min<size_t>(1024, grid.size()));
+    const PatchResampler resampler(grid.windowSize);
+    std::vector<float> patch(static_cast<size_t>(3) * patchSize * patchSize);
+    for (auto _ : state) {
+        for (int i = 0; i < count; ++i) {
+            resampler.prepare(image, (i % grid.columns) * grid.stepSize, (i / grid.columns) * grid.stepSize,
+                              patch.data());
+            benchmark::DoNotOptimize(patch.data());
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * count);
+    state.counters["window"] = grid.windowSize;
+}
+
+void benchEdgeMap(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    const Config config = benchConfig();
+    const int threshold = colorDistanceThreshold(config.k, config.euclidif);
+    std::vector<std::uint8_t> edges;
+    for (auto _ : state) {
+        buildEdgeMap({input.pixels.data(), input.width, input.height}, config.use8Way, config.euclidif, threshold,
+                     config.threads, edges);
+        benchmark::DoNotOptimize(edges.data());
+    }
+    setPixelsProcessed(state, input);
+}
+
+void benchLabel(benchmark::State& state, InputSpec spec, FillEngine engine, int threads) {
+    BenchInput& input = inputFor(spec);
+    Config config = benchConfig();
+    config.fillEngine = engine;
+    config.threads = threads;
+    Segmenter segmenter;
+    size_t components = 0;
+    for (auto _ : state) {
+        ComponentSet result = segmenter.segment({input.pixels.data(), input.width, input.height},
+                                                {input.heatmap.data(), input.width, input.height}, config);
+        components = result.components.size();
+        benchmark::DoNotOptimize(result.components.data());
+    }
+    setPixelsProcessed(state, input);
+    state.counters["components"] = static_cast<double>(components);
+}
+
+void benchClassify(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    const Config config = benchConfig();
+    ComponentSet& result = input.sheet.result;
+    for (auto _ : state) {
+        classifyComponents(result, {input.heatmap.data(), input.width, input.height}, config);
+        benchmark::ClobberMemory();
+    }
+    setPixelsProcessed(state, input);
+}
+
+void benchHeatmapStats(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    const ComponentSet& result = input.sheet.result;
+    for (auto _ : state) {
+        const HeatmapView heatmap{input.heatmap.data(), input.width, input.height};
+        for (const Component& comp : result.components) {
+            benchmark::DoNotOptimize(heatmapStatsOf(heatmap, result.probabilityThreshold, result.runsOf(comp)));
+        }
+    }
+    setPixelsProcessed(state, input);
+}
+
+void benchOutlines(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    const ComponentSet& result = input.sheet.result;
+    size_t points = 0;
+    for (auto _ : state) {
+        points = 0;
+        for (const Component& comp : result.components) {
+            if (comp.isBuildingBlock) {
+                points += simplifyRdp(traceOutline(result, comp), benchConfig().simplifyTolerance).size();
+            }
+        }
+        benchmark::DoNotOptimize(points);
+    }
+    setPixelsProcessed(state, input);
+    state.counters["points"] = static_cast<double>(points);
+}
+
+void benchOutlineFeatures(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    for (auto _ : state) {
+        std::vector<PolygonFeatures> features =
+            computeOutlineFeatures(input.sheet.result, benchConfig().simplifyTolerance, 1);
+        benchmark::DoNotOptimize(features.data());
+    }
+    setPixelsProcessed(state, input);
+}
+
+void benchDbscan(benchmark::State& state, InputSpec spec) {
+    BenchInput& input = inputFor(spec);
+    // Columns load_and_preprocess_data keeps, min-max scaled
+    const std::vector<PolygonFeatures> features =
+        computeOutlineFeatures(input.sheet.result, benchConfig().simplifyTolerance, 0);
+    constexpr int dims = 5;
+    std::vector<double> points;
+    for (const PolygonFeatures& f : features) {
+        points.insert(points.end(), {static_cast<double>(f.sides), f.circularity, f.compactness, f.convexity, f.sideCv});
+    }
+    const size_t count = features.size();
+    for (int d = 0; d < dims; ++d) {
+        double low = 0.0, high = 0.0;
+        for (size_t i = 0; i < count; ++i) {
+            const double value = points[i * dims + d];
+            low = i == 0 ? value : std::min(low, value);
+            high = i == 0 ? value : std::max(high, value);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            points[i * dims + d] = high > low ? (points[i * dims + d] - low) / (high - low) : 0.0;
+        }
+    }
+    size_t noise = 0;
+    for (auto _ : state) {
+        const NeighborIndex index(points.data(), count, dims, 1.0, 1);
+        for (int call = 0; call < 15; ++call) {
+            noise = countNoise(index.cluster(0.1 + 0.06 * call, 2 + call));
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * count);
+    state.counters["polygons"] = static_cast<double>(count);
+    state.counters["noise"] = static_cast<double>(noise);
+}
+
+void benchFootprintMatch(benchmark::State& state, InputSpec spec, MatchOptions options) {
+    BenchInput& input = inputFor(spec);
+    const ComponentSet& result = input.sheet.result;
+    std::vector<std::vector<FootprintPoint>> rings;
+    std::vector<std::string> names;
+    for (const Component& comp : result.components) {
+        if (comp.isBuildingBlock) {
+            std::vector<FootprintPoint> ring;
+            for (const RingPoint& point : simplifyRdp(traceOutline(result, comp), benchConfig().simplifyTolerance)) {
+                ring.push_back({static_cast<double>(point.x), static_cast<double>(point.y)});
+            }
+            rings.push_back(std::move(ring));
+            names.push_back("component_" + std::to_string(comp.id));
+        }
+    }
+    std::vector<NormalizedShape> queries;
+    for (size_t i = 0; i < rings.size() && queries.size() < 16; ++i) {
+        queries.push_back(normalizeShape(rings[i].data(), rings[i].size()));
+    }
+    size_t matches = 0;
+    for (auto _ : state) {
+        const FootprintIndex index(rings, names);
+        matches = matchFootprints(queries, index, options).size();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * queries.size());
+    state.counters["footprints"] = static_cast<double>(rings.size());
+    state.counters["matches"] = static_cast<double>(matches);
+}
+
+enum class EncodeStage { Json, Table, RawRaster, TiffRaster, PreviewRender, PreviewJpeg, PreviewPng, Everything };
+
+void benchEncode(benchmark::State& state, InputSpec spec, EncodeStage stage) {
+    BenchInput& input = inputFor(spec);
+    const Config config = benchConfig();
+    Sheet& sheet = input.sheet;
+    if (!createDirectory(sheet.outputFolder)) {
+        state.SkipWithError("Failed to create the output directory");
+        return;
+    }
+    const ImageView image{input.pixels.data(), input.width, input.height};
+    std::vector<Color> preview;
+    renderSegmentationPreview(image, sheet.result, preview);
+    for (auto _ : state) {
+        switch (stage) {
+        case EncodeStage::Json:
+            writeComponentsInfo(sheet.result, sheet.outputFolder + "/components_info.json", config.compactJson);
+            break;
+        case EncodeStage::Table:
+            writeComponentTable(sheet.result, sheet.outputFolder + "/components_info.p2pc",
+                                tableLabeling(config, false));
+            break;
+        case EncodeStage::RawRaster:
+            writeLabelRaster(sheet.outputFolder + "/labels.p2pl", rasterizeLabels(sheet.result), sheet.width,
+                             sheet.height, LabelRasterFormat::Raw);
+            break;
+        case EncodeStage::TiffRaster:
+            writeLabelRaster(sheet.outputFolder + "/labels.tif", rasterizeLabels(sheet.result), sheet.width,
+                             sheet.height, LabelRasterFormat::Tiff);
+            break;
+        case EncodeStage::PreviewRender:
+            renderSegmentationPreview(image, sheet.result, preview);
+            benchmark::DoNotOptimize(preview.data());
+            break;
+        case EncodeStage::PreviewJpeg:
+        case EncodeStage::PreviewPng: {
+            const ImageFormat format = stage == EncodeStage::PreviewJpeg ? ImageFormat::Jpeg : ImageFormat::Png;
+            const auto* pixels = reinterpret_cast<const unsigned char*>(preview.data());
+            std::vector<unsigned char> bytes = encodeImage(pixels, sheet.width, sheet.height, 3, format);
+            benchmark::DoNotOptimize(bytes.data());
+            break;
+        }
+        case EncodeStage::Everything:
+            if (!writeSheet(sheet, config)) {
+                state.SkipWithError("Failed to write the outputs");
+            }
+            break;
+        }
+    }
+    setPixelsProcessed(state, input);
+}
+
+void registerGroup(const InputSpec& spec) {
+    auto add = [&](const std::string& stage, auto&& function, auto... args) {
+        benchmark::RegisterBenchmark((stage + "/" + spec.name).c_str(), function, spec, args...)
+            ->Unit(benchmark::kMillisecond)
+            ->UseRealTime();
+    };
+    add("Decode", benchDecode);
+    add("HeatmapLoad", benchHeatmapLoad);
+    add("PreparePatches", benchPreparePatches);
+    add("EdgeMap", benchEdgeMap);
+    add("Label/stack", benchLabel, FillEngine::Stack, 1);
+    add("Label/scanline", benchLabel, FillEngine::Scanline, 1);
+    add("Label/unionfind", benchLabel, FillEngine::UnionFind, 1);
+    add("Label/unionfind_mt", benchLabel, FillEngine::UnionFind, 0);
+    add("Classify", benchClassify);
+    add("HeatmapStats", benchHeatmapStats);
+    add("Outlines", benchOutlines);
+    add("OutlineFeatures", benchOutlineFeatures);
+    add("Dbscan", benchDbscan);
+    MatchOptions pruned;
+    pruned.descriptorTolerance = 0.1f;
+    pruned.rasterSize = 64;
+    add("FootprintMatch/exact", benchFootprintMatch, MatchOptions{});
+    add("FootprintMatch/pruned", benchFootprintMatch, pruned);
+    add("Encode/json", benchEncode, EncodeStage::Json);
+    add("Encode/table", benchEncode, EncodeStage::Table);
+    add("Encode/raster_raw", benchEncode, EncodeStage::RawRaster);
+    add("Encode/raster_tiff", benchEncode, EncodeStage::TiffRaster);
+    add("Encode/preview_render", benchEncode, EncodeStage::PreviewRender);
+    add("Encode/preview_jpg", benchEncode, EncodeStage::PreviewJpeg);
+    add("Encode/preview_png", benchEncode, EncodeStage::PreviewPng);
+    add("Encode/all", benchEncode, EncodeStage::Everything);
+}
+
+// Value of a --name=value flag, removed from argv
+bool takeFlag(int& argc, char** argv, const std::string& name, std::string& value) {
+    const std::string prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]).compare(0, prefix.size(), prefix) == 0) {
+            value = argv[i] + prefix.size();
+            for (int j = i; j + 1 < argc; ++j) {
+                argv[j] = argv[j + 1];
+            }
+            argc--;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string sizes = "1,16";
+    takeFlag(argc, argv, "sizes", sizes);
+    takeFlag(argc, argv, "tiny_image", tinyImagePath);
+    takeFlag(argc, argv, "tiny_heatmap", tinyHeatmapPath);
+    const char* temp = std::getenv("TMPDIR");
+    outputDir = std::string(temp ? temp : "/tmp") + "/p2p_bench";
+    takeFlag(argc, argv, "output", outputDir);
+    if (!createDirectory(outputDir)) {
+        std::cerr << "Failed to create directory: " << outputDir << "\n";
+        return 1;
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    if (std::FILE* tiny = std::fopen(tinyImagePath.c_str(), "rb")) {
+        std::fclose(tiny);
+        registerGroup({"tiny_map", 0});
+    } else {
+        std::cerr << "Skipping tiny_map, not found: " << tinyImagePath << "\n";
+    }
+    std::istringstream list(sizes);
+    std::string size;
+    while (std::getline(list, size, ',')) {
+        int megapixels = std::stoi(size);
+        if (megapixels > 0) {
+            registerGroup({"synthetic_" + std::to_string(megapixels) + "MP", megapixels});
+        }
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,1450 @@
+#include "segmentation_io.h"
+#include "component_table.h"
+#include "contour.h"
+#include "heatmap_format.h"
+#include "heatmap_index.h"
+#include "image_codec.h"
+#include "json_writer.h"
+#include "label_raster.h"
+#include "segmentation_preview.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <cerrno>
+#include <cmath>
+#include <memory>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <exception>
+#include <thread>
+#include <unordered_map>
+
+Config readConfig(const std::string& configFile) {
+    Config config;
+    std::ifstream file(configFile);
+    if (!file) {
+        throw std::runtime_error("Could not open config file.");
+    }
+
+    file >> config.k >> config.use8Way >> config.euclidif >> config.adj >> config.minComponentSize >> config.buildingBlockTreshold;
+    if (!file) {
+        throw std::runtime_error("Malformed config file.");
+    }
+
+    // Optional "key value" settings after the positional values
+    std::string key;
+    while (file >> key) {
+        std::string value;
+        if (!(file >> value)) {
+            throw std::runtime_error("Missing value for config key: " + key);
+        }
+        if (key == "engine") {
+            config.fillEngine = parseFillEngine(value);
+        } else if (key == "threads") {
+            config.threads = std::stoi(value);
+        } else if (key == "probability_percentile") {
+            config.probabilityPercentile = std::stod(value);
+        } else if (key == "size_percentile") {
+            config.sizePercentile = std::stod(value);
+        } else if (key == "masks") {
+            config.writeMasks = std::stoi(value) != 0;
+        } else if (key == "polygons") {
+            config.writePolygons = std::stoi(value) != 0;
+        } else if (key == "simplify_tolerance") {
+            config.simplifyTolerance = std::stod(value);
+        } else if (key == "compact_json") {
+            config.compactJson = std::stoi(value) != 0;
+        } else if (key == "component_table") {
+            config.writeComponentTable = std::stoi(value) != 0;
+        } else if (key == "label_raster") {
+            config.labelRaster = parseLabelRasterFormat(value);
+        } else if (key == "band_height") {
+            config.bandHeight = std::stoi(value);
+        } else if (key == "metrics") {
+            config.metrics = parseMetricsFormat(value);
+        } else if (key == "image_format") {
+            config.imageFormat = parseImageFormat(value);
+        } else if (key == "previews") {
+            config.writePreviews = std::stoi(value) != 0;
+        } else if (key == "heatmap_stats") {
+            config.heatmapStats = std::stoi(value) != 0;
+        } else {
+            throw std::runtime_error("Unknown config key: " + key);
+        }
+    }
+    file.close();
+    return config;
+}
+
+// Function to name a percentile fraction, e.g. 0.8 as "80th"
+std::string percentileName(double fraction) {
+    std::ostringstream name;
+    double percent = fraction * 100.0;
+    name << percent;
+    long whole = std::lround(percent);
+    if (std::abs(percent - whole) > 1e-9 || (whole % 100 >= 11 && whole % 100 <= 13)) {
+        name << "th";
+    } else {
+        switch (whole % 10) {
+        case 1: name << "st"; break;
+        case 2: name << "nd"; break;
+        case 3: name << "rd"; break;
+        default: name << "th"; break;
+        }
+    }
+    return name.str();
+}
+
+// Function to get files in a directory
+std::vector<std::string> getFiles(const std::string& directory) {
+    std::vector<std::string> files;
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+        throw std::runtime_error("Could not open directory: " + directory);
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string name = entry->d_name;
+        if (name != "." && name != "..") {
+            files.push_back(directory + "/" + name);
+        }
+    }
+    closedir(dir);
+    return files;
+}
+
+// Function to create a directory
+bool createDirectory(const std::string& dir) {
+    #ifdef _WIN32
+    return mkdir(dir.c_str()) == 0 || errno == EEXIST; // Windows
+    #else
+    return mkdir(dir.c_str(), 0777) == 0 || errno == EEXIST; // POSIX
+    #endif
+}
+
+namespace {
+
+// Function to replace the file at path with the one write(temporaryPath) creates next to it,
+// so a failure leaves the previous file whole. Throws std::runtime_error on failure.
+template <typename Write>
+void replaceFile(const std::string& path, Write write) {
+    const std::string temporaryPath = path + ".tmp";
+    try {
+        write(temporaryPath);
+#ifdef _WIN32
+        std::remove(path.c_str()); // rename does not replace an existing file there
+#endif
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            throw std::runtime_error("Could not replace file: " + path);
+        }
+    } catch (...) {
+        std::remove(temporaryPath.c_str());
+        throw;
+    }
+}
+
+// Binary PPM read a few rows at a time
+class PpmRowSource : public RowSource {
+public:
+    PpmRowSource(std::ifstream&& file, const std::string& path) : file_(std::move(file)), path_(path) {
+        file_.seekg(2);
+        int maxValue = 0;
+        if (!(readHeaderValue(width_) && readHeaderValue(height_) && readHeaderValue(maxValue)) ||
+            maxValue != 255 || width_ <= 0 || height_ <= 0) {
+            throw std::runtime_error("Unsupported PPM file, expected 8-bit P6: " + path);
+        }
+        file_.get(); // Single whitespace before the pixels
+    }
+
+    void readRows(int count, Color* rows) override {
+        file_.read(reinterpret_cast<char*>(rows), static_cast<std::streamsize>(count) * width_ * sizeof(Color));
+        if (!file_) {
+            throw std::runtime_error("Truncated PPM file: " + path_);
+        }
+    }
+
+private:
+    // Next header number, skipping whitespace and comments
+    bool readHeaderValue(int& value) {
+        int c = file_.peek();
+        while (c == '#' || std::isspace(c)) {
+            if (c == '#') {
+                file_.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            } else {
+                file_.get();
+            }
+            c = file_.peek();
+        }
+        return static_cast<bool>(file_ >> value);
+    }
+
+    std::ifstream file_;
+    std::string path_;
+};
+
+// Image decoded whole by decodeImage, handed out row by row
+class DecodedRowSource : public RowSource {
+public:
+    explicit DecodedRowSource(const std::string& path) {
+        int channels;
+        pixels_ = decodeImage(path, width_, height_, channels);
+    }
+
+    void readRows(int count, Color* rows) override {
+        const size_t bytes = static_cast<size_t>(count) * width_ * sizeof(Color);
+        std::memcpy(rows, pixels_.get() + static_cast<size_t>(nextRow_) * width_ * sizeof(Color), bytes);
+        nextRow_ += count;
+    }
+
+private:
+    ImageBuffer pixels_{nullptr, nullptr};
+    int nextRow_ = 0;
+};
+
+// Heatmap file handed out a band at a time, each band decoded as it is asked for
+class HeatmapFileRows : public HeatmapRowSource {
+public:
+    explicit HeatmapFileRows(HeatmapFile& heatmap) : heatmap_(heatmap) {
+        width_ = heatmap.width();
+        height_ = heatmap.height();
+    }
+
+    const float* waitRows(int rowBegin, int rowEnd) override { return heatmap_.rows(rowBegin, rowEnd); }
+    void finish(float& low, float& range) override {
+        low = 0.0f;
+        range = 1.0f;
+    }
+    const float* finishedRows(int rowBegin, int rowEnd) override { return heatmap_.rows(rowBegin, rowEnd); }
+
+private:
+    HeatmapFile& heatmap_;
+};
+
+// Image held in memory by the caller, handed out row by row
+class ViewRowSource : public RowSource {
+public:
+    explicit ViewRowSource(const ImageView& image) : image_(image) {
+        width_ = image.width;
+        height_ = image.height;
+    }
+
+    void readRows(int count, Color* rows) override {
+        std::copy_n(image_.pixels + static_cast<size_t>(nextRow_) * width_, static_cast<size_t>(count) * width_, rows);
+        nextRow_ += count;
+    }
+
+private:
+    ImageView image_;
+    int nextRow_ = 0;
+};
+
+} // namespace
+
+std::unique_ptr<RowSource> openRowSource(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[2] = {};
+    if (file.read(magic, 2) && magic[0] == 'P' && magic[1] == '6') {
+        return std::make_unique<PpmRowSource>(std::move(file), path);
+    }
+    if (std::unique_ptr<RowSource> jpeg = openJpegRowSource(path)) {
+        return jpeg;
+    }
+    return std::make_unique<DecodedRowSource>(path);
+}
+
+namespace {
+
+// Consecutive rows of an image read through openRowSource, for resegmentImage. Rows below the
+// band are read on from where the source stopped; rows above it open the image again and
+// skip down to them.
+class ImageRowBand {
+public:
+    ImageRowBand(const std::string& path, int width, int height) : path_(path), width_(width), height_(height) {}
+
+    int rowBegin() const { return rowBegin_; }
+    int rowEnd() const { return rowEnd_; }
+    ImageView view() const { return {rows_.data(), width_, rowEnd_ - rowBegin_}; }
+
+    // Hold at least the rows [rowBegin, rowEnd), clamped to the image
+    void read(int rowBegin, int rowEnd) {
+        rowBegin = std::max(rowBegin, 0);
+        rowEnd = std::min(rowEnd, height_);
+        if (rowBegin >= rowEnd) {
+            return;
+        }
+        rowEnd = std::max(rowEnd, rowEnd_);
+        if (!source_ || rowBegin < rowBegin_ || rowEnd_ == rowBegin_) {
+            source_ = openRowSource(path_);
+            if (source_->width() != width_ || source_->height() != height_) {
+                throw std::runtime_error("Image size " + std::to_string(source_->width()) + "x" +
+                                         std::to_string(source_->height()) + " does not match the label raster: " +
+                                         path_);
+            }
+            std::vector<Color> skipped(width_);
+            for (int y = 0; y < rowBegin; ++y) {
+                source_->readRows(1, skipped.data());
+            }
+            rows_.clear();
+            rowBegin_ = rowBegin;
+            rowEnd_ = rowBegin;
+        }
+        if (rowEnd > rowEnd_) {
+            rows_.resize(static_cast<size_t>(rowEnd - rowBegin_) * width_);
+            source_->readRows(rowEnd - rowEnd_, rows_.data() + static_cast<size_t>(rowEnd_ - rowBegin_) * width_);
+            rowEnd_ = rowEnd;
+        }
+    }
+
+private:
+    std::string path_;
+    int width_;
+    int height_;
+    std::unique_ptr<RowSource> source_;
+    std::vector<Color> rows_;
+    int rowBegin_ = 0;
+    int rowEnd_ = 0;
+};
+
+} // namespace
+
+// Function to encode a segmentation image
+std::vector<unsigned char> encodeSegmentation(const std::vector<Color>& image, int width, int height,
+                                              ImageFormat format) {
+    return encodeImage(reinterpret_cast<const unsigned char*>(image.data()), width, height, 3, format);
+}
+
+// Function to save a mask for a connected component, cropped to its bounding box. JPEG
+// masks stay RGB like the original outputs, PNG masks are grayscale.
+void saveMask(RunRange runs, int xMin, int yMin, int width, int height, ImageFormat format,
+              const std::string& filePath) {
+    const int channels = format == ImageFormat::Png ? 1 : 3;
+    std::vector<unsigned char> maskImage(static_cast<size_t>(width) * height * channels, 255);
+    for (const PixelRun& run : runs) {
+        unsigned char* row = maskImage.data() + (static_cast<size_t>(run.y - yMin) * width + run.xBegin - xMin) * channels;
+        std::fill(row, row + (run.xEnd - run.xBegin + 1) * channels, 0); // Black pixels for component
+    }
+    writeImage(filePath, maskImage.data(), width, height, channels, format);
+}
+
+// Function to get the file name of the mask of a component
+std::string maskFileName(const Component& comp, ImageFormat format) {
+    std::ostringstream name;
+    name << "component_" << std::setw(5) << std::setfill('0') << comp.id << "." << imageFormatName(format);
+    return name.str();
+}
+
+// Function to paint the pixels of a component into an image
+void paintRuns(std::vector<Color>& image, int width, RunRange runs, const Color& color) {
+    for (const PixelRun& run : runs) {
+        std::fill(image.begin() + run.y * width + run.xBegin, image.begin() + run.y * width + run.xEnd + 1, color);
+    }
+}
+
+// Function to read the entries of a polygons.json savePolygons wrote, the value after each
+// "component_<id>" key by id, empty when the file cannot be read. Only bracket depth is
+// tracked, since the keys are the only strings and hold no brackets.
+std::unordered_map<int, std::string> readPolygonEntries(const std::string& filePath) {
+    std::unordered_map<int, std::string> entries;
+    std::ifstream file(filePath, std::ios::binary);
+    const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    const std::string prefix = "\"component_";
+    size_t position = text.find(prefix);
+    while (position != std::string::npos) {
+        const int id = std::atoi(text.c_str() + position + prefix.size());
+        const size_t begin = text.find('[', position);
+        if (begin == std::string::npos) {
+            break;
+        }
+        int depth = 0;
+        size_t end = begin;
+        for (; end < text.size(); ++end) {
+            if (text[end] == '[' || text[end] == '{') {
+                ++depth;
+            } else if ((text[end] == ']' || text[end] == '}') && --depth == 0) {
+                break;
+            }
+        }
+        if (end == text.size()) {
+            break;
+        }
+        entries[id] = text.substr(begin, end + 1 - begin);
+        position = text.find(prefix, end);
+    }
+    return entries;
+}
+
+// Function to save the outlines of the building blocks in the JSON layout written by
+// vectorize.group_shapefile_data: rings are relative to the bounding box, flipped
+// vertically about their own bounding box center like vectorize.flip_vertical and
+// clockwise in that flipped frame. Components in kept get that entry instead of being traced.
+void savePolygons(const ComponentSet& result, double tolerance, bool compact, const std::string& filePath,
+                  const std::unordered_map<int, std::string>& kept = {}) {
+    JsonWriter json(filePath, compact);
+    json.raw('{');
+    bool first = true;
+    for (const Component& comp : result.components) {
+        if (!comp.isBuildingBlock) {
+            continue;
+        }
+        std::ostringstream name;
+        name << "component_" << std::setw(5) << std::setfill('0') << comp.id;
+        auto entry = kept.find(comp.id);
+        if (entry != kept.end()) {
+            if (!first) {
+                json.raw(',');
+            }
+            first = false;
+            json.newline(4).key(name.str().c_str()).raw(entry->second.c_str());
+            continue;
+        }
+        std::vector<RingPoint> ring = traceOutline(result, comp);
+        if (tolerance > 0.0) {
+            ring = simplifyRdp(ring, tolerance);
+        }
+        int yMin = ring.front().y;
+        int yMax = ring.front().y;
+        for (const RingPoint& point : ring) {
+            yMin = std::min(yMin, point.y);
+            yMax = std::max(yMax, point.y);
+        }
+
+        if (!first) {
+            json.raw(',');
+        }
+        first = false;
+        json.newline(4).key(name.str().c_str()).raw('[');
+        json.newline(8).raw('{');
+        json.newline(12).key("coordinates").raw('[');
+        for (size_t i = 0; i < ring.size(); ++i) {
+            if (i > 0) {
+                json.raw(',').space();
+            }
+            json.raw('[').value(ring[i].x - comp.xMin).raw(',').space();
+            json.value(yMin + yMax - ring[i].y - comp.yMin).raw(']');
+        }
+        json.raw("],");
+        json.newline(12).key("top_left_corner").raw('[').value(comp.xMin).raw(',').space();
+        json.value(comp.yMin).raw("],");
+        json.newline(12).key("width").value(comp.width()).raw(',');
+        json.newline(12).key("height").value(comp.height());
+        json.newline(8).raw('}');
+        json.newline(4).raw(']');
+    }
+    json.newline().raw('}');
+    json.close();
+}
+
+void processImages(const std::string& inputDir, const std::string& outputDir, const Config& config) {
+    std::vector<std::string> files = getFiles(inputDir);
+    std::cout << "Number of files in the directory: " << files.size() << "\n";
+
+    Segmenter segmenter;
+    int i = -1;
+    for (const auto& filePath : files) {
+        std::cout << filePath <<"\n";
+        // Check if the file is an image based on its extension
+        if (filePath.size() >= 4 && filePath.substr(filePath.size() - 4) == ".hmp") continue;
+        i++;
+
+        // Load image data
+        int width, height, channels;
+        ImageBuffer imgData{nullptr, nullptr};
+        try {
+            imgData = decodeImage(filePath, width, height, channels);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            continue;
+        }
+
+        std::cout << "Processing image " << i + 1 << ": " << filePath
+                  << " (Width: " << width << ", Height: " << height << ", Channels: " << channels << ")\n";
+
+        // Derive the heatmap file path and map it
+        std::string heatmapPath = filePath.substr(0, filePath.size() - 4) + ".hmp";
+        std::unique_ptr<HeatmapFile> heatmap;
+        try {
+            heatmap = std::make_unique<HeatmapFile>(heatmapPath, width, height);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            continue;
+        }
+
+        std::ostringstream folderPath;
+        folderPath << outputDir << "/" << std::setw(3) << std::setfill('0') << (i + 1);
+        std::ostringstream buildingBlocksFolderPath;
+        buildingBlocksFolderPath << folderPath.str() << "/building_blocks";
+        std::ostringstream nonBuildingBlocksFolderPath;
+        nonBuildingBlocksFolderPath << folderPath.str() << "/non_building_blocks";
+        if (!createDirectory(folderPath.str()) || !createDirectory(buildingBlocksFolderPath.str()) ||
+            !createDirectory(nonBuildingBlocksFolderPath.str())) {
+            std::cerr << "Failed to create directories in: " << folderPath.str() << "\n";
+            continue;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        ImageView image{reinterpret_cast<const Color*>(imgData.get()), width, height};
+        ComponentSet result = segmenter.segment(image, heatmap->view(), config);
+        if (!config.writePreviews) {
+            imgData.reset();
+        }
+
+        // This mode classifies with the fixed buildingBlockTreshold instead of the percentiles.
+        // The classification replaces the one of the segmenter, so the masks, the preview, the
+        // JSON and the table all agree; a component covering a quarter of the sheet or more is
+        // the background and never a building block.
+        float heatmapThreshold = config.buildingBlockTreshold;
+        result.probabilityPercentile = 0.0f;
+        result.probabilityThreshold = heatmapThreshold;
+        for (Component& comp : result.components) {
+            comp.isBuildingBlock = comp.avgProbability >= heatmapThreshold &&
+                                   static_cast<long long>(comp.size) * 4 < static_cast<long long>(width) * height;
+        }
+
+        // Save each component in the folder of its class
+        for (const Component& comp : result.components) {
+            if (!config.writeMasks) {
+                break;
+            }
+            const std::string& folder = comp.isBuildingBlock ? buildingBlocksFolderPath.str()
+                                                             : nonBuildingBlocksFolderPath.str();
+            try {
+                saveMask(result.runsOf(comp), comp.xMin, comp.yMin, comp.width(), comp.height(), config.imageFormat,
+                         folder + "/" + maskFileName(comp, config.imageFormat));
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+            }
+
+            if (comp.id % 100 == 0) std::cout << comp.id << " processed components.\n";
+        }
+
+        // Write component information in JSON format and as the binary table, and the label raster
+        try {
+            writeComponentsInfo(result, folderPath.str() + "/components_info.json", config.compactJson);
+            if (config.writeComponentTable) {
+                writeComponentTable(result, folderPath.str() + "/components_info.p2pc", tableLabeling(config, false));
+            }
+            if (config.labelRaster != LabelRasterFormat::None) {
+                writeLabelRaster(folderPath.str() + "/" + labelRasterFileName(config.labelRaster),
+                                 rasterizeLabels(result), width, height, config.labelRaster);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+
+        std::cout << "Finished processing: " << filePath
+                  << " (Components: " << result.components.size() << ", Time: " << elapsed.count() << "s)\n";
+
+        // Save segmentation image, encoded once and written to the folder as well
+        if (config.writePreviews) {
+            const std::string extension = "." + imageFormatName(config.imageFormat);
+            try {
+                std::vector<Color> preview;
+                renderSegmentationPreview(image, result, preview);
+                imgData.reset();
+                std::vector<unsigned char> segmentation = encodeSegmentation(preview, width, height,
+                                                                             config.imageFormat);
+                std::ostringstream segPath;
+                segPath << outputDir << "/output_" << std::setw(3) << std::setfill('0') << (i + 1) << extension;
+                writeFileBytes(segPath.str(), segmentation);
+                writeFileBytes(folderPath.str() + "/output" + extension, segmentation);
+                std::vector<Color> buildingBlocksImage(static_cast<size_t>(width) * height, {255, 255, 255});
+                for (const Component& comp : result.components) {
+                    if (comp.isBuildingBlock) {
+                        paintRuns(buildingBlocksImage, width, result.runsOf(comp), {0, 0, 0});
+                    }
+                }
+                std::ostringstream buildingBlocksImagePath;
+                buildingBlocksImagePath << outputDir << "/building_blocks_" << std::setw(3) << std::setfill('0')
+                                        << (i + 1) << extension;
+                writeFileBytes(buildingBlocksImagePath.str(),
+                               encodeSegmentation(buildingBlocksImage, width, height, config.imageFormat));
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << "\n";
+            }
+        }
+
+        std::cout << "Component information written to components_info.json" << std::endl;
+    }
+}
+
+
+
+// Segment a sheet in bands of config.bandHeight rows and write its outputs, reading the
+// heatmap band by band as well. The run metrics are left to the caller.
+bool streamSheet(const std::string& imagePath, RowSource& image, HeatmapRowSource& heatmap,
+                 const std::string& outputFolder, const Config& config, RunMetrics& metrics) {
+    std::cout << "Processing image: " << imagePath << " (Width: " << image.width()
+              << ", Height: " << image.height() << ", Bands of " << config.bandHeight << " rows)\n";
+
+    std::string buildingBlocksFolder = outputFolder + "/building_blocks";
+    std::string nonBuildingBlocksFolder = outputFolder + "/non_building_blocks";
+    if (!createDirectory(outputFolder) || !createDirectory(buildingBlocksFolder) ||
+        !createDirectory(nonBuildingBlocksFolder)) {
+        std::cerr << "Failed to create directories in: " << outputFolder << "\n";
+        return false;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Masks, outlines and heatmap statistics are read back from a raw label raster, a
+    // temporary one unless the raw raster was requested
+    bool needsRaster = config.labelRaster != LabelRasterFormat::None || config.writeMasks || config.writePolygons ||
+                       config.heatmapStats;
+    std::string rasterPath = outputFolder + "/" + labelRasterFileName(LabelRasterFormat::Raw);
+    if (config.labelRaster != LabelRasterFormat::Raw) {
+        rasterPath += ".tmp";
+    }
+
+    const int width = image.width();
+    const int height = image.height();
+    const std::uint64_t pixels = static_cast<std::uint64_t>(width) * height;
+    metrics.setRun(imagePath, width, height, config);
+    bool written = true;
+    try {
+        metrics.beginStage("segment", pixels);
+        StreamingSegmenter segmenter;
+        ComponentSet result = segmenter.segment(image, heatmap, config, needsRaster ? rasterPath : "");
+        metrics.addSegmenterStages(result, pixels);
+        metrics.endStage(config.labelRaster == LabelRasterFormat::Raw ? fileSize(rasterPath) : 0);
+        metrics.setComponents(result);
+        std::cout << "Probability " << percentileName(config.probabilityPercentile)
+                  << " percentile threshold: " << result.probabilityThreshold << "\n";
+        std::cout << "Component size " << percentileName(config.sizePercentile)
+                  << " percentile threshold: " << result.sizeThreshold << "\n";
+        if (config.heatmapStats) {
+            // In one pass over the raster and the finished heatmap, a band at a time; the ids
+            // of a streamed sheet are 1 to the component count
+            metrics.beginStage("heatmap_stats", pixels);
+            LabelRasterReader raster(rasterPath);
+            std::vector<HeatmapStatsSums> sums(result.components.size() + 1);
+            std::vector<std::uint32_t> labels(static_cast<size_t>(config.bandHeight) * width);
+            for (int y0 = 0; y0 < height; y0 += config.bandHeight) {
+                const int y1 = std::min(y0 + config.bandHeight, height);
+                raster.readRows(y0, y1, labels.data());
+                const float* values = heatmap.finishedRows(y0, y1);
+                for (size_t i = 0; i < static_cast<size_t>(y1 - y0) * width; ++i) {
+                    if (labels[i] != 0) {
+                        sums[labels[i]].add(values[i], result.probabilityThreshold);
+                    }
+                }
+            }
+            result.heatmapStats.reserve(result.components.size());
+            for (const Component& comp : result.components) {
+                result.heatmapStats.push_back(sums[comp.id].stats());
+            }
+            metrics.endStage();
+        }
+
+        const std::string infoPath = outputFolder + "/components_info.json";
+        metrics.beginStage("components_info");
+        writeComponentsInfo(result, infoPath, config.compactJson);
+        metrics.endStage(fileSize(infoPath));
+        if (config.writeComponentTable) {
+            const std::string tablePath = outputFolder + "/components_info.p2pc";
+            metrics.beginStage("component_table");
+            writeComponentTable(result, tablePath, tableLabeling(config, true));
+            metrics.endStage(fileSize(tablePath));
+        }
+        if (config.labelRaster != LabelRasterFormat::None || config.writeMasks || config.writePolygons) {
+            // Only the building blocks keep their runs, for the outlines
+            metrics.beginStage("masks", pixels);
+            std::uint64_t maskBytes = 0;
+            LabelRasterReader raster(rasterPath);
+            for (Component& comp : result.components) {
+                if (!config.writeMasks && !(config.writePolygons && comp.isBuildingBlock)) {
+                    continue;
+                }
+                std::vector<PixelRun> runs = raster.readRuns(comp);
+                if (config.writeMasks) {
+                    const std::string targetPath = (comp.isBuildingBlock ? buildingBlocksFolder : nonBuildingBlocksFolder) +
+                                                   "/" + maskFileName(comp, config.imageFormat);
+                    saveMask({runs.data(), runs.data() + runs.size()}, comp.xMin, comp.yMin, comp.width(),
+                             comp.height(), config.imageFormat, targetPath);
+                    maskBytes += fileSize(targetPath);
+                }
+                if (config.writePolygons && comp.isBuildingBlock) {
+                    comp.runBegin = result.runs.size();
+                    result.runs.insert(result.runs.end(), runs.begin(), runs.end());
+                    comp.runEnd = result.runs.size();
+                }
+            }
+            metrics.endStage(maskBytes);
+            if (config.writePolygons) {
+                const std::string polygonsPath = outputFolder + "/polygons.json";
+                metrics.beginStage("polygons");
+                savePolygons(result, config.simplifyTolerance, config.compactJson, polygonsPath);
+                metrics.endStage(fileSize(polygonsPath));
+            }
+            if (config.labelRaster == LabelRasterFormat::Tiff) {
+                const std::string tiffPath = outputFolder + "/" + labelRasterFileName(config.labelRaster);
+                metrics.beginStage("label_raster", pixels);
+                convertLabelRasterToTiff(rasterPath, tiffPath);
+                metrics.endStage(fileSize(tiffPath));
+            }
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        std::cout << "Finished processing: " << imagePath << " (Components: " << result.components.size()
+                  << ", Time: " << elapsed.count() << "s)\n";
+        std::cout << "Component information written to components_info.json\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        metrics.endStage();
+        written = false;
+    }
+    if (needsRaster && config.labelRaster != LabelRasterFormat::Raw) {
+        std::remove(rasterPath.c_str());
+    }
+    return written;
+}
+
+
+// processImage in bands of config.bandHeight rows
+bool processImageStreaming(const std::string& imagePath, const std::string& heatmapPath,
+                           const std::string& outputFolder, const Config& config) {
+    RunMetrics metrics;
+    std::unique_ptr<RowSource> image;
+    std::unique_ptr<HeatmapFile> heatmap;
+    try {
+        metrics.beginStage("open");
+        image = openRowSource(imagePath);
+        heatmap = std::make_unique<HeatmapFile>(heatmapPath, image->width(), image->height());
+        metrics.endStage();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return false;
+    }
+    HeatmapFileRows heatmapRows(*heatmap);
+    bool written = streamSheet(imagePath, *image, heatmapRows, outputFolder, config, metrics);
+    writeRunMetrics(metrics, outputFolder, config);
+    return written;
+}
+
+// processImageWithModel in bands: the inference runs on a worker thread and each band is
+// labeled as soon as its heatmap rows are final
+bool processImageWithModelStreaming(const std::string& imagePath, PatchClassifier& classifier,
+                                    const std::string& outputFolder, const Config& config,
+                                    const HeatmapOptions& options, const std::string& heatmapOutputPath) {
+    RunMetrics metrics;
+    ImageBuffer pixels{nullptr, nullptr};
+    int width = 0, height = 0;
+    try {
+        metrics.beginStage("open");
+        int channels;
+        pixels = decodeImage(imagePath, width, height, channels);
+        metrics.endStage();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return false;
+    }
+
+    const ImageView image{reinterpret_cast<const Color*>(pixels.get()), width, height};
+    ViewRowSource rows(image);
+    StreamingHeatmapInference inference(image, classifier, options);
+    bool written = streamSheet(imagePath, rows, inference, outputFolder, config, metrics);
+    try {
+        float low, range;
+        inference.finish(low, range);
+        std::cout << "Heatmap inferred from " << inference.grid().size() << " windows of "
+                  << inference.grid().windowSize << " pixels in " << inference.seconds() << "s\n";
+        if (!heatmapOutputPath.empty()) {
+            metrics.beginStage("heatmap_output", static_cast<std::uint64_t>(width) * height);
+            writeHeatmap(heatmapOutputPath, {inference.values().data(), width, height});
+            metrics.endStage(fileSize(heatmapOutputPath));
+        }
+    } catch (const std::exception& e) {
+        if (written) {
+            std::cerr << e.what() << "\n";
+        }
+        metrics.endStage();
+        written = false;
+    }
+    writeRunMetrics(metrics, outputFolder, config);
+    return written;
+}
+
+void loadSheet(Sheet& sheet) {
+    int channels;
+    int infoWidth = 0, infoHeight = 0;
+    readImageSize(sheet.imagePath, infoWidth, infoHeight);
+    sheet.metrics.beginStage("decode", static_cast<std::uint64_t>(infoWidth) * infoHeight);
+    sheet.pixels = decodeImage(sheet.imagePath, sheet.width, sheet.height, channels);
+    sheet.metrics.endStage();
+    std::ostringstream message;
+    message << "Processing image: " << sheet.imagePath
+            << " (Width: " << sheet.width << ", Height: " << sheet.height
+            << ", Channels: " << channels << ")\n";
+    std::cout << message.str();
+
+    if (sheet.heatmapPath.empty()) {
+        return;
+    }
+    const std::uint64_t pixels = static_cast<std::uint64_t>(sheet.width) * sheet.height;
+    sheet.metrics.beginStage("heatmap", pixels);
+    sheet.heatmap = std::make_unique<HeatmapFile>(sheet.heatmapPath, sheet.width, sheet.height);
+    sheet.metrics.endStage();
+}
+
+void inferSheetHeatmap(Sheet& sheet, PatchClassifier& classifier, const HeatmapOptions& options,
+                       const std::string& heatmapOutputPath) {
+    const std::uint64_t pixels = static_cast<std::uint64_t>(sheet.width) * sheet.height;
+    const PatchGrid grid = makePatchGrid(sheet.width, sheet.height, options);
+    ImageView image{reinterpret_cast<const Color*>(sheet.pixels.get()), sheet.width, sheet.height};
+    sheet.metrics.beginStage("inference", pixels);
+    sheet.heatmapValues = inferHeatmap(image, classifier, options);
+    sheet.metrics.endStage();
+    std::ostringstream message;
+    message << "Heatmap inferred from " << grid.size() << " windows of " << grid.windowSize << " pixels\n";
+    std::cout << message.str();
+    if (!heatmapOutputPath.empty()) {
+        sheet.metrics.beginStage("heatmap_output", pixels);
+        writeHeatmap(heatmapOutputPath, {sheet.heatmapValues.data(), sheet.width, sheet.height});
+        sheet.metrics.endStage(fileSize(heatmapOutputPath));
+    }
+}
+
+void segmentSheet(Segmenter& segmenter, Sheet& sheet, const Config& config) {
+    const std::uint64_t pixels = static_cast<std::uint64_t>(sheet.width) * sheet.height;
+    sheet.metrics.beginStage("segment", pixels);
+    ImageView image{reinterpret_cast<const Color*>(sheet.pixels.get()), sheet.width, sheet.height};
+    HeatmapView heatmap = sheet.heatmap ? sheet.heatmap->view()
+                                        : HeatmapView{sheet.heatmapValues.data(), sheet.width, sheet.height};
+    sheet.result = segmenter.segment(image, heatmap, config, sheet.arena ? sheet.arena->takeResult() : ComponentSet());
+    if (!config.writePreviews) {
+        sheet.pixels.reset();
+    }
+    sheet.metrics.addSegmenterStages(sheet.result, pixels);
+    sheet.metrics.endStage();
+    if (config.heatmapStats) {
+        sheet.metrics.beginStage("heatmap_stats", pixels);
+        computeHeatmapStats(sheet.result, heatmap, config.threads);
+        sheet.metrics.endStage();
+    }
+    sheet.heatmap.reset();
+    sheet.heatmapValues = std::vector<float>();
+    sheet.metrics.setRun(sheet.imagePath, sheet.width, sheet.height, config);
+    sheet.metrics.setComponents(sheet.result);
+    std::ostringstream message;
+    message << "Probability " << percentileName(config.probabilityPercentile)
+            << " percentile threshold: " << sheet.result.probabilityThreshold << "\n";
+    message << "Component size " << percentileName(config.sizePercentile)
+            << " percentile threshold: " << sheet.result.sizeThreshold << "\n";
+    std::cout << message.str();
+}
+
+bool writeSheet(Sheet& sheet, const Config& config) {
+    const ComponentSet& result = sheet.result;
+    RunMetrics& metrics = sheet.metrics;
+    const std::uint64_t pixels = static_cast<std::uint64_t>(sheet.width) * sheet.height;
+    const std::string& outputFolder = sheet.outputFolder;
+    const int width = sheet.width;
+    const int height = sheet.height;
+
+    // Create necessary directories
+    std::string buildingBlocksFolder = outputFolder + "/building_blocks";
+    std::string nonBuildingBlocksFolder = outputFolder + "/non_building_blocks";
+    if (!createDirectory(outputFolder) || !createDirectory(buildingBlocksFolder) ||
+        !createDirectory(nonBuildingBlocksFolder)) {
+        std::cerr << "Failed to create directories in: " << outputFolder << "\n";
+        return false;
+    }
+
+    // Save the mask of each component
+    bool written = true;
+    if (config.writeMasks) {
+        metrics.beginStage("masks", pixels);
+        std::uint64_t maskBytes = 0;
+        try {
+            for (const Component& comp : result.components) {
+                const std::string targetPath = (comp.isBuildingBlock ? buildingBlocksFolder : nonBuildingBlocksFolder) +
+                                               "/" + maskFileName(comp, config.imageFormat);
+                saveMask(result.runsOf(comp), comp.xMin, comp.yMin, comp.width(), comp.height(), config.imageFormat,
+                         targetPath);
+                maskBytes += fileSize(targetPath);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << "\n";
+            written = false;
+        }
+        metrics.endStage(maskBytes);
+    }
+
+    // Write component information, the table, the label raster and the outlines
+    try {
+        const std::string infoPath = outputFolder + "/components_info.json";
+        metrics.beginStage("components_info");
+        writeComponentsInfo(result, infoPath, config.compactJson);
+        metrics.endStage(fileSize(infoPath));
+        if (config.writeComponentTable) {
+            const std::string tablePath = outputFolder + "/components_info.p2pc";
+            metrics.beginStage("component_table");
+            writeComponentTable(result, tablePath, tableLabeling(config, false));
+            metrics.endStage(fileSize(tablePath));
+        }
+        if (config.labelRaster != LabelRasterFormat::None) {
+            const std::string rasterPath = outputFolder + "/" + labelRasterFileName(config.labelRaster);
+            metrics.beginStage("label_raster", pixels);
+            writeLabelRaster(rasterPath, rasterizeLabels(result), width, height, config.labelRaster);
+            metrics.endStage(fileSize(rasterPath));
+        }
+        if (config.writePolygons) {
+            const std::string polygonsPath = outputFolder + "/polygons.json";
+            metrics.beginStage("polygons");
+            savePolygons(result, config.simplifyTolerance, config.compactJson, polygonsPath);
+            metrics.endStage(fileSize(polygonsPath));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        metrics.endStage();
+        written = false;
+    }
+
+    // Save segmentation images, both rendered and encoded at the same time. The segmentation
+    // preview is rendered from the runs over the image segmentSheet kept for it.
+    if (config.writePreviews && sheet.pixels) {
+        metrics.beginStage("previews", 2 * pixels);
+        const std::string extension = "." + imageFormatName(config.imageFormat);
+        const std::string segPath = outputFolder + "/segmentation" + extension;
+        const std::string buildingBlocksImagePath = outputFolder + "/building_blocks" + extension;
+        const ImageView image{reinterpret_cast<const Color*>(sheet.pixels.get()), width, height};
+        // Both buffers are taken before the encoder starts, so nothing that can throw runs
+        // between its start and the try that joins it
+        std::vector<Color> segmentationImage = sheet.arena ? sheet.arena->takeImage() : std::vector<Color>();
+        std::vector<Color> buildingBlocksImage = sheet.arena ? sheet.arena->takeImage() : std::vector<Color>();
+        std::vector<unsigned char> segmentation;
+        std::exception_ptr segmentationError;
+        std::thread encoder([&]() {
+            try {
+                renderSegmentationPreview(image, result, segmentationImage);
+                segmentation = encodeSegmentation(segmentationImage, width, height, config.imageFormat);
+            } catch (...) {
+                segmentationError = std::current_exception();
+            }
+        });
+        try {
+            buildingBlocksImage.assign(static_cast<size_t>(width) * height, {255, 255, 255});
+            for (const Component& comp : result.components) {
+                if (comp.isBuildingBlock) {
+                    paintRuns(buildingBlocksImage, width, result.runsOf(comp), {0, 0, 0});
+                }
+            }
+            writeFileBytes(buildingBlocksImagePath,
+                           encodeSegmentation(buildingBlocksImage, width, height, config.imageFormat));
+            encoder.join();
+            if (segmentationError) {
+                std::rethrow_exception(segmentationError);
+            }
+            writeFileBytes(segPath, segmentation);
+        } catch (const std::exception& e) {
+            if (encoder.joinable()) {
+                encoder.join();
+            }
+            std::cerr << e.what() << "\n";
+            written = false;
+        }
+        if (sheet.arena) {
+            sheet.arena->giveBack(std::move(segmentationImage));
+            sheet.arena->giveBack(std::move(buildingBlocksImage));
+        }
+        metrics.endStage(fileSize(segPath) + fileSize(buildingBlocksImagePath));
+    }
+
+    writeRunMetrics(metrics, outputFolder, config);
+    return written;
+}
+
+bool processImage(const std::string& imagePath, const std::string& heatmapPath,
+                  const std::string& outputFolder, const Config& config) {
+    if (config.bandHeight > 0) {
+        return processImageStreaming(imagePath, heatmapPath, outputFolder, config);
+    }
+
+    // Load image data and map the heatmap file
+    Sheet sheet;
+    sheet.imagePath = imagePath;
+    sheet.heatmapPath = heatmapPath;
+    sheet.outputFolder = outputFolder;
+    try {
+        loadSheet(sheet);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return false;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Extract and classify connected components, then write them out
+    Segmenter segmenter;
+    segmentSheet(segmenter, sheet, config);
+    bool written = writeSheet(sheet, config);
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Finished processing: " << imagePath << " (Components: " << sheet.result.components.size()
+              << ", Time: " << elapsed.count() << "s)\n";
+    std::cout << "Component information written to components_info.json\n";
+    return written;
+}
+
+bool processImageWithModel(const std::string& imagePath, const std::string& modelPath,
+                           const std::string& outputFolder, const Config& config, const HeatmapOptions& options,
+                           const std::string& heatmapOutputPath) {
+    std::unique_ptr<PatchClassifier> classifier;
+    try {
+        classifier = loadPatchClassifier(modelPath, config.threads);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return false;
+    }
+    return processImageWithClassifier(imagePath, *classifier, outputFolder, config, options, heatmapOutputPath);
+}
+
+bool processImageWithClassifier(const std::string& imagePath, PatchClassifier& classifier,
+                                const std::string& outputFolder, const Config& config, const HeatmapOptions& options,
+                                const std::string& heatmapOutputPath) {
+    if (config.bandHeight > 0) {
+        return processImageWithModelStreaming(imagePath, classifier, outputFolder, config, options,
+                                              heatmapOutputPath);
+    }
+
+    // Infer the heatmap straight into the sheet
+    Sheet sheet;
+    sheet.imagePath = imagePath;
+    sheet.outputFolder = outputFolder;
+    try {
+        loadSheet(sheet);
+        inferSheetHeatmap(sheet, classifier, options, heatmapOutputPath);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return false;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    Segmenter segmenter;
+    segmentSheet(segmenter, sheet, config);
+    bool written = writeSheet(sheet, config);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Finished processing: " << imagePath << " (Components: " << sheet.result.components.size()
+              << ", Time: " << elapsed.count() << "s)\n";
+    return written;
+}
+
+bool reclassifyImage(const std::string& heatmapPath, const std::string& outputFolder, const Config& config) {
+    RunMetrics metrics;
+    const std::string tablePath = outputFolder + "/components_info.p2pc";
+    const std::string rasterPath = outputFolder + "/" + labelRasterFileName(LabelRasterFormat::Raw);
+    ComponentSet result;
+    TableLabeling labeling;
+    std::unique_ptr<LabelRasterReader> raster;
+    std::unique_ptr<HeatmapFile> heatmap;
+    try {
+        metrics.beginStage("open");
+        result = readComponentTable(tablePath, &labeling);
+        raster = std::make_unique<LabelRasterReader>(rasterPath);
+        heatmap = std::make_unique<HeatmapFile>(heatmapPath, raster->width(), raster->height());
+        metrics.endStage();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n"
+                  << "Reclassifying needs the components_info.p2pc table and the labels.p2pl raster of an "
+                     "earlier run with \"component_table 1\" and \"label_raster raw\"\n";
+        return false;
+    }
+    result.width = raster->width();
+    result.height = raster->height();
+    const std::uint64_t pixels = static_cast<std::uint64_t>(result.width) * result.height;
+    metrics.setRun(heatmapPath, result.width, result.height, config);
+    std::cout << "Reclassifying: " << outputFolder << " (Width: " << result.width << ", Height: " << result.height
+              << ", Components: " << result.components.size() << ")\n";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<bool> wasBuildingBlock;
+    for (const Component& comp : result.components) {
+        wasBuildingBlock.push_back(comp.isBuildingBlock);
+    }
+    metrics.beginStage("classify", pixels);
+    classifyComponents(result, heatmap->view(), config);
+    result.heatmapStats.clear(); // Against the old threshold
+    metrics.endStage();
+    metrics.setComponents(result);
+    std::cout << "Probability " << percentileName(config.probabilityPercentile)
+              << " percentile threshold: " << result.probabilityThreshold << "\n";
+    std::cout << "Component size " << percentileName(config.sizePercentile)
+              << " percentile threshold: " << result.sizeThreshold << "\n";
+
+    const std::string buildingBlocksFolder = outputFolder + "/building_blocks";
+    const std::string nonBuildingBlocksFolder = outputFolder + "/non_building_blocks";
+    bool written = true;
+    try {
+        // Masks only change folders; missing ones are written from the raster. They are moved
+        // before the table records the new classes, so a reclassify that stops halfway still
+        // finds every mask not yet moved where the table says it is.
+        int moved = 0;
+        metrics.beginStage("masks");
+        std::uint64_t maskBytes = 0;
+        for (size_t i = 0; i < result.components.size(); ++i) {
+            const Component& comp = result.components[i];
+            const std::string name = "/" + maskFileName(comp, config.imageFormat);
+            const std::string target = (comp.isBuildingBlock ? buildingBlocksFolder : nonBuildingBlocksFolder) + name;
+            const std::string previous = (wasBuildingBlock[i] ? buildingBlocksFolder : nonBuildingBlocksFolder) + name;
+            if (comp.isBuildingBlock != wasBuildingBlock[i] && fileSize(previous) > 0) {
+                if (std::rename(previous.c_str(), target.c_str()) != 0) {
+                    throw std::runtime_error("Could not move mask: " + previous);
+                }
+                moved++;
+            } else if (config.writeMasks && fileSize(target) == 0) {
+                if (!createDirectory(buildingBlocksFolder) || !createDirectory(nonBuildingBlocksFolder)) {
+                    throw std::runtime_error("Failed to create directories in: " + outputFolder);
+                }
+                std::vector<PixelRun> runs = raster->readRuns(comp);
+                saveMask({runs.data(), runs.data() + runs.size()}, comp.xMin, comp.yMin, comp.width(), comp.height(),
+                         config.imageFormat, target);
+                maskBytes += fileSize(target);
+            }
+        }
+        metrics.endStage(maskBytes);
+
+        // The building blocks need their runs for the outlines and the preview, every component
+        // for the heatmap statistics
+        if (config.heatmapStats || config.writePolygons || config.writePreviews) {
+            for (Component& comp : result.components) {
+                if (!config.heatmapStats && !comp.isBuildingBlock) {
+                    continue;
+                }
+                std::vector<PixelRun> runs = raster->readRuns(comp);
+                comp.runBegin = result.runs.size();
+                result.runs.insert(result.runs.end(), runs.begin(), runs.end());
+                comp.runEnd = result.runs.size();
+            }
+        }
+        // aboveThresholdShare follows the new probability threshold, so the table and
+        // components_info.json are written again, with the statistics or without them as configured
+        if (config.heatmapStats) {
+            metrics.beginStage("heatmap_stats", pixels);
+            computeHeatmapStats(result, heatmap->view(), config.threads);
+            metrics.endStage();
+        }
+        heatmap.reset();
+        metrics.beginStage("component_table");
+        replaceFile(tablePath, [&](const std::string& path) { writeComponentTable(result, path, labeling); });
+        metrics.endStage(fileSize(tablePath));
+        const std::string infoPath = outputFolder + "/components_info.json";
+        metrics.beginStage("components_info");
+        replaceFile(infoPath, [&](const std::string& path) { writeComponentsInfo(result, path, config.compactJson); });
+        metrics.endStage(fileSize(infoPath));
+        if (config.writePolygons) {
+            const std::string polygonsPath = outputFolder + "/polygons.json";
+            metrics.beginStage("polygons");
+            savePolygons(result, config.simplifyTolerance, config.compactJson, polygonsPath);
+            metrics.endStage(fileSize(polygonsPath));
+        }
+        if (config.writePreviews) {
+            const std::string buildingBlocksImagePath = outputFolder + "/building_blocks." +
+                                                        imageFormatName(config.imageFormat);
+            metrics.beginStage("previews", pixels);
+            std::vector<Color> buildingBlocksImage(pixels, {255, 255, 255});
+            for (const Component& comp : result.components) {
+                if (comp.isBuildingBlock) {
+                    paintRuns(buildingBlocksImage, result.width, result.runsOf(comp), {0, 0, 0});
+                }
+            }
+            writeFileBytes(buildingBlocksImagePath,
+                           encodeSegmentation(buildingBlocksImage, result.width, result.height, config.imageFormat));
+            metrics.endStage(fileSize(buildingBlocksImagePath));
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        int buildingBlocks = 0;
+        for (const Component& comp : result.components) {
+            buildingBlocks += comp.isBuildingBlock ? 1 : 0;
+        }
+        std::cout << "Finished reclassifying: " << outputFolder << " (Building blocks: " << buildingBlocks
+                  << ", Masks moved: " << moved << ", Time: " << elapsed.count() << "s)\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        metrics.endStage();
+        written = false;
+    }
+    writeRunMetrics(metrics, outputFolder, config);
+    return written;
+}
+
+bool resegmentImage(const std::string& imagePath, const std::string& heatmapPath, const std::string& outputFolder,
+                    const PixelRect& dirty, const Config& config) {
+    RunMetrics metrics;
+    const std::string tablePath = outputFolder + "/components_info.p2pc";
+    const std::string rasterPath = outputFolder + "/" + labelRasterFileName(LabelRasterFormat::Raw);
+    ComponentSet result;
+    TableLabeling labeling;
+    std::unique_ptr<LabelRasterFile> raster;
+    std::unique_ptr<HeatmapFile> heatmap;
+    try {
+        metrics.beginStage("open");
+        result = readComponentTable(tablePath, &labeling);
+        raster = std::make_unique<LabelRasterFile>(rasterPath);
+        heatmap = std::make_unique<HeatmapFile>(heatmapPath, raster->width(), raster->height());
+        metrics.endStage();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n"
+                  << "Resegmenting needs the components_info.p2pc table and the labels.p2pl raster of an "
+                     "earlier run with \"component_table 1\" and \"label_raster raw\"\n";
+        return false;
+    }
+    const TableLabeling expected = tableLabeling(config, false);
+    if ((labeling.labeler != TableLabeler::UnionFind && labeling.labeler != TableLabeler::Streaming) ||
+        labeling.k != expected.k || labeling.use8Way != expected.use8Way || labeling.euclidif != expected.euclidif) {
+        std::cerr << "The cache in " << outputFolder << " was labeled by the " << tableLabelerName(labeling.labeler)
+                  << " engine with k=" << labeling.k << ", use8Way=" << labeling.use8Way
+                  << ", euclidif=" << labeling.euclidif << "\n"
+                  << "Resegmenting relabels with the unionfind criterion and needs a cache written by the "
+                     "unionfind engine or in bands with the same k, use8Way and euclidif\n";
+        return false;
+    }
+    result.width = raster->width();
+    result.height = raster->height();
+    const std::uint64_t pixelCount = static_cast<std::uint64_t>(result.width) * result.height;
+    metrics.setRun(imagePath, result.width, result.height, config);
+    std::cout << "Resegmenting: " << outputFolder << " (Width: " << result.width << ", Height: " << result.height
+              << ", Dirty: " << dirty.width << "x" << dirty.height << " at " << dirty.x << "," << dirty.y << ")\n";
+
+    auto start = std::chrono::high_resolution_clock::now();
+    int maxId = 0;
+    for (const Component& comp : result.components) {
+        maxId = std::max(maxId, comp.id);
+    }
+    std::vector<bool> wasBuildingBlock(maxId + 1, false);
+    std::vector<ComponentHeatmapStats> storedStats(result.heatmapStats.empty() ? 0 : maxId + 1);
+    for (size_t i = 0; i < result.components.size(); ++i) {
+        const Component& comp = result.components[i];
+        wasBuildingBlock[comp.id] = comp.isBuildingBlock;
+        if (!storedStats.empty()) {
+            storedStats[comp.id] = result.heatmapStats[i];
+        }
+    }
+    // The heatmap has not changed, so the probability threshold the table stores still holds
+    // when it was taken at the same percentile
+    const bool sameThreshold = result.probabilityPercentile > 0.0f &&
+                               result.probabilityPercentile == static_cast<float>(config.probabilityPercentile);
+    const float storedThreshold = result.probabilityThreshold;
+
+    // Only the rows around the region are read, unless the segmentation preview needs them all
+    ImageRowBand image(imagePath, result.width, result.height);
+    ResegmentPatch patch;
+    try {
+        metrics.beginStage("segment");
+        if (config.writePreviews) {
+            image.read(0, result.height);
+        }
+        IncrementalSegmenter segmenter;
+        for (;;) {
+            patch = segmenter.resegment(image.view(), image.rowBegin(), heatmap->view(), config, dirty,
+                                        raster->labels(), result);
+            if (patch.complete) {
+                break;
+            }
+            // At least double the band, so a region reaching further one row at a time costs
+            // few passes
+            int rowBegin = patch.rowBegin - 1;
+            int rowEnd = patch.rowEnd + 1;
+            if (image.rowEnd() > image.rowBegin()) {
+                const int rows = image.rowEnd() - image.rowBegin();
+                rowBegin = std::min(rowBegin, image.rowBegin() - (rowBegin < image.rowBegin() ? rows : 0));
+                rowEnd = std::max(rowEnd, image.rowEnd() + (rowEnd > image.rowEnd() ? rows : 0));
+            }
+            image.read(rowBegin, rowEnd);
+        }
+        metrics.endStage();
+        metrics.beginStage("classify");
+        if (sameThreshold) {
+            classifyComponents(result, storedThreshold, config);
+        } else {
+            classifyComponents(result, heatmap->view(), config);
+        }
+        metrics.endStage();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        metrics.endStage();
+        writeRunMetrics(metrics, outputFolder, config);
+        return false;
+    }
+    metrics.setComponents(result);
+    std::cout << "Relabeled " << patch.regionPixels << " pixels in rows " << patch.rowBegin << " to "
+              << patch.rowEnd - 1 << ": " << patch.removedIds.size() << " components removed, "
+              << patch.addedIds.size() << " added\n";
+
+    const std::string buildingBlocksFolder = outputFolder + "/building_blocks";
+    const std::string nonBuildingBlocksFolder = outputFolder + "/non_building_blocks";
+    const std::string polygonsPath = outputFolder + "/polygons.json";
+    auto isAdded = [&](int id) { return std::binary_search(patch.addedIds.begin(), patch.addedIds.end(), id); };
+    bool written = true;
+    try {
+        // The outlines of the building blocks that were ones before and are still there are
+        // copied from polygons.json; the removed ids may come back as other components
+        std::unordered_map<int, std::string> keptPolygons;
+        if (config.writePolygons) {
+            keptPolygons = readPolygonEntries(polygonsPath);
+            for (int id : patch.removedIds) {
+                keptPolygons.erase(id);
+            }
+        }
+        const bool reuseStats = sameThreshold && !storedStats.empty();
+
+        // The new components have their runs; the others are cropped from the raster only for
+        // an outline that cannot be copied, or for the statistics when the stored ones do not hold
+        for (Component& comp : result.components) {
+            if (isAdded(comp.id)) {
+                continue;
+            }
+            const bool traced = config.writePolygons && comp.isBuildingBlock && !keptPolygons.count(comp.id);
+            if (!traced && !(config.heatmapStats && !reuseStats)) {
+                continue;
+            }
+            std::vector<PixelRun> runs = labelRuns(raster->labels(), result.width, comp);
+            comp.runBegin = result.runs.size();
+            result.runs.insert(result.runs.end(), runs.begin(), runs.end());
+            comp.runEnd = result.runs.size();
+        }
+        if (config.heatmapStats && reuseStats) {
+            metrics.beginStage("heatmap_stats");
+            result.heatmapStats.resize(result.components.size());
+            for (size_t i = 0; i < result.components.size(); ++i) {
+                const Component& comp = result.components[i];
+                result.heatmapStats[i] = isAdded(comp.id) ? heatmapStatsOf(heatmap->view(), result.probabilityThreshold,
+                                                                           result.runsOf(comp))
+                                                          : storedStats[comp.id];
+            }
+            metrics.endStage();
+        } else if (config.heatmapStats) {
+            metrics.beginStage("heatmap_stats", pixelCount);
+            computeHeatmapStats(result, heatmap->view(), config.threads);
+            metrics.endStage();
+        }
+        heatmap.reset();
+
+        // Both the table and components_info.json are written before either replaces the old
+        // one, and the raster rows only go back after them; nothing reached the raster before,
+        // so a failure up to there leaves the cache as it was
+        const std::string infoPath = outputFolder + "/components_info.json";
+        metrics.beginStage("component_table");
+        replaceFile(tablePath, [&](const std::string& path) {
+            writeComponentTable(result, path, labeling);
+            replaceFile(infoPath, [&](const std::string& infoTemporary) {
+                writeComponentsInfo(result, infoTemporary, config.compactJson);
+            });
+        });
+        metrics.endStage(fileSize(tablePath) + fileSize(infoPath));
+        metrics.beginStage("label_raster",
+                           static_cast<std::uint64_t>(patch.rowEnd - patch.rowBegin) * result.width);
+        raster->flush(patch.rowBegin, patch.rowEnd);
+        metrics.endStage();
+        if (config.labelRaster == LabelRasterFormat::Tiff) {
+            const std::string tiffPath = outputFolder + "/" + labelRasterFileName(LabelRasterFormat::Tiff);
+            metrics.beginStage("label_raster_tiff", pixelCount);
+            convertLabelRasterToTiff(rasterPath, tiffPath);
+            metrics.endStage(fileSize(tiffPath));
+        }
+
+        // The masks of the removed components go and the new ones are written; the others
+        // only move when their class changed
+        int moved = 0;
+        metrics.beginStage("masks");
+        std::uint64_t maskBytes = 0;
+        for (int id : patch.removedIds) {
+            Component removed{};
+            removed.id = id;
+            const std::string name = "/" + maskFileName(removed, config.imageFormat);
+            std::remove((buildingBlocksFolder + name).c_str());
+            std::remove((nonBuildingBlocksFolder + name).c_str());
+        }
+        for (const Component& comp : result.components) {
+            const std::string name = "/" + maskFileName(comp, config.imageFormat);
+            const std::string target = (comp.isBuildingBlock ? buildingBlocksFolder : nonBuildingBlocksFolder) + name;
+            if (isAdded(comp.id)) {
+                if (!config.writeMasks) {
+                    continue;
+                }
+                if (!createDirectory(buildingBlocksFolder) || !createDirectory(nonBuildingBlocksFolder)) {
+                    throw std::runtime_error("Failed to create directories in: " + outputFolder);
+                }
+                saveMask(result.runsOf(comp), comp.xMin, comp.yMin, comp.width(), comp.height(), config.imageFormat,
+                         target);
+                maskBytes += fileSize(target);
+                continue;
+            }
+            const std::string previous =
+                (wasBuildingBlock[comp.id] ? buildingBlocksFolder : nonBuildingBlocksFolder) + name;
+            if (comp.isBuildingBlock != wasBuildingBlock[comp.id] && fileSize(previous) > 0) {
+                if (std::rename(previous.c_str(), target.c_str()) != 0) {
+                    throw std::runtime_error("Could not move mask: " + previous);
+                }
+                moved++;
+            }
+        }
+        metrics.endStage(maskBytes);
+
+        if (config.writePolygons) {
+            metrics.beginStage("polygons");
+            replaceFile(polygonsPath, [&](const std::string& path) {
+                savePolygons(result, config.simplifyTolerance, config.compactJson, path, keptPolygons);
+            });
+            metrics.endStage(fileSize(polygonsPath));
+        }
+        if (config.writePreviews) {
+            const std::string extension = "." + imageFormatName(config.imageFormat);
+            const std::string segPath = outputFolder + "/segmentation" + extension;
+            const std::string buildingBlocksImagePath = outputFolder + "/building_blocks" + extension;
+            metrics.beginStage("previews", 2 * pixelCount);
+            std::vector<Color> segmentationImage;
+            renderSegmentationPreview(image.view(), raster->labels(), segmentationImage);
+            writeFileBytes(segPath, encodeSegmentation(segmentationImage, result.width, result.height,
+                                                       config.imageFormat));
+            // Painted from the raster, so the building blocks need no runs
+            std::vector<bool> isBuildingBlock(wasBuildingBlock.size(), false);
+            for (const Component& comp : result.components) {
+                if (isBuildingBlock.size() <= static_cast<size_t>(comp.id)) {
+                    isBuildingBlock.resize(comp.id + 1, false);
+                }
+                isBuildingBlock[comp.id] = comp.isBuildingBlock;
+            }
+            const std::uint32_t* labels = raster->labels();
+            std::vector<Color> buildingBlocksImage(pixelCount, {255, 255, 255});
+            for (std::uint64_t i = 0; i < pixelCount; ++i) {
+                if (labels[i] != 0 && isBuildingBlock[labels[i]]) {
+                    buildingBlocksImage[i] = {0, 0, 0};
+                }
+            }
+            writeFileBytes(buildingBlocksImagePath,
+                           encodeSegmentation(buildingBlocksImage, result.width, result.height, config.imageFormat));
+            metrics.endStage(fileSize(segPath) + fileSize(buildingBlocksImagePath));
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        std::cout << "Finished resegmenting: " << outputFolder << " (Components: " << result.components.size()
+                  << ", Masks moved: " << moved << ", Time: " << elapsed.count() << "s)\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        metrics.endStage();
+        written = false;
+    }
+    writeRunMetrics(metrics, outputFolder, config);
+    return written;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "heatmap_format.h"
+#include "heatmap_inference.h"
+#include "image_codec.h"
+#include "incremental_segmenter.h"
+#include "run_metrics.h"
+#include "segmenter.h"
+#include "sheet_arena.h"
+#include "stream_segmenter.h"
+
+// Function to read configuration: the six positional values followed by optional
+// "key value" lines (engine, threads, probability_percentile, size_percentile, masks,
+// polygons, simplify_tolerance, compact_json, component_table, label_raster, band_height,
+// metrics, image_format, previews, heatmap_stats)
+Config readConfig(const std::string& configFile);
+
+// Segment one image and write its component masks, components_info.json and its
+// components_info.p2pc table, the label raster, polygons.json, the segmentation and
+// building_blocks previews unless Config::writePreviews is off, and metrics.json when
+// Config::metrics is set, into outputFolder. With Config::heatmapStats components_info.json
+// also holds the heatmap minimum, maximum, deviation and share above the probability
+// threshold of every component. Masks and previews are Config::imageFormat
+// files. With a bandHeight the sheet is streamed through StreamingSegmenter, the outputs
+// are read back from the label raster and the full resolution previews are skipped. Returns false when the inputs could not be read or an
+// output could not be written.
+bool processImage(const std::string& imagePath, const std::string& heatmapPath,
+                  const std::string& outputFolder, const Config& config);
+
+// processImage with the heatmap inferred from the image by the border classifier at
+// modelPath, see heatmap_inference.h, instead of read from a .hmp file. The heatmap is
+// written to heatmapOutputPath when one is given. With a bandHeight the two stages overlap:
+// the inference runs on a worker thread and StreamingSegmenter labels each band as soon as
+// the windows covering it are classified, so a sheet takes about as long as the slower of
+// the two instead of their sum; only the image is held whole, for the windows.
+bool processImageWithModel(const std::string& imagePath, const std::string& modelPath,
+                           const std::string& outputFolder, const Config& config, const HeatmapOptions& options,
+                           const std::string& heatmapOutputPath = "");
+
+// processImageWithModel with a classifier loaded by the caller, which can keep it for other sheets
+bool processImageWithClassifier(const std::string& imagePath, PatchClassifier& classifier,
+                                const std::string& outputFolder, const Config& config, const HeatmapOptions& options,
+                                const std::string& heatmapOutputPath = "");
+
+// Reapply the classification of Config::probabilityPercentile and Config::sizePercentile to
+// a sheet segmented earlier into outputFolder, without segmenting it again. Reads the
+// components_info.p2pc table and the labels.p2pl raster that run wrote ("component_table 1"
+// and "label_raster raw") and maps the heatmap for its percentile, then moves the masks that
+// changed class between building_blocks and non_building_blocks, writes missing masks when
+// Config::writeMasks is set, and rewrites the table, components_info.json (with the heatmap
+// statistics against the new probability threshold when Config::heatmapStats is set),
+// polygons.json and the building_blocks preview. Returns false when the cache could not be
+// read or an output could not be written.
+bool reclassifyImage(const std::string& heatmapPath, const std::string& outputFolder, const Config& config);
+
+// Segment again the part of a sheet segmented earlier into outputFolder that an edit of
+// imagePath inside dirty can reach, see IncrementalSegmenter, from the same cache as
+// reclassifyImage. The cache must have been written by the unionfind engine or in bands
+// (Config::bandHeight) with the k, use8Way and euclidif of config, as its table records; any
+// other cache is refused, since relabeling part of it with the unionfind criterion would mix
+// two segmentations. Every component outside the edited region keeps its id and its mask.
+// Only the rows of the image around the region are read, unless Config::writePreviews needs
+// them all. The components are classified again with the probability threshold the table
+// stores when it was taken at the same percentile, and the heatmap statistics of the kept
+// components are reused from the table on the same condition. The new table and
+// components_info.json replace the old ones together, then the relabeled rows of labels.p2pl
+// are written back, so the cache is left as it was when anything fails before. After that
+// the masks of the invalidated components are deleted and the new ones written when
+// Config::writeMasks is set, the masks that changed class are moved, polygons.json is
+// rewritten with the outlines of the unchanged building blocks copied from the old one, and
+// the TIFF label raster and the previews are rewritten as configured, the segmentation
+// preview rendered from the raster with its colors following the ids. Returns false when
+// the cache could not be read, was labeled otherwise or an output could not be written.
+bool resegmentImage(const std::string& imagePath, const std::string& heatmapPath, const std::string& outputFolder,
+                    const PixelRect& dirty, const Config& config);
+
+// One sheet on its way through the stages of processImage: loaded, segmented, written.
+// The heatmap is released as soon as the sheet is segmented, and so is the image unless
+// Config::writePreviews keeps it for writeSheet to render the segmentation preview from.
+// With an arena the result and both previews are built in buffers of earlier sheets; the
+// caller gives the result back once it is done with it.
+struct Sheet {
+    std::string imagePath;
+    std::string heatmapPath;
+    std::string outputFolder;
+    int width = 0;
+    int height = 0;
+    ImageBuffer pixels{nullptr, nullptr}; // RGB, from decodeImage
+    std::unique_ptr<HeatmapFile> heatmap;
+    std::vector<float> heatmapValues; // Inferred heatmap, used when heatmapPath is empty
+    ComponentSet result;
+    RunMetrics metrics; // Stages of this sheet, written by writeSheet when Config::metrics is set
+    SheetArena* arena = nullptr;
+};
+
+// Decode sheet.imagePath and map sheet.heatmapPath unless it is empty. Throws std::runtime_error on failure.
+void loadSheet(Sheet& sheet);
+
+// Infer the heatmap of a loaded sheet into sheet.heatmapValues, and write it to
+// heatmapOutputPath when one is given. Throws std::runtime_error on failure.
+void inferSheetHeatmap(Sheet& sheet, PatchClassifier& classifier, const HeatmapOptions& options,
+                       const std::string& heatmapOutputPath);
+
+// Segment a loaded sheet into sheet.result
+void segmentSheet(Segmenter& segmenter, Sheet& sheet, const Config& config);
+
+// Write the outputs of a segmented sheet into sheet.outputFolder, false when one failed
+bool writeSheet(Sheet& sheet, const Config& config);
+
+// Function to get the paths of the entries of a directory. Throws std::runtime_error on failure.
+std::vector<std::string> getFiles(const std::string& directory);
+
+// Function to create a directory, true when it exists afterwards
+bool createDirectory(const std::string& dir);
+
+// Open an image as a source of rows. Binary PPM (P6, 8-bit) files, and JPEG files when
+// built with P2P_LIBJPEG_DECODE, are read incrementally; other formats are decoded whole by
+// decodeImage. Throws std::runtime_error on failure.
+std::unique_ptr<RowSource> openRowSource(const std::string& path);
+
+// Segment every image of a directory next to its .hmp heatmap, classifying with the
+// fixed buildingBlockTreshold, into numbered folders of outputDir. That one classification
+// is used by every output: the masks (with Config::writeMasks), the previews, the JSON and
+// the table.
+void processImages(const std::string& inputDir, const std::string& outputDir, const Config& config);
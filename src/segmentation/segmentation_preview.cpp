@@ -0,0 +1,46 @@
+#include "segmentation_preview.h"
+
+#include <algorithm>
+
+Color componentColor(int id) {
+    // lowbias32 finalizer, every input bit reaches every output bit
+    std::uint32_t hash = static_cast<std::uint32_t>(id);
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    hash *= 0x846ca68bu;
+    hash ^= hash >> 16;
+    return {static_cast<unsigned char>(hash), static_cast<unsigned char>(hash >> 8),
+            static_cast<unsigned char>(hash >> 16)};
+}
+
+void renderSegmentationPreview(const ImageView& image, const ComponentSet& result, std::vector<Color>& preview) {
+    const size_t width = static_cast<size_t>(image.width);
+    preview.assign(image.pixels, image.pixels + width * image.height);
+    for (const Component& comp : result.components) {
+        const Color color = componentColor(comp.id);
+        for (const PixelRun& run : result.runsOf(comp)) {
+            Color* row = preview.data() + run.y * width;
+            std::fill(row + run.xBegin, row + run.xEnd + 1, color);
+        }
+    }
+}
+
+void renderSegmentationPreview(const ImageView& image, const std::uint32_t* labels, std::vector<Color>& preview) {
+    const size_t pixelCount = static_cast<size_t>(image.width) * image.height;
+    preview.resize(pixelCount);
+    std::uint32_t lastId = 0;
+    Color lastColor{};
+    for (size_t i = 0; i < pixelCount; ++i) {
+        const std::uint32_t id = labels[i];
+        if (id == 0) {
+            preview[i] = image.pixels[i];
+            continue;
+        }
+        if (id != lastId) {
+            lastId = id;
+            lastColor = componentColor(static_cast<int>(id));
+        }
+        preview[i] = lastColor;
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "segmenter.h"
+
+// Color of component id in the segmentation preview, an integer hash of the id. A
+// component keeps its color from run to run and through resegmentImage, and consecutive
+// ids get unrelated colors.
+Color componentColor(int id);
+
+// Render the segmentation preview into preview: the image with the pixels of every
+// component of result in its componentColor. Reads the runs of the components.
+void renderSegmentationPreview(const ImageView& image, const ComponentSet& result, std::vector<Color>& preview);
+
+// Same from a width * height label raster, 0 where no kept component is
+void renderSegmentationPreview(const ImageView& image, const std::uint32_t* labels, std::vector<Color>& preview);
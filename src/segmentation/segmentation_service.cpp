@@ -0,0 +1,398 @@
+#include "segmentation_service.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include "component_table.h"
+#include "image_codec.h"
+#include "segmentation_io.h"
+#include "task_queue.h"
+
+namespace {
+
+// Member of a request: the decoded text of strings, and the JSON text as given for echoing
+struct RequestValue {
+    bool isString = false;
+    std::string text;
+    std::string json;
+};
+
+using Request = std::map<std::string, RequestValue>;
+
+// Parser of the flat objects of the requests, whose values are strings, numbers, true,
+// false or null
+class RequestParser {
+public:
+    explicit RequestParser(const std::string& line) : line_(line) {}
+
+    // Throws std::runtime_error on malformed lines
+    Request parse() {
+        Request request;
+        skipSpace();
+        expect('{');
+        skipSpace();
+        if (peek() == '}') {
+            ++position_;
+        } else {
+            while (true) {
+                skipSpace();
+                if (peek() != '"') {
+                    fail("expected a member name");
+                }
+                std::string name = parseString();
+                skipSpace();
+                expect(':');
+                skipSpace();
+                request[name] = parseValue();
+                skipSpace();
+                if (peek() == ',') {
+                    ++position_;
+                    continue;
+                }
+                expect('}');
+                break;
+            }
+        }
+        skipSpace();
+        if (position_ != line_.size()) {
+            fail("unexpected text after the object");
+        }
+        return request;
+    }
+
+private:
+    char peek() const { return position_ < line_.size() ? line_[position_] : '\0'; }
+
+    void skipSpace() {
+        while (position_ < line_.size() &&
+               (line_[position_] == ' ' || line_[position_] == '\t' || line_[position_] == '\r')) {
+            ++position_;
+        }
+    }
+
+    void expect(char c) {
+        if (peek() != c) {
+            fail(std::string("expected '") + c + "'");
+        }
+        ++position_;
+    }
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error("Malformed request at column " + std::to_string(position_ + 1) + ": " + message);
+    }
+
+    RequestValue parseValue() {
+        const size_t begin = position_;
+        RequestValue value;
+        if (peek() == '"') {
+            value.isString = true;
+            value.text = parseString();
+        } else if (peek() == '{' || peek() == '[') {
+            fail("objects and arrays are not accepted as values");
+        } else {
+            while (position_ < line_.size() && line_[position_] != ',' && line_[position_] != '}' &&
+                   line_[position_] != ' ' && line_[position_] != '\t' && line_[position_] != '\r') {
+                ++position_;
+            }
+            value.text = line_.substr(begin, position_ - begin);
+            if (value.text.empty()) {
+                fail("expected a value");
+            }
+            if (value.text != "true" && value.text != "false" && value.text != "null") {
+                size_t parsed = 0;
+                try {
+                    std::stod(value.text, &parsed);
+                } catch (const std::exception&) {
+                }
+                if (parsed != value.text.size()) {
+                    fail("invalid value " + value.text);
+                }
+            }
+        }
+        value.json = line_.substr(begin, position_ - begin);
+        return value;
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string text;
+        while (true) {
+            if (position_ >= line_.size()) {
+                fail("unterminated string");
+            }
+            char c = line_[position_++];
+            if (c == '"') {
+                return text;
+            }
+            if (c != '\\') {
+                text += c;
+                continue;
+            }
+            char escape = peek();
+            ++position_;
+            switch (escape) {
+            case '"': text += '"'; break;
+            case '\\': text += '\\'; break;
+            case '/': text += '/'; break;
+            case 'b': text += '\b'; break;
+            case 'f': text += '\f'; break;
+            case 'n': text += '\n'; break;
+            case 'r': text += '\r'; break;
+            case 't': text += '\t'; break;
+            case 'u': appendUtf8(parseCodeUnit(), text); break;
+            default: fail("invalid escape");
+            }
+        }
+    }
+
+    unsigned parseCodeUnit() {
+        if (position_ + 4 > line_.size()) {
+            fail("truncated \\u escape");
+        }
+        unsigned unit = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = line_[position_++];
+            unit <<= 4;
+            if (c >= '0' && c <= '9') {
+                unit |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                unit |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                unit |= c - 'A' + 10;
+            } else {
+                fail("invalid \\u escape");
+            }
+        }
+        return unit;
+    }
+
+    // Encode the code point of a \u escape, joining surrogate pairs
+    void appendUtf8(unsigned code, std::string& text) {
+        if (code >= 0xD800 && code < 0xDC00 && line_.compare(position_, 2, "\\u") == 0) {
+            position_ += 2;
+            unsigned low = parseCodeUnit();
+            if (low < 0xDC00 || low >= 0xE000) {
+                fail("unpaired surrogate");
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        if (code < 0x80) {
+            text += static_cast<char>(code);
+        } else if (code < 0x800) {
+            text += static_cast<char>(0xC0 | (code >> 6));
+            text += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            text += static_cast<char>(0xE0 | (code >> 12));
+            text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            text += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            text += static_cast<char>(0xF0 | (code >> 18));
+            text += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            text += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            text += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    const std::string& line_;
+    size_t position_ = 0;
+};
+
+// Function to quote text as a JSON string
+std::string quoted(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escape[8];
+                std::snprintf(escape, sizeof(escape), "\\u%04x", static_cast<unsigned>(c));
+                out += escape;
+            } else {
+                out += c;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+// Function to get a string member of a request, empty when it is missing. Throws
+// std::runtime_error when it is not a string.
+std::string stringMember(const Request& request, const char* name) {
+    auto found = request.find(name);
+    if (found == request.end() || found->second.json == "null") {
+        return "";
+    }
+    if (!found->second.isString) {
+        throw std::runtime_error(std::string("\"") + name + "\" must be a string");
+    }
+    return found->second.text;
+}
+
+// Function to tell whether a request line asks for a shutdown, without failing on bad lines
+bool isShutdown(const std::string& line) {
+    try {
+        return stringMember(RequestParser(line).parse(), "command") == "shutdown";
+    } catch (const std::exception&) {
+        return false;
+    }
+}
+
+// Function to tell whether a request line has nothing but whitespace
+bool isBlank(const std::string& line) {
+    return line.find_first_not_of(" \t\r") == std::string::npos;
+}
+
+} // namespace
+
+SegmentationService::SegmentationService(const Config& config, const ServiceOptions& options)
+    : config_(config), options_(options) {
+    if (!options_.modelPath.empty()) {
+        classifier_ = loadPatchClassifier(options_.modelPath, config_.threads);
+        options_.heatmap.threads = config_.threads;
+    }
+}
+
+SegmentationService::~SegmentationService() = default;
+
+ServiceResponse SegmentationService::handle(const std::string& line) {
+    std::string id = "null";
+    std::ostringstream response;
+    bool jobStarted = false;
+    try {
+        const Request request = RequestParser(line).parse();
+        auto idMember = request.find("id");
+        if (idMember != request.end()) {
+            id = idMember->second.json;
+        }
+        response << "{\"id\":" << id << ",\"ok\":true";
+
+        const std::string command = stringMember(request, "command");
+        if (command == "shutdown") {
+            return {response.str() + "}", true, true};
+        }
+        if (command == "status") {
+            response << ",\"jobs\":" << jobs_ << ",\"failed\":" << failures_
+                     << ",\"largest_pixels\":" << largestPixels_
+                     << ",\"model\":" << (classifier_ ? "true" : "false") << "}";
+            return {response.str(), true, false};
+        }
+        if (!command.empty()) {
+            throw std::runtime_error("Unknown command: " + command);
+        }
+
+        const std::string imagePath = stringMember(request, "image");
+        const std::string heatmapPath = stringMember(request, "heatmap");
+        const std::string outputFolder = stringMember(request, "output");
+        const std::string heatmapOutputPath = stringMember(request, "heatmap_out");
+        if (imagePath.empty() || outputFolder.empty()) {
+            throw std::runtime_error("A job needs an \"image\" and an \"output\"");
+        }
+        if (heatmapPath.empty() && !classifier_) {
+            throw std::runtime_error("A job without a \"heatmap\" needs the service started with a model");
+        }
+
+        jobs_++;
+        jobStarted = true;
+        auto start = std::chrono::steady_clock::now();
+        const std::string tablePath = outputFolder + "/components_info.p2pc";
+        long long components = -1, buildingBlocks = -1;
+        int width = 0, height = 0;
+        bool written;
+        if (config_.bandHeight > 0) {
+            // Streamed with a StreamingSegmenter of its own; the counts come from the table
+            readImageSize(imagePath, width, height);
+            written = heatmapPath.empty()
+                          ? processImageWithClassifier(imagePath, *classifier_, outputFolder, config_, options_.heatmap,
+                                                       heatmapOutputPath)
+                          : processImage(imagePath, heatmapPath, outputFolder, config_);
+            if (written && config_.writeComponentTable) {
+                const ComponentSet table = readComponentTable(tablePath);
+                components = static_cast<long long>(table.components.size());
+                buildingBlocks = 0;
+                for (const Component& comp : table.components) {
+                    buildingBlocks += comp.isBuildingBlock;
+                }
+            }
+        } else {
+            Sheet sheet;
+            sheet.imagePath = imagePath;
+            sheet.heatmapPath = heatmapPath;
+            sheet.outputFolder = outputFolder;
+            sheet.arena = &arena_;
+            loadSheet(sheet);
+            if (heatmapPath.empty()) {
+                inferSheetHeatmap(sheet, *classifier_, options_.heatmap, heatmapOutputPath);
+            }
+            width = sheet.width;
+            height = sheet.height;
+            segmentSheet(segmenter_, sheet, config_);
+            written = writeSheet(sheet, config_);
+            components = static_cast<long long>(sheet.result.components.size());
+            buildingBlocks = 0;
+            for (const Component& comp : sheet.result.components) {
+                buildingBlocks += comp.isBuildingBlock;
+            }
+            arena_.giveBack(std::move(sheet.result));
+        }
+        largestPixels_ = std::max(largestPixels_, static_cast<unsigned long long>(width) * height);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Finished processing: " << imagePath << " (Time: " << seconds << "s)\n";
+        if (!written) {
+            throw std::runtime_error("Outputs of " + imagePath + " could not be written, see the log");
+        }
+
+        response << ",\"seconds\":" << seconds;
+        if (components >= 0) {
+            response << ",\"components\":" << components << ",\"building_blocks\":" << buildingBlocks;
+        }
+        response << ",\"table\":" << (config_.writeComponentTable ? quoted(tablePath) : "null") << "}";
+        return {response.str(), true, false};
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        failures_ += jobStarted;
+        return {"{\"id\":" + id + ",\"ok\":false,\"error\":" + quoted(e.what()) + "}", false, false};
+    }
+}
+
+size_t SegmentationService::serve(std::istream& in, std::ostream& out) {
+    TaskQueue<std::string> lines(options_.queueDepth);
+    std::thread reader([&]() {
+        std::string line;
+        while (std::getline(in, line)) {
+            if (isBlank(line)) {
+                continue;
+            }
+            const bool last = isShutdown(line);
+            if (!lines.push(std::move(line)) || last) {
+                break;
+            }
+        }
+        lines.close();
+    });
+
+    size_t failed = 0;
+    std::string line;
+    while (lines.pop(line)) {
+        const ServiceResponse response = handle(line);
+        failed += !response.ok;
+        out << response.line << std::endl;
+        if (response.shutdown) {
+            break;
+        }
+    }
+    lines.close();
+    reader.join();
+    return failed;
+}
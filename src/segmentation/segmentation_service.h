@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include "heatmap_inference.h"
+#include "segmenter.h"
+#include "sheet_arena.h"
+
+// Long-running segmentation over JSON lines, so a caller segmenting sheet after sheet pays
+// for the configuration, the model and the segmenter buffers once. Every request is one
+// JSON object per line and gets one response line, in request order:
+//   {"id": 1, "image": "a.jpg", "heatmap": "a.hmp", "output": "out/a"}
+//       processImage; without "heatmap" the heatmap is inferred by the model given at start,
+//       and written to "heatmap_out" when the job has one
+//   {"id": 2, "command": "status"}    sheets run, sheets failed, largest sheet so far
+//   {"id": 3, "command": "shutdown"}  answered, then no more lines are read
+// A job is answered with {"id", "ok", "seconds", "components", "building_blocks", "table"}:
+// the component counts and the components_info.p2pc path, whose counts are read back from
+// the table for sheets streamed in bands. A request that fails is answered with "ok": false
+// and an "error" message; the id, any JSON value, is echoed back as given.
+struct ServiceOptions {
+    std::string modelPath;  // Border classifier kept loaded for jobs without a heatmap, none when empty
+    HeatmapOptions heatmap; // Sliding windows of those jobs
+    size_t queueDepth = 16; // Request lines read ahead of the one running
+};
+
+// Answer to one request line
+struct ServiceResponse {
+    std::string line; // JSON object, without the newline
+    bool ok = false;
+    bool shutdown = false;
+};
+
+class SegmentationService {
+public:
+    // Loads the model of options. Throws std::runtime_error when it cannot be loaded.
+    SegmentationService(const Config& config, const ServiceOptions& options);
+    ~SegmentationService();
+    SegmentationService(const SegmentationService&) = delete;
+    SegmentationService& operator=(const SegmentationService&) = delete;
+
+    // Function to run one request line and return its response
+    ServiceResponse handle(const std::string& line);
+
+    // Answer the request lines of in on out until a shutdown request or the end of in. A
+    // reader thread queues the lines, so a client can send its jobs without waiting for
+    // the answers. Returns the number of requests that failed.
+    size_t serve(std::istream& in, std::ostream& out);
+
+private:
+    Config config_;
+    ServiceOptions options_;
+    std::unique_ptr<PatchClassifier> classifier_;
+    SheetArena arena_{1}; // Result and preview buffers of the last sheet, for the next one
+    Segmenter segmenter_; // Reused by every sheet segmented whole
+    size_t jobs_ = 0;
+    size_t failures_ = 0;
+    unsigned long long largestPixels_ = 0;
+};
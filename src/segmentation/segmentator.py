@@ -1,24 +1,46 @@
+import json
+import os
+import shutil
 import subprocess
 
-def segmentate_image(image_path, heatmap_path, output_path, k, use8Way, euclidif, adj, minComponentSize, buildingBlockTreshold):
+# Módulo nativo (segmenter_module.cpp); si no está compilado se usa main.exe.
+try:
+    from segmentation import segmenter_native
+except ImportError:
+    segmenter_native = None
+
+def segmentate_image(image_path, heatmap_path, output_path, k, use8Way, euclidif, adj, minComponentSize, buildingBlockTreshold, engine="scanline", threads=1, probabilityPercentile=0.8, sizePercentile=0.9, writeMasks=True, writePolygons=True, simplifyTolerance=0, compactJson=False, writeComponentTable=True, labelRaster="none", bandHeight=0, metrics="none", imageFormat="jpg", writePreviews=True, heatmapStats=False):
+    # Con el módulo nativo se segmenta en este mismo proceso, sin compilar ni lanzar main.exe.
+    if segmenter_native is not None:
+        config = segmenter_native.Config(k=k, use8Way=bool(use8Way), euclidif=bool(euclidif), adj=bool(adj),
+                                         minComponentSize=minComponentSize,
+                                         buildingBlockTreshold=buildingBlockTreshold,
+                                         engine=engine, threads=threads,
+                                         probabilityPercentile=probabilityPercentile,
+                                         sizePercentile=sizePercentile,
+                                         writeMasks=bool(writeMasks), writePolygons=bool(writePolygons),
+                                         simplifyTolerance=simplifyTolerance,
+                                         compactJson=bool(compactJson),
+                                         writeComponentTable=bool(writeComponentTable),
+                                         labelRaster=labelRaster, bandHeight=bandHeight,
+                                         metrics=metrics, imageFormat=imageFormat,
+                                         writePreviews=bool(writePreviews),
+                                         heatmapStats=bool(heatmapStats))
+        segmenter_native.process_image(image_path, heatmap_path, output_path, config)
+        return read_metrics(output_path) if metrics != "none" else None
+
     # 1. Crear el archivo de configuración.
     config_path = "segmentation/config.txt"
-    with open(config_path, "w") as config_file:
-        # Puedes ajustar el formato de salida según lo que espere tu función readConfig.
-        config_file.write(f"{k}\n")
-        config_file.write(f"{use8Way}\n")
-        config_file.write(f"{euclidif}\n")
-        config_file.write(f"{adj}\n")
-        config_file.write(f"{minComponentSize}\n")
-        config_file.write(f"{buildingBlockTreshold}\n")
+    write_config(config_path, k, use8Way, euclidif, adj, minComponentSize, buildingBlockTreshold, engine, threads,
+                 probabilityPercentile, sizePercentile, writeMasks, writePolygons, simplifyTolerance, compactJson,
+                 writeComponentTable, labelRaster, bandHeight, metrics, imageFormat, writePreviews, heatmapStats)
     
-    # 2. Compilar el archivo C++.
-    compile_cmd = ["g++", "segmentation/main.cpp", "-o", "segmentation/main.exe"]
-    subprocess.run(compile_cmd, check=True)
+    # 2. Compilar el segmentador. Con CMake (CMakeLists.txt) la compilación es optimizada e
+    # incremental; sin CMake se compila directamente con g++.
+    executable = build_segmenter()
     
     # 3. Ejecutar el .exe y capturar la salida.
-    # Nota: en Windows podrías necesitar llamar a "segmentation/main.exe" sin "./".
-    run_cmd = ["./segmentation/main.exe"]
+    run_cmd = [executable, config_path, image_path, heatmap_path, output_path]
     process = subprocess.Popen(run_cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
     
     # Mostrar la salida estándar en tiempo real.
@@ -31,3 +53,180 @@ def segmentate_image(image_path, heatmap_path, output_path, k, use8Way, euclidif
     
     # Esperar a que el proceso finalice.
     process.wait()
+    return read_metrics(output_path) if metrics != "none" else None
+
+
+def write_config(config_path, k, use8Way, euclidif, adj, minComponentSize, buildingBlockTreshold, engine="scanline", threads=1, probabilityPercentile=0.8, sizePercentile=0.9, writeMasks=True, writePolygons=True, simplifyTolerance=0, compactJson=False, writeComponentTable=True, labelRaster="none", bandHeight=0, metrics="none", imageFormat="jpg", writePreviews=True, heatmapStats=False):
+    # Escribe el archivo de configuración que lee readConfig (segmentation_io.h).
+    with open(config_path, "w") as config_file:
+        # Puedes ajustar el formato de salida según lo que espere tu función readConfig.
+        config_file.write(f"{k}\n")
+        config_file.write(f"{use8Way}\n")
+        config_file.write(f"{euclidif}\n")
+        config_file.write(f"{adj}\n")
+        config_file.write(f"{minComponentSize}\n")
+        config_file.write(f"{buildingBlockTreshold}\n")
+        # Motor de etiquetado: "scanline" (por defecto), "stack" o "unionfind".
+        config_file.write(f"engine {engine}\n")
+        # Hilos para el motor "unionfind" (0 usa todos los núcleos).
+        config_file.write(f"threads {threads}\n")
+        # Percentiles del heatmap y del tamaño usados para clasificar los building blocks.
+        config_file.write(f"probability_percentile {probabilityPercentile}\n")
+        config_file.write(f"size_percentile {sizePercentile}\n")
+        # Salidas: máscaras JPEG por componente y polygons.json con los contornos (tolerancia RDP en píxeles).
+        config_file.write(f"masks {int(bool(writeMasks))}\n")
+        config_file.write(f"polygons {int(bool(writePolygons))}\n")
+        config_file.write(f"simplify_tolerance {simplifyTolerance}\n")
+        # JSON sin espacios y tabla binaria components_info.p2pc (ver component_table.py).
+        config_file.write(f"compact_json {int(bool(compactJson))}\n")
+        config_file.write(f"component_table {int(bool(writeComponentTable))}\n")
+        # Raster con el id de componente de cada píxel: "none", "raw" (labels.p2pl) o "tiff" (labels.tif).
+        config_file.write(f"label_raster {labelRaster}\n")
+        # Filas por banda para hojas que no caben en memoria (0 segmenta la hoja completa).
+        config_file.write(f"band_height {bandHeight}\n")
+        # Métricas por etapa en metrics.json: "none", "json" o "trace" (también metrics_trace.json).
+        config_file.write(f"metrics {metrics}\n")
+        # Formato de las máscaras y vistas previas ("jpg" o "png"), y si se escriben
+        # las vistas previas de depuración (segmentation y building_blocks).
+        config_file.write(f"image_format {imageFormat}\n")
+        config_file.write(f"previews {int(bool(writePreviews))}\n")
+        # Mínimo, máximo, desviación y fracción sobre el umbral del heatmap por componente
+        # en components_info.json.
+        config_file.write(f"heatmap_stats {int(bool(heatmapStats))}\n")
+
+
+class SegmentationService:
+    # Segmentador persistente (main.exe config --serve, ver segmentation_service.h): la
+    # configuración, el modelo y los buffers del segmentador se cargan una sola vez y cada
+    # hoja solo paga su cómputo. Acepta los mismos parámetros que segmentate_image, y
+    # model_path para inferir el heatmap de las hojas que no lo traen (.onnx o TorchScript).
+    # Se usa como context manager; el log del segmentador sale por stderr.
+    def __init__(self, k, use8Way, euclidif, adj, minComponentSize, buildingBlockTreshold, model_path=None, config_path="segmentation/config_service.txt", **options):
+        write_config(config_path, k, use8Way, euclidif, adj, minComponentSize, buildingBlockTreshold, **options)
+        self.metrics = options.get("metrics", "none")
+        run_cmd = [build_segmenter(), config_path, "--serve"]
+        if model_path is not None:
+            run_cmd += ["--model", model_path]
+        self.process = subprocess.Popen(run_cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True, bufsize=1)
+        self.next_id = 0
+
+    def request(self, **fields):
+        # Envía una línea JSON y devuelve la respuesta como diccionario.
+        self.next_id += 1
+        self.process.stdin.write(json.dumps({"id": self.next_id, **fields}) + "\n")
+        self.process.stdin.flush()
+        line = self.process.stdout.readline()
+        if not line:
+            raise RuntimeError("The segmentation service exited")
+        response = json.loads(line)
+        if not response["ok"]:
+            raise RuntimeError(response["error"])
+        return response
+
+    def segment(self, image_path, output_path, heatmap_path=None, heatmap_out=None):
+        # Segmenta una hoja. Devuelve la respuesta del servicio (componentes, building blocks,
+        # ruta de components_info.p2pc) con las métricas de la hoja en "metrics" si se pidieron.
+        fields = {"image": image_path, "output": output_path}
+        if heatmap_path is not None:
+            fields["heatmap"] = heatmap_path
+        if heatmap_out is not None:
+            fields["heatmap_out"] = heatmap_out
+        response = self.request(**fields)
+        response["metrics"] = read_metrics(output_path) if self.metrics != "none" else None
+        return response
+
+    def close(self):
+        if self.process.poll() is None:
+            self.request(command="shutdown")
+            self.process.stdin.close()
+        self.process.wait()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def reclassify_image(heatmap_path, output_path, probabilityPercentile=0.8, sizePercentile=0.9, writeMasks=True, writePolygons=True, simplifyTolerance=0, compactJson=False, imageFormat="jpg", writePreviews=True, metrics="none"):
+    # Reclasifica una hoja ya segmentada en output_path con otros percentiles, sin volver a
+    # segmentarla: usa la tabla components_info.p2pc y el raster labels.p2pl de esa
+    # ejecución (segmentate_image con labelRaster="raw"). Devuelve True si terminó bien.
+    if segmenter_native is not None:
+        config = segmenter_native.Config(k=0, use8Way=False, euclidif=False, adj=False, minComponentSize=0,
+                                         buildingBlockTreshold=0,
+                                         probabilityPercentile=probabilityPercentile,
+                                         sizePercentile=sizePercentile,
+                                         writeMasks=bool(writeMasks), writePolygons=bool(writePolygons),
+                                         simplifyTolerance=simplifyTolerance, compactJson=bool(compactJson),
+                                         metrics=metrics, imageFormat=imageFormat,
+                                         writePreviews=bool(writePreviews))
+        return segmenter_native.reclassify_image(heatmap_path, output_path, config)
+
+    # Los seis valores posicionales no se usan al reclasificar.
+    config_path = "segmentation/config_reclassify.txt"
+    with open(config_path, "w") as config_file:
+        config_file.write("0\n0\n0\n0\n0\n0\n")
+        config_file.write(f"probability_percentile {probabilityPercentile}\n")
+        config_file.write(f"size_percentile {sizePercentile}\n")
+        config_file.write(f"masks {int(bool(writeMasks))}\n")
+        config_file.write(f"polygons {int(bool(writePolygons))}\n")
+        config_file.write(f"simplify_tolerance {simplifyTolerance}\n")
+        config_file.write(f"compact_json {int(bool(compactJson))}\n")
+        config_file.write(f"image_format {imageFormat}\n")
+        config_file.write(f"previews {int(bool(writePreviews))}\n")
+        config_file.write(f"metrics {metrics}\n")
+    executable = build_segmenter()
+    return subprocess.run([executable, config_path, "--reclassify", heatmap_path, output_path]).returncode == 0
+
+def resegment_image(image_path, heatmap_path, output_path, dirty_rect, k, use8Way, euclidif, adj, minComponentSize, buildingBlockTreshold, **options):
+    # Vuelve a segmentar solo la zona editada de una hoja ya segmentada en output_path
+    # (segmentate_image con labelRaster="raw"). dirty_rect es (x, y, ancho, alto) en píxeles;
+    # los componentes fuera de la zona conservan su id y su máscara. Acepta los mismos
+    # parámetros que segmentate_image. Devuelve True si terminó bien.
+    x, y, width, height = dirty_rect
+    if segmenter_native is not None:
+        config = segmenter_native.Config(k=k, use8Way=bool(use8Way), euclidif=bool(euclidif), adj=bool(adj),
+                                         minComponentSize=minComponentSize,
+                                         buildingBlockTreshold=buildingBlockTreshold, **options)
+        return segmenter_native.resegment_image(image_path, heatmap_path, output_path, x, y, width, height, config)
+
+    config_path = "segmentation/config_resegment.txt"
+    write_config(config_path, k, use8Way, euclidif, adj, minComponentSize, buildingBlockTreshold, **options)
+    executable = build_segmenter()
+    run_cmd = [executable, config_path, "--resegment", image_path, heatmap_path, output_path,
+               str(x), str(y), str(width), str(height)]
+    return subprocess.run(run_cmd).returncode == 0
+
+def read_metrics(output_path):
+    # Métricas de la última segmentación en output_path (ver run_metrics.h), o None si no se pidieron.
+    metrics_path = os.path.join(output_path, "metrics.json")
+    if not os.path.exists(metrics_path):
+        return None
+    with open(metrics_path) as metrics_file:
+        return json.load(metrics_file)
+
+def build_segmenter():
+    # Compila el ejecutable del segmentador y devuelve su ruta.
+    if shutil.which("cmake") is not None:
+        build_dir = "segmentation/build/release"
+        if not os.path.exists(os.path.join(build_dir, "CMakeCache.txt")):
+            subprocess.run(["cmake", "-S", "segmentation", "-B", build_dir, "-DCMAKE_BUILD_TYPE=Release"], check=True)
+        subprocess.run(["cmake", "--build", build_dir, "--target", "segment"], check=True)
+        return os.path.join(build_dir, "main.exe" if os.name == "nt" else "main")
+
+    compile_cmd = ["g++", "-O3", "-pthread", "segmentation/main.cpp", "segmentation/segmenter.cpp",
+                   "segmentation/segmentation_io.cpp", "segmentation/heatmap_format.cpp",
+                   "segmentation/heatmap_index.cpp", "segmentation/heatmap_inference.cpp",
+                   "segmentation/edge_map.cpp", "segmentation/contour.cpp",
+                   "segmentation/json_writer.cpp", "segmentation/component_table.cpp",
+                   "segmentation/label_raster.cpp",
+                   "segmentation/stream_segmenter.cpp", "segmentation/batch_pipeline.cpp",
+                   "segmentation/incremental_segmenter.cpp",
+                   "segmentation/run_metrics.cpp", "segmentation/image_codec.cpp",
+                   "segmentation/segmentation_service.cpp", "segmentation/segmentation_preview.cpp",
+                   "segmentation/sheet_arena.cpp",
+                   "segmentation/stb_impl.cpp",
+                   "-lz", "-o", "segmentation/main.exe"]
+    subprocess.run(compile_cmd, check=True)
+    return "./segmentation/main.exe"
@@ -0,0 +1,722 @@
+#include "segmenter.h"
+#include "bitset.h"
+#include "edge_map.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// Function to calculate color difference
+double colorDifference(const Color& c1, const Color& c2, bool euclidif) {
+    if (euclidif) {
+        return std::sqrt(std::pow(c1.r - c2.r, 2) +
+                         std::pow(c1.g - c2.g, 2) +
+                         std::pow(c1.b - c2.b, 2));
+    } else {
+        return std::abs(c1.r - c2.r) +
+               std::abs(c1.g - c2.g) +
+               std::abs(c1.b - c2.b);
+    }
+}
+
+// Bounds, size and heatmap sum of the component being filled, whose pixels are appended
+// to a shared run arena from runBegin on
+struct ComponentBuilder {
+    int xMin, xMax, yMin, yMax, size;
+    double heatmapSum;
+    std::vector<PixelRun>& runs;
+    size_t runBegin;
+
+    explicit ComponentBuilder(std::vector<PixelRun>& arena) : runs(arena) {}
+
+    void reset(int width, int height) {
+        xMin = width;
+        xMax = 0;
+        yMin = height;
+        yMax = 0;
+        size = 0;
+        heatmapSum = 0.0;
+        runBegin = runs.size();
+    }
+
+    // Account for a run of pixels without storing it
+    void accumulate(int y, int xBegin, int xEnd, const HeatmapView& heatmap) {
+        xMin = std::min(xMin, xBegin);
+        xMax = std::max(xMax, xEnd);
+        yMin = std::min(yMin, y);
+        yMax = std::max(yMax, y);
+        size += xEnd - xBegin + 1;
+        const float* row = heatmap.values + static_cast<size_t>(y) * heatmap.width;
+        for (int x = xBegin; x <= xEnd; ++x) {
+            heatmapSum += row[x];
+        }
+    }
+
+    // Add a run of pixels, extending the last run when it continues it
+    void addRun(int y, int xBegin, int xEnd, const HeatmapView& heatmap) {
+        accumulate(y, xBegin, xEnd, heatmap);
+        if (runs.size() > runBegin && runs.back().y == y && runs.back().xEnd + 1 == xBegin) {
+            runs.back().xEnd = xEnd;
+        } else {
+            runs.push_back({y, xBegin, xEnd});
+        }
+    }
+};
+
+// Modified Flood Fill Algorithm
+void floodFillIterative(const ImageView& image, int startX, int startY, Bitset& visited,
+                        const Color& startColor, const Config& config, const HeatmapView& heatmap,
+                        ComponentBuilder& component, FillQueues& queues, size_t& maxDepth) {
+    const int width = image.width;
+    const int height = image.height;
+    std::vector<FillQueues::ColoredPixel>& stack = queues.coloredPixels;
+    stack.clear();
+    stack.push_back({startX, startY, startColor});
+
+    while (!stack.empty()) {
+        int x = stack.back().x;
+        int y = stack.back().y;
+        Color neighborColor = stack.back().color;
+        stack.pop_back();
+
+        if (x < 0 || x >= width || y < 0 || y >= height || visited.test(y * width + x)) {
+            continue;
+        }
+
+        component.addRun(y, x, x, heatmap);
+        visited.set(y * width + x);
+
+        Color currentColor = image.pixels[y * width + x];
+        Color compareColor = config.adj ? neighborColor : startColor; // Use neighbor's color if adj is true
+
+        if (colorDifference(currentColor, compareColor, config.euclidif) <= config.k) {
+            stack.push_back({x + 1, y, currentColor});
+            stack.push_back({x - 1, y, currentColor});
+            stack.push_back({x, y + 1, currentColor});
+            stack.push_back({x, y - 1, currentColor});
+
+            if (config.use8Way) {
+                stack.push_back({x + 1, y + 1, currentColor});
+                stack.push_back({x + 1, y - 1, currentColor});
+                stack.push_back({x - 1, y + 1, currentColor});
+                stack.push_back({x - 1, y - 1, currentColor});
+            }
+            maxDepth = std::max(maxDepth, stack.size());
+        }
+    }
+}
+
+// Scanline Flood Fill Algorithm
+// Fills whole horizontal runs and only keeps seed spans on the stack. The result is
+// identical to floodFillIterative: every unvisited pixel that touches an accepted one
+// is claimed by the component, accepted pixels are filled and the rest only marked.
+// When adj is false acceptance only depends on the seed color, so the visiting order
+// is irrelevant. When adj is true acceptance depends on which neighbor reaches a pixel
+// first, so that case replays the original LIFO order on a compact pre-filtered stack
+// and reads the color test of each pixel against that neighbor from the edge map.
+void floodFillScanline(const ImageView& image, int startX, int startY, Bitset& visited,
+                       const Color& startColor, const Config& config, const HeatmapView& heatmap,
+                       ComponentBuilder& component, const std::uint8_t* edges, int threshold, FillQueues& queues,
+                       size_t& maxDepth) {
+    const int width = image.width;
+    const int height = image.height;
+    const bool euclidif = config.euclidif;
+    auto claim = [&](int x, int y) {
+        component.addRun(y, x, x, heatmap);
+        visited.set(y * width + x);
+    };
+
+    if (config.adj) {
+        // Edge map byte and bit holding the color test of a pixel with the neighbor that
+        // pushed it, relative to the pixel, per push direction
+        const int edgeOffset[8] = {-1, 0, -width, 0, -width - 1, 0, -width + 1, 0};
+        const std::uint8_t edgeBit[8] = {EdgeEast, EdgeEast, EdgeSouth, EdgeSouth,
+                                         EdgeSouthEast, EdgeSouthWest, EdgeSouthWest, EdgeSouthEast};
+        const int seedDirection = 8;
+        std::vector<FillQueues::PendingPixel>& stack = queues.pixels;
+        stack.clear();
+        stack.push_back({startX, startY, seedDirection});
+
+        while (!stack.empty()) {
+            FillQueues::PendingPixel pixel = stack.back();
+            stack.pop_back();
+            int x = pixel.x;
+            int y = pixel.y;
+            if (visited.test(y * width + x)) {
+                continue;
+            }
+            claim(x, y);
+
+            // The seed is compared with itself, which passes whenever anything does
+            int index = y * width + x;
+            bool accepted = pixel.direction == seedDirection
+                                ? threshold >= 0
+                                : (edges[index + edgeOffset[pixel.direction]] & edgeBit[pixel.direction]) != 0;
+            if (accepted) {
+                // Same push order as floodFillIterative, skipping entries it would discard on pop
+                auto push = [&](int nx, int ny, int direction) {
+                    if (nx >= 0 && nx < width && ny >= 0 && ny < height && !visited.test(ny * width + nx)) {
+                        stack.push_back({nx, ny, direction});
+                    }
+                };
+                push(x + 1, y, 0);
+                push(x - 1, y, 1);
+                push(x, y + 1, 2);
+                push(x, y - 1, 3);
+
+                if (config.use8Way) {
+                    push(x + 1, y + 1, 4);
+                    push(x + 1, y - 1, 5);
+                    push(x - 1, y + 1, 6);
+                    push(x - 1, y - 1, 7);
+                }
+                maxDepth = std::max(maxDepth, stack.size());
+            }
+        }
+        return;
+    }
+
+    auto passes = [&](int index) {
+        return colorDistance(image.pixels[index], startColor, euclidif) <= threshold;
+    };
+
+    std::vector<FillQueues::Span>& spans = queues.spans;
+    spans.clear();
+
+    // Fill the run containing (x, y), claim the pixels that stopped it and queue it.
+    // Returns the right end of the run so the caller can skip over it.
+    auto fillRun = [&](int x, int y) {
+        int row = y * width;
+        int xLeft = x;
+        while (xLeft > 0 && !visited.test(row + xLeft - 1) && passes(row + xLeft - 1)) {
+            --xLeft;
+        }
+        int xRight = x;
+        while (xRight < width - 1 && !visited.test(row + xRight + 1) && passes(row + xRight + 1)) {
+            ++xRight;
+        }
+        component.addRun(y, xLeft, xRight, heatmap);
+        visited.setRange(row + xLeft, row + xRight + 1);
+        if (xLeft > 0 && !visited.test(row + xLeft - 1)) {
+            claim(xLeft - 1, y);
+        }
+        if (xRight < width - 1 && !visited.test(row + xRight + 1)) {
+            claim(xRight + 1, y);
+        }
+        spans.push_back({xLeft, xRight, y});
+        maxDepth = std::max(maxDepth, spans.size());
+        return xRight;
+    };
+
+    if (!passes(startY * width + startX)) {
+        claim(startX, startY);
+        return;
+    }
+    fillRun(startX, startY);
+
+    while (!spans.empty()) {
+        FillQueues::Span span = spans.back();
+        spans.pop_back();
+        int from = config.use8Way ? std::max(span.xLeft - 1, 0) : span.xLeft;
+        int to = config.use8Way ? std::min(span.xRight + 1, width - 1) : span.xRight;
+
+        for (int ny : {span.y - 1, span.y + 1}) {
+            if (ny < 0 || ny >= height) {
+                continue;
+            }
+            for (int nx = from; nx <= to; ++nx) {
+                int index = ny * width + nx;
+                if (visited.test(index)) {
+                    continue;
+                }
+                if (passes(index)) {
+                    nx = fillRun(nx, ny);
+                } else {
+                    claim(nx, ny);
+                }
+            }
+        }
+    }
+}
+
+// Union-find lookup with path compression
+int findRoot(std::vector<int>& parent, int label) {
+    int root = label;
+    while (parent[root] != root) {
+        root = parent[root];
+    }
+    while (parent[label] != root) {
+        int next = parent[label];
+        parent[label] = root;
+        label = next;
+    }
+    return root;
+}
+
+// Union-find merge, the smaller label becomes the root so roots follow raster order
+int uniteLabels(std::vector<int>& parent, int a, int b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+        return a;
+    }
+    parent[a] = b;
+    return b;
+}
+
+// Bounding box and size of a labeled component
+struct ComponentBounds {
+    int xMin, xMax, yMin, yMax, size;
+};
+
+// Grow the bounds of a component by those of another part of it
+void mergeBounds(ComponentBounds& into, const ComponentBounds& part) {
+    into.xMin = std::min(into.xMin, part.xMin);
+    into.xMax = std::max(into.xMax, part.xMax);
+    into.yMin = std::min(into.yMin, part.yMin);
+    into.yMax = std::max(into.yMax, part.yMax);
+    into.size += part.size;
+}
+
+// Two-pass union-find labeling of rows [yBegin, yEnd), ignoring neighbors above yBegin.
+// Writes labels numbered from 0 in raster order of each component's first pixel into
+// that band of labels, appends the bounds of every component and returns their count.
+int labelRowsUnionFind(const std::uint8_t* edges, int width, int yBegin, int yEnd, bool use8Way,
+                       std::vector<int>& labels, std::vector<ComponentBounds>& bounds) {
+    std::vector<int> parent;
+    parent.reserve(width * (yEnd - yBegin) / 8 + 1);
+
+    // First pass: provisional labels from the already scanned neighbors
+    for (int y = yBegin; y < yEnd; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int index = y * width + x;
+            int label = -1;
+            auto join = [&](int dx, int dy) {
+                if (edgePasses(edges, width, index, dx, dy)) {
+                    int neighborLabel = labels[index + dy * width + dx];
+                    label = label < 0 ? neighborLabel : uniteLabels(parent, label, neighborLabel);
+                }
+            };
+
+            if (x > 0) join(-1, 0);
+            if (y > yBegin) {
+                if (use8Way && x > 0) join(-1, -1);
+                join(0, -1);
+                if (use8Way && x < width - 1) join(1, -1);
+            }
+            if (label < 0) {
+                label = static_cast<int>(parent.size());
+                parent.push_back(label);
+            }
+            labels[index] = label;
+        }
+    }
+
+    // Flatten the forest into consecutive labels; parents always precede their children
+    int componentCount = 0;
+    for (size_t label = 0; label < parent.size(); ++label) {
+        parent[label] = parent[label] == static_cast<int>(label) ? componentCount++ : parent[parent[label]];
+    }
+
+    // Second pass: final labels and component bounds
+    size_t firstBound = bounds.size();
+    bounds.resize(firstBound + componentCount, {width, 0, yEnd, 0, 0});
+    for (int y = yBegin; y < yEnd; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int& label = labels[y * width + x];
+            label = parent[label];
+            mergeBounds(bounds[firstBound + label], {x, x, y, y, 1});
+        }
+    }
+    return componentCount;
+}
+
+// Two-pass union-find connected-component labeling
+// Two neighboring pixels belong to the same component when their color difference is
+// at most k, which labels the whole raster in two linear sweeps over the edge map. Labels are numbered
+// from 0 in raster order of each component's first pixel, which is also the order in
+// which the flood fill engines seed their components. Returns the number of components.
+//
+// The criterion is symmetric, so the result differs from the flood fill in two ways:
+// - The flood fill claims every unvisited neighbor of an accepted pixel, even one that
+//   fails the color test, so components own a one pixel rim of rejected pixels. Here
+//   such pixels join whichever neighbors they are close enough to, or stay alone.
+// - With adj the flood fill only tests a pixel against the first neighbor that reaches
+//   it, and a rejected pixel is never retested. Here a pixel joins every neighbor
+//   within k, so two regions that the fill kept apart because the bridging pixel was
+//   reached from the wrong side first are merged.
+// Without adj the flood fill compares against the seed color, which depends on which
+// pixel seeded the component and cannot be expressed as an equivalence between
+// neighbors, so this engine always uses the neighbor criterion.
+//
+// With several threads the image is split into horizontal tiles labeled concurrently.
+// The tile components are then merged across the seams in a union-find pass and their
+// bounds combined. Tile labels are ordered by tile and then by raster order, and the
+// smallest label wins every merge, so the result is the same for any thread count.
+int labelComponentsUnionFind(const std::uint8_t* edges, int width, int height, bool use8Way, int threads,
+                             std::vector<int>& labels, std::vector<ComponentBounds>& bounds) {
+    labels.assign(static_cast<size_t>(width) * height, 0);
+    bounds.clear();
+    if (threads <= 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int tileCount = std::max(1, std::min(threads, height));
+    if (tileCount == 1) {
+        return labelRowsUnionFind(edges, width, 0, height, use8Way, labels, bounds);
+    }
+
+    std::vector<int> tileBegin(tileCount + 1);
+    for (int t = 0; t <= tileCount; ++t) {
+        tileBegin[t] = static_cast<int>(static_cast<long long>(height) * t / tileCount);
+    }
+    std::vector<int> tileLabelCount(tileCount);
+    std::vector<std::vector<ComponentBounds>> tileBounds(tileCount);
+    auto runTiles = [&](auto work) {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < tileCount; ++t) {
+            workers.emplace_back(work, t);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    };
+
+    // Label every tile on its own
+    runTiles([&](int t) {
+        tileLabelCount[t] = labelRowsUnionFind(edges, width, tileBegin[t], tileBegin[t + 1], use8Way,
+                                               labels, tileBounds[t]);
+    });
+
+    std::vector<int> tileOffset(tileCount, 0);
+    for (int t = 1; t < tileCount; ++t) {
+        tileOffset[t] = tileOffset[t - 1] + tileLabelCount[t - 1];
+    }
+    int tileComponentCount = tileOffset[tileCount - 1] + tileLabelCount[tileCount - 1];
+    std::vector<int> parent(tileComponentCount);
+    for (int label = 0; label < tileComponentCount; ++label) {
+        parent[label] = label;
+    }
+
+    // Merge the components touching across each seam
+    for (int t = 1; t < tileCount; ++t) {
+        int y = tileBegin[t];
+        for (int x = 0; x < width; ++x) {
+            int index = y * width + x;
+            int label = tileOffset[t] + labels[index];
+            auto join = [&](int dx) {
+                if (edgePasses(edges, width, index, dx, -1)) {
+                    uniteLabels(parent, label, tileOffset[t - 1] + labels[index - width + dx]);
+                }
+            };
+            if (use8Way && x > 0) join(-1);
+            join(0);
+            if (use8Way && x < width - 1) join(1);
+        }
+    }
+
+    // Flatten into final labels and recompute the bounds of merged components
+    int componentCount = 0;
+    for (int label = 0; label < tileComponentCount; ++label) {
+        parent[label] = parent[label] == label ? componentCount++ : parent[parent[label]];
+    }
+    bounds.assign(componentCount, {width, 0, height, 0, 0});
+    for (int t = 0; t < tileCount; ++t) {
+        for (int label = 0; label < tileLabelCount[t]; ++label) {
+            mergeBounds(bounds[parent[tileOffset[t] + label]], tileBounds[t][label]);
+        }
+    }
+
+    runTiles([&](int t) {
+        for (int index = tileBegin[t] * width; index < tileBegin[t + 1] * width; ++index) {
+            labels[index] = parent[tileOffset[t] + labels[index]];
+        }
+    });
+    return componentCount;
+}
+
+// Index of the value at the given fraction of count sorted values
+size_t percentileIndex(size_t count, double fraction) {
+    size_t index = static_cast<size_t>(fraction * count);
+    return index < count ? index : count - 1;
+}
+
+// Value at the given fraction of values, as if they were sorted; reorders values
+template <typename T>
+T selectPercentile(std::vector<T>& values, double fraction) {
+    if (values.empty()) {
+        return T();
+    }
+    auto nth = values.begin() + percentileIndex(values.size(), fraction);
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+// Key that orders like the float it was made from
+inline std::uint32_t floatKey(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+} // namespace
+
+// Function to parse a fill engine name
+FillEngine parseFillEngine(const std::string& name) {
+    if (name == "stack") return FillEngine::Stack;
+    if (name == "scanline") return FillEngine::Scanline;
+    if (name == "unionfind") return FillEngine::UnionFind;
+    throw std::runtime_error("Unknown fill engine: " + name);
+}
+
+// Function to get the name of a fill engine
+std::string fillEngineName(FillEngine engine) {
+    switch (engine) {
+    case FillEngine::Stack: return "stack";
+    case FillEngine::Scanline: return "scanline";
+    case FillEngine::UnionFind: return "unionfind";
+    }
+    return "unknown";
+}
+
+ComponentSet Segmenter::segment(const ImageView& image, const HeatmapView& heatmap, const Config& config,
+                                ComponentSet storage) {
+    if (heatmap.width != image.width || heatmap.height != image.height) {
+        throw std::invalid_argument("Heatmap size does not match the image");
+    }
+    if (!(config.probabilityPercentile >= 0.0 && config.probabilityPercentile <= 1.0) ||
+        !(config.sizePercentile >= 0.0 && config.sizePercentile <= 1.0)) {
+        throw std::invalid_argument("Percentiles must be fractions between 0 and 1");
+    }
+    const int width = image.width;
+    const int height = image.height;
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+
+    ComponentSet result = std::move(storage);
+    result.components.clear();
+    result.runs.clear();
+    result.heatmapStats.clear();
+    result.stats = SegmentationStats();
+    result.width = width;
+    result.height = height;
+
+    // Keep the component being built when it passes the filter. Its runs must be
+    // result.runs[runBegin, runEnd); returns false when the component is dropped.
+    ComponentBuilder component(result.runs);
+    auto keepComponent = [&](size_t runBegin, size_t runEnd) {
+        if (!passesComponentFilter(config, component.size, component.xMax - component.xMin + 1,
+                                   component.yMax - component.yMin + 1)) {
+            countRejectedComponent(result.stats, config, component.size);
+            return false;
+        }
+        Component kept;
+        kept.id = static_cast<int>(result.components.size()) + 1;
+        kept.xMin = component.xMin;
+        kept.xMax = component.xMax;
+        kept.yMin = component.yMin;
+        kept.yMax = component.yMax;
+        kept.size = component.size;
+        kept.avgProbability = static_cast<float>(component.heatmapSum / component.size);
+        kept.isBuildingBlock = false;
+        kept.runBegin = runBegin;
+        kept.runEnd = runEnd;
+        result.components.push_back(kept);
+        return true;
+    };
+
+    // Integer form of the color test, and the neighbor tests precomputed for the engines
+    // that compare neighbors with each other
+    const int threshold = colorDistanceThreshold(config.k, config.euclidif);
+    bool neighborCriterion = config.fillEngine == FillEngine::UnionFind ||
+                             (config.fillEngine == FillEngine::Scanline && config.adj);
+    auto stageStart = std::chrono::steady_clock::now();
+    auto secondsSince = [](std::chrono::steady_clock::time_point& start) {
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - start).count();
+        start = now;
+        return seconds;
+    };
+    if (neighborCriterion) {
+        buildEdgeMap(image, config.use8Way, config.euclidif, threshold, config.threads, edges_);
+    }
+    result.stats.edgeMapSeconds = secondsSince(stageStart);
+
+    if (config.fillEngine == FillEngine::UnionFind) {
+        std::vector<int>& labels = labels_;
+        std::vector<ComponentBounds> bounds;
+        int labelCount = labelComponentsUnionFind(edges_.data(), width, height, config.use8Way,
+                                                  config.threads, labels, bounds);
+
+        // Drop the components that fail the filter before collecting any runs, so the
+        // run arena only ever holds kept components
+        std::vector<int>& keptIndex = keptIndex_;
+        keptIndex.assign(labelCount, -1);
+        int keptCount = 0;
+        for (int label = 0; label < labelCount; ++label) {
+            const ComponentBounds& b = bounds[label];
+            if (passesComponentFilter(config, b.size, b.xMax - b.xMin + 1, b.yMax - b.yMin + 1)) {
+                keptIndex[label] = keptCount++;
+            } else {
+                countRejectedComponent(result.stats, config, b.size);
+            }
+        }
+        bounds = std::vector<ComponentBounds>();
+
+        // Group the runs of the kept components, in raster order
+        auto forEachRun = [&](auto visit) {
+            for (int y = 0; y < height; ++y) {
+                const int* row = labels.data() + static_cast<size_t>(y) * width;
+                for (int xBegin = 0, xEnd = 0; xBegin < width; xBegin = xEnd + 1) {
+                    xEnd = xBegin;
+                    while (xEnd + 1 < width && row[xEnd + 1] == row[xBegin]) {
+                        ++xEnd;
+                    }
+                    visit(row[xBegin], PixelRun{y, xBegin, xEnd});
+                }
+            }
+        };
+        std::vector<size_t>& runOffset = runOffsets_;
+        runOffset.assign(keptCount + 1, 0);
+        forEachRun([&](int label, const PixelRun&) {
+            if (keptIndex[label] >= 0) {
+                runOffset[keptIndex[label] + 1]++;
+            }
+        });
+        for (int kept = 0; kept < keptCount; ++kept) {
+            runOffset[kept + 1] += runOffset[kept];
+        }
+        result.runs.resize(runOffset[keptCount]);
+        std::vector<size_t>& runFill = runFill_;
+        runFill.assign(runOffset.begin(), runOffset.end() - 1);
+        forEachRun([&](int label, const PixelRun& run) {
+            if (keptIndex[label] >= 0) {
+                result.runs[runFill[keptIndex[label]]++] = run;
+            }
+        });
+
+        for (int kept = 0; kept < keptCount; ++kept) {
+            component.reset(width, height);
+            for (size_t r = runOffset[kept]; r < runOffset[kept + 1]; ++r) {
+                const PixelRun& run = result.runs[r];
+                component.accumulate(run.y, run.xBegin, run.xEnd, heatmap);
+            }
+            keepComponent(runOffset[kept], runOffset[kept + 1]);
+        }
+    } else {
+        // Seed a fill at every pixel still unvisited, in raster order
+        visited_.assign(pixelCount);
+        for (size_t seed = visited_.findClear(0); seed < pixelCount; seed = visited_.findClear(seed + 1)) {
+            int x = static_cast<int>(seed % width);
+            int y = static_cast<int>(seed / width);
+            component.reset(width, height);
+
+            Color startColor = image.pixels[seed];
+            if (config.fillEngine == FillEngine::Stack) {
+                floodFillIterative(image, x, y, visited_, startColor, config, heatmap, component, fillQueues_,
+                                   result.stats.maxFillDepth);
+            } else {
+                floodFillScanline(image, x, y, visited_, startColor, config, heatmap, component, edges_.data(),
+                                  threshold, fillQueues_, result.stats.maxFillDepth);
+            }
+            if (!keepComponent(component.runBegin, result.runs.size())) {
+                result.runs.resize(component.runBegin);
+            }
+        }
+    }
+
+    result.stats.labelSeconds = secondsSince(stageStart);
+
+    classifyComponents(result, heatmap, config);
+    result.stats.classifySeconds = secondsSince(stageStart);
+    return result;
+}
+
+bool passesComponentFilter(const Config& config, int size, int width, int height) {
+    return size >= config.minComponentSize && size >= (width * height) / 3;
+}
+
+void countRejectedComponent(SegmentationStats& stats, const Config& config, int size) {
+    if (size < config.minComponentSize) {
+        stats.rejectedTooSmall++;
+    } else {
+        stats.rejectedLowDensity++;
+    }
+}
+
+// The first pass histograms the high 16 bits of every key to find the bin holding the
+// percentile, the second histograms the low 16 bits inside that bin, which pins the key
+float heatmapPercentile(int width, int height, int bandHeight,
+                        const std::function<const float*(int, int)>& rows, double fraction) {
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+    if (pixelCount == 0) {
+        return 0.0f;
+    }
+    size_t rank = percentileIndex(pixelCount, fraction);
+    bandHeight = std::max(bandHeight, 1);
+
+    auto findBin = [&rank](const std::vector<size_t>& histogram) {
+        std::uint32_t bin = 0;
+        while (rank >= histogram[bin]) {
+            rank -= histogram[bin];
+            ++bin;
+        }
+        return bin;
+    };
+    auto forEachBand = [&](auto visit) {
+        for (int y0 = 0; y0 < height; y0 += bandHeight) {
+            const int y1 = std::min(y0 + bandHeight, height);
+            visit(rows(y0, y1), static_cast<size_t>(y1 - y0) * width);
+        }
+    };
+
+    std::vector<size_t> histogram(1 << 16, 0);
+    forEachBand([&](const float* values, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            histogram[floatKey(values[i]) >> 16]++;
+        }
+    });
+    std::uint32_t high = findBin(histogram);
+
+    std::fill(histogram.begin(), histogram.end(), 0);
+    forEachBand([&](const float* values, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            std::uint32_t key = floatKey(values[i]);
+            if ((key >> 16) == high) {
+                histogram[key & 0xffff]++;
+            }
+        }
+    });
+    std::uint32_t key = (high << 16) | findBin(histogram);
+
+    std::uint32_t bits = (key & 0x80000000u) ? (key & 0x7fffffffu) : ~key;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void classifyComponents(ComponentSet& result, const HeatmapView& heatmap, const Config& config) {
+    const float percentile = heatmapPercentile(heatmap.width, heatmap.height, heatmap.height,
+                                               [&](int, int) { return heatmap.values; }, config.probabilityPercentile);
+    classifyComponents(result, percentile, config);
+}
+
+void classifyComponents(ComponentSet& result, float probabilityThreshold, const Config& config) {
+    result.probabilityPercentile = static_cast<float>(config.probabilityPercentile);
+    result.probabilityThreshold = probabilityThreshold;
+    std::vector<int> sizes;
+    for (const auto& comp : result.components)
+        sizes.push_back(comp.size);
+    result.sizeThreshold = selectPercentile(sizes, config.sizePercentile);
+    for (auto& comp : result.components) {
+        comp.isBuildingBlock = comp.avgProbability >= result.probabilityThreshold &&
+                               comp.size <= result.sizeThreshold;
+    }
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "bitset.h"
+
+// Color structure
+struct Color {
+    unsigned char r, g, b;
+};
+static_assert(sizeof(Color) == 3 && alignof(Color) == 1, "Color must map onto packed RGB bytes");
+
+// Flood fill engines available to the segmentation loop
+enum class FillEngine {
+    Stack,     // Original pixel stack, kept as a reference implementation
+    Scanline,  // Span-based fill, same output as Stack
+    UnionFind  // Two-pass connected-component labeling, see labelComponentsUnionFind
+};
+
+// Function to parse a fill engine name ("stack", "scanline" or "unionfind")
+FillEngine parseFillEngine(const std::string& name);
+
+// Function to get the name of a fill engine
+std::string fillEngineName(FillEngine engine);
+
+// File formats for the per-pixel component id raster, see label_raster.h
+enum class LabelRasterFormat {
+    None, // No label raster
+    Raw,  // labels.p2pl, memory-mappable row-major uint32
+    Tiff  // labels.tif, Deflate compressed tiled uint32 TIFF
+};
+
+// Formats of the per-stage run metrics, see run_metrics.h
+enum class MetricsFormat {
+    None,  // No metrics
+    Json,  // metrics.json
+    Trace  // metrics.json and metrics_trace.json in the Chrome trace event format
+};
+
+// File formats of the component masks and the previews, see image_codec.h
+enum class ImageFormat {
+    Jpeg, // .jpg at quality 100 without chroma subsampling
+    Png   // .png, lossless; the masks are written as 8-bit grayscale
+};
+
+// Segmentation configuration
+struct Config {
+    double k;
+    bool use8Way;
+    bool euclidif;
+    bool adj;
+    int minComponentSize;
+    double buildingBlockTreshold;
+    FillEngine fillEngine = FillEngine::Scanline;
+    int threads = 1; // Worker threads for the unionfind engine and the edge map, 0 uses every core
+    double probabilityPercentile = 0.8; // Heatmap percentile a building block must reach on average
+    double sizePercentile = 0.9;        // Component size percentile a building block must not exceed
+    bool writeMasks = true;             // processImage: one JPEG mask per component
+    bool writePolygons = true;          // processImage: polygons.json with the building block outlines
+    double simplifyTolerance = 0.0;     // RDP epsilon for the outlines in pixels, 0 keeps every corner
+    bool compactJson = false;           // processImage: JSON outputs without whitespace
+    bool writeComponentTable = true;    // processImage: components_info.p2pc binary sidecar
+    LabelRasterFormat labelRaster = LabelRasterFormat::None; // processImage: component id per pixel
+    int bandHeight = 0; // processImage: stream the sheet in bands of this many rows, 0 segments it whole
+    MetricsFormat metrics = MetricsFormat::None; // processImage: per-stage times, memory and counts
+    ImageFormat imageFormat = ImageFormat::Jpeg; // processImage: format of the masks and previews
+    bool writePreviews = true; // processImage: segmentation.jpg and building_blocks.jpg debug images
+    bool heatmapStats = false; // processImage: heatmap min, max, deviation and share above the threshold per component
+};
+
+// Read-only view over row-major packed RGB pixels
+struct ImageView {
+    const Color* pixels;
+    int width;
+    int height;
+};
+
+// Read-only view over one building block probability per pixel, same layout as the image
+struct HeatmapView {
+    const float* values;
+    int width;
+    int height;
+};
+
+// Horizontal run of component pixels, from xBegin to xEnd inclusive
+struct PixelRun {
+    int y, xBegin, xEnd;
+};
+static_assert(sizeof(PixelRun) == 3 * sizeof(int), "PixelRun must map onto (y, xBegin, xEnd) triples");
+
+// Contiguous runs of one component
+struct RunRange {
+    const PixelRun* first;
+    const PixelRun* last;
+
+    const PixelRun* begin() const { return first; }
+    const PixelRun* end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+};
+
+// Connected component kept by the segmenter
+struct Component {
+    int id;            // 1-based, in raster order of the component's first pixel
+    int xMin;
+    int xMax;
+    int yMin;
+    int yMax;
+    int size;
+    float avgProbability;
+    bool isBuildingBlock;
+    size_t runBegin;   // Pixels of the component, ComponentSet::runs[runBegin, runEnd)
+    size_t runEnd;
+
+    int width() const { return xMax - xMin + 1; }
+    int height() const { return yMax - yMin + 1; }
+};
+
+// What the segmenter did besides keeping components, for the run metrics
+struct SegmentationStats {
+    int rejectedTooSmall = 0;    // Components under minComponentSize pixels
+    int rejectedLowDensity = 0;  // Components filling less than a third of their bounding box
+    size_t maxFillDepth = 0;     // Most entries the fill stack held at once, 0 for unionfind
+    double edgeMapSeconds = 0.0;
+    double labelSeconds = 0.0;   // Labeling, bounds, sizes, heatmap sums and the size filter
+    double classifySeconds = 0.0;
+    double heatmapWaitSeconds = 0.0; // StreamingSegmenter: waiting for heatmap rows still being inferred
+};
+
+// Heatmap statistics of a component beyond its mean, see computeHeatmapStats
+struct ComponentHeatmapStats {
+    float minProbability = 0.0f;
+    float maxProbability = 0.0f;
+    float stdDevProbability = 0.0f; // Population standard deviation
+    float aboveThreshold = 0.0f;    // Share of its pixels at or above ComponentSet::probabilityThreshold
+};
+
+// Result of segmenting one image
+struct ComponentSet {
+    int width = 0;
+    int height = 0;
+    float probabilityPercentile = 0.0f; // Config::probabilityPercentile, 0 for a fixed threshold
+    float probabilityThreshold = 0.0f;  // That percentile of the heatmap
+    int sizeThreshold = 0;             // Config::sizePercentile of the component sizes
+    std::vector<Component> components;
+    std::vector<PixelRun> runs; // Pixels of every component, in component order
+    std::vector<ComponentHeatmapStats> heatmapStats; // Per component with Config::heatmapStats, else empty
+    SegmentationStats stats;
+
+    RunRange runsOf(const Component& comp) const {
+        return {runs.data() + comp.runBegin, runs.data() + comp.runEnd};
+    }
+};
+
+// Size and density filter of the kept components: at least minComponentSize pixels and a
+// third of the bounding box
+bool passesComponentFilter(const Config& config, int size, int width, int height);
+
+// Count a component that failed passesComponentFilter under the rule it broke
+void countRejectedComponent(SegmentationStats& stats, const Config& config, int size);
+
+// Mark the building blocks of result: components whose mean probability reaches the
+// probabilityPercentile of the heatmap and whose size does not exceed the sizePercentile
+// of the component sizes. Sets both thresholds of result.
+void classifyComponents(ComponentSet& result, const HeatmapView& heatmap, const Config& config);
+
+// The same with the probability threshold already taken, e.g. read back from a component
+// table: only the size threshold is computed, from the component sizes
+void classifyComponents(ComponentSet& result, float probabilityThreshold, const Config& config);
+
+// Value at fraction of a heatmap read in bands of bandHeight rows, rows(rowBegin, rowEnd)
+// giving the values of each, as if they were sorted: two passes over the bands, so a
+// heatmap that is decoded or streamed band by band never has to be whole in memory
+float heatmapPercentile(int width, int height, int bandHeight,
+                        const std::function<const float*(int, int)>& rows, double fraction);
+
+// Work lists of the fill engines, emptied for every component but kept with their capacity
+struct FillQueues {
+    // Pixel to visit and the color of the neighbor that pushed it, for the stack engine
+    struct ColoredPixel {
+        int x, y;
+        Color color;
+    };
+    // Pixel to visit and the direction it was pushed in, for the adj criterion
+    struct PendingPixel {
+        int x, y, direction;
+    };
+    struct Span {
+        int xLeft, xRight, y;
+    };
+    std::vector<ColoredPixel> coloredPixels;
+    std::vector<PendingPixel> pixels;
+    std::vector<Span> spans;
+};
+
+// Splits an image into connected components and classifies them as building blocks.
+// All state lives in the instance, so separate instances can run concurrently and one
+// instance can be reused across images, but a single instance is not thread-safe. The
+// buffers keep their capacity between images, so an instance reused across sheets only
+// allocates when a sheet is larger than every one before it. The image is only read, so
+// it can be mapped read-only or shared between threads; the colored preview is rendered
+// from the result on demand, see renderSegmentationPreview.
+class Segmenter {
+public:
+    // storage is a result whose buffers the new one reuses, such as SheetArena::takeResult;
+    // its contents are discarded
+    ComponentSet segment(const ImageView& image, const HeatmapView& heatmap, const Config& config,
+                         ComponentSet storage = {});
+
+private:
+    Bitset visited_;
+    std::vector<std::uint8_t> edges_; // Edge map, see buildEdgeMap
+    std::vector<int> labels_;         // Component label per pixel of the unionfind engine
+    std::vector<int> keptIndex_;      // Kept component per unionfind label, -1 for rejected ones
+    std::vector<size_t> runOffsets_;  // First run of each kept component in the run arena
+    std::vector<size_t> runFill_;
+    FillQueues fillQueues_;
+};
@@ -0,0 +1,456 @@
+// Python bindings for the segmenter, imported as segmentation.segmenter_native.
+//
+// Built next to this file by the segmenter_native CMake target when pybind11 is found:
+//   cmake --preset release && cmake --build --preset release --target segmenter_native
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "batch_pipeline.h"
+#include "dbscan.h"
+#include "footprint_index.h"
+#include "image_codec.h"
+#include "label_raster.h"
+#include "polygon_features.h"
+#include "polygon_match.h"
+#include "run_metrics.h"
+#include "segmentation_io.h"
+#include "segmentation_preview.h"
+#include "segmenter.h"
+
+namespace py = pybind11;
+
+namespace {
+
+// Hand a vector over to numpy without copying, viewed as elements of type T;
+// the array owns the vector from then on
+template <typename T, typename Owned>
+py::array_t<T> toArray(std::vector<Owned>&& values, std::vector<py::ssize_t> shape) {
+    auto owned = std::make_unique<std::vector<Owned>>(std::move(values));
+    const T* data = reinterpret_cast<const T*>(owned->data());
+    py::capsule release(owned.get(), [](void* pointer) { delete static_cast<std::vector<Owned>*>(pointer); });
+    owned.release();
+    return py::array_t<T>(shape, data, release);
+}
+
+Config makeConfig(double k, bool use8Way, bool euclidif, bool adj, int minComponentSize,
+                  double buildingBlockTreshold, const std::string& engine, int threads,
+                  double probabilityPercentile, double sizePercentile, bool writeMasks, bool writePolygons,
+                  double simplifyTolerance, bool compactJson, bool writeComponentTable,
+                  const std::string& labelRaster, int bandHeight, const std::string& metrics,
+                  const std::string& imageFormat, bool writePreviews, bool heatmapStats) {
+    Config config;
+    config.k = k;
+    config.use8Way = use8Way;
+    config.euclidif = euclidif;
+    config.adj = adj;
+    config.minComponentSize = minComponentSize;
+    config.buildingBlockTreshold = buildingBlockTreshold;
+    config.fillEngine = parseFillEngine(engine);
+    config.threads = threads;
+    config.probabilityPercentile = probabilityPercentile;
+    config.sizePercentile = sizePercentile;
+    config.writeMasks = writeMasks;
+    config.writePolygons = writePolygons;
+    config.simplifyTolerance = simplifyTolerance;
+    config.compactJson = compactJson;
+    config.writeComponentTable = writeComponentTable;
+    config.labelRaster = parseLabelRasterFormat(labelRaster);
+    config.bandHeight = bandHeight;
+    config.metrics = parseMetricsFormat(metrics);
+    config.imageFormat = parseImageFormat(imageFormat);
+    config.writePreviews = writePreviews;
+    config.heatmapStats = heatmapStats;
+    return config;
+}
+
+// Segment an (H, W, 3) uint8 image with an (H, W) float32 heatmap. C-contiguous arrays of
+// the right dtype are read in place; anything else is converted once by pybind11.
+py::dict segmentArrays(Segmenter& segmenter,
+                       py::array_t<std::uint8_t, py::array::c_style | py::array::forcecast> image,
+                       py::array_t<float, py::array::c_style | py::array::forcecast> heatmap,
+                       const Config& config) {
+    if (image.ndim() != 3 || image.shape(2) != 3) {
+        throw std::invalid_argument("image must have shape (height, width, 3)");
+    }
+    if (heatmap.ndim() != 2 || heatmap.shape(0) != image.shape(0) || heatmap.shape(1) != image.shape(1)) {
+        throw std::invalid_argument("heatmap must have shape (height, width) matching the image");
+    }
+    const int width = static_cast<int>(image.shape(1));
+    const int height = static_cast<int>(image.shape(0));
+    ImageView imageView{reinterpret_cast<const Color*>(image.data()), width, height};
+    HeatmapView heatmapView{heatmap.data(), width, height};
+
+    ComponentSet result;
+    std::vector<Color> preview;
+    {
+        py::gil_scoped_release release;
+        result = segmenter.segment(imageView, heatmapView, config);
+        if (config.writePreviews) {
+            renderSegmentationPreview(imageView, result, preview);
+        }
+    }
+
+    const size_t count = result.components.size();
+    std::vector<std::int32_t> ids(count), bbox(count * 4), sizes(count);
+    std::vector<float> probabilities(count);
+    py::array_t<bool> isBuildingBlock(static_cast<py::ssize_t>(count));
+    auto buildingBlocks = isBuildingBlock.mutable_unchecked<1>();
+    std::vector<std::int64_t> runOffsets(count + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        const Component& comp = result.components[i];
+        ids[i] = comp.id;
+        bbox[i * 4] = comp.xMin;
+        bbox[i * 4 + 1] = comp.yMin;
+        bbox[i * 4 + 2] = comp.width();
+        bbox[i * 4 + 3] = comp.height();
+        sizes[i] = comp.size;
+        probabilities[i] = comp.avgProbability;
+        buildingBlocks(i) = comp.isBuildingBlock;
+        runOffsets[i] = static_cast<std::int64_t>(comp.runBegin);
+    }
+    const auto runCount = static_cast<py::ssize_t>(result.runs.size());
+    runOffsets[count] = runCount;
+
+    const auto n = static_cast<py::ssize_t>(count);
+    py::dict out;
+    out["id"] = toArray<std::int32_t>(std::move(ids), {n});
+    out["bbox"] = toArray<std::int32_t>(std::move(bbox), {n, 4});
+    out["size"] = toArray<std::int32_t>(std::move(sizes), {n});
+    out["avg_probability"] = toArray<float>(std::move(probabilities), {n});
+    out["is_building_block"] = isBuildingBlock;
+    out["run_offsets"] = toArray<std::int64_t>(std::move(runOffsets), {n + 1});
+    out["runs"] = toArray<std::int32_t>(std::move(result.runs), {runCount, 3});
+    if (config.writePreviews) {
+        out["preview"] = toArray<std::uint8_t>(std::move(preview), {height, width, 3});
+    }
+    out["probability_threshold"] = result.probabilityThreshold;
+    out["size_threshold"] = result.sizeThreshold;
+    return out;
+}
+
+// Features of a list of (N, 2) integer rings, one (sides, area, perimeter, circularity,
+// compactness, convexity, side cv) row per ring
+py::array_t<double> polygonFeatures(const py::list& polygons, int threads) {
+    std::vector<std::vector<RingPoint>> rings;
+    rings.reserve(polygons.size());
+    for (const py::handle& polygon : polygons) {
+        auto coordinates = py::array_t<std::int32_t, py::array::c_style | py::array::forcecast>::ensure(polygon);
+        if (!coordinates || (coordinates.size() > 0 && (coordinates.ndim() != 2 || coordinates.shape(1) != 2))) {
+            throw std::invalid_argument("every polygon must be an (N, 2) array of coordinates");
+        }
+        const auto* points = reinterpret_cast<const RingPoint*>(coordinates.data());
+        rings.emplace_back(points, points + coordinates.size() / 2);
+    }
+    std::vector<PolygonFeatures> features;
+    {
+        py::gil_scoped_release release;
+        features = computePolygonFeatures(rings, threads);
+    }
+    std::vector<double> rows;
+    rows.reserve(features.size() * 7);
+    for (const PolygonFeatures& f : features) {
+        rows.insert(rows.end(), {static_cast<double>(f.sides), f.area, f.perimeter, f.circularity, f.compactness,
+                                 f.convexity, f.sideCv});
+    }
+    return toArray<double>(std::move(rows), {static_cast<py::ssize_t>(features.size()), 7});
+}
+
+// Ring of an (N, 2) array or list of coordinates
+std::vector<FootprintPoint> toRing(const py::handle& polygon) {
+    auto coordinates = py::array_t<double, py::array::c_style | py::array::forcecast>::ensure(polygon);
+    if (!coordinates || (coordinates.size() > 0 && (coordinates.ndim() != 2 || coordinates.shape(1) != 2))) {
+        throw std::invalid_argument("every polygon must be an (N, 2) array of coordinates");
+    }
+    const auto* points = reinterpret_cast<const FootprintPoint*>(coordinates.data());
+    return std::vector<FootprintPoint>(points, points + coordinates.size() / 2);
+}
+
+MatchOptions makeMatchOptions(double threshold, float descriptorTolerance, int rasterSize, int refineCount,
+                              int threads) {
+    MatchOptions options;
+    options.threshold = threshold;
+    options.descriptorTolerance = descriptorTolerance;
+    options.rasterSize = rasterSize;
+    options.refineCount = refineCount;
+    options.threads = threads;
+    return options;
+}
+
+NeighborIndex makeNeighborIndex(py::array_t<double, py::array::c_style | py::array::forcecast> points, double maxEps,
+                                int threads) {
+    if (points.ndim() != 2) {
+        throw std::invalid_argument("points must have shape (count, dims)");
+    }
+    const double* data = points.data();
+    const auto count = static_cast<size_t>(points.shape(0));
+    const int dims = static_cast<int>(points.shape(1));
+    py::gil_scoped_release release;
+    return NeighborIndex(data, count, dims, maxEps, threads);
+}
+
+} // namespace
+
+PYBIND11_MODULE(segmenter_native, m) {
+    m.doc() = "Flood fill / union-find segmentation of historical map sheets";
+
+    py::class_<Config>(m, "Config")
+        .def(py::init(&makeConfig), py::arg("k"), py::arg("use8Way"), py::arg("euclidif"), py::arg("adj"),
+             py::arg("minComponentSize"), py::arg("buildingBlockTreshold"), py::arg("engine") = "scanline",
+             py::arg("threads") = 1, py::arg("probabilityPercentile") = 0.8, py::arg("sizePercentile") = 0.9,
+             py::arg("writeMasks") = true, py::arg("writePolygons") = true, py::arg("simplifyTolerance") = 0.0,
+             py::arg("compactJson") = false, py::arg("writeComponentTable") = true,
+             py::arg("labelRaster") = "none", py::arg("bandHeight") = 0, py::arg("metrics") = "none",
+             py::arg("imageFormat") = "jpg", py::arg("writePreviews") = true, py::arg("heatmapStats") = false)
+        .def_readwrite("k", &Config::k)
+        .def_readwrite("use8Way", &Config::use8Way)
+        .def_readwrite("euclidif", &Config::euclidif)
+        .def_readwrite("adj", &Config::adj)
+        .def_readwrite("minComponentSize", &Config::minComponentSize)
+        .def_readwrite("buildingBlockTreshold", &Config::buildingBlockTreshold)
+        .def_property(
+            "engine", [](const Config& config) { return fillEngineName(config.fillEngine); },
+            [](Config& config, const std::string& name) { config.fillEngine = parseFillEngine(name); })
+        .def_readwrite("threads", &Config::threads)
+        .def_readwrite("probabilityPercentile", &Config::probabilityPercentile)
+        .def_readwrite("sizePercentile", &Config::sizePercentile)
+        .def_readwrite("writeMasks", &Config::writeMasks)
+        .def_readwrite("writePolygons", &Config::writePolygons)
+        .def_readwrite("simplifyTolerance", &Config::simplifyTolerance)
+        .def_readwrite("compactJson", &Config::compactJson)
+        .def_readwrite("writeComponentTable", &Config::writeComponentTable)
+        .def_property(
+            "labelRaster", [](const Config& config) { return labelRasterFormatName(config.labelRaster); },
+            [](Config& config, const std::string& name) { config.labelRaster = parseLabelRasterFormat(name); })
+        .def_readwrite("bandHeight", &Config::bandHeight)
+        .def_property(
+            "metrics", [](const Config& config) { return metricsFormatName(config.metrics); },
+            [](Config& config, const std::string& name) { config.metrics = parseMetricsFormat(name); })
+        .def_property(
+            "imageFormat", [](const Config& config) { return imageFormatName(config.imageFormat); },
+            [](Config& config, const std::string& name) { config.imageFormat = parseImageFormat(name); })
+        .def_readwrite("writePreviews", &Config::writePreviews)
+        .def_readwrite("heatmapStats", &Config::heatmapStats);
+
+    py::class_<Segmenter>(m, "Segmenter")
+        .def(py::init<>())
+        .def("segment", &segmentArrays, py::arg("image"), py::arg("heatmap"), py::arg("config"),
+             "Segment an (H, W, 3) uint8 image with an (H, W) float32 heatmap.\n\n"
+             "Returns a dict of arrays: id, bbox (x, y, width, height), size, avg_probability,\n"
+             "is_building_block, runs (y, x_begin, x_end) with run_offsets per component,\n"
+             "probability_threshold and size_threshold, and the colored preview when\n"
+             "config.writePreviews is set.");
+
+    m.def("polygon_features", &polygonFeatures, py::arg("polygons"), py::arg("threads") = 1,
+          "Shape features of a list of (N, 2) coordinate arrays, as the rings of polygons.json.\n\n"
+          "Returns a (count, 7) float64 array with the columns of process_shapes in\n"
+          "georeferencing/outliers_detection/dbscan.py: Num_Sides, Area, Perimeter, Circularity,\n"
+          "Compactness, Convexity and CV.");
+
+    py::class_<NeighborIndex>(m, "NeighborIndex")
+        .def(py::init(&makeNeighborIndex), py::arg("points"), py::arg("max_eps"), py::arg("threads") = 1,
+             "Neighborhoods within max_eps of a (count, dims) array, searched once with a KD-tree.")
+        .def_property_readonly("max_eps", &NeighborIndex::maxEps)
+        .def("__len__", &NeighborIndex::size)
+        .def(
+            "cluster",
+            [](const NeighborIndex& index, double eps, int minSamples) {
+                std::vector<int> labels;
+                {
+                    py::gil_scoped_release release;
+                    labels = index.cluster(eps, minSamples);
+                }
+                const auto count = static_cast<py::ssize_t>(labels.size());
+                return toArray<std::int32_t>(std::move(labels), {count});
+            },
+            py::arg("eps"), py::arg("min_samples"),
+            "Labels of sklearn.cluster.DBSCAN(eps, min_samples).fit_predict(points), -1 for noise,\n"
+            "for any eps <= max_eps, without searching the neighborhoods again.");
+
+    py::class_<FootprintIndex>(m, "FootprintIndex")
+        .def_static(
+            "build",
+            [](const std::vector<std::string>& names, const py::list& polygons) {
+                std::vector<std::vector<FootprintPoint>> rings;
+                rings.reserve(polygons.size());
+                for (const py::handle& polygon : polygons) {
+                    rings.push_back(toRing(polygon));
+                }
+                py::gil_scoped_release release;
+                return FootprintIndex(rings, names);
+            },
+            py::arg("names"), py::arg("polygons"),
+            "Index the (N, 2) coordinate arrays of polygons, named by names, by their shape descriptors.")
+        .def_static("load", &FootprintIndex::load, py::arg("path"), "Read an index written by save.")
+        .def("save", &FootprintIndex::save, py::arg("path"))
+        .def("__len__", &FootprintIndex::size)
+        .def("names",
+             [](const FootprintIndex& index) {
+                 std::vector<std::string> names(index.size());
+                 for (size_t i = 0; i < names.size(); ++i) {
+                     names[i] = index.name(i);
+                 }
+                 return names;
+             })
+        .def(
+            "centroid",
+            [](const FootprintIndex& index, size_t i) {
+                if (i >= index.size()) {
+                    throw py::index_error("footprint out of range");
+                }
+                const FootprintPoint centroid = index.centroid(i);
+                return py::make_tuple(centroid.x, centroid.y);
+            },
+            py::arg("footprint"), "Centroid of the source ring, as calculate_polygon_centroid computes it.")
+        .def(
+            "match",
+            [](const FootprintIndex& index, const py::list& polygons, double threshold, float descriptorTolerance,
+               int rasterSize, int refineCount, int threads, const std::vector<std::uint32_t>& allowed) {
+                std::vector<std::vector<FootprintPoint>> rings;
+                for (const py::handle& polygon : polygons) {
+                    rings.push_back(toRing(polygon));
+                }
+                std::vector<std::uint8_t> mask;
+                if (!allowed.empty()) {
+                    mask.assign(index.size(), 0);
+                    for (std::uint32_t footprint : allowed) {
+                        if (footprint >= index.size()) {
+                            throw py::index_error("allowed footprint out of range");
+                        }
+                        mask[footprint] = 1;
+                    }
+                }
+                std::vector<FootprintMatch> matches;
+                {
+                    py::gil_scoped_release release;
+                    std::vector<NormalizedShape> queries;
+                    queries.reserve(rings.size());
+                    for (const auto& ring : rings) {
+                        queries.push_back(normalizeShape(ring.data(), ring.size()));
+                    }
+                    matches = matchFootprints(
+                        queries, index, makeMatchOptions(threshold, descriptorTolerance, rasterSize, refineCount, threads),
+                        mask);
+                }
+                const auto count = static_cast<py::ssize_t>(matches.size());
+                std::vector<std::int32_t> query(matches.size()), footprint(matches.size());
+                std::vector<double> iou(matches.size());
+                for (size_t i = 0; i < matches.size(); ++i) {
+                    query[i] = static_cast<std::int32_t>(matches[i].query);
+                    footprint[i] = static_cast<std::int32_t>(matches[i].footprint);
+                    iou[i] = matches[i].iou;
+                }
+                py::dict out;
+                out["query"] = toArray<std::int32_t>(std::move(query), {count});
+                out["footprint"] = toArray<std::int32_t>(std::move(footprint), {count});
+                out["iou"] = toArray<double>(std::move(iou), {count});
+                return out;
+            },
+            py::arg("polygons"), py::arg("threshold") = 0.9, py::arg("descriptor_tolerance") = 0.0f,
+            py::arg("raster_size") = 0, py::arg("refine_count") = 3, py::arg("threads") = 0,
+            py::arg("allowed") = std::vector<std::uint32_t>(),
+            "Match every (N, 2) coordinate array of polygons against the footprints whose shape\n"
+            "descriptors are within descriptor_tolerance (0 compares every footprint), restricted\n"
+            "to the allowed footprints when given. Returns a dict of arrays query, footprint and\n"
+            "iou with the pairs whose aligned IoU is at least threshold. raster_size 0 computes\n"
+            "every side alignment exactly. The defaults are exact; a descriptor_tolerance or a\n"
+            "raster_size above 0 is faster but may miss pairs at or above threshold.");
+
+    m.def(
+        "aligned_iou",
+        [](const py::handle& a, const py::handle& b, int rasterSize, int refineCount) {
+            const std::vector<FootprintPoint> ringA = toRing(a), ringB = toRing(b);
+            const NormalizedShape shapeA = normalizeShape(ringA.data(), ringA.size());
+            const NormalizedShape shapeB = normalizeShape(ringB.data(), ringB.size());
+            if (!shapeA.valid || !shapeB.valid) {
+                throw std::invalid_argument("polygon has zero area and cannot be scaled");
+            }
+            MatchOptions options;
+            options.rasterSize = rasterSize;
+            options.refineCount = refineCount;
+            return maxAlignedIoU(viewOf(shapeA), viewOf(shapeB), options);
+        },
+        py::arg("coords_a"), py::arg("coords_b"), py::arg("raster_size") = 0, py::arg("refine_count") = 3,
+        "Largest IoU of the two rings scaled to area 1 over every pair of side alignments, the\n"
+        "max_iou of topological_similarity in georeferencing/polygons_comparation.py.");
+
+    m.def(
+        "process_image",
+        [](const std::string& imagePath, const std::string& heatmapPath, const std::string& outputFolder,
+           const Config& config) {
+            py::gil_scoped_release release;
+            processImage(imagePath, heatmapPath, outputFolder, config);
+        },
+        py::arg("image_path"), py::arg("heatmap_path"), py::arg("output_folder"), py::arg("config"),
+        "Same as the main.exe CLI: segment one image and write its outputs to output_folder.");
+
+    m.def(
+        "process_image_with_model",
+        [](const std::string& imagePath, const std::string& modelPath, const std::string& outputFolder,
+           const Config& config, int batchSize, int windowSize, const std::string& heatmapOutputPath) {
+            py::gil_scoped_release release;
+            HeatmapOptions options;
+            options.batchSize = batchSize;
+            options.windowSize = windowSize;
+            options.threads = config.threads;
+            return processImageWithModel(imagePath, modelPath, outputFolder, config, options, heatmapOutputPath);
+        },
+        py::arg("image_path"), py::arg("model_path"), py::arg("output_folder"), py::arg("config"),
+        py::arg("batch_size") = 128, py::arg("window_size") = 0, py::arg("heatmap_output_path") = "",
+        "Same as main.exe --infer: infer the heatmap of one image with a model exported by\n"
+        "heatmap_generator.export_model, then segment it and write its outputs to output_folder.\n"
+        "With config.bandHeight set, bands are segmented while the rest of the heatmap is inferred.\n"
+        "Returns False when the model or the image could not be read or an output could not be written.");
+
+    m.def(
+        "reclassify_image",
+        [](const std::string& heatmapPath, const std::string& outputFolder, const Config& config) {
+            py::gil_scoped_release release;
+            return reclassifyImage(heatmapPath, outputFolder, config);
+        },
+        py::arg("heatmap_path"), py::arg("output_folder"), py::arg("config"),
+        "Reapply the percentile thresholds of config to a sheet segmented earlier into\n"
+        "output_folder with label_raster raw, from its cached table and label raster.\n"
+        "Returns False when the cache could not be read or an output could not be written.");
+
+    m.def(
+        "resegment_image",
+        [](const std::string& imagePath, const std::string& heatmapPath, const std::string& outputFolder, int x, int y,
+           int width, int height, const Config& config) {
+            py::gil_scoped_release release;
+            return resegmentImage(imagePath, heatmapPath, outputFolder, {x, y, width, height}, config);
+        },
+        py::arg("image_path"), py::arg("heatmap_path"), py::arg("output_folder"), py::arg("x"), py::arg("y"),
+        py::arg("width"), py::arg("height"), py::arg("config"),
+        "Same as main.exe --resegment: segment again the components of a sheet segmented earlier\n"
+        "into output_folder with label_raster raw that an edit of the image inside the rectangle\n"
+        "can reach, keeping the ids of all the others, and patch its outputs. The sheet must have\n"
+        "been segmented by the unionfind engine or in bands with the same k, use8Way and euclidif.\n"
+        "Returns False when the cache could not be read, was labeled otherwise or an output could\n"
+        "not be written.");
+
+    m.def(
+        "process_batch",
+        [](const std::string& imageDir, const std::string& heatmapDir, const std::string& outputDir,
+           const Config& config, int decodeThreads, int writeThreads, int queueDepth, bool resume) {
+            py::gil_scoped_release release;
+            BatchOptions options;
+            options.decodeThreads = decodeThreads;
+            options.writeThreads = writeThreads;
+            options.queueDepth = queueDepth;
+            options.resume = resume;
+            return processBatch(imageDir, heatmapDir, outputDir, config, options);
+        },
+        py::arg("image_dir"), py::arg("heatmap_dir"), py::arg("output_dir"), py::arg("config"),
+        py::arg("decode_threads") = 2, py::arg("write_threads") = 2, py::arg("queue_depth") = 2,
+        py::arg("resume") = true,
+        "Same as main.exe --batch: segment every image of image_dir with heatmap_dir/<name>.hmp\n"
+        "into output_dir/<name>/, skipping folders already complete when resume is set.\n"
+        "Returns the number of images that failed.");
+}
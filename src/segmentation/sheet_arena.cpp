@@ -0,0 +1,50 @@
+#include "sheet_arena.h"
+
+#include <utility>
+
+SheetArena::SheetArena(size_t capacity) : capacity_(capacity) {}
+
+ComponentSet SheetArena::takeResult() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (results_.empty()) {
+        return {};
+    }
+    ComponentSet result = std::move(results_.back());
+    results_.pop_back();
+    return result;
+}
+
+void SheetArena::giveBack(ComponentSet&& result) {
+    // Everything but the buffers goes back to its defaults
+    ComponentSet kept;
+    kept.components = std::move(result.components);
+    kept.runs = std::move(result.runs);
+    kept.heatmapStats = std::move(result.heatmapStats);
+    kept.components.clear();
+    kept.runs.clear();
+    kept.heatmapStats.clear();
+    result = ComponentSet();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (results_.size() < capacity_) {
+        results_.push_back(std::move(kept));
+    }
+}
+
+std::vector<Color> SheetArena::takeImage() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (images_.empty()) {
+        return {};
+    }
+    std::vector<Color> image = std::move(images_.back());
+    images_.pop_back();
+    return image;
+}
+
+void SheetArena::giveBack(std::vector<Color>&& image) {
+    std::vector<Color> kept = std::move(image);
+    kept.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (images_.size() < 2 * capacity_) {
+        images_.push_back(std::move(kept));
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "segmenter.h"
+
+// Buffers of written sheets kept for the sheets after them. A run over many sheets then
+// allocates the component list, the runs and the two preview images once for the largest
+// sheet, instead of freeing them and faulting their pages in again for every sheet, and
+// the heap of a long run does not fill up with sheet sized holes. The
+// buffers are cleared, not freed, when given back. Thread-safe, since the writers of
+// processBatch give back what the segmentation stage takes.
+class SheetArena {
+public:
+    // Keep the buffers of at most capacity sheets, the ones given back beyond it are freed
+    explicit SheetArena(size_t capacity);
+
+    // An empty result whose vectors keep the capacity of an earlier sheet, a new one when
+    // none is left. For Segmenter::segment.
+    ComponentSet takeResult();
+    void giveBack(ComponentSet&& result);
+
+    // An empty pixel buffer, same as takeResult. Two are kept per sheet, for the
+    // segmentation and building_blocks previews.
+    std::vector<Color> takeImage();
+    void giveBack(std::vector<Color>&& image);
+
+private:
+    std::mutex mutex_;
+    size_t capacity_;
+    std::vector<ComponentSet> results_;
+    std::vector<std::vector<Color>> images_;
+};
@@ -0,0 +1,6 @@
+// The stb_image and stb_image_write implementations, kept in their own translation unit so
+// they are compiled once instead of with every change to segmentation_io.cpp.
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
@@ -0,0 +1,363 @@
+#include "stream_segmenter.h"
+#include "edge_map.h"
+#include "label_raster.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+
+int StreamingSegmenter::findRecord(int record) {
+    int root = record;
+    while (records_[root].parent != root) {
+        root = records_[root].parent;
+    }
+    while (records_[record].parent != root) {
+        int next = records_[record].parent;
+        records_[record].parent = root;
+        record = next;
+    }
+    return root;
+}
+
+std::uint32_t StreamingSegmenter::findLabel(std::uint32_t label) {
+    while (labelParent_[label] != label) {
+        labelParent_[label] = labelParent_[labelParent_[label]];
+        label = labelParent_[label];
+    }
+    return label;
+}
+
+std::uint32_t StreamingSegmenter::findSlot(std::uint32_t slot) {
+    while (slots_[slot].parent != slot) {
+        slots_[slot].parent = slots_[slots_[slot].parent].parent;
+        slot = slots_[slot].parent;
+    }
+    return slot;
+}
+
+// Merge two roots into the one with the earlier first pixel, which keeps its label and slot
+int StreamingSegmenter::uniteRecords(int a, int b) {
+    if (a == b) {
+        return a;
+    }
+    if (records_[b].firstPixel < records_[a].firstPixel) {
+        std::swap(a, b);
+    }
+    OpenComponent& root = records_[a];
+    OpenComponent& merged = records_[b];
+    root.xMin = std::min(root.xMin, merged.xMin);
+    root.xMax = std::max(root.xMax, merged.xMax);
+    root.yMin = std::min(root.yMin, merged.yMin);
+    root.yMax = std::max(root.yMax, merged.yMax);
+    root.size += merged.size;
+    root.heatmapSum += merged.heatmapSum;
+    root.lastRow = std::max(root.lastRow, merged.lastRow);
+    merged.parent = a;
+    labelParent_[merged.label] = root.label;
+    if (root.slot == 0) {
+        root.slot = merged.slot;
+    } else if (merged.slot != 0) {
+        slots_[merged.slot].parent = root.slot;
+    }
+    return a;
+}
+
+int StreamingSegmenter::openRecord(int x, int y, int width) {
+    int record;
+    if (freeRecords_.empty()) {
+        record = static_cast<int>(records_.size());
+        records_.emplace_back();
+    } else {
+        record = freeRecords_.back();
+        freeRecords_.pop_back();
+    }
+    std::uint32_t label = static_cast<std::uint32_t>(labelParent_.size());
+    labelParent_.push_back(label);
+    labelSlot_.push_back(0);
+    records_[record] = {record, static_cast<size_t>(y) * width + x, label, 0, x, x, y, y, 0, 0.0, y};
+    return record;
+}
+
+ComponentSet StreamingSegmenter::segment(RowSource& image, const HeatmapView& heatmap, const Config& config,
+                                         const std::string& labelPath) {
+    HeatmapViewRows rows(heatmap);
+    return segment(image, rows, config, labelPath);
+}
+
+ComponentSet StreamingSegmenter::segment(RowSource& image, HeatmapRowSource& heatmap, const Config& config,
+                                         const std::string& labelPath) {
+    if (heatmap.width() != image.width() || heatmap.height() != image.height()) {
+        throw std::invalid_argument("Heatmap size does not match the image");
+    }
+    if (!(config.probabilityPercentile >= 0.0 && config.probabilityPercentile <= 1.0) ||
+        !(config.sizePercentile >= 0.0 && config.sizePercentile <= 1.0)) {
+        throw std::invalid_argument("Percentiles must be fractions between 0 and 1");
+    }
+    if (config.bandHeight <= 0) {
+        throw std::invalid_argument("Band height must be positive");
+    }
+    const int width = image.width();
+    const int height = image.height();
+    const int bandHeight = std::min(config.bandHeight, std::max(height, 1));
+    const int threshold = colorDistanceThreshold(config.k, config.euclidif);
+
+    const auto start = std::chrono::steady_clock::now();
+    ComponentSet result;
+    result.width = width;
+    result.height = height;
+    records_.clear();
+    freeRecords_.clear();
+    labelParent_.clear();
+    labelSlot_.clear();
+    slots_.assign(1, RasterSlot{0, 0});
+    std::vector<size_t> keptFirstPixel;
+
+    // Band labels of the raster band being written, resolved to slots at the band end
+    std::ofstream labelFile;
+    std::vector<std::uint32_t> bandLabels;
+    if (!labelPath.empty()) {
+        labelFile.open(labelPath, std::ios::binary);
+        if (!labelFile) {
+            throw std::runtime_error("Failed to create label raster: " + labelPath);
+        }
+        LabelRasterHeader header = makeLabelRasterHeader(width, height);
+        labelFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        bandLabels.resize(static_cast<size_t>(bandHeight) * width);
+    }
+
+    // Close a root that no pixel of the last row reaches and keep it when it passes the
+    // filter; its band label then resolves to a slot of its own when kept, to slot 0 if not
+    auto closeRecord = [&](const OpenComponent& record) {
+        if (!passesComponentFilter(config, record.size, record.xMax - record.xMin + 1,
+                                   record.yMax - record.yMin + 1)) {
+            countRejectedComponent(result.stats, config, record.size);
+            labelSlot_[record.label] = record.slot;
+            return;
+        }
+        Component kept;
+        kept.id = 0;
+        kept.xMin = record.xMin;
+        kept.xMax = record.xMax;
+        kept.yMin = record.yMin;
+        kept.yMax = record.yMax;
+        kept.size = record.size;
+        kept.avgProbability = static_cast<float>(record.heatmapSum / record.size);
+        kept.isBuildingBlock = false;
+        kept.runBegin = 0;
+        kept.runEnd = 0;
+        result.components.push_back(kept);
+        keptFirstPixel.push_back(record.firstPixel);
+        std::uint32_t slot = record.slot;
+        if (slot == 0) {
+            slot = static_cast<std::uint32_t>(slots_.size());
+            slots_.push_back({slot, 0});
+        }
+        slots_[slot].kept = static_cast<std::uint32_t>(result.components.size());
+        labelSlot_[record.label] = slot;
+    };
+
+    // Records per pixel of the previous and the current row, and the records in use
+    std::vector<int> previous(width, -1);
+    std::vector<int> current(width, -1);
+    std::vector<std::uint8_t> aboveEdges(width, 0);
+    std::vector<int> live;
+    std::vector<int> stillLive;
+    const float* heatmapValues = nullptr; // Rows of the band, from heatmapRowBegin
+    int heatmapRowBegin = 0;
+
+    // Label row y against the row above it, whose edge bytes are in above
+    auto labelRow = [&](int y, const std::uint8_t* edgeRow, const std::uint8_t* above) {
+        const float* heatmapRow = heatmapValues + static_cast<size_t>(y - heatmapRowBegin) * width;
+        for (int x = 0; x < width; ++x) {
+            int record = -1;
+            auto join = [&](int neighbor) {
+                neighbor = findRecord(neighbor);
+                record = record < 0 ? neighbor : uniteRecords(record, neighbor);
+            };
+            if (x > 0 && (edgeRow[x - 1] & EdgeEast)) join(current[x - 1]);
+            if (y > 0) {
+                if (config.use8Way && x > 0 && (above[x - 1] & EdgeSouthEast)) join(previous[x - 1]);
+                if (above[x] & EdgeSouth) join(previous[x]);
+                if (config.use8Way && x < width - 1 && (above[x + 1] & EdgeSouthWest)) join(previous[x + 1]);
+            }
+            if (record < 0) {
+                record = openRecord(x, y, width);
+                live.push_back(record);
+            }
+            OpenComponent& root = records_[record];
+            root.xMin = std::min(root.xMin, x);
+            root.xMax = std::max(root.xMax, x);
+            root.yMax = y;
+            root.size++;
+            root.heatmapSum += heatmapRow[x];
+            root.lastRow = y;
+            current[x] = record;
+        }
+
+        // Settle the row on its roots, then close the roots it does not reach and free aliases
+        for (int x = 0; x < width; ++x) {
+            current[x] = findRecord(current[x]);
+        }
+        stillLive.clear();
+        for (int record : live) {
+            const OpenComponent& open = records_[record];
+            if (open.parent == record && open.lastRow == y) {
+                stillLive.push_back(record);
+                continue;
+            }
+            if (open.parent == record) {
+                closeRecord(open);
+            }
+            freeRecords_.push_back(record);
+        }
+        live.swap(stillLive);
+        previous.swap(current);
+    };
+
+    // The band buffer holds the band and the row below it, so the edge map of every band
+    // row is complete; the row below is carried over as the first row of the next band
+    band_.resize(static_cast<size_t>(bandHeight + 1) * width);
+    int loaded = std::min(bandHeight + 1, height);
+    image.readRows(loaded, band_.data());
+    for (int y0 = 0; y0 < height; y0 += bandHeight) {
+        const int rows = std::min(bandHeight, height - y0);
+        ImageView view{band_.data(), width, loaded};
+        auto edgeStart = std::chrono::steady_clock::now();
+        buildEdgeMap(view, config.use8Way, config.euclidif, threshold, config.threads, edges_);
+        result.stats.edgeMapSeconds +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - edgeStart).count();
+        auto waitStart = std::chrono::steady_clock::now();
+        heatmapValues = heatmap.waitRows(y0, y0 + rows);
+        heatmapRowBegin = y0;
+        result.stats.heatmapWaitSeconds +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+        for (int row = 0; row < rows; ++row) {
+            const std::uint8_t* edgeRow = edges_.data() + static_cast<size_t>(row) * width;
+            labelRow(y0 + row, edgeRow, row == 0 ? aboveEdges.data() : edgeRow - width);
+            if (labelFile.is_open()) {
+                std::uint32_t* out = bandLabels.data() + static_cast<size_t>(row) * width;
+                for (int x = 0; x < width; ++x) {
+                    out[x] = records_[previous[x]].label;
+                }
+            }
+        }
+        std::copy(edges_.begin() + static_cast<size_t>(rows - 1) * width,
+                  edges_.begin() + static_cast<size_t>(rows) * width, aboveEdges.begin());
+
+        // Give the roots still open a slot, resolve the band to slots and renumber the band
+        // labels of the open roots from 0, so the label tables only span the next band
+        for (int record : live) {
+            OpenComponent& open = records_[record];
+            if (open.slot == 0) {
+                open.slot = static_cast<std::uint32_t>(slots_.size());
+                slots_.push_back({open.slot, 0});
+            }
+            labelSlot_[open.label] = open.slot;
+        }
+        if (labelFile.is_open()) {
+            for (size_t i = 0; i < static_cast<size_t>(rows) * width; ++i) {
+                bandLabels[i] = labelSlot_[findLabel(bandLabels[i])];
+            }
+            labelFile.write(reinterpret_cast<const char*>(bandLabels.data()),
+                            static_cast<std::streamsize>(rows) * width * sizeof(std::uint32_t));
+        }
+        labelParent_.clear();
+        labelSlot_.clear();
+        for (int record : live) {
+            OpenComponent& open = records_[record];
+            open.label = static_cast<std::uint32_t>(labelParent_.size());
+            labelParent_.push_back(open.label);
+            labelSlot_.push_back(open.slot);
+        }
+
+        int next = y0 + rows;
+        if (next < height) {
+            std::copy(band_.begin() + static_cast<size_t>(rows) * width,
+                      band_.begin() + static_cast<size_t>(rows + 1) * width, band_.begin());
+            loaded = std::min(bandHeight + 1, height - next);
+            image.readRows(loaded - 1, band_.data() + width);
+        }
+    }
+    for (int record : live) {
+        closeRecord(records_[record]);
+    }
+    records_.clear();
+    freeRecords_.clear();
+
+    labelParent_.clear();
+    labelSlot_.clear();
+
+    // Number the kept components in raster order of their first pixel, like the unionfind engine
+    std::vector<size_t> order(result.components.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return keptFirstPixel[a] < keptFirstPixel[b]; });
+    std::vector<Component> components(order.size());
+    std::vector<std::uint32_t> keptId(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        components[i] = result.components[order[i]];
+        components[i].id = static_cast<int>(i) + 1;
+        keptId[order[i]] = static_cast<std::uint32_t>(i) + 1;
+    }
+    result.components.swap(components);
+
+    if (labelFile.is_open()) {
+        labelFile.close();
+        if (!labelFile) {
+            throw std::runtime_error("Error writing label raster: " + labelPath);
+        }
+
+        // Slot to component id, 0 for dropped components
+        std::vector<std::uint32_t> finalLabel(slots_.size());
+        for (std::uint32_t slot = 0; slot < finalLabel.size(); ++slot) {
+            const std::uint32_t kept = slots_[findSlot(slot)].kept;
+            finalLabel[slot] = kept == 0 ? 0 : keptId[kept - 1];
+        }
+
+        std::fstream raster(labelPath, std::ios::binary | std::ios::in | std::ios::out);
+        for (int y0 = 0; y0 < height && raster; y0 += bandHeight) {
+            const int rows = std::min(bandHeight, height - y0);
+            const std::streamoff offset =
+                sizeof(LabelRasterHeader) + static_cast<std::streamoff>(y0) * width * sizeof(std::uint32_t);
+            const std::streamsize bytes = static_cast<std::streamsize>(rows) * width * sizeof(std::uint32_t);
+            raster.seekg(offset);
+            raster.read(reinterpret_cast<char*>(bandLabels.data()), bytes);
+            for (size_t i = 0; i < static_cast<size_t>(rows) * width; ++i) {
+                bandLabels[i] = finalLabel[bandLabels[i]];
+            }
+            raster.seekp(offset);
+            raster.write(reinterpret_cast<const char*>(bandLabels.data()), bytes);
+        }
+        if (!raster) {
+            throw std::runtime_error("Error writing label raster: " + labelPath);
+        }
+    }
+    slots_.clear();
+    auto classifyStart = std::chrono::steady_clock::now();
+    result.stats.labelSeconds = std::chrono::duration<double>(classifyStart - start).count() -
+                                result.stats.edgeMapSeconds - result.stats.heatmapWaitSeconds;
+
+    // Map the means of the streamed rows onto the finished heatmap
+    float low = 0.0f, range = 1.0f;
+    heatmap.finish(low, range);
+    auto finishEnd = std::chrono::steady_clock::now();
+    result.stats.heatmapWaitSeconds += std::chrono::duration<double>(finishEnd - classifyStart).count();
+    if (low != 0.0f || range != 1.0f) {
+        for (Component& comp : result.components) {
+            comp.avgProbability = (comp.avgProbability - low) / range;
+        }
+    }
+
+    classifyStart = finishEnd;
+    // The percentile is taken over the finished rows a band at a time as well
+    const float percentile =
+        heatmapPercentile(width, height, bandHeight,
+                          [&](int rowBegin, int rowEnd) { return heatmap.finishedRows(rowBegin, rowEnd); },
+                          config.probabilityPercentile);
+    classifyComponents(result, percentile, config);
+    result.stats.classifySeconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - classifyStart).count();
+    return result;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "segmenter.h"
+
+// Image rows read once, top to bottom
+class RowSource {
+public:
+    virtual ~RowSource() = default;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Next count rows into rows, count * width pixels
+    virtual void readRows(int count, Color* rows) = 0;
+
+protected:
+    int width_ = 0;
+    int height_ = 0;
+};
+
+// Heatmap rows that become final top to bottom while a sheet is streamed, e.g. while the
+// inference that produces them is still running (see StreamingHeatmapInference) or while
+// they are decoded from a file (see HeatmapFile). The rows may be unnormalized: finish gives
+// the mapping onto the finished heatmap.
+class HeatmapRowSource {
+public:
+    virtual ~HeatmapRowSource() = default;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // Row-major values of rows [rowBegin, rowEnd), blocking until they are final. The
+    // pointer holds row rowBegin and is valid until the next call.
+    virtual const float* waitRows(int rowBegin, int rowEnd) = 0;
+    // Block until every row is final; a value handed out by waitRows maps onto the finished
+    // heatmap as (value - low) / range
+    virtual void finish(float& low, float& range) = 0;
+    // Rows [rowBegin, rowEnd) of the finished heatmap once finish has returned, like waitRows
+    virtual const float* finishedRows(int rowBegin, int rowEnd) = 0;
+
+protected:
+    int width_ = 0;
+    int height_ = 0;
+};
+
+// Rows of a heatmap that is complete already
+class HeatmapViewRows : public HeatmapRowSource {
+public:
+    explicit HeatmapViewRows(const HeatmapView& heatmap) : heatmap_(heatmap) {
+        width_ = heatmap.width;
+        height_ = heatmap.height;
+    }
+
+    const float* waitRows(int rowBegin, int) override {
+        return heatmap_.values + static_cast<size_t>(rowBegin) * width_;
+    }
+    void finish(float& low, float& range) override {
+        low = 0.0f;
+        range = 1.0f;
+    }
+    const float* finishedRows(int rowBegin, int rowEnd) override { return waitRows(rowBegin, rowEnd); }
+
+private:
+    HeatmapView heatmap_;
+};
+
+// Segments a sheet in bands of Config::bandHeight rows with the unionfind criterion, for
+// sheets too large to hold at full resolution. Only one band of the image and of the edge
+// map, the labels of the previous row and the components still open are kept in memory;
+// a component is closed, filtered and added to the table once a row holds none of its
+// pixels. The flood fill engines depend on the visiting order over the whole sheet, so
+// Config::fillEngine is ignored here; components, bounds and ids are those of the
+// unionfind engine.
+//
+// When labelPath is not empty a raw label raster is written there: each band goes out with
+// band labels resolved to raster slots, which are only held for kept components and for those
+// still open at a band end, and a final sequential pass rewrites the slots to the
+// component ids, so masks and outlines can be read back per component afterwards. The
+// returned set has no runs.
+//
+// The heatmap is read a band at a time as well, so it can still be in the making: each band
+// waits for its heatmap rows, and the time spent waiting is SegmentationStats::heatmapWaitSeconds.
+// The probability percentile is then taken over the finished rows band by band too.
+class StreamingSegmenter {
+public:
+    ComponentSet segment(RowSource& image, const HeatmapView& heatmap, const Config& config,
+                         const std::string& labelPath);
+    ComponentSet segment(RowSource& image, HeatmapRowSource& heatmap, const Config& config,
+                         const std::string& labelPath);
+
+private:
+    // Component reachable from the last labeled row, or an alias of one it merged into
+    struct OpenComponent {
+        int parent;                // Record of the component it merged into, itself for a root
+        size_t firstPixel;         // Raster index of its first pixel; a merge keeps the earlier one
+        std::uint32_t label;       // Band label of its pixels in the band being labeled
+        std::uint32_t slot;        // Raster slot once it outlives a band or is kept, 0 for none
+        int xMin, xMax, yMin, yMax, size;
+        double heatmapSum;
+        int lastRow;               // Last row holding one of its pixels
+    };
+
+    // Value written to the label raster until the final pass rewrites it to a component id
+    struct RasterSlot {
+        std::uint32_t parent; // Slot it merged into, itself for a root
+        std::uint32_t kept;   // Index of the kept component plus one, 0 while open or dropped
+    };
+
+    int findRecord(int record);
+    int uniteRecords(int a, int b);
+    int openRecord(int x, int y, int width);
+    std::uint32_t findLabel(std::uint32_t label);
+    std::uint32_t findSlot(std::uint32_t slot);
+
+    std::vector<Color> band_;                 // Rows of the current band and the one below it
+    std::vector<std::uint8_t> edges_;         // Edge map of band_, see buildEdgeMap
+    std::vector<OpenComponent> records_;
+    std::vector<int> freeRecords_;
+    std::vector<std::uint32_t> labelParent_; // Band label each band label merged into
+    std::vector<std::uint32_t> labelSlot_;   // Raster slot of each closed or still open band label
+    std::vector<RasterSlot> slots_;          // Slot 0 stands for dropped components
+};
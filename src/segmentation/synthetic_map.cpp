@@ -0,0 +1,147 @@
+#include "synthetic_map.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace {
+
+// Integer hash of up to three values, the only source of randomness of the generator
+std::uint32_t mix(std::uint32_t a, std::uint32_t b = 0, std::uint32_t c = 0) {
+    std::uint32_t h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u) * 0x85EBCA77u ^ (c + 0x165667B1u) * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return h;
+}
+
+// Street layout along one axis: streets of 6 to 13 pixels between blocks of 96 to 255
+struct Axis {
+    std::vector<int> block;  // Block index of every coordinate, -1 on a street
+    std::vector<int> offset; // Position inside the block
+    std::vector<int> length; // Length of the block
+};
+
+Axis layoutAxis(int size, std::uint32_t seed) {
+    Axis axis;
+    axis.block.resize(size);
+    axis.offset.resize(size);
+    axis.length.resize(size);
+    int pos = 0;
+    for (int index = 0; pos < size; ++index) {
+        std::uint32_t h = mix(seed, static_cast<std::uint32_t>(index));
+        int street = 6 + static_cast<int>(h % 8);
+        int length = 96 + static_cast<int>((h >> 8) % 160);
+        for (int i = 0; i < street && pos < size; ++i, ++pos) {
+            axis.block[pos] = -1;
+            axis.offset[pos] = 0;
+            axis.length[pos] = 0;
+        }
+        for (int i = 0; i < length && pos < size; ++i, ++pos) {
+            axis.block[pos] = index;
+            axis.offset[pos] = i;
+            axis.length[pos] = length;
+        }
+    }
+    return axis;
+}
+
+enum class BlockKind { Building, Open, Split };
+
+const Color paper{238, 230, 212};
+const Color ink{58, 50, 44};
+const Color open{196, 208, 170};
+const Color buildingPalette[] = {{232, 176, 160}, {226, 196, 140}, {214, 164, 150}};
+
+// Glyphs of the parcel numbers, 4 x 6 bits each, row-major from the top
+const std::uint32_t digitGlyphs[] = {0x699996, 0x262227, 0x69124F, 0xE1611E, 0x99F111,
+                                     0xF8E11E, 0x68E996, 0xF12444, 0x696996, 0x69971E};
+
+} // namespace
+
+SyntheticMap generateStreetGrid(int width, int height, std::uint32_t seed) {
+    if (width <= 0 || height <= 0) {
+        throw std::invalid_argument("Synthetic map size must be positive");
+    }
+    SyntheticMap map;
+    map.width = width;
+    map.height = height;
+    map.pixels.resize(static_cast<size_t>(width) * height);
+    map.heatmap.resize(static_cast<size_t>(width) * height);
+
+    const Axis columns = layoutAxis(width, mix(seed, 1));
+    const Axis rows = layoutAxis(height, mix(seed, 2));
+
+    for (int y = 0; y < height; ++y) {
+        Color* pixelRow = map.pixels.data() + static_cast<size_t>(y) * width;
+        float* heatRow = map.heatmap.data() + static_cast<size_t>(y) * width;
+        const int by = rows.block[y];
+        const int oy = rows.offset[y];
+        const int ly = rows.length[y];
+        for (int x = 0; x < width; ++x) {
+            const std::uint32_t noise = mix(seed, static_cast<std::uint32_t>(x), static_cast<std::uint32_t>(y));
+            const int bx = columns.block[x];
+            Color color = paper;
+            float probability = 0.02f;
+            if (by >= 0 && bx >= 0) {
+                const int ox = columns.offset[x];
+                const int lx = columns.length[x];
+                const std::uint32_t h = mix(seed, static_cast<std::uint32_t>(bx), static_cast<std::uint32_t>(by) + 3);
+                const BlockKind kind = h % 20 < 12 ? BlockKind::Building : h % 20 < 17 ? BlockKind::Open : BlockKind::Split;
+
+                // Parcel number of three digits centered in the block, scaled by two
+                const int lx0 = ox - (lx / 2 - 15);
+                const int ly0 = oy - (ly / 2 - 6);
+                bool label = false;
+                if (lx0 >= 0 && lx0 < 30 && ly0 >= 0 && ly0 < 12 && lx0 / 2 % 5 < 4) {
+                    const int gx = lx0 / 2;
+                    const std::uint32_t glyph = digitGlyphs[(h >> (8 + 4 * (gx / 5))) % 10];
+                    label = (glyph >> (23 - ly0 / 2 * 4 - gx % 5)) & 1;
+                }
+
+                if (ox < 2 || oy < 2 || ox >= lx - 2 || oy >= ly - 2 ||
+                    (kind == BlockKind::Split && std::abs(ox - lx / 2) <= 1)) {
+                    color = ink;
+                    probability = 0.1f;
+                } else if (label) {
+                    color = ink;
+                    probability = 0.3f;
+                } else if (kind == BlockKind::Open) {
+                    color = open;
+                    probability = 0.15f + static_cast<float>((h >> 4) % 16) / 100.0f;
+                } else {
+                    color = buildingPalette[(h >> 12) % 3];
+                    if ((x + y) % 9 == 0) {
+                        color.r = static_cast<unsigned char>(color.r - 28);
+                        color.g = static_cast<unsigned char>(color.g - 28);
+                        color.b = static_cast<unsigned char>(color.b - 28);
+                    }
+                    probability = 0.72f + static_cast<float>((h >> 16) % 20) / 100.0f;
+                }
+            }
+
+            // Scan noise, the same offset on every channel
+            const int grain = static_cast<int>(noise % 7) - 3;
+            color.r = static_cast<unsigned char>(std::clamp(color.r + grain, 0, 255));
+            color.g = static_cast<unsigned char>(std::clamp(color.g + grain, 0, 255));
+            color.b = static_cast<unsigned char>(std::clamp(color.b + grain, 0, 255));
+            pixelRow[x] = color;
+            heatRow[x] = probability + static_cast<float>((noise >> 8) % 16) / 400.0f;
+        }
+    }
+
+    // Count the building blocks that made it onto the sheet; block indices are consecutive
+    const int columnBlocks = *std::max_element(columns.block.begin(), columns.block.end()) + 1;
+    const int rowBlocks = *std::max_element(rows.block.begin(), rows.block.end()) + 1;
+    for (int by = 0; by < rowBlocks; ++by) {
+        for (int bx = 0; bx < columnBlocks; ++bx) {
+            const std::uint32_t h = mix(seed, static_cast<std::uint32_t>(bx), static_cast<std::uint32_t>(by) + 3);
+            if (h % 20 < 12) {
+                map.buildingBlocks++;
+            }
+        }
+    }
+    return map;
+}
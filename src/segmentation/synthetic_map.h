@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "segmenter.h"
+
+// Synthetic cadastral sheet for benchmarks: a street grid with outlined blocks, hatched
+// building blocks, street labels and scan noise, and a matching heatmap that is high
+// inside the building blocks. Built from its own integer hash, so the same arguments
+// give the same pixels on every compiler and platform.
+struct SyntheticMap {
+    int width = 0;
+    int height = 0;
+    std::vector<Color> pixels;
+    std::vector<float> heatmap;
+    int buildingBlocks = 0; // Blocks painted as building blocks
+
+    ImageView image() const { return {pixels.data(), width, height}; }
+    HeatmapView heatmapView() const { return {heatmap.data(), width, height}; }
+};
+
+// Function to generate a width x height street grid sheet
+SyntheticMap generateStreetGrid(int width, int height, std::uint32_t seed = 1);
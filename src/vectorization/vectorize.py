@@ -10,6 +10,12 @@ from shapely.affinity import scale
 from shapely.geometry import shape, mapping, Polygon, MultiPolygon
 import sys
 
+try:
+    from segmentation.component_table import read_component_table
+except ImportError:
+    sys.path.append(str(Path(__file__).resolve().parent.parent / "segmentation"))
+    from component_table import read_component_table
+
 # region Main Pipeline
 
 
@@ -120,10 +126,10 @@ def vectorize_image(input_raster, output_vector) -> None:
 
 def process_directory(input_dir: str, output_dir: str, verbose: bool = False) -> None:
     """
-    Processes all JPG images in a directory.
+    Processes all JPG and PNG images in a directory.
     """
     for filename in os.listdir(input_dir):
-        if filename.endswith(".jpg"):
+        if filename.endswith((".jpg", ".png")):
             input_path = os.path.join(input_dir, filename)
             output_tiff_path = os.path.join(
                 output_dir, f"{os.path.splitext(filename)[0]}.tif"
@@ -339,9 +345,24 @@ def extract_polygon_data(shapefile_path: str) -> list:
 def parse_components_info(components_info_path: str) -> dict:
     """
     Parses the components_info.json file to extract data for each component.
+    Uses the components_info.p2pc binary table next to it instead when it exists.
     """
     components_data = {}
 
+    table_path = Path(components_info_path).with_suffix(".p2pc")
+    if table_path.exists():
+        table = read_component_table(str(table_path))
+        for component_id, x, y, width, height in zip(
+            table["id"].tolist(), table["x"].tolist(), table["y"].tolist(),
+            table["width"].tolist(), table["height"].tolist(),
+        ):
+            components_data[str(component_id)] = {
+                "top_left_corner": (x, y),
+                "width": width,
+                "height": height,
+            }
+        return components_data
+
     with open(components_info_path, "r") as file:
         data = json.load(file)
 